@@ -0,0 +1,481 @@
+#include "pch.h"
+#include <jni.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ClientAPI.hpp"
+#include "Executor.hpp"
+#include "Histogram.hpp"
+#include "JniCounters.hpp"
+#include "Pipeline.hpp"
+#include "Stats.hpp"
+
+// Measures the bridge without a game client. An embedded JVM runs a synthetic
+// class graph shaped like RuneLite's (Benchmark/java), and ClientAPI finds it
+// through the same injector and client thread lookups it uses in the game.
+//
+// Every workload runs on an executor worker, as queries do in the server, so
+// parallel projections and batches behave as they would in production. A
+// workload is warmed up, then timed in samples of at least --sample-ms each;
+// the report gives the median and mean time per operation with a 95%
+// confidence interval over the samples, their coefficient of variation, and
+// per-operation tail latencies.
+//
+// With --serve the workloads are skipped and the process serves the synthetic
+// client on a Unix socket instead, for end-to-end runs with jrb_load.
+
+#ifndef JRB_BENCH_CLASSPATH
+#define JRB_BENCH_CLASSPATH "jrb-bench.jar"
+#endif
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    struct Options {
+        std::string classPath = JRB_BENCH_CLASSPATH;
+        std::vector<std::string> jvmOptions;
+        std::string filter;
+        std::string serve;
+        int samples = 30;
+        int warmupMs = 500;
+        int sampleMs = 20;
+        int players = 200;
+        int npcs = 500;
+        int frameMs = 1;
+        int framesPerTick = 600;
+        unsigned threads = 0;
+        bool csv = false;
+        bool stages = false;
+        bool jni = false;
+        bool list = false;
+    };
+
+    struct Workload {
+        const char* name;
+        const char* description;
+        // Runs one operation and returns false if the bridge answered with an
+        // error.
+        std::function<bool(ClientAPI&)> run;
+        // Runs the operation on every worker at once instead of on one.
+        bool concurrent = false;
+    };
+
+    struct Result {
+        double median = 0;
+        double mean = 0;
+        double confidence = 0;
+        double variation = 0;
+        double opsPerSecond = 0;
+        Histogram::Snapshot latency;
+    };
+
+    bool isError(const std::string& value) {
+        return !value.empty() && static_cast<ValueTag>(value[0]) == ValueTag::Error;
+    }
+
+    std::function<bool(ClientAPI&)> query(const char* text, Encoding encoding = Encoding::Binary) {
+        return [text, encoding](ClientAPI& api) {
+            return !isError(api.ProcessInstruction(text, encoding));
+        };
+    }
+
+    std::function<bool(ClientAPI&)> batch(std::vector<std::string> queries) {
+        std::string joined;
+        for (const auto& line : queries) {
+            joined += line + "\n";
+        }
+        joined.pop_back();
+        return [joined](ClientAPI& api) {
+            for (const auto& result : api.ProcessBatch(joined, Encoding::Binary)) {
+                if (isError(result)) {
+                    return false;
+                }
+            }
+            return true;
+        };
+    }
+
+    std::vector<Workload> workloads() {
+        return {
+            { "scalar", "one getter on the root", query("Client.getWorld") },
+            { "string", "two hops ending in a string", query("Client.getLocalPlayer.getName") },
+            { "text", "the same query in text encoding", query("Client.getLocalPlayer.getName", Encoding::Text) },
+            { "chain", "three hops to a primitive", query("Client.getLocalPlayer.getWorldLocation.getX") },
+            { "deep-chain", "five hops through an interface that changes every tick", query("Client.getLocalPlayer.getInteracting.getWorldLocation.getPlane") },
+            { "int-array", "primitive array", query("Client.getBoostedSkillLevels") },
+            { "nested-array", "array at the end of a four hop chain", query("Client.getLocalPlayer.getPlayerComposition.getEquipmentIds") },
+            { "object-array", "array of objects returned as handles", query("Client.getWidgetRoots") },
+            { "projection", "players list projected into four columns", query("Client.getPlayers{getName,getCombatLevel,getWorldLocation.getX,getWorldLocation.getY}") },
+            { "sparse-projection", "sparse NPC array with nulls and string arrays", query("Client.getCachedNPCs{getName,getId,getComposition.getActions}") },
+            { "batch", "sixteen queries pinned to one tick on the client thread", batch({
+                "Client.getTickCount", "Client.getGameState", "Client.getWorld", "Client.getEnergy",
+                "Client.getLocalPlayer.getName", "Client.getLocalPlayer.getCombatLevel", "Client.getLocalPlayer.getAnimation",
+                "Client.getLocalPlayer.getHealthRatio", "Client.getLocalPlayer.getWorldLocation.getX",
+                "Client.getLocalPlayer.getWorldLocation.getY", "Client.getLocalPlayer.getWorldLocation.getPlane",
+                "Client.getLocalPlayer.getInteracting.getName", "Client.getBoostedSkillLevels", "Client.getRealSkillLevels",
+                "Client.getSkillExperiences", "Client.getLocalPlayer.getPlayerComposition.getEquipmentIds" }) },
+            { "concurrent-chain", "chain query from every worker at once", query("Client.getLocalPlayer.getWorldLocation.getX"), true },
+            { "concurrent-projection", "projection from every worker at once", query("Client.getPlayers{getName,getCombatLevel,getWorldLocation.getX,getWorldLocation.getY}"), true },
+        };
+    }
+
+    // Two-sided 95% quantiles of Student's t for 1 to 30 degrees of freedom.
+    double studentT(size_t freedom) {
+        static const double table[] = {
+            12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+            2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+            2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+        };
+        if (freedom == 0) {
+            return 0;
+        }
+        return freedom <= 30 ? table[freedom - 1] : 1.960;
+    }
+
+    // Runs `job` on an executor worker and waits for it.
+    void onWorker(Executor& executor, const std::function<void()>& job) {
+        std::mutex mutex;
+        std::condition_variable done;
+        bool finished = false;
+        executor.submit([&] {
+            job();
+            std::lock_guard<std::mutex> lock(mutex);
+            finished = true;
+            done.notify_one();
+        });
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&] { return finished; });
+    }
+
+    // Times one sample of `iterations` operations, recording each operation's
+    // latency. Returns the mean nanoseconds per operation.
+    double sample(ClientAPI& api, const Workload& workload, size_t iterations, Histogram& latency, bool& failed) {
+        auto start = Clock::now();
+        for (size_t i = 0; i < iterations; i++) {
+            auto begin = Clock::now();
+            if (!workload.run(api)) {
+                failed = true;
+            }
+            latency.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - begin).count()));
+        }
+        return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / static_cast<double>(iterations);
+    }
+
+    Result summarize(std::vector<double> samples, const Histogram& latency) {
+        Result result;
+        std::sort(samples.begin(), samples.end());
+        size_t count = samples.size();
+        result.median = count % 2 == 1 ? samples[count / 2] : (samples[count / 2 - 1] + samples[count / 2]) / 2;
+        double sum = 0;
+        for (double value : samples) {
+            sum += value;
+        }
+        result.mean = sum / static_cast<double>(count);
+        double squares = 0;
+        for (double value : samples) {
+            squares += (value - result.mean) * (value - result.mean);
+        }
+        double deviation = count > 1 ? std::sqrt(squares / static_cast<double>(count - 1)) : 0;
+        result.confidence = studentT(count - 1) * deviation / std::sqrt(static_cast<double>(count));
+        result.variation = result.mean > 0 ? deviation / result.mean : 0;
+        result.opsPerSecond = result.median > 0 ? 1e9 / result.median : 0;
+        result.latency = latency.snapshot();
+        return result;
+    }
+
+    bool measure(Executor& executor, ClientAPI& api, const Workload& workload, const Options& options, unsigned threads, Result& result) {
+        bool failed = false;
+        Histogram latency;
+
+        if (!workload.concurrent) {
+            std::vector<double> samples;
+            onWorker(executor, [&] {
+                // Warm up until the JIT and the bridge's caches settle, then
+                // pick a sample size that runs for at least --sample-ms.
+                auto warmupEnd = Clock::now() + std::chrono::milliseconds(options.warmupMs);
+                size_t iterations = 1;
+                while (Clock::now() < warmupEnd && !failed) {
+                    failed = !workload.run(api);
+                }
+                while (!failed) {
+                    auto start = Clock::now();
+                    for (size_t i = 0; i < iterations; i++) {
+                        workload.run(api);
+                    }
+                    if (Clock::now() - start >= std::chrono::milliseconds(options.sampleMs) || iterations >= (1u << 24)) {
+                        break;
+                    }
+                    iterations *= 2;
+                }
+                for (int i = 0; i < options.samples && !failed; i++) {
+                    samples.push_back(sample(api, workload, iterations, latency, failed));
+                }
+            });
+            if (failed) {
+                return false;
+            }
+            result = summarize(samples, latency);
+            return true;
+        }
+
+        // Every worker runs the operation in lockstep samples; a sample's time
+        // per operation is its wall time divided by the operations of all
+        // workers, so the report shows aggregate throughput.
+        auto warmupEnd = Clock::now() + std::chrono::milliseconds(options.warmupMs);
+        std::vector<double> samples;
+        size_t iterations = 1;
+        for (int round = -1; round < options.samples && !failed; round++) {
+            std::mutex mutex;
+            std::condition_variable done;
+            unsigned remaining = threads;
+            bool warmup = round < 0;
+            auto start = Clock::now();
+            for (unsigned t = 0; t < threads; t++) {
+                executor.submit([&] {
+                    bool taskFailed = false;
+                    if (warmup) {
+                        while (Clock::now() < warmupEnd && !taskFailed) {
+                            taskFailed = !workload.run(api);
+                        }
+                    }
+                    else {
+                        sample(api, workload, iterations, latency, taskFailed);
+                    }
+                    std::lock_guard<std::mutex> lock(mutex);
+                    failed = failed || taskFailed;
+                    if (--remaining == 0) {
+                        done.notify_one();
+                    }
+                });
+            }
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                done.wait(lock, [&] { return remaining == 0; });
+            }
+            if (warmup) {
+                // Size samples from one timed run of a single operation per
+                // worker, doubled until a sample lasts --sample-ms.
+                while (iterations < (1u << 24)) {
+                    auto probe = Clock::now();
+                    onWorker(executor, [&] {
+                        for (size_t i = 0; i < iterations; i++) {
+                            workload.run(api);
+                        }
+                    });
+                    if (Clock::now() - probe >= std::chrono::milliseconds(options.sampleMs)) {
+                        break;
+                    }
+                    iterations *= 2;
+                }
+                continue;
+            }
+            double elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+            samples.push_back(elapsed / static_cast<double>(iterations * threads));
+        }
+        if (failed) {
+            return false;
+        }
+        result = summarize(samples, latency);
+        return true;
+    }
+
+    void usage() {
+        printf(
+            "usage: jrb_bench [options] [filter]\n"
+            "  --list                 list workloads and exit\n"
+            "  --samples N            timed samples per workload (30)\n"
+            "  --sample-ms N          minimum duration of a sample (20)\n"
+            "  --warmup-ms N          warm-up time per workload (500)\n"
+            "  --threads N            executor workers (hardware threads, at most 8)\n"
+            "  --players N            players in the synthetic world (200)\n"
+            "  --npcs N               NPCs in the synthetic world (500)\n"
+            "  --frame-ms N           game loop frame time (1)\n"
+            "  --frames-per-tick N    frames per game tick (600)\n"
+            "  --classpath PATH       jar with the synthetic classes\n"
+            "  --jvm-option OPTION    extra JVM option, may repeat\n"
+            "  --stages               print the bridge's per-stage latencies at the end\n"
+            "  --jni                  count JNI calls and allocations per query and print them at the end\n"
+            "  --csv                  print results as CSV\n"
+            "  --serve PATH           serve the synthetic client on a Unix socket until killed\n");
+    }
+
+    bool parseOptions(int argc, char** argv, Options& options) {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            auto value = [&]() -> const char* {
+                return i + 1 < argc ? argv[++i] : "";
+            };
+            if (arg == "--list") options.list = true;
+            else if (arg == "--csv") options.csv = true;
+            else if (arg == "--stages") options.stages = true;
+            else if (arg == "--jni") options.jni = true;
+            else if (arg == "--samples") options.samples = (std::max)(2, std::atoi(value()));
+            else if (arg == "--sample-ms") options.sampleMs = std::atoi(value());
+            else if (arg == "--warmup-ms") options.warmupMs = std::atoi(value());
+            else if (arg == "--threads") options.threads = static_cast<unsigned>(std::atoi(value()));
+            else if (arg == "--players") options.players = (std::max)(1, std::atoi(value()));
+            else if (arg == "--npcs") options.npcs = std::atoi(value());
+            else if (arg == "--frame-ms") options.frameMs = std::atoi(value());
+            else if (arg == "--frames-per-tick") options.framesPerTick = (std::max)(1, std::atoi(value()));
+            else if (arg == "--serve") options.serve = value();
+            else if (arg == "--classpath") options.classPath = value();
+            else if (arg == "--jvm-option") options.jvmOptions.push_back(value());
+            else if (arg == "--help" || arg == "-h") return false;
+            else if (!arg.empty() && arg[0] != '-') options.filter = arg;
+            else {
+                fprintf(stderr, "unknown option %s\n", arg.c_str());
+                return false;
+            }
+        }
+        return true;
+    }
+
+    JavaVM* createJvm(const Options& options, JNIEnv** env) {
+        std::vector<std::string> strings = { "-Djava.class.path=" + options.classPath, "-Djava.awt.headless=true" };
+        strings.insert(strings.end(), options.jvmOptions.begin(), options.jvmOptions.end());
+        std::vector<JavaVMOption> vmOptions(strings.size());
+        for (size_t i = 0; i < strings.size(); i++) {
+            vmOptions[i].optionString = strings[i].data();
+            vmOptions[i].extraInfo = nullptr;
+        }
+        JavaVMInitArgs args;
+        args.version = JNI_VERSION_1_8;
+        args.nOptions = static_cast<jint>(vmOptions.size());
+        args.options = vmOptions.data();
+        args.ignoreUnrecognized = JNI_FALSE;
+        JavaVM* jvm = nullptr;
+        if (JNI_CreateJavaVM(&jvm, reinterpret_cast<void**>(env), &args) != JNI_OK) {
+            return nullptr;
+        }
+        return jvm;
+    }
+
+    bool startGame(JNIEnv* env, const Options& options) {
+        jclass game = env->FindClass("jrb/bench/SyntheticGame");
+        if (game == nullptr) {
+            env->ExceptionDescribe();
+            env->ExceptionClear();
+            return false;
+        }
+        jmethodID start = env->GetStaticMethodID(game, "start", "(IIII)V");
+        env->CallStaticVoidMethod(game, start, options.players, options.npcs, options.frameMs, options.framesPerTick);
+        if (env->ExceptionCheck()) {
+            env->ExceptionDescribe();
+            env->ExceptionClear();
+            return false;
+        }
+        env->DeleteLocalRef(game);
+        return true;
+    }
+
+    void printTable(Table table) {
+        printf("\n");
+        table.rows.insert(table.rows.begin(), table.columns);
+        for (const auto& row : table.rows) {
+            for (size_t i = 0; i < row.size(); i++) {
+                printf(i == 0 ? "%-40s" : " %10s", row[i].c_str());
+            }
+            printf("\n");
+        }
+    }
+
+    void report(const Workload& workload, const Result& result, const Options& options) {
+        auto micros = [](double nanoseconds) { return nanoseconds / 1000.0; };
+        if (options.csv) {
+            printf("%s,%.3f,%.3f,%.3f,%.2f,%.3f,%.3f,%.3f,%.0f\n", workload.name, micros(result.median), micros(result.mean),
+                micros(result.confidence), result.variation * 100, micros(static_cast<double>(result.latency.percentile(0.5))),
+                micros(static_cast<double>(result.latency.percentile(0.99))), micros(static_cast<double>(result.latency.percentile(0.999))),
+                result.opsPerSecond);
+            return;
+        }
+        printf("%-22s %10.2f %10.2f ±%7.2f %6.1f%% %10.2f %10.2f %10.2f %12.0f\n", workload.name, micros(result.median),
+            micros(result.mean), micros(result.confidence), result.variation * 100,
+            micros(static_cast<double>(result.latency.percentile(0.5))), micros(static_cast<double>(result.latency.percentile(0.99))),
+            micros(static_cast<double>(result.latency.percentile(0.999))), result.opsPerSecond);
+    }
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        usage();
+        return 2;
+    }
+    std::vector<Workload> all = workloads();
+    if (options.list) {
+        for (const auto& workload : all) {
+            printf("%-22s %s\n", workload.name, workload.description);
+        }
+        return 0;
+    }
+
+    JNIEnv* env = nullptr;
+    JavaVM* jvm = createJvm(options, &env);
+    if (jvm == nullptr) {
+        fprintf(stderr, "failed to create the JVM\n");
+        return 1;
+    }
+    if (!startGame(env, options)) {
+        fprintf(stderr, "failed to start the synthetic game from %s\n", options.classPath.c_str());
+        return 1;
+    }
+
+    if (!options.serve.empty()) {
+        // Blocks; the pipeline creates its own executor on the same JVM.
+        Pipeline pipeline(options.serve, 32768);
+        pipeline.StartServer();
+        return 1;
+    }
+
+    unsigned threads = options.threads > 0 ? options.threads : std::clamp(std::thread::hardware_concurrency(), 2u, 8u);
+    Executor executor(threads, jvm);
+    ClientAPI api;
+    if (!api.EnsureClient()) {
+        fprintf(stderr, "the bridge did not find the synthetic client\n");
+        return 1;
+    }
+
+    JniCounters::enable(options.jni);
+    if (options.csv) {
+        printf("workload,median_us,mean_us,ci95_us,cv_percent,p50_us,p99_us,p999_us,ops_per_s\n");
+    }
+    else {
+        printf("%d samples of >= %d ms, %u workers, %d players, %d npcs, tick every %d ms; times per operation in us\n\n",
+            options.samples, options.sampleMs, threads, options.players, options.npcs, options.frameMs * options.framesPerTick);
+        printf("%-22s %10s %10s %8s %7s %10s %10s %10s %12s\n", "workload", "median", "mean", "ci95", "cv", "p50", "p99", "p99.9", "ops/s");
+    }
+    int failures = 0;
+    for (const auto& workload : all) {
+        if (!options.filter.empty() && std::strstr(workload.name, options.filter.c_str()) == nullptr) {
+            continue;
+        }
+        Result result;
+        if (!measure(executor, api, workload, options, threads, result)) {
+            fprintf(stderr, "%s: the bridge returned an error\n", workload.name);
+            failures++;
+            continue;
+        }
+        report(workload, result, options);
+        fflush(stdout);
+    }
+
+    if (options.stages) {
+        printTable(Stats::table(Encoding::Text));
+    }
+    if (options.jni) {
+        printTable(JniCounters::table(Encoding::Text));
+    }
+    // The JVM is left running: the bridge keeps global references and
+    // attached workers until the process exits.
+    fflush(stdout);
+    std::_Exit(failures == 0 ? 0 : 1);
+}
@@ -0,0 +1,414 @@
+#include "pch.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "Histogram.hpp"
+#include "Protocol.hpp"
+
+// Load generator for a running bridge, usually `jrb_bench --serve PATH`.
+// Every connection negotiates binary framing and then replays a weighted mix
+// of queries, keeping up to --depth requests in flight.
+//
+// Without --rate each connection sends its next request as soon as a reply
+// frees a slot (closed loop). With --rate requests are scheduled at fixed
+// intervals and latency is taken from the scheduled send time, so a stalled
+// server is charged for the requests it kept the generator from sending
+// instead of hiding them (coordinated omission).
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    struct Options {
+        std::string socket = "/tmp/jrb.sock";
+        std::string mixFile;
+        int connections = 4;
+        int depth = 1;
+        int durationS = 10;
+        int warmupS = 2;
+        double rate = 0;
+        int priority = -1;
+        uint32_t deadlineMs = 0;
+        bool csv = false;
+    };
+
+    struct Entry {
+        std::string text;
+        unsigned weight = 1;
+        FrameKind kind = FrameKind::Query;
+        std::string payload;
+    };
+
+    struct Totals {
+        Histogram all;
+        std::unique_ptr<Histogram[]> perEntry;
+        std::unique_ptr<std::atomic<uint64_t>[]> entryErrors;
+        std::atomic<uint64_t> errors{ 0 };
+        std::atomic<uint64_t> lost{ 0 };
+        std::atomic<uint64_t> late{ 0 };
+    };
+
+    const char* kDefaultMix[] = {
+        "20\tClient.getLocalPlayer.getWorldLocation.getX",
+        "20\tClient.getLocalPlayer.getName",
+        "10\tClient.getGameState",
+        "10\tClient.getBoostedSkillLevels",
+        "5\tClient.getLocalPlayer.getInteracting.getWorldLocation.getPlane",
+        "5\tClient.getPlayers{getName,getCombatLevel,getWorldLocation.getX,getWorldLocation.getY}",
+        "2\tClient.getCachedNPCs{getName,getId,getComposition.getActions}",
+        "3\tbatch Client.getTickCount;Client.getLocalPlayer.getAnimation;Client.getLocalPlayer.getHealthRatio;Client.getEnergy",
+    };
+
+    // A line is an optional weight and a tab or space, then a query. Queries
+    // prefixed with "batch " are sent as one Batch frame, split on ';'. A
+    // plain list of queries, such as one taken from a client's log, replays
+    // every line with weight 1.
+    bool parseEntry(std::string line, Entry& entry) {
+        while (!line.empty() && (line.back() == '\r' || line.back() == '\n' || line.back() == ' ')) {
+            line.pop_back();
+        }
+        size_t start = line.find_first_not_of(" \t");
+        if (start == std::string::npos || line[start] == '#') {
+            return false;
+        }
+        line.erase(0, start);
+        size_t digits = 0;
+        while (digits < line.size() && line[digits] >= '0' && line[digits] <= '9') {
+            digits++;
+        }
+        if (digits > 0 && digits < line.size() && (line[digits] == '\t' || line[digits] == ' ')) {
+            entry.weight = static_cast<unsigned>(std::strtoul(line.c_str(), nullptr, 10));
+            line.erase(0, line.find_first_not_of(" \t", digits));
+        }
+        entry.text = line;
+        if (line.rfind("batch ", 0) == 0) {
+            entry.kind = FrameKind::Batch;
+            entry.payload = line.substr(6);
+            std::replace(entry.payload.begin(), entry.payload.end(), ';', '\n');
+        }
+        else {
+            entry.kind = FrameKind::Query;
+            entry.payload = line;
+        }
+        return entry.weight > 0;
+    }
+
+    // Wraps the request in Deadline and Priority frames as asked.
+    void wrapEntry(Entry& entry, const Options& options) {
+        if (options.deadlineMs > 0) {
+            std::string wrapped;
+            putUint32(wrapped, options.deadlineMs);
+            wrapped.push_back(static_cast<char>(entry.kind));
+            entry.payload = wrapped + entry.payload;
+            entry.kind = FrameKind::Deadline;
+        }
+        if (options.priority >= 0) {
+            std::string wrapped;
+            wrapped.push_back(static_cast<char>(options.priority));
+            wrapped.push_back(static_cast<char>(entry.kind));
+            entry.payload = wrapped + entry.payload;
+            entry.kind = FrameKind::Priority;
+        }
+    }
+
+    bool loadMix(const Options& options, std::vector<Entry>& mix) {
+        std::vector<std::string> lines;
+        if (options.mixFile.empty()) {
+            lines.assign(std::begin(kDefaultMix), std::end(kDefaultMix));
+        }
+        else {
+            std::ifstream file(options.mixFile);
+            if (!file) {
+                fprintf(stderr, "cannot read %s\n", options.mixFile.c_str());
+                return false;
+            }
+            for (std::string line; std::getline(file, line);) {
+                lines.push_back(line);
+            }
+        }
+        for (const auto& line : lines) {
+            Entry entry;
+            if (parseEntry(line, entry)) {
+                wrapEntry(entry, options);
+                mix.push_back(std::move(entry));
+            }
+        }
+        if (mix.empty()) {
+            fprintf(stderr, "the mix has no queries\n");
+            return false;
+        }
+        return true;
+    }
+
+    bool sendAll(int fd, const std::string& data) {
+        size_t sent = 0;
+        while (sent < data.size()) {
+            ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) {
+                return false;
+            }
+            sent += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    // Connects and switches the connection to binary framing.
+    int openConnection(const std::string& path) {
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            return -1;
+        }
+        sockaddr_un name{};
+        name.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(name.sun_path)) {
+            close(fd);
+            return -1;
+        }
+        std::memcpy(name.sun_path, path.c_str(), path.size() + 1);
+        if (connect(fd, reinterpret_cast<sockaddr*>(&name), sizeof(name)) != 0 || !sendAll(fd, "JRB/1 binary")) {
+            close(fd);
+            return -1;
+        }
+        std::string expected = helloReply(Encoding::Binary);
+        std::string reply;
+        while (reply.size() < expected.size()) {
+            char buffer[64];
+            ssize_t n = recv(fd, buffer, expected.size() - reply.size(), 0);
+            if (n <= 0) {
+                close(fd);
+                return -1;
+            }
+            reply.append(buffer, static_cast<size_t>(n));
+        }
+        if (reply != expected) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    struct Window {
+        Clock::time_point measure;
+        Clock::time_point end;
+    };
+
+    void drive(int fd, unsigned seed, const Options& options, const std::vector<Entry>& mix, const Window& window, Totals& totals) {
+        struct Pending {
+            size_t entry;
+            Clock::time_point intended;
+        };
+        std::vector<unsigned> weights;
+        for (const auto& entry : mix) {
+            weights.push_back(entry.weight);
+        }
+        std::mt19937 random(seed);
+        std::discrete_distribution<size_t> pick(weights.begin(), weights.end());
+        std::unordered_map<uint32_t, Pending> inflight;
+        FrameReader reader;
+        uint32_t nextId = 1;
+        bool paced = options.rate > 0;
+        auto interval = paced
+            ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.connections / options.rate))
+            : Clock::duration::zero();
+        // Stagger paced connections so their sends do not line up.
+        Clock::time_point nextSend = Clock::now() + interval * seed / (std::max)(options.connections, 1);
+        Clock::time_point giveUp = window.end + std::chrono::seconds(5);
+        std::vector<char> buffer(1 << 16);
+        bool open = true;
+
+        while (open) {
+            Clock::time_point now = Clock::now();
+            if (now >= giveUp || (now >= window.end && inflight.empty())) {
+                break;
+            }
+            std::string out;
+            while (now < window.end && inflight.size() < static_cast<size_t>(options.depth) && (!paced || nextSend <= now)) {
+                size_t index = pick(random);
+                uint32_t id = nextId++;
+                inflight[id] = { index, paced ? nextSend : now };
+                out += encodeFrame(mix[index].kind, id, mix[index].payload);
+                nextSend += interval;
+            }
+            if (!out.empty() && !sendAll(fd, out)) {
+                break;
+            }
+
+            pollfd entry{ fd, POLLIN, 0 };
+            int timeoutMs = 100;
+            if (paced && now < window.end && inflight.size() < static_cast<size_t>(options.depth)) {
+                auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(nextSend - Clock::now());
+                timeoutMs = static_cast<int>(std::clamp<int64_t>(wait.count(), 0, 100));
+            }
+            if (poll(&entry, 1, timeoutMs) <= 0) {
+                continue;
+            }
+            ssize_t n = recv(fd, buffer.data(), buffer.size(), 0);
+            if (n <= 0) {
+                open = false;
+                break;
+            }
+            reader.append(buffer.data(), static_cast<size_t>(n));
+            Clock::time_point received = Clock::now();
+            Frame frame;
+            while (reader.next(frame)) {
+                auto found = inflight.find(frame.requestId);
+                if (frame.kind != FrameKind::Result || found == inflight.end()) {
+                    continue;
+                }
+                Pending pending = found->second;
+                inflight.erase(found);
+                if (pending.intended < window.measure) {
+                    continue;
+                }
+                if (received > window.end) {
+                    totals.late++;
+                }
+                uint64_t latency = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(received - pending.intended).count());
+                totals.all.record(latency);
+                totals.perEntry[pending.entry].record(latency);
+                if (!frame.payload.empty() && static_cast<ValueTag>(frame.payload[0]) == ValueTag::Error) {
+                    totals.errors++;
+                    totals.entryErrors[pending.entry]++;
+                }
+            }
+        }
+        totals.lost += inflight.size();
+        close(fd);
+    }
+
+    void usage() {
+        fprintf(stderr,
+            "usage: jrb_load [options]\n"
+            "  --socket PATH          Unix socket of the bridge (/tmp/jrb.sock)\n"
+            "  --connections N        concurrent connections (4)\n"
+            "  --depth N              requests in flight per connection (1)\n"
+            "  --duration S           measured seconds (10)\n"
+            "  --warmup S             unmeasured seconds before that (2)\n"
+            "  --rate N               total requests per second, paced; closed loop if 0 (0)\n"
+            "  --mix FILE             weighted queries to replay, see Benchmark/mix.txt\n"
+            "  --priority N           wrap requests in Priority frames (0 interactive .. 2 bulk)\n"
+            "  --deadline-ms N        wrap requests in Deadline frames\n"
+            "  --csv                  print results as CSV\n");
+    }
+
+    bool parseOptions(int argc, char** argv, Options& options) {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            auto value = [&]() -> const char* {
+                return i + 1 < argc ? argv[++i] : "";
+            };
+            if (arg == "--socket") options.socket = value();
+            else if (arg == "--connections") options.connections = (std::max)(1, std::atoi(value()));
+            else if (arg == "--depth") options.depth = (std::max)(1, std::atoi(value()));
+            else if (arg == "--duration") options.durationS = (std::max)(1, std::atoi(value()));
+            else if (arg == "--warmup") options.warmupS = (std::max)(0, std::atoi(value()));
+            else if (arg == "--rate") options.rate = std::atof(value());
+            else if (arg == "--mix") options.mixFile = value();
+            else if (arg == "--priority") options.priority = std::clamp(std::atoi(value()), 0, 2);
+            else if (arg == "--deadline-ms") options.deadlineMs = static_cast<uint32_t>(std::atoi(value()));
+            else if (arg == "--csv") options.csv = true;
+            else if (arg == "--help" || arg == "-h") return false;
+            else {
+                fprintf(stderr, "unknown option %s\n", arg.c_str());
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void report(const char* name, const Histogram::Snapshot& latency, uint64_t errors, double seconds, const Options& options) {
+        auto micros = [](uint64_t nanoseconds) { return static_cast<double>(nanoseconds) / 1000.0; };
+        double qps = static_cast<double>(latency.count) / seconds;
+        if (options.csv) {
+            printf("\"%s\",%llu,%llu,%.0f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f\n", name, static_cast<unsigned long long>(latency.count),
+                static_cast<unsigned long long>(errors), qps, latency.mean() / 1000.0, micros(latency.percentile(0.5)),
+                micros(latency.percentile(0.9)), micros(latency.percentile(0.99)), micros(latency.percentile(0.999)), micros(latency.max));
+            return;
+        }
+        std::string label(name);
+        if (label.size() > 40) {
+            label = label.substr(0, 37) + "...";
+        }
+        printf("%-40s %10llu %8llu %10.0f %10.2f %10.2f %10.2f %10.2f %10.2f %10.2f\n", label.c_str(),
+            static_cast<unsigned long long>(latency.count), static_cast<unsigned long long>(errors), qps, latency.mean() / 1000.0,
+            micros(latency.percentile(0.5)), micros(latency.percentile(0.9)), micros(latency.percentile(0.99)),
+            micros(latency.percentile(0.999)), micros(latency.max));
+    }
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        usage();
+        return 2;
+    }
+    std::vector<Entry> mix;
+    if (!loadMix(options, mix)) {
+        return 2;
+    }
+
+    // Connect everything first so a missing server fails before any load.
+    std::vector<int> sockets;
+    for (int i = 0; i < options.connections; i++) {
+        int fd = openConnection(options.socket);
+        if (fd < 0) {
+            fprintf(stderr, "cannot open a binary connection to %s\n", options.socket.c_str());
+            for (int open : sockets) {
+                close(open);
+            }
+            return 1;
+        }
+        sockets.push_back(fd);
+    }
+
+    Totals totals;
+    totals.perEntry.reset(new Histogram[mix.size()]);
+    totals.entryErrors.reset(new std::atomic<uint64_t>[mix.size()]);
+    for (size_t i = 0; i < mix.size(); i++) {
+        totals.entryErrors[i] = 0;
+    }
+    Window window;
+    window.measure = Clock::now() + std::chrono::seconds(options.warmupS);
+    window.end = window.measure + std::chrono::seconds(options.durationS);
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < options.connections; i++) {
+        threads.emplace_back(drive, sockets[i], static_cast<unsigned>(i), std::cref(options), std::cref(mix), std::cref(window), std::ref(totals));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    double seconds = static_cast<double>(options.durationS);
+    if (options.csv) {
+        printf("query,count,errors,qps,mean_us,p50_us,p90_us,p99_us,p999_us,max_us\n");
+    }
+    else {
+        printf("%d connections, depth %d, %s, %d s measured after %d s warm-up; latencies in us\n\n", options.connections,
+            options.depth, options.rate > 0 ? (std::to_string(static_cast<long long>(options.rate)) + " requests/s").c_str() : "closed loop",
+            options.durationS, options.warmupS);
+        printf("%-40s %10s %8s %10s %10s %10s %10s %10s %10s %10s\n", "query", "count", "errors", "qps", "mean", "p50", "p90", "p99", "p99.9", "max");
+    }
+    report("all", totals.all.snapshot(), totals.errors, seconds, options);
+    for (size_t i = 0; i < mix.size(); i++) {
+        report(mix[i].text.c_str(), totals.perEntry[i].snapshot(), totals.entryErrors[i], seconds, options);
+    }
+    if (totals.lost > 0 || totals.late > 0) {
+        fprintf(stderr, "%llu requests unanswered, %llu answered after the window\n",
+            static_cast<unsigned long long>(totals.lost.load()), static_cast<unsigned long long>(totals.late.load()));
+    }
+    return totals.lost == 0 ? 0 : 1;
+}
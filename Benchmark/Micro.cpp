@@ -0,0 +1,460 @@
+#include "pch.h"
+#include <jni.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "Cache.hpp"
+#include "ClientAPI.hpp"
+#include "ConcurrentMap.hpp"
+#include "Encoding.hpp"
+#include "Executor.hpp"
+#include "Histogram.hpp"
+#include "MockJni.hpp"
+#include "Plan.hpp"
+#include "Protocol.hpp"
+
+// Microbenchmarks of the bridge's own code paths, run against MockJvm instead
+// of a real JVM: parsing, encoding, framing, the shared maps, plan execution
+// through Cache, the full ProcessInstruction path and executor dispatch.
+// Java calls cost a function call here, so the numbers isolate what the
+// bridge adds on top of the JVM; jrb_bench measures the two together.
+//
+// Each case is warmed up, sized so a sample lasts at least --sample-ms, and
+// timed in --samples samples; the report gives the median and fastest sample
+// in ns per operation and the coefficient of variation across samples.
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    struct Options {
+        std::string filter;
+        int samples = 15;
+        int warmupMs = 100;
+        int sampleMs = 10;
+        int players = 200;
+        unsigned threads = 0;
+        bool csv = false;
+        bool list = false;
+    };
+
+    struct Case {
+        const char* name = nullptr;
+        const char* description = nullptr;
+        std::function<void()> run;
+        // Runs once before the case is measured.
+        std::function<void()> prepare = nullptr;
+    };
+
+    // Results are folded in here so the optimizer cannot drop the work.
+    volatile size_t sink = 0;
+
+    void consume(size_t value) {
+        sink = sink + value;
+    }
+
+    // The handful of RuneLite types the cases query. Per-object state lives
+    // on the C++ side, indexed by the mock object.
+    struct World {
+        struct Player {
+            jstring name;
+            jint combatLevel;
+            jobject location;
+        };
+
+        std::unordered_map<jobject, Player> players;
+        std::unordered_map<jobject, std::array<jint, 3>> points;
+        std::atomic<jint> tick{ 1 };
+        // AWT component to its container.
+        std::unordered_map<jobject, jobject> parents;
+    };
+
+    void build(MockJvm& mock, World& world, int playerCount) {
+        // The client's window: a frame holding the applet, which holds the
+        // game canvas. ClientAPI finds them on the first request.
+        jclass component = mock.defineClass("java/awt/Component");
+        mock.addMethod(component, "getParent", "()Ljava/awt/Container;", [&world](jobject self, const jvalue*) {
+            auto found = world.parents.find(self);
+            return MockJvm::value(found != world.parents.end() ? found->second : nullptr);
+        });
+        mock.addMethod(component, "isDisplayable", "()Z", [](jobject, const jvalue*) {
+            jvalue result;
+            result.z = JNI_TRUE;
+            return result;
+        });
+        jclass container = mock.defineClass("java/awt/Container", "java/awt/Component");
+        mock.addMethod(container, "getComponents", "()[Ljava/awt/Component;", [&mock, &world](jobject self, const jvalue*) {
+            std::vector<jobject> children;
+            for (const auto& entry : world.parents) {
+                if (entry.second == self) {
+                    children.push_back(entry.first);
+                }
+            }
+            return MockJvm::value(mock.newObjectArray("java/awt/Component", children));
+        });
+        jclass window = mock.defineClass("java/awt/Window", "java/awt/Container");
+        jclass canvas = mock.defineClass("java/awt/Canvas", "java/awt/Component");
+        mock.defineClass("java/awt/Panel", "java/awt/Container");
+        jclass applet = mock.defineClass("java/applet/Applet", "java/awt/Panel");
+        jobject frameObject = mock.newObject(window);
+        jobject appletObject = mock.newObject(applet);
+        jobject canvasObject = mock.newObject(canvas);
+        world.parents[appletObject] = frameObject;
+        world.parents[canvasObject] = appletObject;
+        mock.addStaticMethod(window, "getWindows", "()[Ljava/awt/Window;", [&mock, frameObject](jobject, const jvalue*) {
+            return MockJvm::value(mock.newObjectArray("java/awt/Window", { frameObject }));
+        });
+
+        jclass point = mock.defineClass("net/runelite/api/coords/WorldPoint");
+        auto coordinate = [&world](size_t axis) {
+            return [&world, axis](jobject self, const jvalue*) {
+                return MockJvm::value(world.points.at(self)[axis]);
+            };
+        };
+        mock.addMethod(point, "getX", "()I", coordinate(0));
+        mock.addMethod(point, "getY", "()I", coordinate(1));
+        mock.addMethod(point, "getPlane", "()I", coordinate(2));
+
+        mock.defineInterface("net/runelite/api/Actor");
+        mock.defineInterface("net/runelite/api/Player", { "net/runelite/api/Actor" });
+        jclass player = mock.defineClass("jrb/micro/MockPlayer", "java/lang/Object", { "net/runelite/api/Player" });
+        mock.addMethod(player, "getName", "()Ljava/lang/String;", [&world](jobject self, const jvalue*) {
+            return MockJvm::value(world.players.at(self).name);
+        });
+        mock.addMethod(player, "getCombatLevel", "()I", [&world](jobject self, const jvalue*) {
+            return MockJvm::value(world.players.at(self).combatLevel);
+        });
+        mock.addMethod(player, "getWorldLocation", "()Lnet/runelite/api/coords/WorldPoint;", [&world](jobject self, const jvalue*) {
+            return MockJvm::value(world.players.at(self).location);
+        });
+
+        std::vector<jobject> all;
+        for (int i = 0; i < playerCount; i++) {
+            jobject location = mock.newObject(point);
+            world.points[location] = { 3200 + i % 64, 3200 + i / 64, 0 };
+            jobject created = mock.newObject(player);
+            world.players[created] = { mock.newString("Player " + std::to_string(i)), 3 + i % 124, location };
+            all.push_back(created);
+        }
+        jobject players = mock.newList(all);
+        jintArray skills = mock.newIntArray(std::vector<jint>(23, 99));
+
+        mock.defineInterface("net/runelite/api/Client");
+        jclass client = mock.defineClass("jrb/micro/MockClient", "java/lang/Object", { "net/runelite/api/Client" });
+        mock.addMethod(client, "getWorld", "()I", [](jobject, const jvalue*) {
+            return MockJvm::value(302);
+        });
+        mock.addMethod(client, "getTickCount", "()I", [&world](jobject, const jvalue*) {
+            return MockJvm::value(world.tick.load(std::memory_order_relaxed));
+        });
+        mock.addMethod(client, "getLocalPlayer", "()Lnet/runelite/api/Player;", [local = all[0]](jobject, const jvalue*) {
+            return MockJvm::value(local);
+        });
+        mock.addMethod(client, "getPlayers", "()Ljava/util/List;", [players](jobject, const jvalue*) {
+            return MockJvm::value(players);
+        });
+        mock.addMethod(client, "getBoostedSkillLevels", "()[I", [skills](jobject, const jvalue*) {
+            return MockJvm::value(static_cast<jobject>(skills));
+        });
+        // A 765x503 frame, the size of the fixed mode game view.
+        jclass bufferProvider = mock.defineClass("jrb/micro/MockBufferProvider");
+        jobject bufferProviderObject = mock.newObject(bufferProvider);
+        jintArray pixels = mock.newIntArray(std::vector<jint>(765 * 503, 0x00FF8000));
+        mock.addMethod(bufferProvider, "getWidth", "()I", [](jobject, const jvalue*) {
+            return MockJvm::value(765);
+        });
+        mock.addMethod(bufferProvider, "getHeight", "()I", [](jobject, const jvalue*) {
+            return MockJvm::value(503);
+        });
+        mock.addMethod(bufferProvider, "getPixels", "()[I", [pixels](jobject, const jvalue*) {
+            return MockJvm::value(static_cast<jobject>(pixels));
+        });
+        mock.addMethod(client, "getBufferProvider", "()Ljrb/micro/MockBufferProvider;", [bufferProviderObject](jobject, const jvalue*) {
+            return MockJvm::value(bufferProviderObject);
+        });
+        jobject clientObject = mock.newObject(client);
+
+        // RuneLite.injector.getInstance(RuneLite.class).client, as ClientAPI
+        // walks it in the game.
+        jclass runeLite = mock.defineClass("net/runelite/client/RuneLite");
+        jobject runeLiteObject = mock.newObject(runeLite);
+        mock.setField(runeLiteObject, "client", "Lnet/runelite/api/Client;", MockJvm::value(clientObject));
+        mock.defineInterface("com/google/inject/Injector");
+        jclass injector = mock.defineClass("jrb/micro/MockInjector", "java/lang/Object", { "com/google/inject/Injector" });
+        mock.addMethod(injector, "getInstance", "(Ljava/lang/Class;)Ljava/lang/Object;", [runeLiteObject](jobject, const jvalue*) {
+            return MockJvm::value(runeLiteObject);
+        });
+        jobject injectorObject = mock.newObject(injector);
+        mock.setStaticField(runeLite, "injector", "Lcom/google/inject/Injector;", MockJvm::value(injectorObject));
+        mock.addStaticMethod(runeLite, "getInjector", "()Lcom/google/inject/Injector;", [injectorObject](jobject, const jvalue*) {
+            return MockJvm::value(injectorObject);
+        });
+    }
+
+    // Runs `job` on an executor worker and waits for it.
+    void onWorker(Executor& executor, const std::function<void()>& job) {
+        std::mutex mutex;
+        std::condition_variable done;
+        bool finished = false;
+        executor.submit([&] {
+            job();
+            std::lock_guard<std::mutex> lock(mutex);
+            finished = true;
+            done.notify_one();
+        });
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&] { return finished; });
+    }
+
+    bool isError(const std::string& value) {
+        return !value.empty() && static_cast<ValueTag>(value[0]) == ValueTag::Error;
+    }
+
+    struct Result {
+        double median = 0;
+        double fastest = 0;
+        double variation = 0;
+    };
+
+    Result measure(const Case& benchmark, const Options& options) {
+        if (benchmark.prepare) {
+            benchmark.prepare();
+        }
+        auto warmupEnd = Clock::now() + std::chrono::milliseconds(options.warmupMs);
+        while (Clock::now() < warmupEnd) {
+            benchmark.run();
+        }
+        size_t iterations = 1;
+        while (iterations < (1u << 28)) {
+            auto start = Clock::now();
+            for (size_t i = 0; i < iterations; i++) {
+                benchmark.run();
+            }
+            if (Clock::now() - start >= std::chrono::milliseconds(options.sampleMs)) {
+                break;
+            }
+            iterations *= 2;
+        }
+
+        std::vector<double> samples;
+        for (int s = 0; s < options.samples; s++) {
+            auto start = Clock::now();
+            for (size_t i = 0; i < iterations; i++) {
+                benchmark.run();
+            }
+            samples.push_back(std::chrono::duration<double, std::nano>(Clock::now() - start).count() / static_cast<double>(iterations));
+        }
+
+        Result result;
+        std::sort(samples.begin(), samples.end());
+        size_t count = samples.size();
+        result.median = count % 2 == 1 ? samples[count / 2] : (samples[count / 2 - 1] + samples[count / 2]) / 2;
+        result.fastest = samples.front();
+        double mean = 0;
+        for (double value : samples) {
+            mean += value / static_cast<double>(count);
+        }
+        double squares = 0;
+        for (double value : samples) {
+            squares += (value - mean) * (value - mean);
+        }
+        result.variation = count > 1 && mean > 0 ? std::sqrt(squares / static_cast<double>(count - 1)) / mean : 0;
+        return result;
+    }
+
+    void usage() {
+        printf(
+            "usage: jrb_micro [options] [filter]\n"
+            "  --list                 list cases and exit\n"
+            "  --samples N            timed samples per case (15)\n"
+            "  --sample-ms N          minimum duration of a sample (10)\n"
+            "  --warmup-ms N          warm-up time per case (100)\n"
+            "  --threads N            executor workers (hardware threads, at most 8)\n"
+            "  --players N            players in the mock world (200)\n"
+            "  --csv                  print results as CSV\n");
+    }
+
+    bool parseOptions(int argc, char** argv, Options& options) {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            auto value = [&]() -> const char* {
+                return i + 1 < argc ? argv[++i] : "";
+            };
+            if (arg == "--list") options.list = true;
+            else if (arg == "--csv") options.csv = true;
+            else if (arg == "--samples") options.samples = (std::max)(2, std::atoi(value()));
+            else if (arg == "--sample-ms") options.sampleMs = std::atoi(value());
+            else if (arg == "--warmup-ms") options.warmupMs = std::atoi(value());
+            else if (arg == "--threads") options.threads = static_cast<unsigned>(std::atoi(value()));
+            else if (arg == "--players") options.players = (std::max)(1, std::atoi(value()));
+            else if (arg == "--help" || arg == "-h") return false;
+            else if (!arg.empty() && arg[0] != '-') options.filter = arg;
+            else {
+                fprintf(stderr, "unknown option %s\n", arg.c_str());
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        usage();
+        return 2;
+    }
+
+    MockJvm mock;
+    World world;
+    build(mock, world, options.players);
+
+    // Cases run on a worker, as queries do in the server, so projections are
+    // split and the executor cases measure submission from inside the pool.
+    unsigned threads = options.threads > 0 ? options.threads : std::clamp(std::thread::hardware_concurrency(), 2u, 8u);
+    Executor executor(threads, mock.vm());
+    ClientAPI api;
+    if (!api.EnsureClient()) {
+        fprintf(stderr, "the bridge did not find the mock client\n");
+        return 1;
+    }
+    // The environment and view of whichever worker runs the current case;
+    // both belong to that thread.
+    JNIEnv* env = nullptr;
+    Cache* view = nullptr;
+
+    const std::string chain = "Client.getLocalPlayer.getWorldLocation.getX";
+    const std::string projection = "Client.getPlayers{getName,getCombatLevel,getWorldLocation.getX,getWorldLocation.getY}";
+    std::string batch;
+    for (int i = 0; i < 16; i++) {
+        batch += (i % 2 == 0 ? chain : "Client.getLocalPlayer.getName") + "\n";
+    }
+    batch.pop_back();
+    Plan scalarPlan = compilePlan("Client.getWorld");
+    Plan chainPlan = compilePlan(chain);
+    Plan classRootPlan = compilePlan("@net/runelite/client/RuneLite.getInjector.toString");
+    Plan projectionPlan = compilePlan(projection);
+
+    ConcurrentMap<int> map;
+    std::vector<std::string> keys;
+    for (int i = 0; i < 1024; i++) {
+        keys.push_back("jrb.micro.Class" + std::to_string(i) + ".getMethod");
+        map.insert(keys.back(), i);
+    }
+    size_t next = 0;
+    Histogram histogram;
+
+    Table table;
+    table.columns = { "getName", "getCombatLevel", "getX", "getY" };
+    for (int i = 0; i < options.players; i++) {
+        ValueWriter cell;
+        std::vector<std::string> row;
+        cell.writeString("Player " + std::to_string(i));
+        row.push_back(cell.release());
+        for (int column = 0; column < 3; column++) {
+            cell.writeInt(3200 + i);
+            row.push_back(cell.release());
+        }
+        table.rows.push_back(std::move(row));
+    }
+    std::string result;
+    {
+        ValueWriter writer;
+        writer.writeInt(3222);
+        result = writer.release();
+    }
+
+    auto check = [](const std::string& value) {
+        if (value.empty() || isError(value)) {
+            fprintf(stderr, "the bridge returned an error\n");
+            std::_Exit(1);
+        }
+        consume(value.size());
+    };
+    auto noMemo = [&] { view->memo->clear(env); };
+
+    std::vector<Case> all = {
+        { "compile-chain", "parse a four hop query", [&] { consume(compilePlan(chain).hops.size()); } },
+        { "compile-projection", "parse a projection with four columns", [&] { consume(compilePlan(projection).columns.size()); } },
+        { "compile-batch", "parse a batch of sixteen queries", [&] { consume(compileBatch(batch).size()); } },
+        { "map-find", "ConcurrentMap lookup among 1024 keys", [&] { consume(*map.find(keys[next++ & 1023])); } },
+        { "histogram-record", "record one latency", [&] { histogram.record(next++ & 0xFFFF); } },
+        { "encode-scalar", "tag and encode one int", [&] { ValueWriter writer; writer.writeInt(3222); consume(writer.release().size()); } },
+        { "encode-table", "encode a table of players, four columns", [&] { ValueWriter writer; writer.writeTable(table); consume(writer.release().size()); } },
+        { "frame-round-trip", "encode a result frame and read it back", [&] {
+            std::string frame = encodeFrame(FrameKind::Result, static_cast<uint32_t>(next++), result);
+            FrameReader reader;
+            reader.append(frame.data(), frame.size());
+            Frame decoded;
+            consume(reader.next(decoded) ? decoded.payload.size() : 0);
+        } },
+        { "plan-scalar", "execute a compiled one hop plan", [&] { check(view->executePlan(env, scalarPlan, Encoding::Binary)); }, noMemo },
+        { "plan-chain", "execute a compiled four hop plan", [&] { check(view->executePlan(env, chainPlan, Encoding::Binary)); }, noMemo },
+        { "plan-chain-memo", "the same plan with every hop memoized for the tick", [&] { check(view->executePlan(env, chainPlan, Encoding::Binary)); },
+            [&] { view->memo->advance(env, world.tick.load()); } },
+        { "plan-class-root", "a static method of a class resolved by name, then one hop", [&] { check(view->executePlan(env, classRootPlan, Encoding::Binary)); }, noMemo },
+        { "plan-projection", "project every player into four columns", [&] { check(view->executePlan(env, projectionPlan, Encoding::Binary)); }, noMemo },
+        { "catalog-prefix", "find classes by name prefix in the class catalog", [&] { consume(api.Catalog("net.runelite").rows.size()); } },
+        { "catalog-member", "find declared members by name prefix", [&] { consume(api.Catalog("member getWorld").rows.size()); } },
+        { "capture-frame", "copy a 765x503 frame into the capture region", [&] { check(api.Capture("", Encoding::Binary)); } },
+        { "instruction", "ProcessInstruction on a four hop query, parse to encoded result", [&] { check(api.ProcessInstruction(chain, Encoding::Binary)); } },
+        { "executor-submit", "submit an empty task and wait for it", [&] { onWorker(executor, [] {}); } },
+        { "parallel-for", "split 256 trivial items into chunks of 32", [&] {
+            std::atomic<size_t> total{ 0 };
+            executor.parallelFor(256, 32, [&](size_t begin, size_t end) { total += end - begin; });
+            consume(total.load());
+        } },
+    };
+
+    if (options.list) {
+        for (const auto& benchmark : all) {
+            printf("%-20s %s\n", benchmark.name, benchmark.description);
+        }
+        return 0;
+    }
+
+    if (options.csv) {
+        printf("case,median_ns,min_ns,cv_percent,ops_per_s\n");
+    }
+    else {
+        printf("%d samples of >= %d ms, %u workers, %d players; times per operation in ns\n\n", options.samples, options.sampleMs, threads, options.players);
+        printf("%-20s %12s %12s %7s %14s\n", "case", "median", "min", "cv", "ops/s");
+    }
+    // Frames are copied into a region created once, as while capture is on.
+    onWorker(executor, [&] { check(api.Capture("on", Encoding::Binary)); });
+    for (const auto& benchmark : all) {
+        if (!options.filter.empty() && std::strstr(benchmark.name, options.filter.c_str()) == nullptr) {
+            continue;
+        }
+        Result measured;
+        onWorker(executor, [&] {
+            env = Executor::currentEnv();
+            view = &api.View();
+            measured = measure(benchmark, options);
+        });
+        double opsPerSecond = measured.median > 0 ? 1e9 / measured.median : 0;
+        if (options.csv) {
+            printf("%s,%.1f,%.1f,%.2f,%.0f\n", benchmark.name, measured.median, measured.fastest, measured.variation * 100, opsPerSecond);
+        }
+        else {
+            printf("%-20s %12.1f %12.1f %6.1f%% %14.0f\n", benchmark.name, measured.median, measured.fastest, measured.variation * 100, opsPerSecond);
+        }
+        fflush(stdout);
+    }
+    api.Capture("off");
+    // The bridge keeps global references and attached workers; as in
+    // jrb_bench, leave without tearing them down.
+    fflush(stdout);
+    std::_Exit(0);
+}
@@ -0,0 +1,1262 @@
+#include "pch.h"
+// Defines JNI_GetCreatedJavaVMs below, so it must not be declared as imported.
+#define _JNI_IMPLEMENTATION_
+#include "MockJni.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_set>
+
+struct MockJvm::Object {
+    Class* type = nullptr;
+    // Set on java.lang.Class and java.lang.reflect.Method and Field instances.
+    Class* reflectedClass = nullptr;
+    Method* reflectedMethod = nullptr;
+    Field* reflectedField = nullptr;
+    // Strings and exception messages.
+    std::string text;
+    // Boxed numbers, booleans and characters.
+    jvalue boxed{};
+    // Object arrays and lists.
+    std::vector<jobject> elements;
+    // Primitive arrays.
+    std::vector<char> data;
+    std::unordered_map<const Field*, jvalue> fields;
+    // A list's toArray result and any object's toString result, made once
+    // so repeated queries do not grow the heap.
+    Object* array = nullptr;
+    Object* description = nullptr;
+};
+
+struct MockJvm::Class {
+    // Internal name, array descriptor, or Java name for primitives.
+    std::string name;
+    Object* object = nullptr;
+    Object* javaName = nullptr;
+    Class* superclass = nullptr;
+    std::vector<Class*> interfaces;
+    bool isInterface = false;
+    char primitive = 0;
+    Class* component = nullptr;
+    std::unordered_map<std::string, Method*> declared;
+    std::vector<Method*> order;
+    std::unordered_map<std::string, Field*> declaredFields;
+    std::unordered_map<const Field*, jvalue> statics;
+    // getMethods result, dropped when a method is added.
+    Object* methodArray = nullptr;
+};
+
+struct MockJvm::Method {
+    std::string name;
+    std::string signature;
+    std::vector<std::string> parameters;
+    std::string returnType;
+    Class* owner = nullptr;
+    Body body;
+    bool isStatic = false;
+    Object* reflected = nullptr;
+    Object* javaName = nullptr;
+    Object* parameterTypes = nullptr;
+};
+
+struct MockJvm::Field {
+    std::string name;
+    std::string signature;
+    Class* owner = nullptr;
+    bool isStatic = false;
+    Object* reflected = nullptr;
+    Object* javaName = nullptr;
+};
+
+struct MockJvm::Env : JNIEnv_ {
+    MockJvm* owner = nullptr;
+    Object* pending = nullptr;
+    bool attached = false;
+};
+
+namespace {
+    std::atomic<MockJvm*> latest{ nullptr };
+    std::atomic<uint64_t> generations{ 0 };
+
+    struct CachedEnv {
+        uint64_t generation = UINT64_MAX;
+        MockJvm::Env* env = nullptr;
+    };
+    thread_local CachedEnv cachedEnv;
+
+    const char* primitiveName(char descriptor) {
+        switch (descriptor) {
+        case 'Z': return "boolean";
+        case 'B': return "byte";
+        case 'C': return "char";
+        case 'S': return "short";
+        case 'I': return "int";
+        case 'J': return "long";
+        case 'F': return "float";
+        case 'D': return "double";
+        case 'V': return "void";
+        }
+        return nullptr;
+    }
+
+    size_t primitiveSize(char descriptor) {
+        switch (descriptor) {
+        case 'Z': case 'B': return 1;
+        case 'C': case 'S': return 2;
+        case 'I': case 'F': return 4;
+        default: return 8;
+        }
+    }
+
+    // Splits a method signature into parameter descriptors and the return type.
+    bool splitSignature(const std::string& signature, std::vector<std::string>& parameters, std::string& returnType) {
+        if (signature.empty() || signature[0] != '(') {
+            return false;
+        }
+        size_t i = 1;
+        auto next = [&](std::string& out) {
+            size_t start = i;
+            while (i < signature.size() && signature[i] == '[') {
+                i++;
+            }
+            if (i < signature.size() && signature[i] == 'L') {
+                i = signature.find(';', i);
+                if (i == std::string::npos) {
+                    return false;
+                }
+            }
+            if (i >= signature.size()) {
+                return false;
+            }
+            out = signature.substr(start, ++i - start);
+            return true;
+        };
+        while (i < signature.size() && signature[i] != ')') {
+            std::string parameter;
+            if (!next(parameter)) {
+                return false;
+            }
+            parameters.push_back(parameter);
+        }
+        if (i >= signature.size()) {
+            return false;
+        }
+        i++;
+        return next(returnType);
+    }
+
+    template <typename T>
+    T unwrap(jvalue value) {
+        if constexpr (std::is_same_v<T, jboolean>) return value.z;
+        else if constexpr (std::is_same_v<T, jbyte>) return value.b;
+        else if constexpr (std::is_same_v<T, jchar>) return value.c;
+        else if constexpr (std::is_same_v<T, jshort>) return value.s;
+        else if constexpr (std::is_same_v<T, jint>) return value.i;
+        else if constexpr (std::is_same_v<T, jlong>) return value.j;
+        else if constexpr (std::is_same_v<T, jfloat>) return value.f;
+        else if constexpr (std::is_same_v<T, jdouble>) return value.d;
+        else return static_cast<T>(value.l);
+    }
+}
+
+// The JNI entry points. Handles are object pointers, method IDs are Method
+// pointers and field IDs are Field pointers.
+struct MockApi {
+    using Object = MockJvm::Object;
+    using Class = MockJvm::Class;
+    using Method = MockJvm::Method;
+    using Field = MockJvm::Field;
+
+    static MockJvm& jvm(JNIEnv* env) {
+        return *static_cast<MockJvm::Env*>(env)->owner;
+    }
+
+    static Object* object(jobject handle) {
+        return reinterpret_cast<Object*>(handle);
+    }
+
+    static Class* type(jclass handle) {
+        return handle != nullptr ? object(handle)->reflectedClass : nullptr;
+    }
+
+    static jobject handle(Object* object) {
+        return reinterpret_cast<jobject>(object);
+    }
+
+    static bool assignable(const Class* from, const Class* to) {
+        if (from == nullptr || to == nullptr) {
+            return false;
+        }
+        if (from == to) {
+            return true;
+        }
+        if (from->primitive != 0 || to->primitive != 0) {
+            return false;
+        }
+        if (to->superclass == nullptr && !to->isInterface && to->component == nullptr) {
+            return true;  // java.lang.Object
+        }
+        if (from->component != nullptr && to->component != nullptr) {
+            return assignable(from->component, to->component);
+        }
+        for (const Class* current = from; current != nullptr; current = current->superclass) {
+            if (current == to) {
+                return true;
+            }
+            for (const Class* implemented : current->interfaces) {
+                if (assignable(implemented, to)) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    static Method* findMethod(const Class* owner, const std::string& key) {
+        for (const Class* current = owner; current != nullptr; current = current->superclass) {
+            auto found = current->declared.find(key);
+            if (found != current->declared.end()) {
+                return found->second;
+            }
+            for (const Class* implemented : current->interfaces) {
+                if (Method* method = findMethod(implemented, key)) {
+                    return method;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    static Field* findField(const Class* owner, const std::string& name, const std::string& signature) {
+        for (const Class* current = owner; current != nullptr; current = current->superclass) {
+            auto found = current->declaredFields.find(name);
+            if (found != current->declaredFields.end() && found->second->signature == signature) {
+                return found->second;
+            }
+        }
+        return nullptr;
+    }
+
+    static std::vector<jvalue> readArguments(const Method* method, va_list list) {
+        std::vector<jvalue> arguments(method->parameters.size());
+        for (size_t i = 0; i < arguments.size(); i++) {
+            switch (method->parameters[i][0]) {
+            case 'Z': arguments[i].z = static_cast<jboolean>(va_arg(list, jint)); break;
+            case 'B': arguments[i].b = static_cast<jbyte>(va_arg(list, jint)); break;
+            case 'C': arguments[i].c = static_cast<jchar>(va_arg(list, jint)); break;
+            case 'S': arguments[i].s = static_cast<jshort>(va_arg(list, jint)); break;
+            case 'I': arguments[i].i = va_arg(list, jint); break;
+            case 'J': arguments[i].j = va_arg(list, jlong); break;
+            case 'F': arguments[i].f = static_cast<jfloat>(va_arg(list, jdouble)); break;
+            case 'D': arguments[i].d = va_arg(list, jdouble); break;
+            default: arguments[i].l = va_arg(list, jobject); break;
+            }
+        }
+        return arguments;
+    }
+
+    static jvalue invoke(JNIEnv* env, jobject receiver, jmethodID id, const jvalue* arguments, bool dispatch) {
+        Method* method = reinterpret_cast<Method*>(id);
+        jvalue result{};
+        if (method == nullptr) {
+            jvm(env).raise("java/lang/NullPointerException", "null method ID");
+            return result;
+        }
+        if (!method->isStatic && receiver == nullptr) {
+            jvm(env).raise("java/lang/NullPointerException", method->name);
+            return result;
+        }
+        // Virtual dispatch to an override in the receiver's class.
+        if (dispatch && !method->isStatic && object(receiver)->type != method->owner) {
+            if (Method* target = findMethod(object(receiver)->type, method->name + method->signature)) {
+                method = target;
+            }
+        }
+        if (!method->body) {
+            jvm(env).raise("java/lang/AbstractMethodError", method->name);
+            return result;
+        }
+        return method->body(method->isStatic ? nullptr : receiver, arguments);
+    }
+
+    template <typename T>
+    static T finish(jvalue value) {
+        if constexpr (!std::is_void_v<T>) {
+            return unwrap<T>(value);
+        }
+    }
+
+    template <typename T>
+    static T JNICALL callV(JNIEnv* env, jobject receiver, jmethodID id, va_list list) {
+        std::vector<jvalue> arguments = readArguments(reinterpret_cast<Method*>(id), list);
+        return finish<T>(invoke(env, receiver, id, arguments.data(), true));
+    }
+
+    template <typename T>
+    static T JNICALL callA(JNIEnv* env, jobject receiver, jmethodID id, const jvalue* arguments) {
+        return finish<T>(invoke(env, receiver, id, arguments, true));
+    }
+
+    template <typename T>
+    static T JNICALL callNonvirtualV(JNIEnv* env, jobject receiver, jclass, jmethodID id, va_list list) {
+        std::vector<jvalue> arguments = readArguments(reinterpret_cast<Method*>(id), list);
+        return finish<T>(invoke(env, receiver, id, arguments.data(), false));
+    }
+
+    template <typename T>
+    static T JNICALL callNonvirtualA(JNIEnv* env, jobject receiver, jclass, jmethodID id, const jvalue* arguments) {
+        return finish<T>(invoke(env, receiver, id, arguments, false));
+    }
+
+    template <typename T>
+    static T JNICALL callStaticV(JNIEnv* env, jclass, jmethodID id, va_list list) {
+        std::vector<jvalue> arguments = readArguments(reinterpret_cast<Method*>(id), list);
+        return finish<T>(invoke(env, nullptr, id, arguments.data(), false));
+    }
+
+    template <typename T>
+    static T JNICALL callStaticA(JNIEnv* env, jclass, jmethodID id, const jvalue* arguments) {
+        return finish<T>(invoke(env, nullptr, id, arguments, false));
+    }
+
+    template <typename T>
+    static T JNICALL getField(JNIEnv*, jobject receiver, jfieldID id) {
+        const auto& fields = object(receiver)->fields;
+        auto found = fields.find(reinterpret_cast<Field*>(id));
+        return unwrap<T>(found != fields.end() ? found->second : jvalue{});
+    }
+
+    template <typename T>
+    static T JNICALL getStaticField(JNIEnv*, jclass, jfieldID id) {
+        const Field* field = reinterpret_cast<Field*>(id);
+        auto found = field->owner->statics.find(field);
+        return unwrap<T>(found != field->owner->statics.end() ? found->second : jvalue{});
+    }
+
+    template <typename T>
+    static void JNICALL getArrayRegion(JNIEnv* env, jarray array, jsize start, jsize length, T* out) {
+        const std::vector<char>& data = object(array)->data;
+        if (start < 0 || length < 0 || (static_cast<size_t>(start) + length) * sizeof(T) > data.size()) {
+            jvm(env).raise("java/lang/ArrayIndexOutOfBoundsException", std::to_string(start + length));
+            return;
+        }
+        std::memcpy(out, data.data() + start * sizeof(T), length * sizeof(T));
+    }
+
+    template <typename T>
+    static T* JNICALL getArrayElements(JNIEnv*, jarray array, jboolean* isCopy) {
+        if (isCopy != nullptr) {
+            *isCopy = JNI_FALSE;
+        }
+        return reinterpret_cast<T*>(object(array)->data.data());
+    }
+
+    template <typename T>
+    static void JNICALL releaseArrayElements(JNIEnv*, jarray, T*, jint) {}
+
+    static void* JNICALL getPrimitiveArrayCritical(JNIEnv*, jarray array, jboolean* isCopy) {
+        return getArrayElements<char>(nullptr, array, isCopy);
+    }
+
+    static void JNICALL releasePrimitiveArrayCritical(JNIEnv*, jarray, void*, jint) {}
+
+    template <char Descriptor, typename ArrayType>
+    static ArrayType JNICALL newArray(JNIEnv* env, jsize length) {
+        MockJvm& mock = jvm(env);
+        Object* array = mock.allocate(mock.classFor(std::string("[") + Descriptor));
+        array->data.assign(static_cast<size_t>(length) * primitiveSize(Descriptor), 0);
+        return static_cast<ArrayType>(handle(array));
+    }
+
+    static jint JNICALL getVersion(JNIEnv*) {
+        return JNI_VERSION_1_8;
+    }
+
+    static jclass JNICALL defineClass(JNIEnv* env, const char*, jobject, const jbyte*, jsize) {
+        jvm(env).raise("java/lang/UnsupportedOperationException", "DefineClass");
+        return nullptr;
+    }
+
+    static jclass JNICALL findClass(JNIEnv* env, const char* name) {
+        MockJvm& mock = jvm(env);
+        jclass found = name[0] == '[' ? static_cast<jclass>(handle(mock.classFor(name)->object)) : mock.findClass(name);
+        if (found == nullptr) {
+            mock.raise("java/lang/NoClassDefFoundError", name);
+        }
+        return found;
+    }
+
+    static jclass JNICALL getSuperclass(JNIEnv*, jclass handle) {
+        Class* superclass = type(handle)->superclass;
+        return superclass != nullptr && !type(handle)->isInterface ? static_cast<jclass>(MockApi::handle(superclass->object)) : nullptr;
+    }
+
+    static jboolean JNICALL isAssignableFrom(JNIEnv*, jclass from, jclass to) {
+        return assignable(type(from), type(to)) ? JNI_TRUE : JNI_FALSE;
+    }
+
+    static jint JNICALL throwObject(JNIEnv* env, jthrowable throwable) {
+        static_cast<MockJvm::Env*>(env)->pending = object(throwable);
+        return JNI_OK;
+    }
+
+    static jint JNICALL throwNew(JNIEnv* env, jclass handle, const char* message) {
+        jvm(env).raise(type(handle)->name, message != nullptr ? message : "");
+        return JNI_OK;
+    }
+
+    static jthrowable JNICALL exceptionOccurred(JNIEnv* env) {
+        return static_cast<jthrowable>(handle(static_cast<MockJvm::Env*>(env)->pending));
+    }
+
+    static jboolean JNICALL exceptionCheck(JNIEnv* env) {
+        return static_cast<MockJvm::Env*>(env)->pending != nullptr ? JNI_TRUE : JNI_FALSE;
+    }
+
+    // Benchmarks provoke exceptions on purpose; describing them would only
+    // add console noise to the measurement.
+    static void JNICALL exceptionDescribe(JNIEnv*) {}
+
+    static void JNICALL exceptionClear(JNIEnv* env) {
+        static_cast<MockJvm::Env*>(env)->pending = nullptr;
+    }
+
+    static void JNICALL fatalError(JNIEnv*, const char* message) {
+        fprintf(stderr, "fatal JNI error: %s\n", message);
+        std::abort();
+    }
+
+    static jint JNICALL pushLocalFrame(JNIEnv*, jint) {
+        return JNI_OK;
+    }
+
+    static jobject JNICALL popLocalFrame(JNIEnv*, jobject result) {
+        return result;
+    }
+
+    static jobject JNICALL newRef(JNIEnv*, jobject reference) {
+        return reference;
+    }
+
+    static jweak JNICALL newWeakRef(JNIEnv*, jobject reference) {
+        return reference;
+    }
+
+    static void JNICALL deleteRef(JNIEnv*, jobject) {}
+
+    static jboolean JNICALL isSameObject(JNIEnv*, jobject a, jobject b) {
+        return a == b ? JNI_TRUE : JNI_FALSE;
+    }
+
+    static jint JNICALL ensureLocalCapacity(JNIEnv*, jint) {
+        return JNI_OK;
+    }
+
+    static jobjectRefType JNICALL getObjectRefType(JNIEnv*, jobject reference) {
+        return reference != nullptr ? JNIGlobalRefType : JNIInvalidRefType;
+    }
+
+    static jobject JNICALL allocObject(JNIEnv* env, jclass handle) {
+        return MockApi::handle(jvm(env).allocate(type(handle)));
+    }
+
+    static jobject JNICALL newObjectV(JNIEnv* env, jclass handle, jmethodID constructor, va_list list) {
+        jobject created = allocObject(env, handle);
+        if (constructor != nullptr) {
+            callNonvirtualV<void>(env, created, handle, constructor, list);
+        }
+        return created;
+    }
+
+    static jobject JNICALL newObjectA(JNIEnv* env, jclass handle, jmethodID constructor, const jvalue* arguments) {
+        jobject created = allocObject(env, handle);
+        if (constructor != nullptr) {
+            callNonvirtualA<void>(env, created, handle, constructor, arguments);
+        }
+        return created;
+    }
+
+    static jclass JNICALL getObjectClass(JNIEnv*, jobject receiver) {
+        return receiver != nullptr ? static_cast<jclass>(handle(object(receiver)->type->object)) : nullptr;
+    }
+
+    static jboolean JNICALL isInstanceOf(JNIEnv*, jobject receiver, jclass handle) {
+        return receiver == nullptr || assignable(object(receiver)->type, type(handle)) ? JNI_TRUE : JNI_FALSE;
+    }
+
+    static jmethodID lookupMethod(JNIEnv* env, jclass handle, const char* name, const char* signature, bool isStatic) {
+        Method* method = findMethod(type(handle), std::string(name) + signature);
+        if (method == nullptr || method->isStatic != isStatic) {
+            jvm(env).raise("java/lang/NoSuchMethodError", name);
+            return nullptr;
+        }
+        return reinterpret_cast<jmethodID>(method);
+    }
+
+    static jmethodID JNICALL getMethodID(JNIEnv* env, jclass handle, const char* name, const char* signature) {
+        return lookupMethod(env, handle, name, signature, false);
+    }
+
+    static jmethodID JNICALL getStaticMethodID(JNIEnv* env, jclass handle, const char* name, const char* signature) {
+        return lookupMethod(env, handle, name, signature, true);
+    }
+
+    static jfieldID lookupField(JNIEnv* env, jclass handle, const char* name, const char* signature, bool isStatic) {
+        Field* field = findField(type(handle), name, signature);
+        if (field == nullptr || field->isStatic != isStatic) {
+            jvm(env).raise("java/lang/NoSuchFieldError", name);
+            return nullptr;
+        }
+        return reinterpret_cast<jfieldID>(field);
+    }
+
+    static jfieldID JNICALL getFieldID(JNIEnv* env, jclass handle, const char* name, const char* signature) {
+        return lookupField(env, handle, name, signature, false);
+    }
+
+    static jfieldID JNICALL getStaticFieldID(JNIEnv* env, jclass handle, const char* name, const char* signature) {
+        return lookupField(env, handle, name, signature, true);
+    }
+
+    static jstring JNICALL newStringUTF(JNIEnv* env, const char* text) {
+        return jvm(env).newString(text);
+    }
+
+    static jsize JNICALL getStringUTFLength(JNIEnv*, jstring string) {
+        return static_cast<jsize>(object(string)->text.size());
+    }
+
+    static const char* JNICALL getStringUTFChars(JNIEnv*, jstring string, jboolean* isCopy) {
+        if (isCopy != nullptr) {
+            *isCopy = JNI_FALSE;
+        }
+        return object(string)->text.c_str();
+    }
+
+    static void JNICALL releaseStringUTFChars(JNIEnv*, jstring, const char*) {}
+
+    static void JNICALL getStringUTFRegion(JNIEnv*, jstring string, jsize start, jsize length, char* out) {
+        std::memcpy(out, object(string)->text.data() + start, length);
+    }
+
+    static jsize JNICALL getArrayLength(JNIEnv*, jarray array) {
+        const Object* target = object(array);
+        if (target->type->component->primitive != 0) {
+            return static_cast<jsize>(target->data.size() / primitiveSize(target->type->component->primitive));
+        }
+        return static_cast<jsize>(target->elements.size());
+    }
+
+    static jobjectArray JNICALL newObjectArray(JNIEnv* env, jsize length, jclass element, jobject initial) {
+        MockJvm& mock = jvm(env);
+        return mock.newObjectArray(type(element)->name, std::vector<jobject>(length, initial));
+    }
+
+    static jobject JNICALL getObjectArrayElement(JNIEnv* env, jobjectArray array, jsize index) {
+        const std::vector<jobject>& elements = object(array)->elements;
+        if (index < 0 || static_cast<size_t>(index) >= elements.size()) {
+            jvm(env).raise("java/lang/ArrayIndexOutOfBoundsException", std::to_string(index));
+            return nullptr;
+        }
+        return elements[index];
+    }
+
+    static void JNICALL setObjectArrayElement(JNIEnv* env, jobjectArray array, jsize index, jobject value) {
+        std::vector<jobject>& elements = object(array)->elements;
+        if (index < 0 || static_cast<size_t>(index) >= elements.size()) {
+            jvm(env).raise("java/lang/ArrayIndexOutOfBoundsException", std::to_string(index));
+            return;
+        }
+        elements[index] = value;
+    }
+
+    static jint JNICALL registerNatives(JNIEnv*, jclass, const JNINativeMethod*, jint) {
+        return JNI_OK;
+    }
+
+    static jint JNICALL getJavaVM(JNIEnv* env, JavaVM** vm) {
+        *vm = jvm(env).vm();
+        return JNI_OK;
+    }
+
+    static jint JNICALL destroyJavaVM(JavaVM*) {
+        return JNI_OK;
+    }
+
+    static MockJvm& owner(JavaVM* vm) {
+        return *static_cast<MockJvm::Vm*>(vm)->owner;
+    }
+
+    static jint JNICALL attachCurrentThread(JavaVM* vm, void** env, void*) {
+        *env = static_cast<JNIEnv*>(owner(vm).currentEnv(true));
+        return JNI_OK;
+    }
+
+    static jint JNICALL detachCurrentThread(JavaVM* vm) {
+        if (MockJvm::Env* env = owner(vm).currentEnv(false)) {
+            env->attached = false;
+        }
+        return JNI_OK;
+    }
+
+    static jint JNICALL getEnv(JavaVM* vm, void** env, jint) {
+        MockJvm::Env* current = owner(vm).currentEnv(false);
+        *env = current != nullptr ? static_cast<JNIEnv*>(current) : nullptr;
+        return current != nullptr ? JNI_OK : JNI_EDETACHED;
+    }
+
+    static void install(JNINativeInterface_& f) {
+#define JRB_MOCK_CALLS(Type, T) \
+        f.Call##Type##MethodV = callV<T>; f.Call##Type##MethodA = callA<T>; \
+        f.CallNonvirtual##Type##MethodV = callNonvirtualV<T>; f.CallNonvirtual##Type##MethodA = callNonvirtualA<T>; \
+        f.CallStatic##Type##MethodV = callStaticV<T>; f.CallStatic##Type##MethodA = callStaticA<T>;
+#define JRB_MOCK_FIELDS(Type, T) \
+        f.Get##Type##Field = getField<T>; f.GetStatic##Type##Field = getStaticField<T>;
+#define JRB_MOCK_ARRAYS(Type, T, Descriptor) \
+        f.New##Type##Array = newArray<Descriptor, T##Array>; \
+        f.Get##Type##ArrayRegion = reinterpret_cast<decltype(f.Get##Type##ArrayRegion)>(&getArrayRegion<T>); \
+        f.Get##Type##ArrayElements = reinterpret_cast<decltype(f.Get##Type##ArrayElements)>(&getArrayElements<T>); \
+        f.Release##Type##ArrayElements = reinterpret_cast<decltype(f.Release##Type##ArrayElements)>(&releaseArrayElements<T>);
+
+        f.GetVersion = getVersion;
+        f.DefineClass = defineClass;
+        f.FindClass = findClass;
+        f.GetSuperclass = getSuperclass;
+        f.IsAssignableFrom = isAssignableFrom;
+        f.Throw = throwObject;
+        f.ThrowNew = throwNew;
+        f.ExceptionOccurred = exceptionOccurred;
+        f.ExceptionDescribe = exceptionDescribe;
+        f.ExceptionClear = exceptionClear;
+        f.ExceptionCheck = exceptionCheck;
+        f.FatalError = fatalError;
+        f.PushLocalFrame = pushLocalFrame;
+        f.PopLocalFrame = popLocalFrame;
+        f.NewGlobalRef = newRef;
+        f.NewLocalRef = newRef;
+        f.NewWeakGlobalRef = newWeakRef;
+        f.DeleteGlobalRef = deleteRef;
+        f.DeleteLocalRef = deleteRef;
+        f.DeleteWeakGlobalRef = deleteRef;
+        f.IsSameObject = isSameObject;
+        f.EnsureLocalCapacity = ensureLocalCapacity;
+        f.GetObjectRefType = getObjectRefType;
+        f.AllocObject = allocObject;
+        f.NewObjectV = newObjectV;
+        f.NewObjectA = newObjectA;
+        f.GetObjectClass = getObjectClass;
+        f.IsInstanceOf = isInstanceOf;
+        f.GetMethodID = getMethodID;
+        f.GetStaticMethodID = getStaticMethodID;
+        f.GetFieldID = getFieldID;
+        f.GetStaticFieldID = getStaticFieldID;
+        JRB_MOCK_CALLS(Object, jobject)
+        JRB_MOCK_CALLS(Boolean, jboolean)
+        JRB_MOCK_CALLS(Byte, jbyte)
+        JRB_MOCK_CALLS(Char, jchar)
+        JRB_MOCK_CALLS(Short, jshort)
+        JRB_MOCK_CALLS(Int, jint)
+        JRB_MOCK_CALLS(Long, jlong)
+        JRB_MOCK_CALLS(Float, jfloat)
+        JRB_MOCK_CALLS(Double, jdouble)
+        JRB_MOCK_CALLS(Void, void)
+        JRB_MOCK_FIELDS(Object, jobject)
+        JRB_MOCK_FIELDS(Boolean, jboolean)
+        JRB_MOCK_FIELDS(Byte, jbyte)
+        JRB_MOCK_FIELDS(Char, jchar)
+        JRB_MOCK_FIELDS(Short, jshort)
+        JRB_MOCK_FIELDS(Int, jint)
+        JRB_MOCK_FIELDS(Long, jlong)
+        JRB_MOCK_FIELDS(Float, jfloat)
+        JRB_MOCK_FIELDS(Double, jdouble)
+        JRB_MOCK_ARRAYS(Boolean, jboolean, 'Z')
+        JRB_MOCK_ARRAYS(Byte, jbyte, 'B')
+        JRB_MOCK_ARRAYS(Char, jchar, 'C')
+        JRB_MOCK_ARRAYS(Short, jshort, 'S')
+        JRB_MOCK_ARRAYS(Int, jint, 'I')
+        JRB_MOCK_ARRAYS(Long, jlong, 'J')
+        JRB_MOCK_ARRAYS(Float, jfloat, 'F')
+        JRB_MOCK_ARRAYS(Double, jdouble, 'D')
+        f.NewStringUTF = newStringUTF;
+        f.GetStringUTFLength = getStringUTFLength;
+        f.GetStringUTFChars = getStringUTFChars;
+        f.ReleaseStringUTFChars = releaseStringUTFChars;
+        f.GetStringUTFRegion = getStringUTFRegion;
+        f.GetArrayLength = getArrayLength;
+        f.GetPrimitiveArrayCritical = getPrimitiveArrayCritical;
+        f.ReleasePrimitiveArrayCritical = releasePrimitiveArrayCritical;
+        f.NewObjectArray = newObjectArray;
+        f.GetObjectArrayElement = getObjectArrayElement;
+        f.SetObjectArrayElement = setObjectArrayElement;
+        f.RegisterNatives = registerNatives;
+        f.GetJavaVM = getJavaVM;
+
+#undef JRB_MOCK_ARRAYS
+#undef JRB_MOCK_FIELDS
+#undef JRB_MOCK_CALLS
+    }
+};
+
+MockJvm::MockJvm() : generation(generations++) {
+    MockApi::install(functions);
+    invocation.DestroyJavaVM = MockApi::destroyJavaVM;
+    invocation.AttachCurrentThread = MockApi::attachCurrentThread;
+    invocation.AttachCurrentThreadAsDaemon = MockApi::attachCurrentThread;
+    invocation.DetachCurrentThread = MockApi::detachCurrentThread;
+    invocation.GetEnv = MockApi::getEnv;
+    javaVm.functions = &invocation;
+    javaVm.owner = this;
+
+    // java.lang.Class has to exist before any class object can be made.
+    objectType = newClass("java/lang/Object", nullptr, false);
+    classType = newClass("java/lang/Class", objectType, false);
+    stringType = newClass("java/lang/String", objectType, false);
+    for (Class* early : { objectType, classType, stringType }) {
+        early->object->type = classType;
+        early->javaName->type = stringType;
+    }
+    methodType = newClass("java/lang/reflect/Method", objectType, false);
+    fieldType = newClass("java/lang/reflect/Field", objectType, false);
+    for (const char* descriptor = "ZBCSIJFDV"; *descriptor != 0; descriptor++) {
+        Class* primitive = newClass(primitiveName(*descriptor), nullptr, false);
+        primitive->primitive = *descriptor;
+    }
+
+    jclass object = handleOf(objectType);
+    addMethod(object, "getClass", "()Ljava/lang/Class;", [](jobject self, const jvalue*) {
+        return value(MockApi::handle(MockApi::object(self)->type->object));
+    });
+    addMethod(object, "hashCode", "()I", [](jobject self, const jvalue*) {
+        return value(static_cast<jint>(reinterpret_cast<uintptr_t>(self) >> 4));
+    });
+    addMethod(object, "toString", "()Ljava/lang/String;", [this](jobject self, const jvalue*) {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        Object* target = MockApi::object(self);
+        if (target->description == nullptr) {
+            char suffix[32];
+            snprintf(suffix, sizeof(suffix), "@%llx", static_cast<unsigned long long>(reinterpret_cast<uintptr_t>(self)));
+            target->description = MockApi::object(newString(target->type->javaName->text + suffix));
+        }
+        return value(MockApi::handle(target->description));
+    });
+    addMethod(object, "equals", "(Ljava/lang/Object;)Z", [](jobject self, const jvalue* args) {
+        jvalue result;
+        result.z = self == args[0].l;
+        return result;
+    });
+
+    jclass classClass = handleOf(classType);
+    addMethod(classClass, "getName", "()Ljava/lang/String;", [](jobject self, const jvalue*) {
+        return value(MockApi::handle(MockApi::object(self)->reflectedClass->javaName));
+    });
+    addMethod(classClass, "isArray", "()Z", [](jobject self, const jvalue*) {
+        jvalue result;
+        result.z = MockApi::object(self)->reflectedClass->component != nullptr;
+        return result;
+    });
+    addMethod(classClass, "getClassLoader", "()Ljava/lang/ClassLoader;", [this](jobject, const jvalue*) {
+        return value(applicationLoader);
+    });
+    addMethod(classClass, "getSuperclass", "()Ljava/lang/Class;", [](jobject self, const jvalue*) {
+        Class* superclass = MockApi::object(self)->reflectedClass->superclass;
+        return value(superclass != nullptr ? MockApi::handle(superclass->object) : nullptr);
+    });
+    addMethod(classClass, "getInterfaces", "()[Ljava/lang/Class;", [this](jobject self, const jvalue*) {
+        std::vector<jobject> found;
+        for (Class* implemented : MockApi::object(self)->reflectedClass->interfaces) {
+            found.push_back(MockApi::handle(implemented->object));
+        }
+        return value(newObjectArray("java/lang/Class", found));
+    });
+    addMethod(classClass, "getDeclaredMethods", "()[Ljava/lang/reflect/Method;", [this](jobject self, const jvalue*) {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        std::vector<jobject> found;
+        for (Method* declared : MockApi::object(self)->reflectedClass->order) {
+            if (declared->name != "<init>") {
+                found.push_back(MockApi::handle(declared->reflected));
+            }
+        }
+        return value(newObjectArray("java/lang/reflect/Method", found));
+    });
+    addMethod(classClass, "getDeclaredFields", "()[Ljava/lang/reflect/Field;", [this](jobject self, const jvalue*) {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        std::vector<jobject> found;
+        for (const auto& declared : MockApi::object(self)->reflectedClass->declaredFields) {
+            found.push_back(MockApi::handle(declared.second->reflected));
+        }
+        return value(newObjectArray("java/lang/reflect/Field", found));
+    });
+    addMethod(classClass, "getMethods", "()[Ljava/lang/reflect/Method;", [this](jobject self, const jvalue*) {
+        // Public methods of the class and everything it inherits, overrides
+        // first, as Class.getMethods returns them.
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        Class* target = MockApi::object(self)->reflectedClass;
+        if (target->methodArray == nullptr) {
+            std::vector<jobject> found;
+            std::unordered_set<std::string> seen;
+            std::function<void(Class*)> collect = [&](Class* current) {
+                for (; current != nullptr; current = current->superclass) {
+                    for (Method* method : current->order) {
+                        if (method->name != "<init>" && seen.insert(method->name + method->signature).second) {
+                            found.push_back(MockApi::handle(method->reflected));
+                        }
+                    }
+                    for (Class* implemented : current->interfaces) {
+                        collect(implemented);
+                    }
+                }
+            };
+            collect(target);
+            target->methodArray = MockApi::object(newObjectArray("java/lang/reflect/Method", found));
+        }
+        return value(MockApi::handle(target->methodArray));
+    });
+
+    jclass method = handleOf(methodType);
+    addMethod(method, "getName", "()Ljava/lang/String;", [](jobject self, const jvalue*) {
+        return value(MockApi::handle(MockApi::object(self)->reflectedMethod->javaName));
+    });
+    addMethod(method, "getParameterTypes", "()[Ljava/lang/Class;", [](jobject self, const jvalue*) {
+        return value(MockApi::handle(MockApi::object(self)->reflectedMethod->parameterTypes));
+    });
+    addMethod(method, "getReturnType", "()Ljava/lang/Class;", [this](jobject self, const jvalue*) {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        return value(MockApi::handle(classFor(MockApi::object(self)->reflectedMethod->returnType)->object));
+    });
+    addMethod(handleOf(fieldType), "getName", "()Ljava/lang/String;", [](jobject self, const jvalue*) {
+        return value(MockApi::handle(MockApi::object(self)->reflectedField->javaName));
+    });
+
+    jclass string = handleOf(stringType);
+    addMethod(string, "toString", "()Ljava/lang/String;", [](jobject self, const jvalue*) {
+        return value(self);
+    });
+    addMethod(string, "length", "()I", [](jobject self, const jvalue*) {
+        return value(static_cast<jint>(MockApi::object(self)->text.size()));
+    });
+
+    // Boxes keep their value in the field of jvalue that matches their type.
+    jclass number = defineClass("java/lang/Number");
+    jclass integer = defineClass("java/lang/Integer", "java/lang/Number");
+    jclass longClass = defineClass("java/lang/Long", "java/lang/Number");
+    jclass floatClass = defineClass("java/lang/Float", "java/lang/Number");
+    jclass doubleClass = defineClass("java/lang/Double", "java/lang/Number");
+    integerType = MockApi::type(integer);
+    longType = MockApi::type(longClass);
+    floatType = MockApi::type(floatClass);
+    doubleType = MockApi::type(doubleClass);
+    auto numeric = [this](jobject self) {
+        const Object* box = MockApi::object(self);
+        if (box->type == integerType) return static_cast<jdouble>(box->boxed.i);
+        if (box->type == longType) return static_cast<jdouble>(box->boxed.j);
+        if (box->type == floatType) return static_cast<jdouble>(box->boxed.f);
+        return box->boxed.d;
+    };
+    auto integral = [this, numeric](jobject self) {
+        const Object* box = MockApi::object(self);
+        if (box->type == integerType) return static_cast<jlong>(box->boxed.i);
+        if (box->type == longType) return box->boxed.j;
+        return static_cast<jlong>(numeric(self));
+    };
+    addMethod(number, "intValue", "()I", [integral](jobject self, const jvalue*) {
+        return value(static_cast<jint>(integral(self)));
+    });
+    addMethod(number, "longValue", "()J", [integral](jobject self, const jvalue*) {
+        jvalue result;
+        result.j = integral(self);
+        return result;
+    });
+    addMethod(number, "floatValue", "()F", [numeric](jobject self, const jvalue*) {
+        jvalue result;
+        result.f = static_cast<jfloat>(numeric(self));
+        return result;
+    });
+    addMethod(number, "doubleValue", "()D", [numeric](jobject self, const jvalue*) {
+        jvalue result;
+        result.d = numeric(self);
+        return result;
+    });
+    jclass boolean = defineClass("java/lang/Boolean");
+    booleanType = MockApi::type(boolean);
+    addMethod(boolean, "booleanValue", "()Z", [](jobject self, const jvalue*) {
+        return MockApi::object(self)->boxed;
+    });
+    jclass character = defineClass("java/lang/Character");
+    addMethod(character, "charValue", "()C", [](jobject self, const jvalue*) {
+        return MockApi::object(self)->boxed;
+    });
+
+    jclass system = defineClass("java/lang/System");
+    addStaticMethod(system, "identityHashCode", "(Ljava/lang/Object;)I", [](jobject, const jvalue* args) {
+        return value(static_cast<jint>(reinterpret_cast<uintptr_t>(args[0].l) >> 4));
+    });
+
+    jclass collection = defineInterface("java/util/Collection");
+    addMethod(collection, "toArray", "()[Ljava/lang/Object;", Body());
+    addMethod(collection, "size", "()I", Body());
+    jclass listInterface = defineInterface("java/util/List", { "java/util/Collection" });
+    addMethod(listInterface, "get", "(I)Ljava/lang/Object;", Body());
+    jclass list = defineClass("java/util/ArrayList", "java/lang/Object", { "java/util/List" });
+    listType = MockApi::type(list);
+    addMethod(list, "get", "(I)Ljava/lang/Object;", [this](jobject self, const jvalue* args) {
+        const std::vector<jobject>& elements = MockApi::object(self)->elements;
+        if (args[0].i < 0 || static_cast<size_t>(args[0].i) >= elements.size()) {
+            raise("java/lang/IndexOutOfBoundsException", std::to_string(args[0].i));
+            return value(static_cast<jobject>(nullptr));
+        }
+        return value(elements[args[0].i]);
+    });
+    addMethod(list, "toArray", "()[Ljava/lang/Object;", [this](jobject self, const jvalue*) {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        Object* target = MockApi::object(self);
+        if (target->array == nullptr) {
+            target->array = MockApi::object(newObjectArray("java/lang/Object", target->elements));
+        }
+        return value(MockApi::handle(target->array));
+    });
+    addMethod(list, "size", "()I", [](jobject self, const jvalue*) {
+        return value(static_cast<jint>(MockApi::object(self)->elements.size()));
+    });
+    jclass map = defineInterface("java/util/Map");
+    addMethod(map, "entrySet", "()Ljava/util/Set;", Body());
+    jclass entry = defineInterface("java/util/Map$Entry");
+    addMethod(entry, "getKey", "()Ljava/lang/Object;", Body());
+    addMethod(entry, "getValue", "()Ljava/lang/Object;", Body());
+    // One loader for every class, which finds anything defined on the mock.
+    jclass classLoader = defineClass("java/lang/ClassLoader");
+    addMethod(classLoader, "loadClass", "(Ljava/lang/String;)Ljava/lang/Class;", [this](jobject, const jvalue* args) {
+        std::string name = MockApi::object(args[0].l)->text;
+        std::replace(name.begin(), name.end(), '.', '/');
+        jclass found = findClass(name);
+        if (found == nullptr) {
+            raise("java/lang/ClassNotFoundException", MockApi::object(args[0].l)->text);
+        }
+        return value(static_cast<jobject>(found));
+    });
+    applicationLoader = newObject(classLoader);
+    // Like a real loader, it lists every class defined from here on.
+    jclass vector = defineClass("java/util/Vector", "java/util/ArrayList");
+    loaderClasses = MockApi::object(newObject(vector));
+    setField(applicationLoader, "classes", "Ljava/util/Vector;", value(MockApi::handle(loaderClasses)));
+
+    jclass throwable = defineClass("java/lang/Throwable");
+    addMethod(throwable, "toString", "()Ljava/lang/String;", [this](jobject self, const jvalue*) {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        Object* target = MockApi::object(self);
+        if (target->description == nullptr) {
+            target->description = MockApi::object(newString(target->type->javaName->text + ": " + target->text));
+        }
+        return value(MockApi::handle(target->description));
+    });
+    addMethod(throwable, "getMessage", "()Ljava/lang/String;", [this](jobject self, const jvalue*) {
+        return value(newString(MockApi::object(self)->text));
+    });
+    addMethod(throwable, "printStackTrace", "()V", [](jobject, const jvalue*) {
+        return jvalue{};
+    });
+    defineClass("java/lang/Exception", "java/lang/Throwable");
+    defineClass("java/lang/RuntimeException", "java/lang/Exception");
+    defineClass("java/lang/Error", "java/lang/Throwable");
+
+    latest.store(this);
+}
+
+MockJvm::~MockJvm() {
+    MockJvm* self = this;
+    latest.compare_exchange_strong(self, nullptr);
+}
+
+JavaVM* MockJvm::vm() {
+    return &javaVm;
+}
+
+JNIEnv* MockJvm::env() {
+    return currentEnv(true);
+}
+
+MockJvm::Env* MockJvm::currentEnv(bool attach) {
+    if (cachedEnv.generation == generation && cachedEnv.env->attached) {
+        return cachedEnv.env;
+    }
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    auto& env = envs[std::this_thread::get_id()];
+    if (!env) {
+        env = std::make_unique<Env>();
+        env->functions = &functions;
+        env->owner = this;
+    }
+    if (attach) {
+        env->attached = true;
+    }
+    if (!env->attached) {
+        return nullptr;
+    }
+    cachedEnv.generation = generation;
+    cachedEnv.env = env.get();
+    return env.get();
+}
+
+jclass MockJvm::handleOf(Class* type) {
+    return static_cast<jclass>(MockApi::handle(type->object));
+}
+
+MockJvm::Object* MockJvm::allocate(Class* type) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    objects.push_back(std::make_unique<Object>());
+    objects.back()->type = type;
+    return objects.back().get();
+}
+
+MockJvm::Class* MockJvm::newClass(const std::string& name, Class* superclass, bool isInterface) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    classes.push_back(std::make_unique<Class>());
+    Class* created = classes.back().get();
+    created->name = name;
+    created->superclass = superclass;
+    created->isInterface = isInterface;
+    created->object = allocate(classType);
+    created->object->reflectedClass = created;
+    created->javaName = allocate(stringType);
+    created->javaName->text = name;
+    for (char& c : created->javaName->text) {
+        if (c == '/') {
+            c = '.';
+        }
+    }
+    classesByName[name] = created;
+    return created;
+}
+
+void MockJvm::listDefined(Class* type) {
+    if (loaderClasses == nullptr) {
+        return;
+    }
+    jobject object = MockApi::handle(type->object);
+    std::vector<jobject>& listed = loaderClasses->elements;
+    if (std::find(listed.begin(), listed.end(), object) == listed.end()) {
+        listed.push_back(object);
+        loaderClasses->array = nullptr;
+    }
+}
+
+MockJvm::Class* MockJvm::classFor(const std::string& descriptor) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    if (descriptor.size() == 1 && primitiveName(descriptor[0]) != nullptr) {
+        return classesByName[primitiveName(descriptor[0])];
+    }
+    if (descriptor[0] == 'L') {
+        std::string name = descriptor.substr(1, descriptor.size() - 2);
+        auto found = classesByName.find(name);
+        return found != classesByName.end() ? found->second : newClass(name, objectType, false);
+    }
+    if (descriptor[0] == '[') {
+        auto found = classesByName.find(descriptor);
+        if (found != classesByName.end()) {
+            return found->second;
+        }
+        Class* component = classFor(descriptor.substr(1));
+        Class* array = newClass(descriptor, objectType, false);
+        array->component = component;
+        return array;
+    }
+    // A bare internal name.
+    auto found = classesByName.find(descriptor);
+    return found != classesByName.end() ? found->second : newClass(descriptor, objectType, false);
+}
+
+jclass MockJvm::defineClass(const std::string& name, const std::string& superclass, const std::vector<std::string>& interfaces) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    Class* created = classFor(name);
+    created->superclass = classFor(superclass);
+    created->isInterface = false;
+    for (const auto& implemented : interfaces) {
+        created->interfaces.push_back(classFor(implemented));
+    }
+    listDefined(created);
+    return handleOf(created);
+}
+
+jclass MockJvm::defineInterface(const std::string& name, const std::vector<std::string>& interfaces) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    Class* created = classFor(name);
+    created->superclass = objectType;
+    created->isInterface = true;
+    for (const auto& implemented : interfaces) {
+        created->interfaces.push_back(classFor(implemented));
+    }
+    listDefined(created);
+    return handleOf(created);
+}
+
+jclass MockJvm::findClass(const std::string& name) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    auto found = classesByName.find(name);
+    return found != classesByName.end() ? handleOf(found->second) : nullptr;
+}
+
+MockJvm::Method* MockJvm::declare(jclass type, const std::string& name, const std::string& signature, Body body, bool isStatic) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    Class* owner = MockApi::type(type);
+    methods.push_back(std::make_unique<Method>());
+    Method* method = methods.back().get();
+    method->name = name;
+    method->signature = signature;
+    if (!splitSignature(signature, method->parameters, method->returnType)) {
+        throw std::invalid_argument("Invalid method signature " + signature);
+    }
+    method->owner = owner;
+    method->body = std::move(body);
+    method->isStatic = isStatic;
+    method->javaName = MockApi::object(newString(name));
+    std::vector<jobject> parameterTypes;
+    for (const auto& parameter : method->parameters) {
+        parameterTypes.push_back(MockApi::handle(classFor(parameter)->object));
+    }
+    method->parameterTypes = MockApi::object(newObjectArray("java/lang/Class", parameterTypes));
+    method->reflected = allocate(methodType);
+    method->reflected->reflectedMethod = method;
+    std::string key = name + signature;
+    if (owner->declared.count(key) == 0) {
+        owner->order.push_back(method);
+    }
+    else {
+        std::replace(owner->order.begin(), owner->order.end(), owner->declared[key], method);
+    }
+    owner->declared[key] = method;
+    owner->methodArray = nullptr;
+    return method;
+}
+
+void MockJvm::addMethod(jclass type, const std::string& name, const std::string& signature, Body body) {
+    declare(type, name, signature, std::move(body), false);
+}
+
+void MockJvm::addStaticMethod(jclass type, const std::string& name, const std::string& signature, Body body) {
+    declare(type, name, signature, std::move(body), true);
+}
+
+MockJvm::Field* MockJvm::declareField(Class* type, const std::string& name, const std::string& signature, bool isStatic) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    auto found = type->declaredFields.find(name);
+    if (found != type->declaredFields.end()) {
+        return found->second;
+    }
+    fields.push_back(std::make_unique<Field>());
+    Field* field = fields.back().get();
+    field->name = name;
+    field->signature = signature;
+    field->owner = type;
+    field->isStatic = isStatic;
+    field->reflected = allocate(fieldType);
+    field->reflected->reflectedField = field;
+    field->javaName = MockApi::object(newString(name));
+    type->declaredFields[name] = field;
+    return field;
+}
+
+void MockJvm::setField(jobject object, const std::string& name, const std::string& signature, jvalue value) {
+    Object* target = MockApi::object(object);
+    target->fields[declareField(target->type, name, signature, false)] = value;
+}
+
+void MockJvm::setStaticField(jclass type, const std::string& name, const std::string& signature, jvalue value) {
+    Class* owner = MockApi::type(type);
+    owner->statics[declareField(owner, name, signature, true)] = value;
+}
+
+jobject MockJvm::newObject(jclass type) {
+    return MockApi::handle(allocate(MockApi::type(type)));
+}
+
+jstring MockJvm::newString(const std::string& text) {
+    Object* string = allocate(stringType);
+    string->text = text;
+    return static_cast<jstring>(MockApi::handle(string));
+}
+
+jobject MockJvm::newInteger(jint value) {
+    Object* box = allocate(integerType);
+    box->boxed.i = value;
+    return MockApi::handle(box);
+}
+
+jobject MockJvm::newLong(jlong value) {
+    Object* box = allocate(longType);
+    box->boxed.j = value;
+    return MockApi::handle(box);
+}
+
+jobject MockJvm::newDouble(jdouble value) {
+    Object* box = allocate(doubleType);
+    box->boxed.d = value;
+    return MockApi::handle(box);
+}
+
+jobject MockJvm::newBoolean(bool value) {
+    Object* box = allocate(booleanType);
+    box->boxed.z = value ? JNI_TRUE : JNI_FALSE;
+    return MockApi::handle(box);
+}
+
+jobjectArray MockJvm::newObjectArray(const std::string& elementClass, const std::vector<jobject>& elements) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    Object* array = allocate(classFor(elementClass[0] == '[' ? "[" + elementClass : "[L" + elementClass + ";"));
+    array->elements = elements;
+    return static_cast<jobjectArray>(MockApi::handle(array));
+}
+
+jintArray MockJvm::newIntArray(const std::vector<jint>& values) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    Object* array = allocate(classFor("[I"));
+    array->data.resize(values.size() * sizeof(jint));
+    std::memcpy(array->data.data(), values.data(), array->data.size());
+    return static_cast<jintArray>(MockApi::handle(array));
+}
+
+jobject MockJvm::newList(const std::vector<jobject>& elements) {
+    Object* list = allocate(listType);
+    list->elements = elements;
+    list->array = MockApi::object(newObjectArray("java/lang/Object", elements));
+    return MockApi::handle(list);
+}
+
+void MockJvm::raise(const std::string& className, const std::string& message) {
+    Class* type;
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        auto found = classesByName.find(className);
+        type = found != classesByName.end() ? found->second : nullptr;
+        if (type == nullptr) {
+            type = MockApi::type(defineClass(className, "java/lang/RuntimeException"));
+        }
+    }
+    Object* exception = allocate(type);
+    exception->text = message;
+    currentEnv(true)->pending = exception;
+}
+
+jvalue MockJvm::value(jint i) {
+    jvalue result{};
+    result.i = i;
+    return result;
+}
+
+jvalue MockJvm::value(jobject l) {
+    jvalue result{};
+    result.l = l;
+    return result;
+}
+
+jint JNICALL JNI_GetCreatedJavaVMs(JavaVM** vms, jsize size, jsize* count) {
+    MockJvm* jvm = latest.load();
+    *count = jvm != nullptr ? 1 : 0;
+    if (jvm != nullptr && size > 0) {
+        vms[0] = jvm->vm();
+    }
+    return JNI_OK;
+}
@@ -0,0 +1,128 @@
+#pragma once
+#include "pch.h"
+#include <jni.h>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// A JVM stand-in for measuring the bridge's own overhead without JIT or GC
+// noise. It implements the part of the JNI function table and invocation
+// interface the bridge uses over an in-memory object model: classes with
+// superclasses and interfaces, methods backed by C++ functions, fields,
+// strings, boxed numbers, arrays and lists. Reflection (Class.getMethods,
+// getDeclaredMethods/getDeclaredFields/getSuperclass/getInterfaces,
+// Method.getName/getParameterTypes/getReturnType, Field.getName) answers from
+// the same model, so Cache discovers mock classes exactly as it does real
+// ones. Every class has one loader, which lists the classes defined after it.
+//
+// References are plain object pointers: local and global references are the
+// same, frames and deletes are no-ops, and objects live until the mock is
+// destroyed. Every thread that calls in gets its own JNIEnv with its own
+// pending exception. Entries the bridge never calls are left null.
+//
+// This file defines JNI_GetCreatedJavaVMs, which returns the most recently
+// created mock, so ClientAPI and Pipeline find it as they would find a real
+// JVM. It must not be linked together with libjvm.
+class MockJvm {
+public:
+    // Implements a method: receives the receiver (nullptr for static methods)
+    // and the arguments, and returns the result.
+    using Body = std::function<jvalue(jobject self, const jvalue* args)>;
+
+    MockJvm();
+    ~MockJvm();
+    MockJvm(const MockJvm&) = delete;
+    MockJvm& operator=(const MockJvm&) = delete;
+
+    JavaVM* vm();
+    // The calling thread's environment, attaching the thread if needed.
+    JNIEnv* env();
+
+    // Names are in internal form, e.g. "net/runelite/api/Client".
+    jclass defineClass(const std::string& name, const std::string& superclass = "java/lang/Object",
+        const std::vector<std::string>& interfaces = {});
+    jclass defineInterface(const std::string& name, const std::vector<std::string>& interfaces = {});
+    // Returns nullptr if the class was never defined.
+    jclass findClass(const std::string& name);
+    void addMethod(jclass type, const std::string& name, const std::string& signature, Body body);
+    void addStaticMethod(jclass type, const std::string& name, const std::string& signature, Body body);
+    void setField(jobject object, const std::string& name, const std::string& signature, jvalue value);
+    void setStaticField(jclass type, const std::string& name, const std::string& signature, jvalue value);
+
+    jobject newObject(jclass type);
+    jstring newString(const std::string& text);
+    jobject newInteger(jint value);
+    jobject newLong(jlong value);
+    jobject newDouble(jdouble value);
+    jobject newBoolean(bool value);
+    jobjectArray newObjectArray(const std::string& elementClass, const std::vector<jobject>& elements);
+    jintArray newIntArray(const std::vector<jint>& values);
+    // A java/util/ArrayList.
+    jobject newList(const std::vector<jobject>& elements);
+
+    // Makes `className` with `message` the calling thread's pending exception.
+    void raise(const std::string& className, const std::string& message);
+
+    static jvalue value(jint i);
+    static jvalue value(jobject l);
+
+    struct Object;
+    struct Class;
+    struct Method;
+    struct Field;
+    struct Env;
+
+private:
+    friend struct MockApi;
+
+    jclass handleOf(Class* type);
+    Class* classFor(const std::string& descriptor);
+    Class* newClass(const std::string& name, Class* superclass, bool isInterface);
+    Object* allocate(Class* type);
+    Method* declare(jclass type, const std::string& name, const std::string& signature, Body body, bool isStatic);
+    Field* declareField(Class* type, const std::string& name, const std::string& signature, bool isStatic);
+    // Adds a class to the loader's list of defined classes.
+    void listDefined(Class* type);
+    Env* currentEnv(bool attach);
+
+    // Distinguishes this mock from an earlier one at the same address in the
+    // per-thread environment cache.
+    uint64_t generation;
+    Class* objectType = nullptr;
+    Class* classType = nullptr;
+    Class* stringType = nullptr;
+    Class* methodType = nullptr;
+    Class* fieldType = nullptr;
+    Class* listType = nullptr;
+    Class* integerType = nullptr;
+    Class* longType = nullptr;
+    Class* floatType = nullptr;
+    Class* doubleType = nullptr;
+    Class* booleanType = nullptr;
+    // Returned by Class.getClassLoader for every class.
+    jobject applicationLoader = nullptr;
+    // Its "classes" list.
+    Object* loaderClasses = nullptr;
+
+    JNINativeInterface_ functions{};
+    JNIInvokeInterface_ invocation{};
+    struct Vm : JavaVM_ {
+        MockJvm* owner = nullptr;
+    } javaVm;
+
+    // Every definition and allocation takes the lock; lookups during calls
+    // read a model that is only appended to.
+    std::recursive_mutex mutex;
+    std::deque<std::unique_ptr<Object>> objects;
+    std::deque<std::unique_ptr<Class>> classes;
+    std::deque<std::unique_ptr<Method>> methods;
+    std::deque<std::unique_ptr<Field>> fields;
+    std::unordered_map<std::string, Class*> classesByName;
+    std::unordered_map<std::thread::id, std::unique_ptr<Env>> envs;
+};
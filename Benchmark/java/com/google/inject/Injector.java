@@ -0,0 +1,6 @@
+package com.google.inject;
+
+// Stand-in for Guice's injector; the bridge only calls getInstance.
+public interface Injector {
+    <T> T getInstance(Class<T> type);
+}
@@ -0,0 +1,526 @@
+package jrb.bench;
+
+import com.google.inject.Injector;
+import java.util.ArrayList;
+import java.util.List;
+import java.util.Random;
+import net.runelite.api.Actor;
+import net.runelite.api.Client;
+import net.runelite.api.GameState;
+import net.runelite.api.InventoryID;
+import net.runelite.api.Item;
+import net.runelite.api.ItemContainer;
+import net.runelite.api.NPC;
+import net.runelite.api.NPCComposition;
+import net.runelite.api.Player;
+import net.runelite.api.PlayerComposition;
+import net.runelite.api.Widget;
+import net.runelite.api.WorldPoint;
+import net.runelite.client.RuneLite;
+import net.runelite.client.callback.ClientThread;
+
+// A deterministic stand-in for the game client. A daemon thread plays the
+// game loop: every frame it runs the work queued on the ClientThread, and
+// every framesPerTick frames it advances the world by one tick, moving actors
+// and changing their animations, health and targets.
+public final class SyntheticGame implements Client {
+    private static final int SKILLS = 23;
+    private static final int WIDGET_GROUPS = 16;
+    private static final int WIDGET_CHILDREN = 24;
+    private static final int WIDGET_GRANDCHILDREN = 6;
+
+    private final Random random = new Random(42);
+    private final ClientThread clientThread = new ClientThread();
+    private final SyntheticPlayer localPlayer;
+    private final List<Player> players = new ArrayList<>();
+    private final List<NPC> npcs = new ArrayList<>();
+    private final NPC[] cachedNpcs;
+    private final int[] boostedLevels = new int[SKILLS];
+    private final int[] realLevels = new int[SKILLS];
+    private final int[] experiences = new int[SKILLS];
+    private final SyntheticContainer inventory;
+    private final SyntheticContainer equipment;
+    private final SyntheticContainer bank;
+    private final SyntheticWidget[] widgetRoots = new SyntheticWidget[WIDGET_GROUPS];
+    private volatile int tickCount;
+    private volatile int energy = 10000;
+
+    public static void start(int playerCount, int npcCount, int frameMillis, int framesPerTick) {
+        SyntheticGame game = new SyntheticGame(playerCount, npcCount);
+        RuneLite.injector = new SyntheticInjector(new RuneLite(game), game.clientThread);
+
+        Thread loop = new Thread(() -> {
+            long frame = 0;
+            while (true) {
+                game.clientThread.runPending();
+                if (++frame % framesPerTick == 0) {
+                    game.advance();
+                }
+                try {
+                    Thread.sleep(frameMillis);
+                } catch (InterruptedException e) {
+                    return;
+                }
+            }
+        }, "Client");
+        loop.setDaemon(true);
+        loop.start();
+    }
+
+    private SyntheticGame(int playerCount, int npcCount) {
+        localPlayer = new SyntheticPlayer("Local Player", randomPoint(), 126, randomEquipment());
+        players.add(localPlayer);
+        for (int i = 1; i < playerCount; i++) {
+            players.add(new SyntheticPlayer("Player " + i, randomPoint(), 3 + random.nextInt(124), randomEquipment()));
+        }
+
+        // The cache is sparse, as in the real client, so projections over it
+        // meet nulls.
+        cachedNpcs = new NPC[Math.max(npcCount * 4, 1)];
+        String[] names = { "Goblin", "Guard", "Cow", "Banker", "Imp", "Dark wizard" };
+        for (int i = 0; i < npcCount; i++) {
+            String name = names[i % names.length];
+            String[] actions = { "Talk-to", null, "Attack", "Examine", null };
+            NPCComposition composition = new SyntheticNpcComposition(name, 1000 + i % names.length, 1 + i % 3, actions);
+            SyntheticNpc npc = new SyntheticNpc(i * 4, composition, randomPoint());
+            npcs.add(npc);
+            cachedNpcs[i * 4] = npc;
+        }
+
+        for (int i = 0; i < SKILLS; i++) {
+            realLevels[i] = 1 + random.nextInt(99);
+            boostedLevels[i] = realLevels[i];
+            experiences[i] = random.nextInt(13034431);
+        }
+
+        inventory = new SyntheticContainer(InventoryID.INVENTORY.getId(), 28);
+        equipment = new SyntheticContainer(InventoryID.EQUIPMENT.getId(), 14);
+        bank = new SyntheticContainer(InventoryID.BANK.getId(), 800);
+
+        for (int group = 0; group < WIDGET_GROUPS; group++) {
+            SyntheticWidget root = new SyntheticWidget(group << 16, "Group " + group, null);
+            SyntheticWidget[] children = new SyntheticWidget[WIDGET_CHILDREN];
+            for (int child = 0; child < WIDGET_CHILDREN; child++) {
+                children[child] = new SyntheticWidget((group << 16) | child, "Child " + child, root);
+                SyntheticWidget[] grandchildren = new SyntheticWidget[WIDGET_GRANDCHILDREN];
+                for (int i = 0; i < WIDGET_GRANDCHILDREN; i++) {
+                    grandchildren[i] = new SyntheticWidget(-1, "Item " + i, children[child]);
+                }
+                children[child].children = grandchildren;
+            }
+            root.children = children;
+            widgetRoots[group] = root;
+        }
+    }
+
+    private void advance() {
+        for (Player player : players) {
+            ((SyntheticActor) player).step(random, players, npcs);
+        }
+        for (NPC npc : npcs) {
+            ((SyntheticActor) npc).step(random, players, npcs);
+        }
+        int skill = random.nextInt(SKILLS);
+        boostedLevels[skill] = realLevels[skill] + random.nextInt(5) - 2;
+        experiences[skill] += random.nextInt(200);
+        energy = Math.max(0, energy - random.nextInt(50));
+        inventory.shuffle(random);
+        tickCount++;
+    }
+
+    private WorldPoint randomPoint() {
+        return new WorldPoint(3200 + random.nextInt(64), 3200 + random.nextInt(64), 0);
+    }
+
+    private int[] randomEquipment() {
+        int[] ids = new int[14];
+        for (int i = 0; i < ids.length; i++) {
+            ids[i] = random.nextInt(4) == 0 ? -1 : 512 + random.nextInt(20000);
+        }
+        return ids;
+    }
+
+    @Override
+    public int getTickCount() {
+        return tickCount;
+    }
+
+    @Override
+    public GameState getGameState() {
+        return GameState.LOGGED_IN;
+    }
+
+    @Override
+    public int getWorld() {
+        return 301;
+    }
+
+    @Override
+    public int getEnergy() {
+        return energy;
+    }
+
+    @Override
+    public Player getLocalPlayer() {
+        return localPlayer;
+    }
+
+    // Like the real client, a fresh list on every call.
+    @Override
+    public List<Player> getPlayers() {
+        return new ArrayList<>(players);
+    }
+
+    @Override
+    public List<NPC> getNpcs() {
+        return new ArrayList<>(npcs);
+    }
+
+    @Override
+    public NPC[] getCachedNPCs() {
+        return cachedNpcs;
+    }
+
+    @Override
+    public int[] getBoostedSkillLevels() {
+        return boostedLevels;
+    }
+
+    @Override
+    public int[] getRealSkillLevels() {
+        return realLevels;
+    }
+
+    @Override
+    public int[] getSkillExperiences() {
+        return experiences;
+    }
+
+    @Override
+    public ItemContainer getItemContainer(int id) {
+        if (id == inventory.getId()) {
+            return inventory;
+        }
+        if (id == equipment.getId()) {
+            return equipment;
+        }
+        if (id == bank.getId()) {
+            return bank;
+        }
+        return null;
+    }
+
+    @Override
+    public ItemContainer getItemContainer(InventoryID id) {
+        return getItemContainer(id.getId());
+    }
+
+    @Override
+    public Widget getWidget(int componentId) {
+        return getWidget(componentId >>> 16, componentId & 0xFFFF);
+    }
+
+    @Override
+    public Widget getWidget(int groupId, int childId) {
+        if (groupId < 0 || groupId >= WIDGET_GROUPS) {
+            return null;
+        }
+        return widgetRoots[groupId].getChild(childId);
+    }
+
+    @Override
+    public Widget[] getWidgetRoots() {
+        return widgetRoots;
+    }
+
+    public static final class SyntheticInjector implements Injector {
+        private final RuneLite runeLite;
+        private final ClientThread clientThread;
+
+        SyntheticInjector(RuneLite runeLite, ClientThread clientThread) {
+            this.runeLite = runeLite;
+            this.clientThread = clientThread;
+        }
+
+        @Override
+        public <T> T getInstance(Class<T> type) {
+            if (type == RuneLite.class) {
+                return type.cast(runeLite);
+            }
+            if (type == ClientThread.class) {
+                return type.cast(clientThread);
+            }
+            throw new IllegalArgumentException("No binding for " + type.getName());
+        }
+    }
+
+    public abstract static class SyntheticActor implements Actor {
+        private final String name;
+        private WorldPoint location;
+        private int animation = -1;
+        private int healthRatio = 30;
+        private Actor interacting;
+        private String overheadText;
+
+        SyntheticActor(String name, WorldPoint location) {
+            this.name = name;
+            this.location = location;
+        }
+
+        // Actors move every tick, which replaces their location object the way
+        // the real client does.
+        void step(Random random, List<Player> players, List<NPC> npcs) {
+            location = new WorldPoint(location.getX() + random.nextInt(3) - 1, location.getY() + random.nextInt(3) - 1, location.getPlane());
+            animation = random.nextInt(8) == 0 ? 400 + random.nextInt(100) : -1;
+            healthRatio = Math.max(0, Math.min(30, healthRatio + random.nextInt(7) - 3));
+            switch (random.nextInt(6)) {
+                case 0:
+                    interacting = npcs.isEmpty() ? null : npcs.get(random.nextInt(npcs.size()));
+                    break;
+                case 1:
+                    interacting = players.get(random.nextInt(players.size()));
+                    break;
+                case 2:
+                    interacting = null;
+                    break;
+                default:
+                    break;
+            }
+            overheadText = random.nextInt(20) == 0 ? "Tick " + random.nextInt(1000) : null;
+        }
+
+        @Override
+        public String getName() {
+            return name;
+        }
+
+        @Override
+        public WorldPoint getWorldLocation() {
+            return location;
+        }
+
+        @Override
+        public int getAnimation() {
+            return animation;
+        }
+
+        @Override
+        public int getHealthRatio() {
+            return healthRatio;
+        }
+
+        @Override
+        public int getHealthScale() {
+            return 30;
+        }
+
+        @Override
+        public Actor getInteracting() {
+            return interacting;
+        }
+
+        @Override
+        public String getOverheadText() {
+            return overheadText;
+        }
+    }
+
+    public static final class SyntheticPlayer extends SyntheticActor implements Player {
+        private final int combatLevel;
+        private final PlayerComposition composition;
+
+        SyntheticPlayer(String name, WorldPoint location, int combatLevel, int[] equipment) {
+            super(name, location);
+            this.combatLevel = combatLevel;
+            this.composition = new SyntheticPlayerComposition(equipment);
+        }
+
+        @Override
+        public int getCombatLevel() {
+            return combatLevel;
+        }
+
+        @Override
+        public int getTeam() {
+            return 0;
+        }
+
+        @Override
+        public boolean isFriend() {
+            return getName().hashCode() % 7 == 0;
+        }
+
+        @Override
+        public PlayerComposition getPlayerComposition() {
+            return composition;
+        }
+    }
+
+    public static final class SyntheticPlayerComposition implements PlayerComposition {
+        private final int[] equipmentIds;
+
+        SyntheticPlayerComposition(int[] equipmentIds) {
+            this.equipmentIds = equipmentIds;
+        }
+
+        @Override
+        public int[] getEquipmentIds() {
+            return equipmentIds;
+        }
+
+        @Override
+        public boolean isFemale() {
+            return equipmentIds[0] % 2 == 0;
+        }
+    }
+
+    public static final class SyntheticNpc extends SyntheticActor implements NPC {
+        private final int index;
+        private final NPCComposition composition;
+
+        SyntheticNpc(int index, NPCComposition composition, WorldPoint location) {
+            super(composition.getName(), location);
+            this.index = index;
+            this.composition = composition;
+        }
+
+        @Override
+        public int getId() {
+            return composition.getId();
+        }
+
+        @Override
+        public int getIndex() {
+            return index;
+        }
+
+        @Override
+        public NPCComposition getComposition() {
+            return composition;
+        }
+    }
+
+    public static final class SyntheticNpcComposition implements NPCComposition {
+        private final String name;
+        private final int id;
+        private final int size;
+        private final String[] actions;
+
+        SyntheticNpcComposition(String name, int id, int size, String[] actions) {
+            this.name = name;
+            this.id = id;
+            this.size = size;
+            this.actions = actions;
+        }
+
+        @Override
+        public String getName() {
+            return name;
+        }
+
+        @Override
+        public int getId() {
+            return id;
+        }
+
+        @Override
+        public int getSize() {
+            return size;
+        }
+
+        @Override
+        public String[] getActions() {
+            return actions;
+        }
+    }
+
+    public static final class SyntheticContainer implements ItemContainer {
+        private final int id;
+        private volatile Item[] items;
+
+        SyntheticContainer(int id, int size) {
+            this.id = id;
+            this.items = new Item[size];
+            for (int i = 0; i < size; i++) {
+                items[i] = new Item(i % 3 == 0 ? -1 : 995 + i, 1 + i);
+            }
+        }
+
+        void shuffle(Random random) {
+            Item[] next = items.clone();
+            int slot = random.nextInt(next.length);
+            next[slot] = new Item(random.nextInt(4) == 0 ? -1 : 995 + random.nextInt(1000), 1 + random.nextInt(100));
+            items = next;
+        }
+
+        @Override
+        public int getId() {
+            return id;
+        }
+
+        @Override
+        public Item[] getItems() {
+            return items;
+        }
+
+        @Override
+        public Item getItem(int slot) {
+            Item[] current = items;
+            return slot >= 0 && slot < current.length ? current[slot] : null;
+        }
+
+        @Override
+        public int count(int itemId) {
+            int count = 0;
+            for (Item item : items) {
+                if (item.getId() == itemId) {
+                    count += item.getQuantity();
+                }
+            }
+            return count;
+        }
+    }
+
+    public static final class SyntheticWidget implements Widget {
+        private final int id;
+        private final String text;
+        private final Widget parent;
+        private Widget[] children = new Widget[0];
+
+        SyntheticWidget(int id, String text, Widget parent) {
+            this.id = id;
+            this.text = text;
+            this.parent = parent;
+        }
+
+        @Override
+        public int getId() {
+            return id;
+        }
+
+        @Override
+        public String getText() {
+            return text;
+        }
+
+        @Override
+        public boolean isHidden() {
+            return false;
+        }
+
+        @Override
+        public Widget getParent() {
+            return parent;
+        }
+
+        @Override
+        public Widget[] getChildren() {
+            return children;
+        }
+
+        @Override
+        public Widget getChild(int index) {
+            return index >= 0 && index < children.length ? children[index] : null;
+        }
+    }
+}
@@ -0,0 +1,17 @@
+package net.runelite.api;
+
+public interface Actor {
+    String getName();
+
+    WorldPoint getWorldLocation();
+
+    int getAnimation();
+
+    int getHealthRatio();
+
+    int getHealthScale();
+
+    Actor getInteracting();
+
+    String getOverheadText();
+}
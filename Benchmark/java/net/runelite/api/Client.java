@@ -0,0 +1,40 @@
+package net.runelite.api;
+
+import java.util.List;
+
+// The subset of RuneLite's Client the benchmark exercises: scalar getters,
+// deep chains through actors, lists and arrays to project, and overloads that
+// share a name.
+public interface Client {
+    int getTickCount();
+
+    GameState getGameState();
+
+    int getWorld();
+
+    int getEnergy();
+
+    Player getLocalPlayer();
+
+    List<Player> getPlayers();
+
+    List<NPC> getNpcs();
+
+    NPC[] getCachedNPCs();
+
+    int[] getBoostedSkillLevels();
+
+    int[] getRealSkillLevels();
+
+    int[] getSkillExperiences();
+
+    ItemContainer getItemContainer(int id);
+
+    ItemContainer getItemContainer(InventoryID id);
+
+    Widget getWidget(int componentId);
+
+    Widget getWidget(int groupId, int childId);
+
+    Widget[] getWidgetRoots();
+}
@@ -0,0 +1,8 @@
+package net.runelite.api;
+
+public enum GameState {
+    STARTING,
+    LOGIN_SCREEN,
+    LOADING,
+    LOGGED_IN
+}
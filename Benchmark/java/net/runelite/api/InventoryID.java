@@ -0,0 +1,17 @@
+package net.runelite.api;
+
+public enum InventoryID {
+    INVENTORY(93),
+    EQUIPMENT(94),
+    BANK(95);
+
+    private final int id;
+
+    InventoryID(int id) {
+        this.id = id;
+    }
+
+    public int getId() {
+        return id;
+    }
+}
@@ -0,0 +1,11 @@
+package net.runelite.api;
+
+public interface ItemContainer {
+    int getId();
+
+    Item[] getItems();
+
+    Item getItem(int slot);
+
+    int count(int itemId);
+}
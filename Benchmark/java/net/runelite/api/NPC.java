@@ -0,0 +1,9 @@
+package net.runelite.api;
+
+public interface NPC extends Actor {
+    int getId();
+
+    int getIndex();
+
+    NPCComposition getComposition();
+}
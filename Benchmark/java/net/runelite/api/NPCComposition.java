@@ -0,0 +1,11 @@
+package net.runelite.api;
+
+public interface NPCComposition {
+    String getName();
+
+    int getId();
+
+    int getSize();
+
+    String[] getActions();
+}
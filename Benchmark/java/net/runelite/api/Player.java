@@ -0,0 +1,11 @@
+package net.runelite.api;
+
+public interface Player extends Actor {
+    int getCombatLevel();
+
+    int getTeam();
+
+    boolean isFriend();
+
+    PlayerComposition getPlayerComposition();
+}
@@ -0,0 +1,7 @@
+package net.runelite.api;
+
+public interface PlayerComposition {
+    int[] getEquipmentIds();
+
+    boolean isFemale();
+}
@@ -0,0 +1,15 @@
+package net.runelite.api;
+
+public interface Widget {
+    int getId();
+
+    String getText();
+
+    boolean isHidden();
+
+    Widget getParent();
+
+    Widget[] getChildren();
+
+    Widget getChild(int index);
+}
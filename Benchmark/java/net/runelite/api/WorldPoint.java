@@ -0,0 +1,34 @@
+package net.runelite.api;
+
+public final class WorldPoint {
+    private final int x;
+    private final int y;
+    private final int plane;
+
+    public WorldPoint(int x, int y, int plane) {
+        this.x = x;
+        this.y = y;
+        this.plane = plane;
+    }
+
+    public int getX() {
+        return x;
+    }
+
+    public int getY() {
+        return y;
+    }
+
+    public int getPlane() {
+        return plane;
+    }
+
+    public int distanceTo(WorldPoint other) {
+        return Math.max(Math.abs(x - other.x), Math.abs(y - other.y));
+    }
+
+    @Override
+    public String toString() {
+        return "WorldPoint(x=" + x + ", y=" + y + ", plane=" + plane + ")";
+    }
+}
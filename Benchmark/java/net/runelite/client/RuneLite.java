@@ -0,0 +1,16 @@
+package net.runelite.client;
+
+import com.google.inject.Injector;
+import net.runelite.api.Client;
+
+// The bridge finds the client through RuneLite.injector and the client field
+// of the RuneLite instance, as in the real launcher.
+public class RuneLite {
+    public static Injector injector;
+
+    private final Client client;
+
+    public RuneLite(Client client) {
+        this.client = client;
+    }
+}
@@ -0,0 +1,34 @@
+package net.runelite.client.callback;
+
+import java.util.concurrent.ConcurrentLinkedQueue;
+
+// Runnables queued here run on the game loop between frames. invoke() runs
+// immediately when already on the game loop, like RuneLite's.
+public class ClientThread {
+    private final ConcurrentLinkedQueue<Runnable> pending = new ConcurrentLinkedQueue<>();
+    private volatile Thread loop;
+
+    public void invoke(Runnable runnable) {
+        if (Thread.currentThread() == loop) {
+            runnable.run();
+        } else {
+            pending.add(runnable);
+        }
+    }
+
+    public void invokeLater(Runnable runnable) {
+        pending.add(runnable);
+    }
+
+    public void runPending() {
+        loop = Thread.currentThread();
+        Runnable runnable;
+        while ((runnable = pending.poll()) != null) {
+            try {
+                runnable.run();
+            } catch (RuntimeException e) {
+                e.printStackTrace();
+            }
+        }
+    }
+}
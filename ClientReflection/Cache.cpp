@@ -1,8 +1,14 @@
 #include "pch.h"
 #include "Cache.hpp"
-#include <cstdio>
+#include "Executor.hpp"
+#include "JavaTypes.hpp"
+#include "JniCounters.hpp"
+#include "RequestToken.hpp"
+#include "Stats.hpp"
+#include "Trace.hpp"
+#include "Log.hpp"
 #include <algorithm>
-#include <iostream>
+#include <atomic>
 
 std::string jstringToString(JNIEnv* env, jstring jStr) {
     const char* cStr = env->GetStringUTFChars(jStr, nullptr);
@@ -13,9 +19,9 @@ std::string jstringToString(JNIEnv* env, jstring jStr) {
 
 void Cache::addMethodToCache(jmethodID methodID, jobject methodObject, const std::string& name, const std::string& signature, const std::string& returnType, const std::string& className) {
     std::string key = className + "." + name;
-    std::cout << "Key to be added: " << key << std::endl;
+    LOG_TRACE("Key to be added: " << key);
     Method method(methodID, methodObject, name, signature, returnType);
-    methodCache[key] = method;
+    metadata->methods.insert(key, method);
 }
 
 std::string Cache::replaceDotsWithSlashes(const std::string& input) {
@@ -30,7 +36,7 @@ std::string Cache::convertToSignature(JNIEnv* env, jobjectArray paramTypeArray)
     jsize paramCount = env->GetArrayLength(paramTypeArray);
     for (jsize i = 0; i < paramCount; i++) {
         jobject paramTypeObject = env->GetObjectArrayElement(paramTypeArray, i);
-        if (env->IsInstanceOf(paramTypeObject, env->FindClass("java/lang/Class"))) {
+        if (env->IsInstanceOf(paramTypeObject, javaTypes(env).classClass)) {
             jclass paramTypeClass = static_cast<jclass>(paramTypeObject);
             std::string paramTypeSignature = getClassSignature(env, paramTypeClass);
             paramTypeSignature = replaceDotsWithSlashes(paramTypeSignature);
@@ -43,7 +49,7 @@ std::string Cache::convertToSignature(JNIEnv* env, jobjectArray paramTypeArray)
 }
 
 std::string Cache::convertToReturnType(JNIEnv* env, jobject returnTypeObject) {
-    if (env->IsInstanceOf(returnTypeObject, env->FindClass("java/lang/Class"))) {
+    if (env->IsInstanceOf(returnTypeObject, javaTypes(env).classClass)) {
         jclass returnTypeClass = static_cast<jclass>(returnTypeObject);
         std::string returnTypeSignature = getClassSignature(env, returnTypeClass);
         returnTypeSignature = replaceDotsWithSlashes(returnTypeSignature);
@@ -55,71 +61,80 @@ std::string Cache::convertToReturnType(JNIEnv* env, jobject returnTypeObject) {
 void Cache::cacheObjectMethods(JNIEnv* env, jobject object) {
     jclass objectClass = env->GetObjectClass(object);
     if (objectClass == nullptr || env->ExceptionCheck()) {
-        std::cout << "Failed to obtain object class" << std::endl;
+        LOG_WARN("Failed to obtain object class");
         env->ExceptionDescribe();
         env->ExceptionClear();
         return;
     }
-    jclass classClass = env->FindClass("java/lang/Class");
-    jmethodID getNameMethod = env->GetMethodID(classClass, "getName", "()Ljava/lang/String;");
-    jstring classNameJava = (jstring)env->CallObjectMethod(objectClass, getNameMethod);
+    cacheClassMethods(env, objectClass);
+    env->DeleteLocalRef(objectClass);
+}
+
+void Cache::cacheClassMethods(JNIEnv* env, jclass objectClass) {
+    const JavaTypes& types = javaTypes(env);
+    jstring classNameJava = (jstring)env->CallObjectMethod(objectClass, types.getName);
     const char* classNameStr = env->GetStringUTFChars(classNameJava, 0);
     std::string className(classNameStr);
-    std::cout << "Class name: " << className << std::endl;
+    env->ReleaseStringUTFChars(classNameJava, classNameStr);
+    env->DeleteLocalRef(classNameJava);
+    // Every public method of a class is cached the first time one of its
+    // objects is seen, so later objects of the same class need no reflection.
+    // Only that first sighting takes a lock; the methods are collected and
+    // published together before the class is marked as cached.
+    if (metadata->cachedClasses.contains(className)) {
+        return;
+    }
+    std::lock_guard<std::mutex> discovery(metadata->discovery);
+    if (metadata->cachedClasses.contains(className)) {
+        return;
+    }
+    LOG_TRACE("Class name: " << className);
+    std::vector<std::pair<std::string, Method>> discovered;
+    std::unordered_set<std::string> discoveredKeys;
+    jclass declaringClass = nullptr;
 
-    jmethodID getMethodsMethod = env->GetMethodID(classClass, "getMethods", "()[Ljava/lang/reflect/Method;");
-    jobjectArray methodArray = (jobjectArray)env->CallObjectMethod(objectClass, getMethodsMethod);
+    jobjectArray methodArray = (jobjectArray)env->CallObjectMethod(objectClass, types.getMethods);
 
     jsize methodCount = env->GetArrayLength(methodArray);
 
     for (jsize i = 0; i < methodCount; i++) {
         jobject methodObject = env->GetObjectArrayElement(methodArray, i);
         if (methodObject == nullptr) {
-            fprintf(stderr, "Failed to obtain method object at index %d\n", i);
-            continue;
-        }
-
-        jclass methodClass = env->GetObjectClass(methodObject);
-        if (methodClass == nullptr || env->ExceptionCheck()) {
-            fprintf(stderr, "Failed to obtain method class at index %d\n", i);
-            env->ExceptionClear();
+            LOG_WARN("Failed to obtain method object at index " << i);
             continue;
         }
 
-        jmethodID getNameMethod = env->GetMethodID(methodClass, "getName", "()Ljava/lang/String;");
-        jstring nameJavaStr = (jstring)env->CallObjectMethod(methodObject, getNameMethod);
+        jstring nameJavaStr = (jstring)env->CallObjectMethod(methodObject, types.methodGetName);
         const char* nameStr = env->GetStringUTFChars(nameJavaStr, 0);
         std::string key = className + "." + nameStr;
 
-        if (methodCache.find(key) != methodCache.end()) {
+        if (metadata->methods.contains(key) || discoveredKeys.count(key) > 0) {
             // Clean up local references
             env->ReleaseStringUTFChars(nameJavaStr, nameStr);
             env->DeleteLocalRef(nameJavaStr);
             env->DeleteLocalRef(methodObject);
-            env->DeleteLocalRef(methodClass);
 
             continue;  // Skip the rest of the processing for this method and move on to the next method
         }
 
-        jmethodID getParameterTypesMethod = env->GetMethodID(methodClass, "getParameterTypes", "()[Ljava/lang/Class;");
-        jobjectArray paramTypeArray = (jobjectArray)env->CallObjectMethod(methodObject, getParameterTypesMethod);
-
-        jmethodID getReturnTypeMethod = env->GetMethodID(methodClass, "getReturnType", "()Ljava/lang/Class;");
-        jobject returnTypeObject = env->CallObjectMethod(methodObject, getReturnTypeMethod);
+        jobjectArray paramTypeArray = (jobjectArray)env->CallObjectMethod(methodObject, types.getParameterTypes);
+        jobject returnTypeObject = env->CallObjectMethod(methodObject, types.getReturnType);
 
         std::string signature = convertToSignature(env, paramTypeArray);
         std::string returnType = convertToReturnType(env, returnTypeObject);
 
         signature += returnType;
 
+        bool isStatic = false;
         jmethodID methodExists = env->GetMethodID(objectClass, nameStr, signature.c_str());
         if (env->ExceptionCheck()) {
             env->ExceptionClear();
+            isStatic = true;
             methodExists = env->GetStaticMethodID(objectClass, nameStr, signature.c_str());
             if (env->ExceptionCheck()) {
                 env->ExceptionClear();
-                fprintf(stderr, "Method %s.%s with signature %s does not exist or is not accessible\n",
-                    className.c_str(), nameStr, signature.c_str());
+                LOG_DEBUG("Method " << className << "." << nameStr << " with signature " << signature
+                    << " does not exist or is not accessible");
                 continue;
             }
         }
@@ -128,21 +143,31 @@ void Cache::cacheObjectMethods(JNIEnv* env, jobject object) {
         jmethodID methodID = methodExists;
 
         Method method(methodID, methodObject, nameStr, signature, returnType);
-        methodCache[key] = method;
-        std::cout << "Key: " << key << std::endl;
+        if (isStatic) {
+            if (declaringClass == nullptr) {
+                declaringClass = static_cast<jclass>(env->NewGlobalRef(objectClass));
+            }
+            method.isStatic = true;
+            method.clazz = declaringClass;
+            // Class roots ("@name") only see static methods.
+            discovered.emplace_back("@" + key, method);
+        }
+        discovered.emplace_back(key, method);
+        discoveredKeys.insert(key);
+        LOG_TRACE("Key: " << key);
 
         // Clean up local references
         env->ReleaseStringUTFChars(nameJavaStr, nameStr);
         env->DeleteLocalRef(nameJavaStr);
         env->DeleteLocalRef(methodObject);
-        env->DeleteLocalRef(methodClass);
         env->DeleteLocalRef(paramTypeArray);
         env->DeleteLocalRef(returnTypeObject);
     }
 
+    metadata->methods.insert(discovered);
+    metadata->cachedClasses.insert(className, true);
+
     // Clean up
-    env->DeleteLocalRef(classClass);
-    env->DeleteLocalRef(objectClass);
     env->DeleteLocalRef(methodArray);
 }
 
@@ -152,23 +177,9 @@ std::string Cache::getClassSignature(JNIEnv* env, jclass clazz) {
         throw std::invalid_argument("JNIEnv or jclass argument is nullptr");
     }
 
-    jclass classClass = env->GetObjectClass(clazz);
-    if (classClass == nullptr) {
-        // handle error
-        throw std::runtime_error("Failed to get class object");
-    }
-
-    jmethodID getNameMethod = env->GetMethodID(classClass, "getName", "()Ljava/lang/String;");
-    if (getNameMethod == nullptr) {
-        // handle error
-        env->DeleteLocalRef(classClass);
-        throw std::runtime_error("Failed to get method ID for getName");
-    }
-
-    jstring nameJavaStr = (jstring)env->CallObjectMethod(clazz, getNameMethod);
+    jstring nameJavaStr = (jstring)env->CallObjectMethod(clazz, javaTypes(env).getName);
     if (nameJavaStr == nullptr) {
         // handle error
-        env->DeleteLocalRef(classClass);
         throw std::runtime_error("Failed to get Java string");
     }
 
@@ -176,7 +187,6 @@ std::string Cache::getClassSignature(JNIEnv* env, jclass clazz) {
     if (nameStr == nullptr) {
         // handle error
         env->DeleteLocalRef(nameJavaStr);
-        env->DeleteLocalRef(classClass);
         throw std::runtime_error("Failed to get UTF characters from Java string");
     }
 
@@ -203,7 +213,6 @@ std::string Cache::getClassSignature(JNIEnv* env, jclass clazz) {
 
     env->ReleaseStringUTFChars(nameJavaStr, nameStr);
     env->DeleteLocalRef(nameJavaStr);
-    env->DeleteLocalRef(classClass);
 
     return signature;
 }
@@ -222,12 +231,12 @@ std::string Cache::executeSingleMethod(JNIEnv* env, const std::string& input) {
     std::string key = class_name + "." + method_name;
 
     // 2. Locate the Method
-    auto it = methodCache.find(key);
-    if (it == methodCache.end()) {
-        printf("Method %s not found\n", key.c_str());
+    const Method* found = metadata->methods.find(key);
+    if (found == nullptr) {
+        LOG_DEBUG("Method " << key << " not found");
         return "";
     }
-    Method& method = it->second;
+    const Method& method = *found;
 
     // 3. Execute the Method
     if (method.return_type == "V") {  // void return type
@@ -247,15 +256,11 @@ std::string Cache::executeSingleMethod(JNIEnv* env, const std::string& input) {
     else {  // Other non-primitive types
         jobject result = env->CallObjectMethod(method.object, method.id);
         if (result != nullptr) {
-            jclass resultClass = env->GetObjectClass(result);
-            jmethodID toStringMethod = env->GetMethodID(resultClass, "toString", "()Ljava/lang/String;");
-            if (toStringMethod != nullptr) {
-                jstring resultStr = (jstring)env->CallObjectMethod(result, toStringMethod);
-                const char* chars = env->GetStringUTFChars(resultStr, nullptr);
-                std::string result_str(chars);
-                env->ReleaseStringUTFChars(resultStr, chars);
-                return result_str;
-            }
+            jstring resultStr = (jstring)env->CallObjectMethod(result, javaTypes(env).toString);
+            const char* chars = env->GetStringUTFChars(resultStr, nullptr);
+            std::string result_str(chars);
+            env->ReleaseStringUTFChars(resultStr, chars);
+            return result_str;
         }
     }
     // ... Handle other return types similarly
@@ -263,178 +268,421 @@ std::string Cache::executeSingleMethod(JNIEnv* env, const std::string& input) {
     return "";
 }
 
-std::string Cache::executeMethod(JNIEnv* env, const std::string& input) {
-    // Split the method chain based on '.' to get individual method calls
-    std::vector<std::string> methods;
-    size_t pos = 0, found;
-    while ((found = input.find('.', pos)) != std::string::npos) {
-        methods.push_back(input.substr(pos, found - pos));
-        pos = found + 1;
+// Nested collections deeper than this are sent as handles.
+static const int kMaxEncodeDepth = 4;
+
+// Pops every local reference created while executing a query, including the
+// ones created for array and collection elements.
+struct LocalFrame {
+    JNIEnv* env;
+    explicit LocalFrame(JNIEnv* env) : env(env) { env->PushLocalFrame(64); }
+    ~LocalFrame() { env->PopLocalFrame(nullptr); }
+};
+
+std::string Cache::getClassName(JNIEnv* env, jobject object) {
+    jclass objectClass = env->GetObjectClass(object);
+    jstring name = (jstring)env->CallObjectMethod(objectClass, javaTypes(env).getName);
+    env->DeleteLocalRef(objectClass);
+    if (name == nullptr || env->ExceptionCheck()) {
+        env->ExceptionClear();
+        return "";
+    }
+    std::string result = jstringToString(env, name);
+    env->DeleteLocalRef(name);
+    return result;
+}
+
+void Cache::registerRoot(JNIEnv* env, const std::string& name, jobject object) {
+    auto it = rootCache.find(name);
+    if (it != rootCache.end()) {
+        env->DeleteGlobalRef(it->second.object);
+    }
+    Root root;
+    root.object = env->NewGlobalRef(object);
+    root.className = getClassName(env, object);
+    rootCache[name] = root;
+    cacheObjectMethods(env, object);
+}
+
+jobject Cache::resolveRoot(JNIEnv* env, const std::string& name, std::string& key) {
+    if (!name.empty() && name[0] == '#') {
+        uint64_t id = std::strtoull(name.c_str() + 1, nullptr, 10);
+        jobject object = handles->get(env, id);
+        if (object != nullptr) {
+            key = getClassName(env, object);
+            cacheObjectMethods(env, object);
+        }
+        return object;
+    }
+    if (!name.empty() && name[0] == '@') {
+        // Roots at a class, so the following hop is one of its static methods.
+        jclass clazz = classes->resolve(env, name.substr(1));
+        if (clazz != nullptr) {
+            key = name;
+            std::replace(key.begin(), key.end(), '/', '.');
+            cacheClassMethods(env, clazz);
+        }
+        return clazz;
+    }
+    auto it = rootCache.find(name);
+    if (it != rootCache.end()) {
+        key = it->second.className;
+        return it->second.object;
+    }
+    return nullptr;
+}
+
+bool Cache::isGetter(const std::string& name) {
+    return name.rfind("get", 0) == 0 || name.rfind("is", 0) == 0 || name.rfind("has", 0) == 0;
+}
+
+int64_t Cache::readTick(JNIEnv* env) {
+    auto root = rootCache.find("Client");
+    if (root == rootCache.end()) {
+        return -1;
+    }
+    const Method* method = metadata->methods.find(root->second.className + ".getTickCount");
+    if (method == nullptr || method->id == nullptr) {
+        return -1;
+    }
+    jint tick = env->CallIntMethod(root->second.object, method->id);
+    if (env->ExceptionCheck()) {
+        env->ExceptionDescribe();
+        env->ExceptionClear();
+        return -1;
+    }
+    return tick;
+}
+
+int64_t Cache::refreshMemo(JNIEnv* env) {
+    // The game tick count is read once per query or batch; without it nothing
+    // is memoized unless a TTL is set.
+    int64_t tick = readTick(env);
+    if (tick >= 0 && memo->getTtl().count() == 0) {
+        memo->advance(env, tick);
+    }
+    // Marks each new tick once, so traces line up with the game loop.
+    static std::atomic<int64_t> tracedTick{ -1 };
+    if (tick >= 0 && Trace::enabled() && tracedTick.exchange(tick) != tick) {
+        Trace::instant("tick", std::to_string(tick));
+    }
+    return tick;
+}
+
+jvalue Cache::invoke(JNIEnv* env, jobject receiver, const Method& method) {
+    jvalue value;
+    value.j = 0;
+    if (method.isStatic) {
+        jclass clazz = method.clazz;
+        switch (method.return_type[0]) {
+        case 'V': env->CallStaticVoidMethod(clazz, method.id); break;
+        case 'Z': value.z = env->CallStaticBooleanMethod(clazz, method.id); break;
+        case 'B': value.b = env->CallStaticByteMethod(clazz, method.id); break;
+        case 'C': value.c = env->CallStaticCharMethod(clazz, method.id); break;
+        case 'S': value.s = env->CallStaticShortMethod(clazz, method.id); break;
+        case 'I': value.i = env->CallStaticIntMethod(clazz, method.id); break;
+        case 'J': value.j = env->CallStaticLongMethod(clazz, method.id); break;
+        case 'F': value.f = env->CallStaticFloatMethod(clazz, method.id); break;
+        case 'D': value.d = env->CallStaticDoubleMethod(clazz, method.id); break;
+        default: value.l = env->CallStaticObjectMethod(clazz, method.id); break;
+        }
+        return value;
+    }
+    switch (method.return_type[0]) {
+    case 'V': env->CallVoidMethod(receiver, method.id); break;
+    case 'Z': value.z = env->CallBooleanMethod(receiver, method.id); break;
+    case 'B': value.b = env->CallByteMethod(receiver, method.id); break;
+    case 'C': value.c = env->CallCharMethod(receiver, method.id); break;
+    case 'S': value.s = env->CallShortMethod(receiver, method.id); break;
+    case 'I': value.i = env->CallIntMethod(receiver, method.id); break;
+    case 'J': value.j = env->CallLongMethod(receiver, method.id); break;
+    case 'F': value.f = env->CallFloatMethod(receiver, method.id); break;
+    case 'D': value.d = env->CallDoubleMethod(receiver, method.id); break;
+    default: value.l = env->CallObjectMethod(receiver, method.id); break;
+    }
+    return value;
+}
+
+std::string Cache::primitiveToString(const std::string& type, jvalue value) {
+    switch (type[0]) {
+    case 'V': return "void";
+    case 'Z': return value.z ? "true" : "false";
+    case 'B': return std::to_string(value.b);
+    case 'C': return std::to_string(value.c);
+    case 'S': return std::to_string(value.s);
+    case 'I': return std::to_string(value.i);
+    case 'J': return std::to_string(value.j);
+    case 'F': return std::to_string(value.f);
+    case 'D': return std::to_string(value.d);
+    }
+    return "";
+}
+
+void Cache::encodeValue(JNIEnv* env, ValueWriter& writer, const std::string& type, jvalue value) {
+    switch (type[0]) {
+    case 'V': writer.writeNull(); break;
+    case 'Z': writer.writeBool(value.z); break;
+    case 'B': writer.writeInt(value.b); break;
+    case 'C': writer.writeInt(value.c); break;
+    case 'S': writer.writeInt(value.s); break;
+    case 'I': writer.writeInt(value.i); break;
+    case 'J': writer.writeInt(value.j); break;
+    case 'F': writer.writeFloat(value.f); break;
+    case 'D': writer.writeDouble(value.d); break;
+    default: encodeObject(env, writer, value.l); break;
     }
-    methods.push_back(input.substr(pos));  // Push the last method
+}
 
-    std::string currentKey = methods[0]; 
+void Cache::encodeObject(JNIEnv* env, ValueWriter& writer, jobject object, int depth) {
+    const JavaTypes& types = javaTypes(env);
+    if (object == nullptr) {
+        writer.writeNull();
+    }
+    else if (env->IsInstanceOf(object, types.stringClass)) {
+        writer.writeString(jstringToString(env, (jstring)object));
+    }
+    else if (env->IsInstanceOf(object, types.booleanClass)) {
+        writer.writeBool(env->CallBooleanMethod(object, types.booleanValue));
+    }
+    else if (env->IsInstanceOf(object, types.characterClass)) {
+        writer.writeInt(env->CallCharMethod(object, types.charValue));
+    }
+    else if (env->IsInstanceOf(object, types.floatClass)) {
+        writer.writeFloat(env->CallFloatMethod(object, types.floatValue));
+    }
+    else if (env->IsInstanceOf(object, types.doubleClass)) {
+        writer.writeDouble(env->CallDoubleMethod(object, types.doubleValue));
+    }
+    else if (env->IsInstanceOf(object, types.numberClass)) {
+        writer.writeInt(env->CallLongMethod(object, types.longValue));
+    }
+    else if (depth < kMaxEncodeDepth && env->IsInstanceOf(object, types.collectionClass)) {
+        jobjectArray elements = (jobjectArray)env->CallObjectMethod(object, types.toArray);
+        encodeArray(env, writer, elements, depth + 1);
+        env->DeleteLocalRef(elements);
+    }
+    else if (depth < kMaxEncodeDepth && env->IsInstanceOf(object, types.mapClass)) {
+        jobject entrySet = env->CallObjectMethod(object, types.entrySet);
+        jobjectArray entries = (jobjectArray)env->CallObjectMethod(entrySet, types.toArray);
+        jsize count = env->GetArrayLength(entries);
+        writer.beginTable({ "key", "value" }, static_cast<uint32_t>(count));
+        for (jsize i = 0; i < count; i++) {
+            jobject entry = env->GetObjectArrayElement(entries, i);
+            jobject key = env->CallObjectMethod(entry, types.getKey);
+            jobject value = env->CallObjectMethod(entry, types.getValue);
+            encodeObject(env, writer, key, depth + 1);
+            encodeObject(env, writer, value, depth + 1);
+            env->DeleteLocalRef(value);
+            env->DeleteLocalRef(key);
+            env->DeleteLocalRef(entry);
+        }
+        env->DeleteLocalRef(entries);
+        env->DeleteLocalRef(entrySet);
+    }
+    else {
+        jclass objectClass = env->GetObjectClass(object);
+        bool isArray = env->CallBooleanMethod(objectClass, types.isArray);
+        env->DeleteLocalRef(objectClass);
+        if (isArray && depth < kMaxEncodeDepth) {
+            encodeArray(env, writer, (jarray)object, depth + 1);
+        }
+        else {
+            jint identity = env->CallStaticIntMethod(types.systemClass, types.identityHashCode, object);
+            writer.writeHandle(handles->put(env, object, identity));
+        }
+    }
+}
+
+template<typename T, typename ArrayType, typename Write>
+static void encodeRegion(JNIEnv* env, jarray array, jsize length, void (JNIEnv::*getter)(ArrayType, jsize, jsize, T*), Write write) {
+    std::vector<T> values(length);
+    (env->*getter)(static_cast<ArrayType>(array), 0, length, values.data());
+    for (T value : values) {
+        write(value);
+    }
+}
 
-    jobject result = nullptr;
-    for (const auto& methodStr : methods) {
-        std::cout << "Method string: " << methodStr << std::endl;
-        std::cout << "Current key: " << currentKey << std::endl;
-        if (methodStr == currentKey) continue;
-        std::string methodName = methodStr.substr(0, methodStr.find('('));
+void Cache::encodeArray(JNIEnv* env, ValueWriter& writer, jarray array, int depth) {
+    if (array == nullptr) {
+        writer.writeNull();
+        return;
+    }
+    std::string name = getClassName(env, array);
+    jsize length = env->GetArrayLength(array);
+    writer.beginArray(static_cast<uint32_t>(length));
+    if (name.size() < 2 || name[1] == '[' || name[1] == 'L') {
+        for (jsize i = 0; i < length; i++) {
+            jobject element = env->GetObjectArrayElement((jobjectArray)array, i);
+            encodeObject(env, writer, element, depth);
+            env->DeleteLocalRef(element);
+        }
+        return;
+    }
+    auto writeInt = [&writer](auto value) { writer.writeInt(value); };
+    switch (name[1]) {
+    case 'Z': encodeRegion(env, array, length, &JNIEnv::GetBooleanArrayRegion, [&writer](jboolean value) { writer.writeBool(value); }); break;
+    case 'B': encodeRegion(env, array, length, &JNIEnv::GetByteArrayRegion, writeInt); break;
+    case 'C': encodeRegion(env, array, length, &JNIEnv::GetCharArrayRegion, writeInt); break;
+    case 'S': encodeRegion(env, array, length, &JNIEnv::GetShortArrayRegion, writeInt); break;
+    case 'I': encodeRegion(env, array, length, &JNIEnv::GetIntArrayRegion, writeInt); break;
+    case 'J': encodeRegion(env, array, length, &JNIEnv::GetLongArrayRegion, writeInt); break;
+    case 'F': encodeRegion(env, array, length, &JNIEnv::GetFloatArrayRegion, [&writer](jfloat value) { writer.writeFloat(value); }); break;
+    case 'D': encodeRegion(env, array, length, &JNIEnv::GetDoubleArrayRegion, [&writer](jdouble value) { writer.writeDouble(value); }); break;
+    }
+}
+
+std::string Cache::executeMethod(JNIEnv* env, const std::string& input, Encoding encoding) {
+    return executePlan(env, compilePlan(input), encoding);
+}
+
+Cache::Evaluation Cache::evaluatePlan(JNIEnv* env, const Plan& plan) {
+    // Registered roots ("Client") and handles ("#12") provide the receiver for
+    // the first hop; every later hop is invoked on the previous hop's result.
+    std::string key = plan.root;
+    jobject receiver = resolveRoot(env, plan.root, key);
+    if (receiver == nullptr && !plan.root.empty() && plan.root[0] == '#') {
+        // Evicted by newer handles, or never issued.
+        Evaluation result;
+        result.error = "Stale handle " + plan.root;
+        return result;
+    }
+    return evaluate(env, receiver, key, plan.hops, plan.nodes);
+}
+
+Cache::Evaluation Cache::evaluate(JNIEnv* env, jobject receiver, std::string currentKey, const std::vector<std::string>& hops, const std::vector<uint32_t>& nodes) {
+    Evaluation result;
+    result.type = "Ljava/lang/Object;";
+    result.value.l = receiver;
+
+    // Time spent resolving and invoking is summed over the chain and recorded
+    // once, whichever way the chain ends.
+    struct StageTimes {
+        Stats::Clock::duration resolve{};
+        Stats::Clock::duration invoke{};
+        ~StageTimes() {
+            Stats::record(Stats::Stage::Resolve, resolve);
+            Stats::record(Stats::Stage::Invoke, invoke);
+        }
+    } times;
+
+    for (size_t i = 0; i < hops.size(); i++) {
+        // A request past its deadline or cancelled stops before its next hop.
+        std::string stop = RequestToken::checkCurrent();
+        if (!stop.empty()) {
+            result.error = stop;
+            return result;
+        }
+        const std::string& methodName = hops[i];
+        LOG_TRACE("Method string: " << methodName);
+        LOG_TRACE("Current key: " << currentKey);
         std::string key = currentKey + "." + methodName;
-        std::cout << "Key: " << key << std::endl;
-        auto it = methodCache.find(key);
-        if (it == methodCache.end()) {
-            printf("Method %s not found\n", key.c_str());
-            return " ";
+        LOG_TRACE("Key: " << key);
+        Trace::Span span("hop", key);
+        auto mark = Stats::Clock::now();
+        const Method* found = metadata->methods.find(key);
+        times.resolve += Stats::Clock::now() - mark;
+        if (found == nullptr) {
+            LOG_DEBUG("Method " << key << " not found");
+            result.error = "Method " + key + " not found";
+            result.notFound = true;
+            return result;
         }
         else {
-            std::cout << "Method found" << std::endl;
+            LOG_TRACE("Method found");
         }
-        Method& method = it->second;
-        std::cout << "Method name: " << method.name << std::endl;
-        if (method.object == nullptr || method.id == nullptr) {
-            std::cout << "Method object is null" << std::endl;
-            return "";
+        const Method& method = *found;
+        LOG_TRACE("Method name: " << method.name);
+        jobject currentObject = receiver != nullptr ? receiver : method.object;
+        if (currentObject == nullptr || method.id == nullptr) {
+            LOG_DEBUG("Method object is null");
+            result.error = "Method " + key + " has no receiver";
+            return result;
         }
-        std::cout << "Method return type: " << method.return_type << std::endl;
-        std::cout << "Method signature: " << method.signature << std::endl;
-        jobject currentObject = method.object;
+        LOG_TRACE("Method return type: " << method.return_type);
+        LOG_TRACE("Method signature: " << method.signature);
         if (env->ExceptionOccurred()) {
             env->ExceptionDescribe();
             env->ExceptionClear();
-            return "";
+            result.error = "Pending exception before " + key;
+            return result;
         }
 
-        if (method.return_type == "V") {  // void return type
-            env->CallVoidMethod(currentObject, method.id);
-            return "void";  // Since void methods don't return anything, you might want to set a default value
-        }
-        else if (method.return_type == "I") {  // int return type
-            jint result = env->CallIntMethod(currentObject, method.id);
-            return std::to_string(result);  // Convert jint to std::string and update currentKey
-        }
-        else if (method.return_type == "Ljava/lang/String;") {  // String return type
-            jstring result = (jstring)env->CallObjectMethod(currentObject, method.id);
-            const char* chars = env->GetStringUTFChars(result, nullptr);
-            std::string result_str(chars);
-            env->ReleaseStringUTFChars(result, chars);
-            return result_str;
-        }
-        else if (method.return_type == "Z") {
-            jboolean result = env->CallBooleanMethod(currentObject, method.id);
-            if (env->ExceptionOccurred()) {
-                env->ExceptionDescribe();
-                env->ExceptionClear();
-                return "";
-            }
-            currentKey = result ? "true" : "false";
-        }
-        else {  // Other non-primitive types
-            std::cout << "identified as object return type" << std::endl;
-            if (currentObject == nullptr || method.id == nullptr || method.object == nullptr) {
-                std::cout << "Current object or method id is null" << std::endl;
-                return "";
-            }
-            // TODO: This call is failing due to runtime-polymorphism. Fix it.
-            result = env->CallObjectMethod(method.object, method.id);
+        // Getter results are shared by every query evaluated in the same tick.
+        // Hops without a node (projection columns) have a different receiver
+        // for every element and are never memoized.
+        char kind = method.return_type[0];
+        bool memoizable = i < nodes.size() && kind != 'V' && isGetter(method.name);
+        jvalue value;
+        std::string nextKey;
+        if (!memoizable || !memo->lookup(env, nodes[i], value, nextKey)) {
+            mark = Stats::Clock::now();
+            value = invoke(env, currentObject, method);
+            times.invoke += Stats::Clock::now() - mark;
             if (env->ExceptionOccurred()) {
                 jthrowable exception = env->ExceptionOccurred();
                 env->ExceptionDescribe();
 
-                jclass throwableClass = env->FindClass("java/lang/Throwable");
-                jmethodID toStringMethod = env->GetMethodID(throwableClass, "toString", "()Ljava/lang/String;");
-                jmethodID printStackTraceMethod = env->GetMethodID(throwableClass, "printStackTrace", "()V");
-                env->CallVoidMethod(exception, printStackTraceMethod);
-                jstring exceptionString = (jstring)env->CallObjectMethod(exception, toStringMethod);
+                const JavaTypes& types = javaTypes(env);
+                env->ExceptionClear();
+                env->CallVoidMethod(exception, types.printStackTrace);
+                jstring exceptionString = (jstring)env->CallObjectMethod(exception, types.toString);
 
                 const char* message = env->GetStringUTFChars(exceptionString, NULL);
-                std::cout << "Exception caught in Cache.cpp: " << message << std::endl;
+                LOG_ERROR("Exception caught in Cache.cpp: " << message);
+                result.error = message;
 
                 env->ReleaseStringUTFChars(exceptionString, message);
                 env->DeleteLocalRef(exceptionString);
-                env->DeleteLocalRef(throwableClass);
                 env->ExceptionClear();
-                return "";
+                return result;
             }
-            if (result != nullptr) {
-                std::cout << "Result is not null" << std::endl;
-                currentObject = result;
-                jclass classClass = env->FindClass("java/lang/Class");
-                if (env->ExceptionOccurred()) {
-                    env->ExceptionDescribe();
-                    env->ExceptionClear();
-                    return "";
-                }
-                std::cout << "classClass: " << classClass << std::endl;
-                jclass objectClass = env->GetObjectClass(currentObject);
-                if (env->ExceptionOccurred()) {
-                    env->ExceptionDescribe();
-                    env->ExceptionClear();
-                    return "";
-                }
-                jmethodID getNameMethod = env->GetMethodID(classClass, "getName", "()Ljava/lang/String;");
-                if (env->ExceptionOccurred()) {
-                    env->ExceptionDescribe();
-                    env->ExceptionClear();
-                    return "";
-                }
-                std::cout << "objectClass: " << objectClass << std::endl;
-                jstring javaResult = (jstring)env->CallObjectMethod(objectClass, getNameMethod);
-                if (env->ExceptionOccurred()) {
-                    env->ExceptionDescribe();
-                    env->ExceptionClear();
-                    return "";
-                }
-                std::cout << "javaResult: " << javaResult << std::endl;
-                if (javaResult == nullptr) {
-                    std::cout << "javaResult is null" << std::endl;
-                    return "";
+            if ((kind == 'L' || kind == '[') && value.l != nullptr && i + 1 < hops.size()) {
+                mark = Stats::Clock::now();
+                nextKey = getClassName(env, value.l);
+                if (nextKey.empty()) {
+                    result.error = "Failed to get class name after " + key;
+                    return result;
                 }
-                const char* nameStr = env->GetStringUTFChars(javaResult, 0);
-                if (env->ExceptionOccurred()) {
-                    env->ExceptionDescribe();
-                    env->ExceptionClear();
-                    return "";
-                }
-                if (nameStr == nullptr) {
-                    std::cout << "nameStr is null" << std::endl;
-                }
-                std::string nameStrCpp(nameStr);
-                std::cout << "new current object: " << nameStrCpp << std::endl;
-                currentKey = nameStrCpp;
-                cacheObjectMethods(env, currentObject);
+                cacheObjectMethods(env, value.l);
+                times.resolve += Stats::Clock::now() - mark;
+            }
+            if (memoizable) {
+                memo->store(env, nodes[i], kind, value, nextKey);
             }
         }
+
+        result.type = method.return_type;
+        result.value = value;
+        // Void, primitives and strings end the chain, and a null in the middle
+        // of the chain makes the whole chain null.
+        if ((kind != 'L' && kind != '[') || method.return_type == "Ljava/lang/String;" || value.l == nullptr) {
+            return result;
+        }
+        LOG_TRACE("identified as object return type");
+        if (i + 1 < hops.size()) {
+            LOG_TRACE("new current object: " << nextKey);
+            currentKey = nextKey;
+        }
+        receiver = value.l;
     }
-    if (result == nullptr) {
-        std::cout << "Result is null" << std::endl;
-        return "";
-    }
-    jclass resultClass = env->GetObjectClass(result);
-    if (env->ExceptionOccurred()) {
-        env->ExceptionDescribe();
-        env->ExceptionClear();
-        return "";
-    }
-    if (resultClass == nullptr) {
-        std::cout << "Result class is null" << std::endl;
-        return "";
+    return result;
+}
+
+std::string Cache::toText(JNIEnv* env, const std::string& type, jvalue value) {
+    if (type[0] != 'L' && type[0] != '[') {
+        return primitiveToString(type, value);
     }
-    jmethodID toStringMethod = env->GetMethodID(resultClass, "toString", "()Ljava/lang/String;");
-    if (toStringMethod == nullptr) {
-        std::cout << "toStringMethod is null" << std::endl;
+    jobject result = value.l;
+    if (result == nullptr) {
+        LOG_DEBUG("Result is null");
         return "";
     }
-    if (env->ExceptionOccurred()) {
-        env->ExceptionDescribe();
-        env->ExceptionClear();
-        return "";
+    if (type == "Ljava/lang/String;") {
+        return jstringToString(env, (jstring)result);
     }
-
-    jstring resultStr = (jstring)env->CallObjectMethod(result, toStringMethod);
+    jstring resultStr = (jstring)env->CallObjectMethod(result, javaTypes(env).toString);
     if (resultStr == nullptr) {
-        std::cout << "resultStr is null" << std::endl;
+        LOG_DEBUG("resultStr is null");
         return "";
     }
     if (env->ExceptionOccurred()) {
@@ -444,46 +692,206 @@ std::string Cache::executeMethod(JNIEnv* env, const std::string& input) {
     }
     const char* chars = env->GetStringUTFChars(resultStr, nullptr);
     if (chars == nullptr) {
-        std::cout << "chars is null" << std::endl;
+        LOG_WARN("chars is null");
         return "";
     }
     std::string result_str(chars);
     env->ReleaseStringUTFChars(resultStr, chars);
+    env->DeleteLocalRef(resultStr);
     return result_str;
 }
 
+std::string Cache::executePlan(JNIEnv* env, const Plan& plan, Encoding encoding) {
+    Stats::QueryTimer queryTimer(plan.text);
+    Trace::Span span("query", plan.text);
+    JniCounters::Scope counters(env, plan.text);
+    LocalFrame frame(env);
+
+    Evaluation result = evaluatePlan(env, plan);
+    if (!result.error.empty()) {
+        if (encoding == Encoding::Binary) {
+            return ValueWriter::error(result.error);
+        }
+        return result.notFound ? " " : "";
+    }
+
+    if (!plan.columns.empty()) {
+        Table table;
+        std::string error = project(env, plan, result.value.l, table, encoding);
+        if (!error.empty()) {
+            return encoding == Encoding::Binary ? ValueWriter::error(error) : "";
+        }
+        Stats::Timer timer(Stats::Stage::Encode);
+        Trace::Span encodeSpan("encode");
+        if (encoding == Encoding::Binary) {
+            ValueWriter writer;
+            writer.writeTable(table);
+            return writer.release();
+        }
+        // Text projections are one row per line with tab separated cells.
+        std::string text;
+        for (const auto& row : table.rows) {
+            for (size_t i = 0; i < row.size(); i++) {
+                text += (i > 0 ? "\t" : "") + row[i];
+            }
+            text += "\n";
+        }
+        return text;
+    }
+
+    Stats::Timer timer(Stats::Stage::Encode);
+    Trace::Span encodeSpan("encode");
+    if (encoding == Encoding::Binary) {
+        ValueWriter writer;
+        encodeValue(env, writer, result.type, result.value);
+        return writer.release();
+    }
+    return toText(env, result.type, result.value);
+}
+
+std::string Cache::executeProjection(JNIEnv* env, const Plan& plan, Table& table) {
+    Stats::QueryTimer queryTimer(plan.text);
+    Trace::Span span("query", plan.text);
+    JniCounters::Scope counters(env, plan.text);
+    LocalFrame frame(env);
+
+    Evaluation result = evaluatePlan(env, plan);
+    if (!result.error.empty()) {
+        return result.error;
+    }
+    return project(env, plan, result.value.l, table, Encoding::Binary);
+}
+
+std::string Cache::project(JNIEnv* env, const Plan& plan, jobject collection, Table& table, Encoding encoding) {
+    const JavaTypes& types = javaTypes(env);
+    for (const auto& column : plan.columns) {
+        table.columns.push_back(column.text);
+    }
+    if (collection == nullptr) {
+        return "";
+    }
+
+    jobjectArray elements;
+    if (env->IsInstanceOf(collection, types.collectionClass)) {
+        elements = (jobjectArray)env->CallObjectMethod(collection, types.toArray);
+    }
+    else if (env->IsInstanceOf(collection, types.objectArrayClass)) {
+        elements = (jobjectArray)env->NewLocalRef(collection);
+    }
+    else {
+        return "Projection source is not a collection or object array";
+    }
+
+    jsize count = env->GetArrayLength(elements);
+    table.rows.assign(count, {});
+    Executor* executor = Executor::current();
+    if (executor != nullptr && Executor::currentEnv() != nullptr && viewForThread && count >= kParallelProjection) {
+        // Large projections are split into ranges that idle workers steal.
+        // Every range runs on its worker's own view and local frame, reading
+        // the elements through a global reference to the array.
+        jobjectArray shared = (jobjectArray)env->NewGlobalRef(elements);
+        const RequestToken* token = RequestToken::current();
+        executor->parallelFor(count, kProjectionGrain, [&](size_t begin, size_t end) {
+            JNIEnv* taskEnv = Executor::currentEnv();
+            Cache& view = viewForThread();
+            RequestToken::Scope scope(token);
+            Trace::Span span("chunk");
+            JniCounters::Scope counters(taskEnv, plan.text, false);
+            taskEnv->PushLocalFrame(16);
+            for (size_t i = begin; i < end; i++) {
+                table.rows[i] = view.projectRow(taskEnv, plan, shared, (jsize)i, encoding);
+            }
+            taskEnv->PopLocalFrame(nullptr);
+        });
+        env->DeleteGlobalRef(shared);
+    }
+    else {
+        for (jsize i = 0; i < count; i++) {
+            table.rows[i] = projectRow(env, plan, elements, i, encoding);
+        }
+    }
+    env->DeleteLocalRef(elements);
+    return "";
+}
+
+std::vector<std::string> Cache::projectRow(JNIEnv* env, const Plan& plan, jobjectArray elements, jsize index, Encoding encoding) {
+    jobject element = env->GetObjectArrayElement(elements, index);
+    std::vector<std::string> row;
+    row.reserve(plan.columns.size());
+    std::string elementKey;
+    if (element != nullptr) {
+        elementKey = getClassName(env, element);
+        cacheObjectMethods(env, element);
+    }
+    for (const auto& column : plan.columns) {
+        Evaluation cell;
+        if (element != nullptr) {
+            env->PushLocalFrame(16);
+            cell = evaluate(env, element, elementKey, column.hops, column.nodes);
+        }
+        Stats::Timer timer(Stats::Stage::Encode);
+        Trace::Span encodeSpan("encode");
+        if (encoding == Encoding::Binary) {
+            ValueWriter writer;
+            if (!cell.error.empty()) {
+                writer.writeError(cell.error);
+            }
+            else {
+                encodeValue(env, writer, cell.type, cell.value);
+            }
+            row.push_back(writer.release());
+        }
+        else {
+            row.push_back(cell.error.empty() ? toText(env, cell.type, cell.value) : "");
+        }
+        if (element != nullptr) {
+            env->PopLocalFrame(nullptr);
+        }
+    }
+    env->DeleteLocalRef(element);
+    return row;
+}
+
 jclass Cache::getClass(JNIEnv* env, const std::string& name, jobject object) {
-    auto it = classCache.find(name);
-    if (it != classCache.end()) {
-        return it->second;
+    if (const jclass* cached = metadata->classes.find(name)) {
+        return *cached;
     }
 
-    jclass cls = env->GetObjectClass(object);
-    classCache[name] = cls;
-    return cls;
+    // Shared with every worker, so the reference has to be global.
+    jclass local = env->GetObjectClass(object);
+    jclass cls = (jclass)env->NewGlobalRef(local);
+    env->DeleteLocalRef(local);
+    const jclass* stored = metadata->classes.insert(name, cls);
+    if (*stored != cls) {
+        env->DeleteGlobalRef(cls);
+    }
+    return *stored;
 }
 
 jobject Cache::getObject(JNIEnv* env, const std::string& key, jclass clazz, const char* name, const char* sig) {
-    auto it = objectCache.find(key);
-    if (it != objectCache.end()) {
-        return it->second;
+    if (const jobject* cached = metadata->objects.find(key)) {
+        return *cached;
     }
 
-    jobject object = env->GetStaticObjectField(clazz, env->GetStaticFieldID(clazz, name, sig));
+    jobject local = env->GetStaticObjectField(clazz, env->GetStaticFieldID(clazz, name, sig));
     if (env->ExceptionCheck()) {
         env->ExceptionDescribe();
         env->ExceptionClear();
         return nullptr;
     }
 
-    objectCache[key] = object;
-    return object;
+    jobject object = env->NewGlobalRef(local);
+    env->DeleteLocalRef(local);
+    const jobject* stored = metadata->objects.insert(key, object);
+    if (*stored != object) {
+        env->DeleteGlobalRef(object);
+    }
+    return *stored;
 }
 
 jfieldID Cache::getFieldID(JNIEnv* env, const std::string& key, jclass clazz, const char* name, const char* sig) {
-    auto it = fieldCache.find(key);
-    if (it != fieldCache.end()) {
-        return it->second;
+    if (const jfieldID* cached = metadata->fields.find(key)) {
+        return *cached;
     }
 
     jfieldID fieldID = env->GetFieldID(clazz, name, sig);
@@ -493,27 +901,45 @@ jfieldID Cache::getFieldID(JNIEnv* env, const std::string& key, jclass clazz, co
         return nullptr;
     }
 
-    fieldCache[key] = fieldID;
-    return fieldID;
+    return *metadata->fields.insert(key, fieldID);
+}
+
+jfieldID Cache::getStaticFieldID(JNIEnv* env, const std::string& key, jclass clazz, const char* name, const char* sig) {
+    if (const jfieldID* cached = metadata->staticFields.find(key)) {
+        return *cached;
+    }
+
+    jfieldID fieldID = env->GetStaticFieldID(clazz, name, sig);
+    if (env->ExceptionCheck()) {
+        env->ExceptionDescribe();
+        env->ExceptionClear();
+        return nullptr;
+    }
+
+    return *metadata->staticFields.insert(key, fieldID);
 }
 
 void Cache::cleanup(JNIEnv* env) {
-    for (auto& entry : methodCache) {
-        Method& method = entry.second;
+    metadata->methods.forEach([env](const Method& method) {
         if (method.object != nullptr) {
             env->DeleteGlobalRef(method.object);
         }
-    }
+    });
 
-    for (auto& entry : classCache) {
-        jclass clazz = entry.second;
+    metadata->classes.forEach([env](const jclass& clazz) {
         env->DeleteGlobalRef(clazz);
-    }
+    });
 
-    for (auto& entry : objectCache) {
-        jobject object = entry.second;
+    metadata->objects.forEach([env](const jobject& object) {
         env->DeleteGlobalRef(object);
+    });
+
+    for (auto& entry : rootCache) {
+        env->DeleteGlobalRef(entry.second.object);
     }
+
+    handles->clear(env);
+    memo->clear(env);
 }
 
 Cache::~Cache() {
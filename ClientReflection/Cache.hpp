@@ -1,10 +1,19 @@
 #pragma once
 #include "pch.h"
 #include <jni.h>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <unordered_map>
+#include <unordered_set>
 #include <string>
 #include <sstream>
+#include "ClassResolver.hpp"
 #include "ClientThread.hpp"
+#include "ConcurrentMap.hpp"
+#include "Encoding.hpp"
+#include "Plan.hpp"
+#include "Memo.hpp"
 
 class Cache {
 public:
@@ -16,23 +25,62 @@ public:
         std::string signature;
         std::string return_type;
         ClientThread* clientThread;
+        // Static methods are invoked on their declaring class.
+        bool isStatic = false;
+        jclass clazz = nullptr;
 
         Method() : id(nullptr), object(nullptr) {}
         Method(jmethodID id, jobject object, const std::string& name, const std::string& signature, const std::string& return_type)
             : id(id), object(object), name(name), signature(signature), return_type(return_type) {}
     };
 
+    // Outcome of walking a chain of hops: the declared type and value of the
+    // last hop that was invoked.
+    struct Evaluation {
+        std::string type = "Ljava/lang/Object;";
+        jvalue value = {};
+        std::string error;
+        bool notFound = false;
+    };
+
+    // Named objects a query can start from, e.g. "Client".
+    struct Root {
+        jobject object;
+        std::string className;
+    };
+
     jclass getClass(JNIEnv* env, const std::string& name, jobject object);
     jobject getObject(JNIEnv* env, const std::string& key, jclass clazz, const char* name, const char* sig);
     jfieldID getFieldID(JNIEnv* env, const std::string& key, jclass clazz, const char* name, const char* sig);
+    jfieldID getStaticFieldID(JNIEnv* env, const std::string& key, jclass clazz, const char* name, const char* sig);
 
     void addMethodToCache(jmethodID methodID, jobject methodObject, const std::string& name, const std::string& signature, const std::string& returnType, const std::string& className);
     void cacheObjectMethods(JNIEnv* env, jobject object);
+    void cacheClassMethods(JNIEnv* env, jclass objectClass);
     std::string convertToSignature(JNIEnv* env, jobjectArray paramTypeArray);
     std::string getClassSignature(JNIEnv* env, jclass clazz);
     std::string convertToReturnType(JNIEnv* env, jobject returnTypeObject);
     std::string executeSingleMethod(JNIEnv* env, const std::string& input);
-    std::string executeMethod(JNIEnv* env, const std::string& input);
+    std::string executeMethod(JNIEnv* env, const std::string& input, Encoding encoding = Encoding::Text);
+    std::string executePlan(JNIEnv* env, const Plan& plan, Encoding encoding);
+    std::string executeProjection(JNIEnv* env, const Plan& plan, Table& table);
+    Evaluation evaluatePlan(JNIEnv* env, const Plan& plan);
+    Evaluation evaluate(JNIEnv* env, jobject receiver, std::string currentKey, const std::vector<std::string>& hops, const std::vector<uint32_t>& nodes);
+    std::string project(JNIEnv* env, const Plan& plan, jobject collection, Table& table, Encoding encoding);
+    std::vector<std::string> projectRow(JNIEnv* env, const Plan& plan, jobjectArray elements, jsize index, Encoding encoding);
+    std::string toText(JNIEnv* env, const std::string& type, jvalue value);
+
+    void registerRoot(JNIEnv* env, const std::string& name, jobject object);
+    jobject resolveRoot(JNIEnv* env, const std::string& name, std::string& key);
+    std::string getClassName(JNIEnv* env, jobject object);
+    jvalue invoke(JNIEnv* env, jobject receiver, const Method& method);
+    bool isGetter(const std::string& name);
+    int64_t readTick(JNIEnv* env);
+    int64_t refreshMemo(JNIEnv* env);
+    std::string primitiveToString(const std::string& type, jvalue value);
+    void encodeValue(JNIEnv* env, ValueWriter& writer, const std::string& type, jvalue value);
+    void encodeObject(JNIEnv* env, ValueWriter& writer, jobject object, int depth = 0);
+    void encodeArray(JNIEnv* env, ValueWriter& writer, jarray array, int depth);
 
     std::string replaceDotsWithSlashes(const std::string& input);
 
@@ -41,9 +89,35 @@ public:
     Cache() = default;
     ~Cache();
 
-    std::unordered_map<std::string, Method> methodCache;
-    std::unordered_map<std::string, jclass> classCache;
-    std::unordered_map<std::string, jobject> objectCache;
-    std::unordered_map<std::string, jfieldID> fieldCache;
+    // Reflection results shared by every view. Lookups take no lock, so the
+    // workers resolve chains without contending; a class seen for the first
+    // time is reflected under `discovery` and its methods published at once.
+    struct Metadata {
+        ConcurrentMap<Method> methods;
+        ConcurrentMap<jclass> classes;
+        ConcurrentMap<jobject> objects;
+        ConcurrentMap<jfieldID> fields;
+        ConcurrentMap<jfieldID> staticFields;
+        ConcurrentMap<bool> cachedClasses;
+        std::mutex discovery;
+    };
+
+    std::shared_ptr<Metadata> metadata = std::make_shared<Metadata>();
+    std::unordered_map<std::string, Root> rootCache;
+    // Shared by every view, so a handle returned by one thread can root a
+    // query executed on another.
+    std::shared_ptr<HandleTable> handles = std::make_shared<HandleTable>();
+    // Shared by every view; resolves "@name" roots through the game's loader.
+    std::shared_ptr<ClassResolver> classes = std::make_shared<ClassResolver>();
+    // Shared by every view, so a getter runs once per tick across workers.
+    std::shared_ptr<TickMemo> memo = std::make_shared<TickMemo>();
+    // Returns the calling thread's view; set by ClientAPI so projections can
+    // be split across executor workers.
+    std::function<Cache&()> viewForThread;
+
+    // Projections with at least this many elements are split into ranges of
+    // kProjectionGrain elements.
+    static constexpr jsize kParallelProjection = 128;
+    static constexpr size_t kProjectionGrain = 32;
 
 };
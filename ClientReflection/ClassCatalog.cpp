@@ -0,0 +1,237 @@
+#include "pch.h"
+#include "ClassCatalog.hpp"
+#include "JavaTypes.hpp"
+#include "Log.hpp"
+#include <algorithm>
+#include <functional>
+
+namespace {
+    // Binary tables carry encoded cells; every catalog cell is a string.
+    void appendRow(Table& table, Encoding encoding, std::initializer_list<std::string_view> cells) {
+        std::vector<std::string> row;
+        for (std::string_view cell : cells) {
+            if (encoding == Encoding::Binary) {
+                ValueWriter writer;
+                writer.writeString(cell);
+                row.push_back(writer.release());
+            }
+            else {
+                row.emplace_back(cell);
+            }
+        }
+        table.rows.push_back(std::move(row));
+    }
+}
+
+void ClassCatalog::refresh(JNIEnv* env, jobject loader) {
+    if (loader == nullptr) {
+        return;
+    }
+    const JavaTypes& types = javaTypes(env);
+    // ClassLoader lists the classes it defined in a private field, a Vector on
+    // older JDKs and an ArrayList on newer ones.
+    jfieldID field = env->GetFieldID(types.classLoaderClass, "classes", "Ljava/util/Vector;");
+    if (field == nullptr || env->ExceptionCheck()) {
+        env->ExceptionClear();
+        field = env->GetFieldID(types.classLoaderClass, "classes", "Ljava/util/ArrayList;");
+    }
+    if (field == nullptr || env->ExceptionCheck()) {
+        env->ExceptionClear();
+        LOG_WARN("Class loader does not list its classes");
+        return;
+    }
+    jobject classes = env->GetObjectField(loader, field);
+    if (classes == nullptr) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    jint count = env->CallIntMethod(classes, types.size);
+    size_t entriesBefore = entries.size();
+    size_t membersBefore = byMember.size();
+    for (; indexed < count; indexed++) {
+        env->PushLocalFrame(16);
+        jobject clazz = env->CallObjectMethod(classes, types.listGet, indexed);
+        if (clazz != nullptr && !env->ExceptionCheck()) {
+            index(env, static_cast<jclass>(clazz));
+        }
+        env->ExceptionClear();
+        env->PopLocalFrame(nullptr);
+    }
+    env->DeleteLocalRef(classes);
+    if (entries.size() == entriesBefore) {
+        return;
+    }
+
+    // The new classes are sorted on their own and merged into the indices.
+    auto classOrder = [this](uint32_t a, uint32_t b) {
+        return text(entries[a].name) < text(entries[b].name);
+    };
+    for (size_t i = entriesBefore; i < entries.size(); i++) {
+        byName.push_back(static_cast<uint32_t>(i));
+    }
+    std::sort(byName.begin() + entriesBefore, byName.end(), classOrder);
+    std::inplace_merge(byName.begin(), byName.begin() + entriesBefore, byName.end(), classOrder);
+
+    auto memberOrder = [this](const Member& a, const Member& b) {
+        std::string_view left = text(a.name);
+        std::string_view right = text(b.name);
+        return left != right ? left < right : text(entries[a.entry].name) < text(entries[b.entry].name);
+    };
+    std::sort(byMember.begin() + membersBefore, byMember.end(), memberOrder);
+    std::inplace_merge(byMember.begin(), byMember.begin() + membersBefore, byMember.end(), memberOrder);
+    LOG_INFO("Catalogued " << entries.size() - entriesBefore << " classes, " << entries.size() << " in total");
+}
+
+void ClassCatalog::index(JNIEnv* env, jclass clazz) {
+    const JavaTypes& types = javaTypes(env);
+    Entry entry{};
+    entry.name = intern(nameOf(env, clazz, types.getName));
+    if (entry.name == 0) {
+        return;
+    }
+    jobject superclass = env->CallObjectMethod(clazz, types.getSuperclass);
+    if (superclass != nullptr) {
+        entry.superclass = intern(nameOf(env, superclass, types.getName));
+        env->DeleteLocalRef(superclass);
+    }
+
+    entry.interfaces = static_cast<uint32_t>(lists.size());
+    jobjectArray interfaces = static_cast<jobjectArray>(env->CallObjectMethod(clazz, types.getInterfaces));
+    jsize interfaceCount = interfaces != nullptr ? env->GetArrayLength(interfaces) : 0;
+    for (jsize i = 0; i < interfaceCount; i++) {
+        jobject implemented = env->GetObjectArrayElement(interfaces, i);
+        lists.push_back(intern(nameOf(env, implemented, types.getName)));
+        env->DeleteLocalRef(implemented);
+    }
+    env->DeleteLocalRef(interfaces);
+    entry.interfaceCount = static_cast<uint32_t>(lists.size()) - entry.interfaces;
+
+    // Members are listed by name only, so overloads collapse into one. A class
+    // whose members refer to classes that fail to load lists none.
+    std::vector<uint32_t> members;
+    auto collect = [&](jmethodID declared, jmethodID getName) {
+        jobjectArray array = static_cast<jobjectArray>(env->CallObjectMethod(clazz, declared));
+        if (array == nullptr || env->ExceptionCheck()) {
+            env->ExceptionClear();
+            return;
+        }
+        jsize length = env->GetArrayLength(array);
+        for (jsize i = 0; i < length; i++) {
+            jobject member = env->GetObjectArrayElement(array, i);
+            uint32_t name = intern(nameOf(env, member, getName));
+            if (name != 0) {
+                members.push_back(name);
+            }
+            env->DeleteLocalRef(member);
+        }
+        env->DeleteLocalRef(array);
+    };
+    collect(types.getDeclaredFields, types.fieldGetName);
+    collect(types.getDeclaredMethods, types.methodGetName);
+    std::sort(members.begin(), members.end(), [this](uint32_t a, uint32_t b) { return text(a) < text(b); });
+    members.erase(std::unique(members.begin(), members.end()), members.end());
+
+    uint32_t number = static_cast<uint32_t>(entries.size());
+    entry.members = static_cast<uint32_t>(lists.size());
+    entry.memberCount = static_cast<uint32_t>(members.size());
+    for (uint32_t member : members) {
+        lists.push_back(member);
+        byMember.push_back({ member, number });
+    }
+    entries.push_back(entry);
+}
+
+std::string ClassCatalog::nameOf(JNIEnv* env, jobject object, jmethodID getName) {
+    if (object == nullptr) {
+        return std::string();
+    }
+    jstring javaName = static_cast<jstring>(env->CallObjectMethod(object, getName));
+    if (javaName == nullptr || env->ExceptionCheck()) {
+        env->ExceptionClear();
+        return std::string();
+    }
+    const char* chars = env->GetStringUTFChars(javaName, nullptr);
+    std::string name = chars != nullptr ? chars : "";
+    env->ReleaseStringUTFChars(javaName, chars);
+    env->DeleteLocalRef(javaName);
+    return name;
+}
+
+uint32_t ClassCatalog::intern(std::string_view name) {
+    if (name.empty()) {
+        return 0;
+    }
+    size_t hash = std::hash<std::string_view>()(name);
+    auto range = interned.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (text(it->second) == name) {
+            return it->second;
+        }
+    }
+    uint32_t offset = static_cast<uint32_t>(arena.size());
+    arena.append(name);
+    arena.push_back('\0');
+    interned.emplace(hash, offset);
+    return offset;
+}
+
+std::string_view ClassCatalog::text(uint32_t name) const {
+    return std::string_view(arena.data() + name);
+}
+
+Table ClassCatalog::findClasses(std::string_view prefix, size_t limit, Encoding encoding) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Table table;
+    table.columns = { "class", "superclass", "interfaces" };
+    auto it = std::lower_bound(byName.begin(), byName.end(), prefix, [this](uint32_t number, std::string_view value) {
+        return text(entries[number].name) < value;
+    });
+    for (; it != byName.end() && table.rows.size() < limit; ++it) {
+        const Entry& entry = entries[*it];
+        std::string_view name = text(entry.name);
+        if (name.substr(0, prefix.size()) != prefix) {
+            break;
+        }
+        std::string interfaces;
+        for (uint32_t i = 0; i < entry.interfaceCount; i++) {
+            interfaces += (i > 0 ? "," : "");
+            interfaces += text(lists[entry.interfaces + i]);
+        }
+        appendRow(table, encoding, { name, text(entry.superclass), interfaces });
+    }
+    return table;
+}
+
+Table ClassCatalog::findMembers(std::string_view prefix, size_t limit, Encoding encoding) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Table table;
+    table.columns = { "member", "class" };
+    auto it = std::lower_bound(byMember.begin(), byMember.end(), prefix, [this](const Member& member, std::string_view value) {
+        return text(member.name) < value;
+    });
+    for (; it != byMember.end() && table.rows.size() < limit; ++it) {
+        std::string_view name = text(it->name);
+        if (name.substr(0, prefix.size()) != prefix) {
+            break;
+        }
+        appendRow(table, encoding, { name, text(entries[it->entry].name) });
+    }
+    return table;
+}
+
+Table ClassCatalog::membersOf(std::string_view name, Encoding encoding) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Table table;
+    table.columns = { "member" };
+    auto it = std::lower_bound(byName.begin(), byName.end(), name, [this](uint32_t number, std::string_view value) {
+        return text(entries[number].name) < value;
+    });
+    if (it != byName.end() && text(entries[*it].name) == name) {
+        const Entry& entry = entries[*it];
+        for (uint32_t i = 0; i < entry.memberCount; i++) {
+            appendRow(table, encoding, { text(lists[entry.members + i]) });
+        }
+    }
+    return table;
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include "pch.h"
+#include <jni.h>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "Encoding.hpp"
+
+// An index of the classes a class loader has defined: their names,
+// superclasses, interfaces and the names of their declared fields and
+// methods, for tooling that explores the client's API. It reads the loader's
+// own list of classes, so only classes the game has loaded so far are
+// listed. Each refresh reflects just the classes defined since the last one.
+//
+// Every name is stored once in a single arena; classes and members refer to
+// names by offset, and two sorted indices answer prefix lookups.
+class ClassCatalog {
+public:
+    // Indexes the classes `loader` has defined since the last refresh.
+    void refresh(JNIEnv* env, jobject loader);
+
+    // Classes whose name starts with `prefix`, sorted by name: name,
+    // superclass and comma separated interfaces.
+    Table findClasses(std::string_view prefix, size_t limit, Encoding encoding);
+    // Declared fields and methods whose name starts with `prefix`, sorted by
+    // name: member and declaring class.
+    Table findMembers(std::string_view prefix, size_t limit, Encoding encoding);
+    // Names of the fields and methods `name` declares, sorted.
+    Table membersOf(std::string_view name, Encoding encoding);
+
+private:
+    struct Entry {
+        uint32_t name;
+        uint32_t superclass;
+        // Ranges in `lists`.
+        uint32_t interfaces;
+        uint32_t interfaceCount;
+        uint32_t members;
+        uint32_t memberCount;
+    };
+    struct Member {
+        uint32_t name;
+        uint32_t entry;
+    };
+
+    uint32_t intern(std::string_view text);
+    std::string_view text(uint32_t name) const;
+    std::string nameOf(JNIEnv* env, jobject object, jmethodID getName);
+    void index(JNIEnv* env, jclass clazz);
+
+    std::mutex mutex;
+    // NUL separated names; offset 0 is the empty name.
+    std::string arena = std::string(1, '\0');
+    // Name offsets by hash, for interning.
+    std::unordered_multimap<size_t, uint32_t> interned;
+    std::vector<Entry> entries;
+    std::vector<uint32_t> lists;
+    // Entry numbers sorted by name, and members sorted by name.
+    std::vector<uint32_t> byName;
+    std::vector<Member> byMember;
+    // Number of the loader's classes already indexed.
+    jint indexed = 0;
+};
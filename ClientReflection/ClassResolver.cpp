@@ -0,0 +1,86 @@
+#include "pch.h"
+#include "ClassResolver.hpp"
+#include "JavaTypes.hpp"
+#include "Log.hpp"
+#include <algorithm>
+
+void ClassResolver::setLoader(JNIEnv* env, jobject newLoader) {
+    if (newLoader == nullptr) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if (loader == nullptr) {
+        loader = env->NewGlobalRef(newLoader);
+        LOG_INFO("Resolving classes through the game class loader");
+    }
+    else if (!env->IsSameObject(loader, newLoader)) {
+        LOG_WARN("Ignoring a second class loader");
+    }
+}
+
+jobject ClassResolver::currentLoader() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return loader;
+}
+
+jclass ClassResolver::resolve(JNIEnv* env, const std::string& name) {
+    if (const jclass* found = classes.find(name)) {
+        return *found;
+    }
+    std::string binaryName = name;
+    std::replace(binaryName.begin(), binaryName.end(), '/', '.');
+    if (binaryName != name) {
+        if (const jclass* found = classes.find(binaryName)) {
+            return *found;
+        }
+    }
+
+    // Misses load under the lock so each name is asked for once.
+    std::lock_guard<std::mutex> lock(mutex);
+    if (const jclass* found = classes.find(binaryName)) {
+        return *found;
+    }
+    if (misses.count(binaryName) > 0) {
+        return nullptr;
+    }
+    jclass clazz = load(env, binaryName);
+    if (clazz == nullptr) {
+        if (loader != nullptr) {
+            if (missOrder.size() >= kMaxMisses) {
+                misses.erase(missOrder.front());
+                missOrder.pop_front();
+            }
+            misses.insert(binaryName);
+            missOrder.push_back(binaryName);
+        }
+        return nullptr;
+    }
+    std::vector<std::pair<std::string, jclass>> entries = { { binaryName, clazz } };
+    if (binaryName != name) {
+        entries.emplace_back(name, clazz);
+    }
+    classes.insert(entries);
+    return clazz;
+}
+
+jclass ClassResolver::load(JNIEnv* env, const std::string& binaryName) {
+    jobject local = nullptr;
+    if (loader != nullptr) {
+        jstring javaName = env->NewStringUTF(binaryName.c_str());
+        local = env->CallObjectMethod(loader, javaTypes(env).loadClass, javaName);
+        env->DeleteLocalRef(javaName);
+    }
+    else {
+        std::string internalName = binaryName;
+        std::replace(internalName.begin(), internalName.end(), '.', '/');
+        local = env->FindClass(internalName.c_str());
+    }
+    if (local == nullptr || env->ExceptionCheck()) {
+        env->ExceptionClear();
+        LOG_DEBUG("Class " << binaryName << " not found");
+        return nullptr;
+    }
+    jclass global = static_cast<jclass>(env->NewGlobalRef(local));
+    env->DeleteLocalRef(local);
+    return global;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include "pch.h"
+#include <jni.h>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "ConcurrentMap.hpp"
+
+// Finds classes by name through the game's class loader. FindClass from a
+// native thread only sees the system loader, so the client's own (often
+// obfuscated) classes are loaded with ClassLoader.loadClass instead, once
+// per name. Results are global references shared by every thread and looked
+// up without locks. Names the loader does not know come from clients, so only
+// the latest kMaxMisses of them are remembered, in a set under the lock.
+// Until a loader is set, names resolve through FindClass and misses are not
+// remembered.
+//
+// Names may be given in binary ("net.runelite.api.Skill") or internal
+// ("net/runelite/api/Skill") form; both share one entry.
+class ClassResolver {
+public:
+    static constexpr size_t kMaxMisses = 1024;
+
+    ClassResolver() = default;
+    ClassResolver(const ClassResolver&) = delete;
+    ClassResolver& operator=(const ClassResolver&) = delete;
+
+    // The first non-null loader is kept for the life of the process; a
+    // different one later is ignored, as cached results came from the first.
+    void setLoader(JNIEnv* env, jobject loader);
+    // The loader in use, or nullptr before one is set.
+    jobject currentLoader();
+
+    // Returns a global reference owned by the resolver, or nullptr.
+    jclass resolve(JNIEnv* env, const std::string& name);
+
+private:
+    jclass load(JNIEnv* env, const std::string& binaryName);
+
+    std::mutex mutex;
+    jobject loader = nullptr;
+    ConcurrentMap<jclass> classes;
+    // Binary names of recent misses, oldest first in `missOrder`.
+    std::unordered_set<std::string> misses;
+    std::deque<std::string> missOrder;
+};
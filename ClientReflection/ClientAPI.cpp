@@ -1,13 +1,24 @@
 #include "pch.h"
 #include "ClientAPI.hpp"
-#include <iostream>
+#include "Executor.hpp"
+#include "JavaTypes.hpp"
+#include "RequestToken.hpp"
+#include "Log.hpp"
+#include <algorithm>
+#include <cstring>
 #include <utility>
 #include <type_traits>
 #include <memory>
 #include <functional>
 
 void DisplayErrorMessage(const std::wstring& message) {
+#ifdef _WIN32
     MessageBoxW(NULL, message.c_str(), L"Error", MB_OK | MB_ICONERROR);
+#else
+    // Hosts without a desktop, such as the benchmark's embedded JVM, get the
+    // message in the log instead. Messages are ASCII.
+    LOG_ERROR(std::string(message.begin(), message.end()));
+#endif
 }
 
 bool checkAndClearException(JNIEnv* env) {
@@ -15,16 +26,13 @@ bool checkAndClearException(JNIEnv* env) {
         jthrowable exception = env->ExceptionOccurred();
         env->ExceptionClear();
 
-        jclass throwableClass = env->FindClass("java/lang/Throwable");
-        jmethodID toStringMethod = env->GetMethodID(throwableClass, "toString", "()Ljava/lang/String;");
-        jstring exceptionString = (jstring)env->CallObjectMethod(exception, toStringMethod);
+        jstring exceptionString = (jstring)env->CallObjectMethod(exception, javaTypes(env).toString);
         const char* exceptionCString = env->GetStringUTFChars(exceptionString, JNI_FALSE);
         std::wstring message = L"JNI Exception: " + std::wstring(exceptionCString, exceptionCString + strlen(exceptionCString));
         DisplayErrorMessage(message);
 
         env->ReleaseStringUTFChars(exceptionString, exceptionCString);
         env->DeleteLocalRef(exceptionString);
-        env->DeleteLocalRef(throwableClass);
         return true;
     }
     return false;
@@ -32,13 +40,22 @@ bool checkAndClearException(JNIEnv* env) {
 
 ClientAPI::ClientAPI() {
     jvm = nullptr;
-    env = nullptr;
 
     injector = nullptr;
     client = nullptr;
-    cache = new Cache();
+    metadata = std::make_shared<Cache::Metadata>();
+    handles = std::make_shared<HandleTable>();
+    classes = std::make_shared<ClassResolver>();
+    memo = std::make_shared<TickMemo>();
+    clientThread = nullptr;
+    subscriptions = new SubscriptionManager();
+    deltas = new DeltaTracker();
+    watches = new FieldWatches();
+    catalog = new ClassCatalog();
+    capture = new FrameCapture();
 
     applet = nullptr;
+    canvas = nullptr;
     classLoader = nullptr;
     frame = nullptr;
 
@@ -48,11 +65,56 @@ ClientAPI::ClientAPI() {
         DisplayErrorMessage(L"No JVM found");
         exit(1);
     }
-    ret = jvm->AttachCurrentThread((void**)&env, NULL);
-    if (ret != JNI_OK) {
+    if (Env() == nullptr) {
         DisplayErrorMessage(L"Failed to attach to JVM");
         exit(1);
     }
+    javaTypes(Env());
+}
+
+JNIEnv* ClientAPI::Env() const {
+    // Executor workers are attached once when they start; any other thread
+    // that calls in is attached as a daemon on first use.
+    if (JNIEnv* workerEnv = Executor::currentEnv()) {
+        return workerEnv;
+    }
+    static thread_local JNIEnv* threadEnv = nullptr;
+    if (threadEnv == nullptr && jvm != nullptr) {
+        if (jvm->GetEnv((void**)&threadEnv, JNI_VERSION_1_6) == JNI_EDETACHED) {
+            jvm->AttachCurrentThreadAsDaemon((void**)&threadEnv, nullptr);
+        }
+    }
+    return threadEnv;
+}
+
+Cache& ClientAPI::View() {
+    static thread_local Cache* threadView = nullptr;
+    static thread_local ClientAPI* threadViewOwner = nullptr;
+    if (threadViewOwner == this) {
+        return *threadView;
+    }
+
+    std::lock_guard<std::mutex> lock(viewsMutex);
+    auto& view = views[std::this_thread::get_id()];
+    if (!view) {
+        view = std::make_unique<Cache>();
+        view->metadata = metadata;
+        view->handles = handles;
+        view->classes = classes;
+        view->memo = memo;
+        view->viewForThread = [this]() -> Cache& { return View(); };
+        for (const auto& root : roots) {
+            view->registerRoot(Env(), root.first, root.second);
+        }
+    }
+    threadView = view.get();
+    threadViewOwner = this;
+    return *view;
+}
+
+bool ClientAPI::EnsureClient() {
+    std::lock_guard<std::mutex> lock(clientMutex);
+    return this->client != nullptr || getClient() != nullptr;
 }
 
 bool ClientAPI::AttachToThread(JNIEnv** Thread)
@@ -74,9 +136,11 @@ bool ClientAPI::DetachThread(JNIEnv** Thread)
 
 
 jobject ClientAPI::getClient() {
+    JNIEnv* env = Env();
+    Cache& cache = View();
     jclass runeLiteClass = env->FindClass("net/runelite/client/RuneLite");
     if (checkAndClearException(env)) {
-        MessageBoxW(NULL, L"Failed to find RuneLite class", L"Error", MB_OK | MB_ICONERROR);
+        DisplayErrorMessage(L"Failed to find RuneLite class");
 		return nullptr;
 	}
 
@@ -85,9 +149,9 @@ jobject ClientAPI::getClient() {
     jobject injector = env->GetStaticObjectField(runeLiteClass, injectorField);
     checkAndClearException(env);
     this->injector = env->NewGlobalRef(injector);
-    this->cache->cacheObjectMethods(env, injector);
-    //this->cache->cacheObjectMethods(env, injector);
-    jclass injectorClass = this->cache->getClass(env, "InjectorClass", injector);
+    cache.cacheObjectMethods(env, injector);
+    //cache.cacheObjectMethods(env, injector);
+    jclass injectorClass = cache.getClass(env, "InjectorClass", injector);
     checkAndClearException(env);
     jmethodID getInstanceMethod = env->GetMethodID(injectorClass, "getInstance", "(Ljava/lang/Class;)Ljava/lang/Object;");
     checkAndClearException(env);
@@ -99,158 +163,159 @@ jobject ClientAPI::getClient() {
     checkAndClearException(env);
     jobject client = env->GetObjectField(runeLiteClient, clientField);
     checkAndClearException(env);
-    jclass clientClass = this->cache->getClass(env, "ClientClass", client);
+    jclass clientClass = cache.getClass(env, "ClientClass", client);
     checkAndClearException(env);
     this->client = env->NewGlobalRef(client);
-    this->cache->cacheObjectMethods(env, client);
+    // The client's classes come from the game's loader, not the system one.
+    jobject loader = env->CallObjectMethod(clientClass, javaTypes(env).getClassLoader);
+    checkAndClearException(env);
+    classes->setLoader(env, loader);
+    env->DeleteLocalRef(loader);
+    {
+        std::lock_guard<std::mutex> lock(viewsMutex);
+        roots.emplace_back("Client", this->client);
+        for (auto& view : views) {
+            view.second->registerRoot(env, "Client", client);
+        }
+    }
+    if (this->clientThread == nullptr) {
+        this->clientThread = new ClientThread(env, this->injector);
+    }
     return client;
 }
 
 bool ClientAPI::IsDecendentOf(jobject object, const char* className) const noexcept
 {
+    JNIEnv* env = Env();
     auto cls = make_safe_local<jclass>(env->FindClass(className));
     return env->IsInstanceOf(object, cls.get());
 }
 
 bool ClientAPI::Initialize() noexcept
 {
-    this->frame = env->NewGlobalRef(env->FindClass("java/awt/Window"));
-    if (!this->frame)
+    // The components found last time are trusted until the next check; a
+    // check costs a few weak reference comparisons and one isDisplayable call,
+    // and walking the windows again only happens when they went stale.
+    constexpr auto kRecheck = std::chrono::seconds(1);
+    auto now = std::chrono::steady_clock::now();
+    if (now - this->awtChecked < kRecheck) {
+        return false;
+    }
+    this->awtChecked = now;
+
+    JNIEnv* env = Env();
+    if (AwtCurrent(env)) {
+        return false;
+    }
+    ReleaseAwt(env);
+
+    const JavaTypes& types = javaTypes(env);
+    if (!types.getWindows || !types.containerClass || !types.getComponents)
     {
-		std::cout << "Failed to find frame" << std::endl;
-		return false;
-	}
+        LOG_DEBUG("No AWT to search");
+        return false;
+    }
     using Result = std::unique_ptr<typename std::remove_pointer<jobject>::type, std::function<void(jobject)>>;
-    std::function<Result(jobject)> findApplet = [&](jobject component) -> Result {
-        if (component && this->IsDecendentOf(component, "java/awt/Container"))
+    // Depth first search below `component` for an instance of `type`.
+    std::function<Result(jobject, jclass)> find = [&](jobject component, jclass type) -> Result {
+        if (!component || !type || !env->IsInstanceOf(component, types.containerClass))
         {
-            auto cls = make_safe_local<jclass>(env->GetObjectClass(component));
-            jmethodID mid = env->GetMethodID(cls.get(), "getComponents", "()[Ljava/awt/Component;");
-
-            if (mid)
-            {
-                auto components = make_safe_local<jobjectArray>(env->CallObjectMethod(component, mid));
-                jint len = env->GetArrayLength(components.get());
-
-                for (jint i = 0; i < len; ++i)
-                {
-                    auto component = make_safe_local<jobject>(env->GetObjectArrayElement(components.get(), i));
-                    auto applet_class = make_safe_local<jclass>(env->FindClass("java/applet/Applet"));
-                    if (env->IsInstanceOf(component.get(), applet_class.get()))
-                    {
-                        std::cout << "Found applet component" << std::endl;
-                        return component;
-                    }
-
-                    auto result = findApplet(component.get());
-                    if (result)
-                    {
-                        std::cout << "Found applet result" << std::endl;
-                        return result;
-                    }
-                }
-            }
-            else {
-				std::cout << "Failed to find components" << std::endl;
-			}
+            return {};
         }
-
-        return {};
-    };
-
-    std::function<Result(jobject)> findCanvas = [&](jobject component) -> Result {
-        if (component && this->IsDecendentOf(component, "java/awt/Container"))
+        auto components = make_safe_local<jobjectArray>(env->CallObjectMethod(component, types.getComponents));
+        jint len = components ? env->GetArrayLength(components.get()) : 0;
+        for (jint i = 0; i < len; ++i)
         {
-            std::cout << "Found container" << std::endl;
-            auto cls = make_safe_local<jclass>(env->GetObjectClass(component));
-            jmethodID mid = env->GetMethodID(cls.get(), "getComponents", "()[Ljava/awt/Component;");
-
-            if (mid)
+            auto child = make_safe_local<jobject>(env->GetObjectArrayElement(components.get(), i));
+            if (env->IsInstanceOf(child.get(), type))
             {
-                auto components = make_safe_local<jobjectArray>(env->CallObjectMethod(component, mid));
-                jint len = env->GetArrayLength(components.get());
-                std::cout << "iterating components" << std::endl;
-                for (jint i = 0; i < len; ++i)
-                {
-                    //Some java.awt.Panel.
-                    auto component = make_safe_local<jobject>(env->GetObjectArrayElement(components.get(), i));
-                    auto canvas_class = make_safe_local<jclass>(env->FindClass("java/awt/Canvas"));
-                    if (env->IsInstanceOf(component.get(), canvas_class.get()))
-                    {
-                        return component;
-                    }
-
-                    auto result = findCanvas(component.get());
-                    if (result)
-                    {
-                        return result;
-                    }
-                }
+                return child;
             }
-            else {
-                std::cout << "Failed to find components" << std::endl;
+            auto result = find(child.get(), type);
+            if (result)
+            {
+                return result;
             }
         }
-        std::cout << "component not descendent or is null" << std::endl;
         return {};
     };
 
-    std::function<Result(jobject)> getParent = [&](jobject component) -> Result {
-        if (component)
+    auto windows = make_safe_local<jobjectArray>(env->CallStaticObjectMethod(types.windowClass, types.getWindows));
+    checkAndClearException(env);
+    jint count = windows ? env->GetArrayLength(windows.get()) : 0;
+    for (jint i = 0; i < count && !this->applet; ++i)
+    {
+        auto window = make_safe_local<jobject>(env->GetObjectArrayElement(windows.get(), i));
+        Result applet = find(window.get(), types.appletClass);
+        Result canvas = find(applet ? applet.get() : window.get(), types.canvasClass);
+        if (!applet && canvas && types.getParent)
         {
-            auto cls = make_safe_local<jclass>(env->GetObjectClass(component));
-            if (cls)
+            applet = make_safe_local<jobject>(env->CallObjectMethod(canvas.get(), types.getParent));
+        }
+        if (applet)
+        {
+            this->frame = env->NewWeakGlobalRef(window.get());
+            this->applet = env->NewWeakGlobalRef(applet.get());
+            this->canvas = canvas ? env->NewWeakGlobalRef(canvas.get()) : nullptr;
+            if (!this->classLoader)
             {
-                jmethodID mid = env->GetMethodID(cls.get(), "getParent", "()Ljava/awt/Container;");
-                if (mid)
-                {
-                    std::cout << "Found parent" << std::endl;
-                    return make_safe_local<jobject>(env->CallObjectMethod(component, mid));
-                }
-            }
-            else {
-                std::cout << "Failed to find component class" << std::endl;
+                auto clsObj = make_safe_local<jobject>(env->CallObjectMethod(applet.get(), types.getClass));
+                this->classLoader = env->NewGlobalRef(make_safe_local<jobject>(env->CallObjectMethod(clsObj.get(), types.getClassLoader)).get());
+                classes->setLoader(env, this->classLoader);
             }
         }
-        std::cout << "Failed to find parent" << std::endl;
-        return {};
-    };
-
-    //Find Canvas Class.
-    this->applet = findApplet(frame).release();
+    }
     if (!this->applet)
     {
-        this->applet = getParent(findCanvas(frame).get()).release();
+        LOG_DEBUG("Failed to find applet");
+        return false;
     }
+    return true;
+}
 
-    if (this->applet)
+bool ClientAPI::AwtCurrent(JNIEnv* env)
+{
+    // A weak reference compares equal to null once its component has been
+    // collected; a component the client removed from its window stops being
+    // displayable well before that.
+    if (!this->applet || env->IsSameObject(this->applet, nullptr) || env->IsSameObject(this->frame, nullptr))
     {
-        this->frame = env->NewGlobalRef(frame);
-        env->DeleteLocalRef(std::exchange(this->applet, env->NewGlobalRef(this->applet)));
-
-        auto cls = make_safe_local<jclass>(env->GetObjectClass(this->applet));
-        jmethodID mid = env->GetMethodID(cls.get(), "getClass", "()Ljava/lang/Class;");
-        auto clsObj = make_safe_local<jobject>(env->CallObjectMethod(this->applet, mid));
-        cls.reset(env->GetObjectClass(clsObj.get()));
-
-        //Get Canvas's ClassLoader.
-        mid = env->GetMethodID(cls.get(), "getClassLoader", "()Ljava/lang/ClassLoader;");
-        this->classLoader = env->NewGlobalRef(make_safe_local<jobject>(env->CallObjectMethod(clsObj.get(), mid)).get());
-        return true;
+        return false;
     }
-    else {
-        std::cout << "Failed to find applet" << std::endl;
+    if (this->canvas && env->IsSameObject(this->canvas, nullptr))
+    {
+        return false;
     }
+    jmethodID isDisplayable = javaTypes(env).isDisplayable;
+    if (!isDisplayable)
+    {
+        return true;
+    }
+    auto component = make_safe_local<jobject>(env->NewLocalRef(this->canvas ? this->canvas : this->applet));
+    bool displayable = component && env->CallBooleanMethod(component.get(), isDisplayable);
+    checkAndClearException(env);
+    return displayable;
+}
 
-    return false;
+void ClientAPI::ReleaseAwt(JNIEnv* env)
+{
+    for (jweak* component : { &this->frame, &this->applet, &this->canvas })
+    {
+        if (*component)
+        {
+            env->DeleteWeakGlobalRef(std::exchange(*component, nullptr));
+        }
+    }
 }
 
 std::string ClientAPI::GetClassName(jobject object) const noexcept
 {
+    JNIEnv* env = Env();
     auto getClassName = [&](jobject object) -> std::string {
-        auto cls = make_safe_local<jclass>(env->GetObjectClass(object));
-        jmethodID mid = env->GetMethodID(cls.get(), "getName", "()Ljava/lang/String;");
-        auto strObj = make_safe_local<jstring>(env->CallObjectMethod(object, mid));
+        // Names a class object itself, or else the class of the object.
+        const JavaTypes& types = javaTypes(env);
+        auto cls = make_safe_local<jobject>(env->IsInstanceOf(object, types.classClass) ? env->NewLocalRef(object) : env->GetObjectClass(object));
+        auto strObj = make_safe_local<jstring>(env->CallObjectMethod(cls.get(), types.getName));
 
         if (strObj)
         {
@@ -264,44 +329,28 @@ std::string ClientAPI::GetClassName(jobject object) const noexcept
     return getClassName(object);
 }
 
-void ClientAPI::PrintClasses() const noexcept
-{
-    if (this->classLoader)
-    {
-        auto clsLoaderClass = make_safe_local<jclass>(env->GetObjectClass(classLoader));
-        jfieldID field = env->GetFieldID(clsLoaderClass.get(), "classes", "Ljava/util/Vector;");
-        auto classes = make_safe_local<jobject>(env->GetObjectField(classLoader, field));
-        jmethodID toArray = env->GetMethodID(make_safe_local<jclass>(env->GetObjectClass(classes.get())).get(), "toArray", "()[Ljava/lang/Object;");
-        auto clses = make_safe_local<jobjectArray>(env->CallObjectMethod(classes.get(), toArray));
-
-        std::cout << "LOADED CLASSES:\n" << std::endl;
-        for (int i = 0; i < env->GetArrayLength(clses.get()); ++i)
-        {
-            auto clsObj = make_safe_local<jobject>(env->GetObjectArrayElement(clses.get(), i));
-            std::string name = this->GetClassName(clsObj.get());
-            std::cout << name << std::endl;
-        }
-        fflush(stdout);
-    }
-}
-
-std::string ClientAPI::ProcessInstruction(const std::string& instruction) {
-    if (this->client == nullptr && !getClient()) {
+std::string ClientAPI::ProcessInstruction(const std::string& instruction, Encoding encoding) {
+    if (!EnsureClient()) {
         DisplayErrorMessage(L"Invalid state: no client");
         return "";
     }
-    if (!this->env) {
+    JNIEnv* env = Env();
+    if (!env) {
         DisplayErrorMessage(L"Invalid state: no env");
         return "";
     }
 
-    std::cout << "Total number of methods in methodCache: " << this->cache->methodCache.size() << std::endl;
-    if (Initialize()) {
-    	std::cout << "Initialized" << std::endl;
+    Cache& cache = View();
+    LOG_DEBUG("Total number of methods in methodCache: " << cache.metadata->methods.size());
+    {
+        std::lock_guard<std::mutex> lock(discoveryMutex);
+        if (Initialize()) {
+            LOG_INFO("Initialized");
+        }
     }
-    PrintClasses();
     try {
-        return this->cache->executeMethod(env, instruction);
+        cache.refreshMemo(env);
+        return cache.executeMethod(env, instruction, encoding);
         checkAndClearException(env);
     }
     catch (const std::exception& e) {
@@ -312,3 +361,217 @@ std::string ClientAPI::ProcessInstruction(const std::string& instruction) {
 
     return "failure";
 }
+
+std::vector<std::string> ClientAPI::ProcessBatch(const std::string& queries, Encoding encoding) {
+    if (!EnsureClient()) {
+        DisplayErrorMessage(L"Invalid state: no client");
+        return {};
+    }
+
+    std::vector<Plan> plans = compileBatch(queries);
+    std::vector<std::string> results(plans.size());
+    // The request's deadline follows the batch to whichever thread runs it.
+    const RequestToken* token = RequestToken::current();
+    auto executeRange = [&](JNIEnv* threadEnv, size_t begin, size_t end) {
+        RequestToken::Scope scope(token);
+        Cache& cache = View();
+        cache.refreshMemo(threadEnv);
+        for (size_t i = begin; i < end; i++) {
+            try {
+                results[i] = cache.executePlan(threadEnv, plans[i], encoding);
+            }
+            catch (const std::exception& e) {
+                results[i] = encoding == Encoding::Binary ? ValueWriter::error(e.what()) : "";
+            }
+        }
+    };
+    auto execute = [&](JNIEnv* threadEnv) {
+        executeRange(threadEnv, 0, plans.size());
+    };
+
+    // Run the whole batch in one client thread task so every value is read
+    // from the same tick. Without RuneLite's ClientThread there is no tick to
+    // stay consistent with, and the queries are spread over the workers.
+    if (this->clientThread == nullptr || !this->clientThread->isValid()) {
+        Executor* executor = Executor::current();
+        if (executor != nullptr && Executor::currentEnv() != nullptr) {
+            executor->parallelFor(plans.size(), 1, [&](size_t begin, size_t end) {
+                JNIEnv* taskEnv = Executor::currentEnv();
+                taskEnv->PushLocalFrame(16);
+                executeRange(taskEnv, begin, end);
+                taskEnv->PopLocalFrame(nullptr);
+            });
+        }
+        else {
+            execute(Env());
+        }
+    }
+    else {
+        auto timeout = std::chrono::milliseconds(2000);
+        if (token != nullptr && token->hasDeadline()) {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(token->remaining());
+            timeout = std::clamp(remaining, std::chrono::milliseconds(0), timeout);
+        }
+        if (!this->clientThread->invokeAndWait(Env(), execute, timeout)) {
+            LOG_WARN("Timed out waiting for the client thread");
+            std::string reason = token != nullptr && !token->check().empty() ? token->check() : "Timed out waiting for the client thread";
+            for (auto& result : results) {
+                result = encoding == Encoding::Binary ? ValueWriter::error(reason) : "";
+            }
+        }
+    }
+    return results;
+}
+
+std::string ClientAPI::Subscribe(uint64_t connection, uint32_t id, const std::string& query, uint32_t interval, SubscriptionManager::Sink sink) {
+    if (!EnsureClient()) {
+        return ValueWriter::error("Invalid state: no client");
+    }
+
+    JNIEnv* env = Env();
+    Cache& cache = View();
+    Plan plan = compilePlan(query);
+    cache.refreshMemo(env);
+    std::string initial = cache.executePlan(env, plan, Encoding::Binary);
+    this->subscriptions->subscribe(connection, id, plan, interval, initial, std::move(sink));
+    StartTicking();
+    return initial;
+}
+
+void ClientAPI::StartTicking() {
+    // Subscriptions and field watches are evaluated, and frames captured, at
+    // the end of every client thread drain until the last one is removed.
+    if (this->clientThread != nullptr && this->clientThread->isValid()) {
+        this->clientThread->startTicking(Env(), [this](JNIEnv* threadEnv) {
+            Cache& cache = View();
+            int64_t tick = cache.refreshMemo(threadEnv);
+            bool subscribed = this->subscriptions->evaluate(threadEnv, cache, tick);
+            bool watching = this->watches->flush(threadEnv, cache);
+            this->capture->capture(threadEnv, cache);
+            bool capturing = this->capture->isActive();
+            return subscribed || watching || capturing;
+        });
+    }
+}
+
+std::string ClientAPI::Watch(uint64_t connection, uint32_t id, const std::string& query, const std::string& field, const std::string& signature, SubscriptionManager::Sink sink) {
+    if (!EnsureClient()) {
+        return ValueWriter::error("Invalid state: no client");
+    }
+    std::string error;
+    if (!this->watches->initialize(jvm, error)) {
+        return ValueWriter::error(error);
+    }
+
+    JNIEnv* env = Env();
+    Cache& cache = View();
+    Plan plan = compilePlan(query);
+    std::string initial;
+    cache.refreshMemo(env);
+    env->PushLocalFrame(16);
+    Cache::Evaluation target = cache.evaluatePlan(env, plan);
+    if (!target.error.empty()) {
+        error = target.error;
+    }
+    else if ((target.type[0] != 'L' && target.type[0] != '[') || target.value.l == nullptr) {
+        error = "Watch target " + query + " is not an object";
+    }
+    else {
+        error = this->watches->watch(env, cache, connection, id, target.value.l, field, signature, std::move(sink), initial);
+    }
+    env->PopLocalFrame(nullptr);
+    if (!error.empty()) {
+        return ValueWriter::error(error);
+    }
+    StartTicking();
+    return initial;
+}
+
+bool ClientAPI::Unsubscribe(uint64_t connection, uint32_t id) {
+    bool subscribed = this->subscriptions->unsubscribe(connection, id);
+    bool watched = this->watches->unwatch(connection, id);
+    return subscribed || watched;
+}
+
+std::string ClientAPI::ProcessDelta(uint64_t connection, const std::string& query, uint32_t keyColumn) {
+    if (!EnsureClient()) {
+        return ValueWriter::error("Invalid state: no client");
+    }
+
+    Plan plan = compilePlan(query);
+    if (plan.columns.empty()) {
+        return ValueWriter::error("Delta queries must be projections");
+    }
+    JNIEnv* env = Env();
+    Cache& cache = View();
+    Table table;
+    cache.refreshMemo(env);
+    std::string error = cache.executeProjection(env, plan, table);
+    if (!error.empty()) {
+        return ValueWriter::error(error);
+    }
+    return this->deltas->encode(connection, query, keyColumn, std::move(table));
+}
+
+void ClientAPI::DropConnection(uint64_t connection) {
+    this->subscriptions->drop(connection);
+    this->deltas->drop(connection);
+    this->watches->drop(connection);
+}
+
+Table ClientAPI::Catalog(const std::string& query, Encoding encoding) {
+    // Caps a prefix that matches most of the client.
+    constexpr size_t kRows = 1000;
+    if (!EnsureClient()) {
+        return Table();
+    }
+    this->catalog->refresh(Env(), this->classes->currentLoader());
+    if (query.rfind("member ", 0) == 0) {
+        return this->catalog->findMembers(query.substr(7), kRows, encoding);
+    }
+    if (query.rfind("of ", 0) == 0) {
+        return this->catalog->membersOf(query.substr(3), encoding);
+    }
+    return this->catalog->findClasses(query, kRows, encoding);
+}
+
+std::string ClientAPI::Capture(const std::string& argument, Encoding encoding) {
+    auto failure = [encoding](const std::string& message) {
+        LOG_WARN("Capture failed: " << message);
+        return encoding == Encoding::Binary ? ValueWriter::error(message) : "";
+    };
+    ValueWriter writer;
+    std::string text;
+    if (argument == "off") {
+        this->capture->stop();
+        writer.writeBool(true);
+        text = "true";
+        return encoding == Encoding::Binary ? writer.release() : text;
+    }
+    if (!EnsureClient()) {
+        return failure("Invalid state: no client");
+    }
+
+    JNIEnv* env = Env();
+    Cache& cache = View();
+    cache.refreshMemo(env);
+    if (argument == "on" || argument.rfind("on ", 0) == 0) {
+        std::string source = argument.substr(2);
+        source.erase(0, source.find_first_not_of(' '));
+        std::string error = this->capture->start(env, cache, source.empty() ? "Client.getBufferProvider" : source, text);
+        if (!error.empty()) {
+            return failure(error);
+        }
+        StartTicking();
+        writer.writeString(text);
+    }
+    else {
+        uint64_t sequence = this->capture->capture(env, cache);
+        if (sequence == 0) {
+            return failure(this->capture->isActive() ? "Frame not captured" : "Capture is not started");
+        }
+        writer.writeInt(static_cast<int64_t>(sequence));
+        text = std::to_string(sequence);
+    }
+    return encoding == Encoding::Binary ? writer.release() : text;
+}
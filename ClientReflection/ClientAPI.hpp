@@ -6,6 +6,17 @@
 #include <vector>
 #include <unordered_map>
 #include "Cache.hpp"
+#include "ClientThread.hpp"
+#include "Plan.hpp"
+#include "Subscriptions.hpp"
+#include "ClassCatalog.hpp"
+#include "FrameCapture.hpp"
+#include "Delta.hpp"
+#include "Watches.hpp"
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include <thread>
 
 typedef int (*ptr_GCJavaVMs)(JavaVM** vmBuf, jsize bufLen, jsize* nVMs);
 typedef jobject(JNICALL* ptr_GetComponent)(JNIEnv* env, void* platformInfo);
@@ -18,9 +29,21 @@ struct AWTRectangle
 class ClientAPI {
 public:
     ClientAPI();
-    std::string ProcessInstruction(const std::string& instruction);
+    std::string ProcessInstruction(const std::string& instruction, Encoding encoding = Encoding::Text);
+    std::vector<std::string> ProcessBatch(const std::string& queries, Encoding encoding = Encoding::Text);
+    std::string Subscribe(uint64_t connection, uint32_t id, const std::string& query, uint32_t interval, SubscriptionManager::Sink sink);
+    bool Unsubscribe(uint64_t connection, uint32_t id);
+    std::string Watch(uint64_t connection, uint32_t id, const std::string& query, const std::string& field, const std::string& signature, SubscriptionManager::Sink sink);
+    std::string ProcessDelta(uint64_t connection, const std::string& query, uint32_t keyColumn);
+    void DropConnection(uint64_t connection);
+    // "member <prefix>" finds members by name, "of <class>" lists the members
+    // of one class, anything else is a class name prefix.
+    Table Catalog(const std::string& query, Encoding encoding = Encoding::Text);
+    // "on [source]" starts copying frames into shared memory and returns the
+    // region's name, "off" stops, and an empty argument copies one frame now
+    // and returns its sequence number.
+    std::string Capture(const std::string& argument, Encoding encoding = Encoding::Text);
 
-    void PrintClasses() const noexcept;
     bool Initialize() noexcept;
     bool IsDecendentOf(jobject object, const char* className) const noexcept;
     std::string GetClassName(jobject object) const noexcept;
@@ -28,25 +51,56 @@ public:
     bool AttachToThread(JNIEnv** Thread);
     bool DetachThread(JNIEnv** Thread);
     jobject getClient();
-    Cache* cache;
+    bool EnsureClient();
+    JNIEnv* Env() const;
+    Cache& View();
+    ClientThread* clientThread;
+    SubscriptionManager* subscriptions;
+    DeltaTracker* deltas;
+    FieldWatches* watches;
+    ClassCatalog* catalog;
+    FrameCapture* capture;
 
 private:
     JavaVM* jvm;
-    JNIEnv* env;
 
     jobject injector;
     jobject client;
-    jobject frame;
-    jobject applet;
+    // The client's window, applet and game canvas, held weakly so a UI the
+    // client replaces can be collected. Found again once they go stale.
+    jweak frame;
+    jweak applet;
+    jweak canvas;
     jobject classLoader;
+    std::chrono::steady_clock::time_point awtChecked;
+
+    // Every thread that executes queries has its own Cache view for its roots.
+    // Resolved metadata, the handle table, resolved classes and the tick memo
+    // are shared by all views; roots are registered into each view when it is
+    // created.
+    std::mutex viewsMutex;
+    std::unordered_map<std::thread::id, std::unique_ptr<Cache>> views;
+    std::vector<std::pair<std::string, jobject>> roots;
+    std::shared_ptr<Cache::Metadata> metadata;
+    std::shared_ptr<HandleTable> handles;
+    std::shared_ptr<ClassResolver> classes;
+    std::shared_ptr<TickMemo> memo;
+
+    std::mutex clientMutex;
+    // Guards the AWT members above.
+    std::mutex discoveryMutex;
+
+    void StartTicking();
+    bool AwtCurrent(JNIEnv* env);
+    void ReleaseAwt(JNIEnv* env);
 
     template<typename T>
     auto make_safe_local(auto object) const noexcept
     {
-        auto deleter = [&](T ptr) {
+        auto deleter = [this](T ptr) {
             if (jvm && ptr)
             {
-                env->DeleteLocalRef(static_cast<jobject>(ptr));
+                Env()->DeleteLocalRef(static_cast<jobject>(ptr));
             }
         };
 
@@ -1,7 +1,256 @@
+#include "pch.h"
 #include "ClientThread.hpp"
+#include "Trace.hpp"
+#include "Log.hpp"
+#include <condition_variable>
+#include <memory>
+#include <utility>
 
-void ClientThread::invokeOnClientThread(std::function<void()> task) {
-    env->CallVoidMethod(clientThread, invokeMethod, env->NewObject(env->FindClass("java/lang/Runnable"), env->GetMethodID(env->FindClass("java/lang/Runnable"), "<init>", "()V"), [task] () {
-        task();
-    }));
+ClientThread* ClientThread::instance = nullptr;
+
+// Class file for:
+//
+//     package jrb;
+//     public final class NativeRunnable implements Runnable {
+//         public native void run();
+//     }
+static const unsigned char nativeRunnableClass[] = {
+    0xCA, 0xFE, 0xBA, 0xBE, 0x00, 0x00, 0x00, 0x34, 0x00, 0x0D, 0x0A, 0x00, 0x03, 0x00, 0x09, 0x07,
+    0x00, 0x0A, 0x07, 0x00, 0x0B, 0x07, 0x00, 0x0C, 0x01, 0x00, 0x06, 0x3C, 0x69, 0x6E, 0x69, 0x74,
+    0x3E, 0x01, 0x00, 0x03, 0x28, 0x29, 0x56, 0x01, 0x00, 0x04, 0x43, 0x6F, 0x64, 0x65, 0x01, 0x00,
+    0x03, 0x72, 0x75, 0x6E, 0x0C, 0x00, 0x05, 0x00, 0x06, 0x01, 0x00, 0x12, 0x6A, 0x72, 0x62, 0x2F,
+    0x4E, 0x61, 0x74, 0x69, 0x76, 0x65, 0x52, 0x75, 0x6E, 0x6E, 0x61, 0x62, 0x6C, 0x65, 0x01, 0x00,
+    0x10, 0x6A, 0x61, 0x76, 0x61, 0x2F, 0x6C, 0x61, 0x6E, 0x67, 0x2F, 0x4F, 0x62, 0x6A, 0x65, 0x63,
+    0x74, 0x01, 0x00, 0x12, 0x6A, 0x61, 0x76, 0x61, 0x2F, 0x6C, 0x61, 0x6E, 0x67, 0x2F, 0x52, 0x75,
+    0x6E, 0x6E, 0x61, 0x62, 0x6C, 0x65, 0x00, 0x31, 0x00, 0x02, 0x00, 0x03, 0x00, 0x01, 0x00, 0x04,
+    0x00, 0x00, 0x00, 0x02, 0x00, 0x01, 0x00, 0x05, 0x00, 0x06, 0x00, 0x01, 0x00, 0x07, 0x00, 0x00,
+    0x00, 0x11, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x05, 0x2A, 0xB7, 0x00, 0x01, 0xB1, 0x00,
+    0x00, 0x00, 0x00, 0x01, 0x01, 0x00, 0x08, 0x00, 0x06, 0x00, 0x00, 0x00, 0x00,
+};
+
+ClientThread::ClientThread(JNIEnv* env)
+    : jvm(nullptr), clientThreadClass(nullptr), clientThread(nullptr), invokeMethod(nullptr), invokeLaterMethod(nullptr), runnable(nullptr), scheduled(false) {
+    jclass runeLiteClass = env->FindClass("net/runelite/client/RuneLite");
+    if (runeLiteClass == nullptr || env->ExceptionCheck()) {
+        env->ExceptionClear();
+        return;
+    }
+    jfieldID injectorField = env->GetStaticFieldID(runeLiteClass, "injector", "Lcom/google/inject/Injector;");
+    jobject injector = env->GetStaticObjectField(runeLiteClass, injectorField);
+    initialize(env, injector);
+    env->DeleteLocalRef(injector);
+    env->DeleteLocalRef(runeLiteClass);
+}
+
+ClientThread::ClientThread(JNIEnv* env, jobject injector)
+    : jvm(nullptr), clientThreadClass(nullptr), clientThread(nullptr), invokeMethod(nullptr), invokeLaterMethod(nullptr), runnable(nullptr), scheduled(false) {
+    initialize(env, injector);
+}
+
+ClientThread::~ClientThread() {
+    if (instance == this) {
+        instance = nullptr;
+    }
+    JNIEnv* env = nullptr;
+    if (jvm == nullptr || jvm->GetEnv((void**)&env, JNI_VERSION_1_6) != JNI_OK) {
+        return;
+    }
+    if (runnable != nullptr) env->DeleteGlobalRef(runnable);
+    if (clientThread != nullptr) env->DeleteGlobalRef(clientThread);
+    if (clientThreadClass != nullptr) env->DeleteGlobalRef(clientThreadClass);
+}
+
+void ClientThread::initialize(JNIEnv* env, jobject injector) {
+    env->GetJavaVM(&jvm);
+    if (injector == nullptr) {
+        return;
+    }
+
+    jclass threadClass = env->FindClass("net/runelite/client/callback/ClientThread");
+    if (threadClass == nullptr || env->ExceptionCheck()) {
+        env->ExceptionDescribe();
+        env->ExceptionClear();
+        return;
+    }
+    jclass injectorClass = env->GetObjectClass(injector);
+    jmethodID getInstanceMethod = env->GetMethodID(injectorClass, "getInstance", "(Ljava/lang/Class;)Ljava/lang/Object;");
+    jobject thread = env->CallObjectMethod(injector, getInstanceMethod, threadClass);
+    invokeMethod = env->GetMethodID(threadClass, "invoke", "(Ljava/lang/Runnable;)V");
+    invokeLaterMethod = env->GetMethodID(threadClass, "invokeLater", "(Ljava/lang/Runnable;)V");
+    if (thread == nullptr || invokeMethod == nullptr || invokeLaterMethod == nullptr || env->ExceptionCheck()) {
+        env->ExceptionDescribe();
+        env->ExceptionClear();
+        env->DeleteLocalRef(injectorClass);
+        env->DeleteLocalRef(threadClass);
+        return;
+    }
+
+    clientThreadClass = static_cast<jclass>(env->NewGlobalRef(threadClass));
+    clientThread = env->NewGlobalRef(thread);
+    env->DeleteLocalRef(thread);
+    env->DeleteLocalRef(injectorClass);
+    env->DeleteLocalRef(threadClass);
+
+    if (defineRunnable(env)) {
+        instance = this;
+    }
+}
+
+bool ClientThread::defineRunnable(JNIEnv* env) {
+    // Define the class through the system class loader; when the bridge is
+    // injected a second time the class already exists and is looked up instead.
+    jclass loaderClass = env->FindClass("java/lang/ClassLoader");
+    jmethodID getSystemClassLoader = env->GetStaticMethodID(loaderClass, "getSystemClassLoader", "()Ljava/lang/ClassLoader;");
+    jobject loader = env->CallStaticObjectMethod(loaderClass, getSystemClassLoader);
+    jclass runnableClass = env->DefineClass("jrb/NativeRunnable", loader, reinterpret_cast<const jbyte*>(nativeRunnableClass), sizeof(nativeRunnableClass));
+    if (runnableClass == nullptr || env->ExceptionCheck()) {
+        env->ExceptionClear();
+        runnableClass = env->FindClass("jrb/NativeRunnable");
+    }
+    env->DeleteLocalRef(loader);
+    env->DeleteLocalRef(loaderClass);
+    if (runnableClass == nullptr || env->ExceptionCheck()) {
+        env->ExceptionDescribe();
+        env->ExceptionClear();
+        LOG_ERROR("Failed to define jrb/NativeRunnable");
+        return false;
+    }
+
+    JNINativeMethod methods[] = {
+        { (char*)"run", (char*)"()V", (void*)&ClientThread::run }
+    };
+    if (env->RegisterNatives(runnableClass, methods, 1) != JNI_OK) {
+        env->ExceptionDescribe();
+        env->ExceptionClear();
+        env->DeleteLocalRef(runnableClass);
+        return false;
+    }
+
+    jmethodID constructor = env->GetMethodID(runnableClass, "<init>", "()V");
+    jobject object = env->NewObject(runnableClass, constructor);
+    if (object != nullptr) {
+        runnable = env->NewGlobalRef(object);
+        env->DeleteLocalRef(object);
+    }
+    env->DeleteLocalRef(runnableClass);
+    return runnable != nullptr;
+}
+
+void ClientThread::invokeOnClientThread(JNIEnv* env, Task task) {
+    bool schedule;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.push_back(std::move(task));
+        schedule = !std::exchange(scheduled, true);
+    }
+    // Only the first task since the last drain schedules the runnable; later
+    // tasks ride along with it.
+    if (schedule) {
+        this->schedule(env, invokeMethod);
+    }
+}
+
+void ClientThread::schedule(JNIEnv* env, jmethodID method) {
+    env->CallVoidMethod(clientThread, method, runnable);
+    if (env->ExceptionCheck()) {
+        env->ExceptionDescribe();
+        env->ExceptionClear();
+        std::lock_guard<std::mutex> lock(mutex);
+        scheduled = false;
+    }
+}
+
+void ClientThread::startTicking(JNIEnv* env, TickTask task) {
+    bool schedule;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tickTask = std::move(task);
+        schedule = !std::exchange(scheduled, true);
+    }
+    if (schedule) {
+        this->schedule(env, invokeMethod);
+    }
+}
+
+bool ClientThread::invokeAndWait(JNIEnv* env, Task task, std::chrono::milliseconds timeout) {
+    enum class Status { Pending, Running, Done, Abandoned };
+    struct State {
+        std::mutex mutex;
+        std::condition_variable changed;
+        Status status = Status::Pending;
+    };
+    auto state = std::make_shared<State>();
+
+    invokeOnClientThread(env, [state, task = std::move(task)](JNIEnv* env) {
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            if (state->status == Status::Abandoned) {
+                return;
+            }
+            state->status = Status::Running;
+        }
+        task(env);
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->status = Status::Done;
+        }
+        state->changed.notify_all();
+    });
+
+    // Once the client thread has started the task we have to wait for it, since
+    // the task may still be using state owned by the caller.
+    std::unique_lock<std::mutex> lock(state->mutex);
+    if (!state->changed.wait_for(lock, timeout, [&]() { return state->status != Status::Pending; })) {
+        state->status = Status::Abandoned;
+        return false;
+    }
+    state->changed.wait(lock, [&]() { return state->status == Status::Done; });
+    return true;
+}
+
+void ClientThread::drain(JNIEnv* env) {
+    Trace::nameThread("client thread");
+    std::vector<Task> tasks;
+    TickTask tick;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.swap(pending);
+        scheduled = false;
+        tick = tickTask;
+    }
+    for (auto& task : tasks) {
+        try {
+            task(env);
+        }
+        catch (const std::exception& e) {
+            LOG_ERROR("Exception caught in ClientThread.cpp: " << e.what());
+        }
+    }
+
+    // The tick task keeps the runnable scheduled for as long as it has work.
+    // invoke() would run it again immediately on this thread, so use
+    // invokeLater() to come back on the next client cycle.
+    bool again = false;
+    try {
+        again = tick && tick(env);
+    }
+    catch (const std::exception& e) {
+        LOG_ERROR("Exception caught in ClientThread.cpp: " << e.what());
+    }
+    if (again) {
+        bool schedule;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            schedule = !std::exchange(scheduled, true);
+        }
+        if (schedule) {
+            this->schedule(env, invokeLaterMethod);
+        }
+    }
+}
+
+void JNICALL ClientThread::run(JNIEnv* env, jobject) {
+    if (instance != nullptr) {
+        instance->drain(env);
+    }
 }
@@ -2,35 +2,51 @@
 #define CLIENT_THREAD_HPP
 
 #include <jni.h>
+#include <chrono>
 #include <functional>
+#include <mutex>
+#include <vector>
 
+// Runs native tasks on RuneLite's client thread. Tasks are queued from any
+// thread and drained by a single jrb.NativeRunnable (defined at runtime, with
+// its run() method bound to ClientThread::run) handed to ClientThread.invoke.
+// Everything queued before the client thread picks the runnable up is executed
+// in the same tick, for the cost of one invoke.
 class ClientThread {
     public:
-        ClientThread(JNIEnv* env) : env(env) {
-            clientThreadClass = env->FindClass("net/runelite/client/callback/ClientThread");
-            jclass runeLiteClass = env->FindClass("net/runelite/client/RuneLite");
-            jfieldID injectorField = env->GetStaticFieldID(runeLiteClass, "injector", "Lcom/google/inject/Injector;");
-            jobject injector = env->GetStaticObjectField(runeLiteClass, injectorField);
-            jclass injectorClass = env->GetObjectClass(injector);
-            jmethodID getInstanceMethod = env->GetMethodID(injectorClass, "getInstance", "(Ljava/lang/Class;)Ljava/lang/Object;");
-            clientThread = env->CallObjectMethod(injector, getInstanceMethod, clientThreadClass);
-            invokeMethod = env->GetMethodID(clientThreadClass, "invoke", "(Ljava/lang/Runnable;)V");
-        }
-
-        ClientThread(JNIEnv* env, jobject client) : env(env) {
-            clientThreadClass = env->FindClass("net/runelite/client/callback/ClientThread");
-            jmethodID getClientThreadMethod = env->GetMethodID(clientThreadClass, "getClientThread", "()Lnet/runelite/client/callback/ClientThread;");
-            clientThread = env->CallObjectMethod(client, getClientThreadMethod);
-            invokeMethod = env->GetMethodID(clientThreadClass, "invoke", "(Ljava/lang/Runnable;)V");
-        }
+        using Task = std::function<void(JNIEnv*)>;
+        // Returns whether it should run again on the next drain.
+        using TickTask = std::function<bool(JNIEnv*)>;
+
+        ClientThread(JNIEnv* env);
+        ClientThread(JNIEnv* env, jobject injector);
         ~ClientThread();
-        void invokeOnClientThread(std::function<void()> task);
+
+        bool isValid() const { return runnable != nullptr; }
+        void invokeOnClientThread(JNIEnv* env, Task task);
+        bool invokeAndWait(JNIEnv* env, Task task, std::chrono::milliseconds timeout);
+        void startTicking(JNIEnv* env, TickTask task);
 
     private:
-        JNIEnv* env;
+        void initialize(JNIEnv* env, jobject injector);
+        bool defineRunnable(JNIEnv* env);
+        void drain(JNIEnv* env);
+        void schedule(JNIEnv* env, jmethodID method);
+        static void JNICALL run(JNIEnv* env, jobject self);
+
+        JavaVM* jvm;
         jclass clientThreadClass;
         jobject clientThread;
         jmethodID invokeMethod;
+        jmethodID invokeLaterMethod;
+        jobject runnable;
+
+        std::mutex mutex;
+        std::vector<Task> pending;
+        TickTask tickTask;
+        bool scheduled;
+
+        static ClientThread* instance;
     };
 
     #endif // CLIENT_THREAD_HPP
@@ -0,0 +1,111 @@
+#pragma once
+#include "pch.h"
+#include <array>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "Epoch.hpp"
+
+// String keyed map for data that is written once and read by every worker.
+// Lookups take no lock: each shard publishes an immutable snapshot of its
+// index, and writers copy the index, publish the copy and retire the old one
+// through Epoch. Values live in a deque and keep their address until the map
+// is destroyed, so a found value may be used after the lookup returns.
+//
+// Entries are never replaced or removed; inserting an existing key keeps the
+// first value.
+template <typename V>
+class ConcurrentMap {
+public:
+    ConcurrentMap() {
+        for (auto& shard : shards) {
+            shard.index.store(new Index());
+        }
+    }
+
+    ~ConcurrentMap() {
+        for (auto& shard : shards) {
+            delete shard.index.load();
+        }
+    }
+
+    ConcurrentMap(const ConcurrentMap&) = delete;
+    ConcurrentMap& operator=(const ConcurrentMap&) = delete;
+
+    const V* find(const std::string& key) const {
+        const Shard& shard = shardFor(key);
+        Epoch::Guard guard;
+        const Index* index = shard.index.load();
+        auto it = index->find(key);
+        return it == index->end() ? nullptr : it->second;
+    }
+
+    bool contains(const std::string& key) const {
+        return find(key) != nullptr;
+    }
+
+    // Returns the stored value, which is `value` unless the key was present.
+    const V* insert(const std::string& key, V value) {
+        std::vector<std::pair<std::string, V>> entries;
+        entries.emplace_back(key, std::move(value));
+        insert(entries);
+        return find(key);
+    }
+
+    // Publishes every entry with one copy per touched shard, e.g. all methods
+    // of a newly discovered class.
+    void insert(std::vector<std::pair<std::string, V>>& entries) {
+        std::lock_guard<std::mutex> lock(writer);
+        std::array<Index*, kShards> next{};
+        for (auto& entry : entries) {
+            size_t slot = std::hash<std::string>()(entry.first) % kShards;
+            if (next[slot] == nullptr) {
+                next[slot] = new Index(*shards[slot].index.load());
+            }
+            if (next[slot]->find(entry.first) == next[slot]->end()) {
+                values.push_back(std::move(entry.second));
+                (*next[slot])[entry.first] = &values.back();
+            }
+        }
+        for (size_t slot = 0; slot < kShards; slot++) {
+            if (next[slot] != nullptr) {
+                Index* previous = shards[slot].index.exchange(next[slot]);
+                Epoch::retire([previous] { delete previous; });
+            }
+        }
+    }
+
+    // Visits every value; blocks writers, not readers.
+    void forEach(const std::function<void(const V&)>& visit) const {
+        std::lock_guard<std::mutex> lock(writer);
+        for (const auto& value : values) {
+            visit(value);
+        }
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(writer);
+        return values.size();
+    }
+
+private:
+    using Index = std::unordered_map<std::string, const V*>;
+    static constexpr size_t kShards = 16;
+
+    struct alignas(64) Shard {
+        std::atomic<Index*> index{ nullptr };
+    };
+
+    const Shard& shardFor(const std::string& key) const {
+        return shards[std::hash<std::string>()(key) % kShards];
+    }
+
+    std::array<Shard, kShards> shards;
+    mutable std::mutex writer;
+    std::deque<V> values;
+};
@@ -0,0 +1,77 @@
+#include "pch.h"
+#include "Delta.hpp"
+#include <unordered_map>
+#include <vector>
+
+static bool indexRows(const Table& table, uint32_t keyColumn, std::unordered_map<std::string, size_t>& index) {
+    index.reserve(table.rows.size());
+    for (size_t i = 0; i < table.rows.size(); i++) {
+        if (!index.emplace(table.rows[i][keyColumn], i).second) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string DeltaTracker::encode(uint64_t connection, const std::string& query, uint32_t keyColumn, Table table) {
+    std::lock_guard<std::mutex> lock(mutex);
+    ValueWriter writer;
+    auto key = std::make_pair(connection, query);
+    auto previous = last.find(key);
+
+    std::unordered_map<std::string, size_t> oldIndex, newIndex;
+    bool full = previous == last.end() || keyColumn >= table.columns.size() || previous->second.columns != table.columns ||
+        !indexRows(previous->second, keyColumn, oldIndex) || !indexRows(table, keyColumn, newIndex);
+    if (full) {
+        writer.writeTable(table);
+        last[key] = std::move(table);
+        return writer.release();
+    }
+
+    const Table& old = previous->second;
+    std::vector<const std::string*> removed;
+    std::vector<const std::vector<std::string>*> inserted, changed;
+    for (const auto& row : old.rows) {
+        if (newIndex.find(row[keyColumn]) == newIndex.end()) {
+            removed.push_back(&row[keyColumn]);
+        }
+    }
+    for (const auto& row : table.rows) {
+        auto it = oldIndex.find(row[keyColumn]);
+        if (it == oldIndex.end()) {
+            inserted.push_back(&row);
+        }
+        else if (old.rows[it->second] != row) {
+            changed.push_back(&row);
+        }
+    }
+
+    writer.beginDelta(keyColumn);
+    writer.writeVarint(removed.size());
+    for (const auto* cell : removed) {
+        writer.writeEncoded(*cell);
+    }
+    for (const auto* rows : { &inserted, &changed }) {
+        writer.writeVarint(rows->size());
+        for (const auto* row : *rows) {
+            for (const auto& cell : *row) {
+                writer.writeEncoded(cell);
+            }
+        }
+    }
+    std::string result = writer.release();
+    previous->second = std::move(table);
+    return result;
+}
+
+void DeltaTracker::drop(uint64_t connection) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = last.begin(); it != last.end();) {
+        if (it->first.first == connection) {
+            it = last.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include "pch.h"
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include "Encoding.hpp"
+
+// Remembers the last projection sent for every (connection, query) so that the
+// next one can be sent as the rows that were removed, inserted or changed,
+// identified by the encoded value of a key column. Falls back to the full
+// table when there is no previous result, the columns differ or a key is not
+// unique.
+class DeltaTracker {
+public:
+    std::string encode(uint64_t connection, const std::string& query, uint32_t keyColumn, Table table);
+    void drop(uint64_t connection);
+
+private:
+    std::mutex mutex;
+    std::map<std::pair<uint64_t, std::string>, Table> last;
+};
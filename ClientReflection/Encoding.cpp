@@ -0,0 +1,154 @@
+#include "pch.h"
+#include "Encoding.hpp"
+#include <cstring>
+
+void ValueWriter::writeTag(ValueTag tag) {
+    buffer.push_back(static_cast<char>(tag));
+}
+
+void ValueWriter::writeVarint(uint64_t value) {
+    while (value >= 0x80) {
+        buffer.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    buffer.push_back(static_cast<char>(value));
+}
+
+void ValueWriter::writeNull() {
+    writeTag(ValueTag::Null);
+}
+
+void ValueWriter::writeBool(bool value) {
+    writeTag(value ? ValueTag::True : ValueTag::False);
+}
+
+void ValueWriter::writeInt(int64_t value) {
+    writeTag(ValueTag::Int);
+    writeVarint((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+}
+
+void ValueWriter::writeFloat(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    writeTag(ValueTag::Float);
+    for (int i = 0; i < 4; i++) {
+        buffer.push_back(static_cast<char>((bits >> (i * 8)) & 0xFF));
+    }
+}
+
+void ValueWriter::writeDouble(double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    writeTag(ValueTag::Double);
+    for (int i = 0; i < 8; i++) {
+        buffer.push_back(static_cast<char>((bits >> (i * 8)) & 0xFF));
+    }
+}
+
+void ValueWriter::writeString(std::string_view value) {
+    writeTag(ValueTag::String);
+    writeVarint(value.size());
+    buffer.append(value.data(), value.size());
+}
+
+void ValueWriter::writeHandle(uint64_t handle) {
+    writeTag(ValueTag::Handle);
+    writeVarint(handle);
+}
+
+void ValueWriter::writeError(std::string_view message) {
+    writeTag(ValueTag::Error);
+    writeVarint(message.size());
+    buffer.append(message.data(), message.size());
+}
+
+void ValueWriter::beginArray(uint32_t count) {
+    writeTag(ValueTag::Array);
+    writeVarint(count);
+}
+
+void ValueWriter::beginTable(const std::vector<std::string>& columns, uint32_t rows) {
+    writeTag(ValueTag::Table);
+    writeVarint(columns.size());
+    for (const auto& column : columns) {
+        writeString(column);
+    }
+    writeVarint(rows);
+}
+
+void ValueWriter::writeTable(const Table& table) {
+    beginTable(table.columns, static_cast<uint32_t>(table.rows.size()));
+    for (const auto& row : table.rows) {
+        for (const auto& cell : row) {
+            writeEncoded(cell);
+        }
+    }
+}
+
+void ValueWriter::beginDelta(uint32_t keyColumn) {
+    writeTag(ValueTag::Delta);
+    writeVarint(keyColumn);
+}
+
+void ValueWriter::writeEncoded(std::string_view value) {
+    buffer.append(value.data(), value.size());
+}
+
+std::string ValueWriter::release() {
+    std::string result;
+    result.swap(buffer);
+    return result;
+}
+
+std::string ValueWriter::error(std::string_view message) {
+    ValueWriter writer;
+    writer.writeError(message);
+    return writer.release();
+}
+
+HandleTable::HandleTable(size_t capacity) : slots(capacity, Slot{ 0, nullptr, 0 }), next(1) {}
+
+uint64_t HandleTable::put(JNIEnv* env, jobject object, int32_t identity) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto range = byIdentity.equal_range(identity);
+    for (auto it = range.first; it != range.second; ++it) {
+        const Slot& slot = slots[it->second];
+        if (env->IsSameObject(slot.object, object)) {
+            return slot.id;
+        }
+    }
+
+    uint64_t id = next++;
+    size_t index = id % slots.size();
+    Slot& slot = slots[index];
+    if (slot.object != nullptr) {
+        range = byIdentity.equal_range(slot.identity);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->second == index) {
+                byIdentity.erase(it);
+                break;
+            }
+        }
+        env->DeleteGlobalRef(slot.object);
+    }
+    slot = Slot{ id, env->NewGlobalRef(object), identity };
+    byIdentity.emplace(identity, index);
+    return id;
+}
+
+jobject HandleTable::get(JNIEnv* env, uint64_t handle) {
+    std::lock_guard<std::mutex> lock(mutex);
+    const Slot& slot = slots[handle % slots.size()];
+    return slot.id == handle && slot.object != nullptr ? env->NewLocalRef(slot.object) : nullptr;
+}
+
+void HandleTable::clear(JNIEnv* env) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& slot : slots) {
+        if (slot.object != nullptr) {
+            env->DeleteGlobalRef(slot.object);
+        }
+        slot = Slot{ 0, nullptr, 0 };
+    }
+    byIdentity.clear();
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include "pch.h"
+#include <jni.h>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Result encoding negotiated per connection. Text is the legacy format where
+// every result is stringified; Binary is the tagged format below.
+enum class Encoding : uint8_t {
+    Text,
+    Binary
+};
+
+// Every binary value starts with one of these tags. Integers of any width are
+// zigzag varints, floats are little endian IEEE-754 and strings are a varint
+// byte length followed by modified UTF-8 (as returned by GetStringUTFChars).
+enum class ValueTag : uint8_t {
+    Null = 0x00,
+    False = 0x01,
+    True = 0x02,
+    Int = 0x03,     // zigzag varint
+    Float = 0x04,   // 4 bytes
+    Double = 0x05,  // 8 bytes
+    String = 0x06,  // varint length + bytes
+    Handle = 0x07,  // varint handle id, see HandleTable
+    Array = 0x08,   // varint count + values
+    Table = 0x09,   // varint column count + column names + varint row count + row-major values
+    Error = 0x0A,   // varint length + message
+    Delta = 0x0B    // varint key column + removed keys + inserted rows + changed rows, each varint counted
+};
+
+// A table whose cells are already encoded values, so rows can be compared
+// byte for byte.
+struct Table {
+    std::vector<std::string> columns;
+    std::vector<std::vector<std::string>> rows;
+};
+
+class ValueWriter {
+public:
+    void writeNull();
+    void writeBool(bool value);
+    void writeInt(int64_t value);
+    void writeFloat(float value);
+    void writeDouble(double value);
+    void writeString(std::string_view value);
+    void writeHandle(uint64_t handle);
+    void writeError(std::string_view message);
+    void beginArray(uint32_t count);
+    void beginTable(const std::vector<std::string>& columns, uint32_t rows);
+    void writeTable(const Table& table);
+    void beginDelta(uint32_t keyColumn);
+    void writeEncoded(std::string_view value);
+
+    const std::string& data() const { return buffer; }
+    std::string release();
+
+    static std::string error(std::string_view message);
+
+    void writeVarint(uint64_t value);
+
+private:
+    void writeTag(ValueTag tag);
+
+    std::string buffer;
+};
+
+// Objects that are not converted to a value are sent as handles. A handle keeps
+// a global reference alive until it is evicted by newer handles, so clients can
+// root a later query at it ("#<id>.getName"). Shared by every thread, so get()
+// returns a local reference that stays valid if the slot is evicted meanwhile.
+class HandleTable {
+public:
+    explicit HandleTable(size_t capacity = 4096);
+
+    // `identity` is System.identityHashCode(object). An object that still has
+    // a handle gets the same one back, without taking another global reference.
+    uint64_t put(JNIEnv* env, jobject object, int32_t identity);
+    // Returns nullptr if the handle was evicted or never issued.
+    jobject get(JNIEnv* env, uint64_t handle);
+    void clear(JNIEnv* env);
+
+private:
+    struct Slot {
+        uint64_t id;
+        jobject object;
+        int32_t identity;
+    };
+
+    std::mutex mutex;
+    std::vector<Slot> slots;
+    // Identity hash to the index of every occupied slot with that hash.
+    std::unordered_multimap<int32_t, size_t> byIdentity;
+    uint64_t next;
+};
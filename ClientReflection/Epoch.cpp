@@ -0,0 +1,117 @@
+#include "pch.h"
+#include "Epoch.hpp"
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace {
+    // One slot per reading thread; a slot holds the epoch its thread entered
+    // with, or 0 outside a guard.
+    constexpr size_t kSlots = 64;
+
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> epoch{ 0 };
+        std::atomic<bool> used{ false };
+    };
+
+    Slot slots[kSlots];
+    std::atomic<uint64_t> globalEpoch{ 1 };
+    // Readers that found no free slot; nothing is reclaimed while one is active.
+    std::atomic<size_t> unslotted{ 0 };
+
+    std::mutex retiredMutex;
+    std::vector<std::pair<uint64_t, std::function<void()>>> retired;
+
+    struct ThreadSlot {
+        Slot* slot = nullptr;
+        bool searched = false;
+        int depth = 0;
+
+        ~ThreadSlot() {
+            if (slot != nullptr) {
+                slot->epoch.store(0);
+                slot->used.store(false);
+            }
+        }
+    };
+
+    thread_local ThreadSlot threadSlot;
+
+    Slot* acquireSlot() {
+        for (auto& slot : slots) {
+            bool expected = false;
+            if (slot.used.compare_exchange_strong(expected, true)) {
+                return &slot;
+            }
+        }
+        return nullptr;
+    }
+}
+
+Epoch::Guard::Guard() {
+    ThreadSlot& thread = threadSlot;
+    // Guards nest, e.g. when a worker runs a stolen chunk inside a query.
+    if (thread.depth++ > 0) {
+        return;
+    }
+    if (!thread.searched) {
+        thread.slot = acquireSlot();
+        thread.searched = true;
+    }
+    if (thread.slot != nullptr) {
+        thread.slot->epoch.store(globalEpoch.load());
+    }
+    else {
+        unslotted++;
+    }
+}
+
+Epoch::Guard::~Guard() {
+    ThreadSlot& thread = threadSlot;
+    if (--thread.depth > 0) {
+        return;
+    }
+    if (thread.slot != nullptr) {
+        thread.slot->epoch.store(0, std::memory_order_release);
+    }
+    else {
+        unslotted--;
+    }
+}
+
+void Epoch::retire(std::function<void()> reclaim) {
+    // The caller has already unpublished what it retires, so readers entering
+    // after the epoch moves on cannot reach it.
+    uint64_t epoch = globalEpoch.fetch_add(1);
+
+    std::vector<std::function<void()>> ready;
+    {
+        std::lock_guard<std::mutex> lock(retiredMutex);
+        retired.emplace_back(epoch, std::move(reclaim));
+        if (unslotted.load() > 0) {
+            return;
+        }
+        uint64_t oldest = UINT64_MAX;
+        for (const auto& slot : slots) {
+            uint64_t entered = slot.epoch.load();
+            if (entered != 0 && entered < oldest) {
+                oldest = entered;
+            }
+        }
+        auto it = retired.begin();
+        while (it != retired.end()) {
+            if (it->first < oldest) {
+                ready.push_back(std::move(it->second));
+                it = retired.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+    }
+    for (auto& run : ready) {
+        run();
+    }
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include "pch.h"
+#include <functional>
+
+// Epoch based reclamation for structures read without locks. Readers pin the
+// current epoch for the length of a Guard; memory retired by a writer is freed
+// once every reader that could still see it has left its guard.
+class Epoch {
+public:
+    class Guard {
+    public:
+        Guard();
+        ~Guard();
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+    };
+
+    // Runs `reclaim` once no guard entered before this call is still active.
+    static void retire(std::function<void()> reclaim);
+};
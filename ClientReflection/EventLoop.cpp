@@ -0,0 +1,496 @@
+#include "pch.h"
+#include "EventLoop.hpp"
+#include <algorithm>
+#include <deque>
+#include <utility>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// Completion keys / epoll tags that are not connections.
+static const uint64_t kWakeKey = ~0ull;
+static const uint64_t kListenKey = ~0ull - 1;
+
+#ifdef _WIN32
+
+struct IoOperation {
+    OVERLAPPED overlapped;
+    enum class Kind { Connect, Read, Write } kind;
+};
+
+struct EventLoop::Channel {
+    uint64_t id = 0;
+    HANDLE pipe = INVALID_HANDLE_VALUE;
+    IoOperation connect = { {}, IoOperation::Kind::Connect };
+    IoOperation read = { {}, IoOperation::Kind::Read };
+    IoOperation write = { {}, IoOperation::Kind::Write };
+    std::vector<char> buffer;
+    std::deque<std::string> outgoing;
+    std::string writing;
+    bool writePending = false;
+    // Overlapped operations that have not completed yet; the handle is only
+    // closed once this drops to zero.
+    int pending = 0;
+    bool closing = false;
+};
+
+EventLoop::EventLoop(const std::string& address, size_t bufferSize, Callbacks callbacks)
+    : address(address), bufferSize(bufferSize), callbacks(std::move(callbacks)) {}
+
+EventLoop::~EventLoop() {
+    for (auto& entry : channels) {
+        CloseHandle(entry.second->pipe);
+    }
+    if (listener) {
+        CloseHandle(listener->pipe);
+    }
+    if (port != NULL) {
+        CloseHandle(port);
+    }
+}
+
+bool EventLoop::listen() {
+    port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+    return port != NULL && createListener();
+}
+
+bool EventLoop::createListener() {
+    // One pipe instance at a time waits for the next client.
+    auto channel = std::make_unique<Channel>();
+    channel->pipe = CreateNamedPipeA(
+        address.c_str(),
+        PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED,
+        PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT,
+        PIPE_UNLIMITED_INSTANCES,
+        static_cast<DWORD>(bufferSize),
+        static_cast<DWORD>(bufferSize),
+        0,
+        NULL);
+    if (channel->pipe == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    // The channel is the completion key; it outlives its pending operations.
+    if (CreateIoCompletionPort(channel->pipe, port, reinterpret_cast<ULONG_PTR>(channel.get()), 0) == NULL) {
+        CloseHandle(channel->pipe);
+        return false;
+    }
+    if (!ConnectNamedPipe(channel->pipe, &channel->connect.overlapped)) {
+        DWORD error = GetLastError();
+        if (error == ERROR_PIPE_CONNECTED) {
+            // The client connected before ConnectNamedPipe; no completion is queued.
+            connected(std::move(channel));
+            return true;
+        }
+        if (error != ERROR_IO_PENDING) {
+            CloseHandle(channel->pipe);
+            return false;
+        }
+    }
+    channel->pending++;
+    listener = std::move(channel);
+    return true;
+}
+
+void EventLoop::connected(std::unique_ptr<Channel> channel) {
+    Channel& connection = *channel;
+    connection.id = nextId++;
+    connection.buffer.resize(bufferSize);
+    channels[connection.id] = std::move(channel);
+    callbacks.onConnect(connection.id);
+    startRead(connection);
+    createListener();
+}
+
+void EventLoop::startRead(Channel& channel) {
+    if (channel.closing) {
+        return;
+    }
+    channel.read.overlapped = {};
+    if (!ReadFile(channel.pipe, channel.buffer.data(), static_cast<DWORD>(channel.buffer.size()), NULL, &channel.read.overlapped) &&
+        GetLastError() != ERROR_IO_PENDING) {
+        closeChannel(channel);
+        return;
+    }
+    // Completes through the port whether or not it finished synchronously.
+    channel.pending++;
+}
+
+void EventLoop::startWrite(Channel& channel) {
+    if (channel.closing || channel.writePending || channel.outgoing.empty()) {
+        return;
+    }
+    channel.writing = std::move(channel.outgoing.front());
+    channel.outgoing.pop_front();
+    channel.write.overlapped = {};
+    if (!WriteFile(channel.pipe, channel.writing.data(), static_cast<DWORD>(channel.writing.size()), NULL, &channel.write.overlapped) &&
+        GetLastError() != ERROR_IO_PENDING) {
+        closeChannel(channel);
+        return;
+    }
+    channel.writePending = true;
+    channel.pending++;
+}
+
+void EventLoop::closeChannel(Channel& channel) {
+    if (!channel.closing) {
+        channel.closing = true;
+        CancelIoEx(channel.pipe, NULL);
+    }
+    releaseIfIdle(channel);
+}
+
+void EventLoop::releaseIfIdle(Channel& channel) {
+    if (!channel.closing || channel.pending > 0) {
+        return;
+    }
+    uint64_t id = channel.id;
+    CloseHandle(channel.pipe);
+    channels.erase(id);
+    callbacks.onDisconnect(id);
+}
+
+void EventLoop::complete(Channel& channel, OVERLAPPED* overlapped, bool ok, DWORD bytes) {
+    IoOperation* operation = reinterpret_cast<IoOperation*>(overlapped);
+    channel.pending--;
+    switch (operation->kind) {
+    case IoOperation::Kind::Connect:
+        if (ok) {
+            connected(std::move(listener));
+        }
+        else {
+            CloseHandle(listener->pipe);
+            listener.reset();
+            createListener();
+        }
+        return;
+    case IoOperation::Kind::Read:
+        if (!channel.closing && (!ok || bytes == 0)) {
+            closeChannel(channel);
+            return;
+        }
+        if (!channel.closing) {
+            callbacks.onData(channel.id, channel.buffer.data(), bytes);
+            startRead(channel);
+            return;
+        }
+        break;
+    case IoOperation::Kind::Write:
+        channel.writePending = false;
+        channel.writing.clear();
+        if (channel.closing) {
+            break;
+        }
+        if (!ok) {
+            closeChannel(channel);
+            return;
+        }
+        startWrite(channel);
+        return;
+    }
+    releaseIfIdle(channel);
+}
+
+void EventLoop::run() {
+    while (!stopped) {
+        DWORD bytes = 0;
+        ULONG_PTR key = 0;
+        OVERLAPPED* overlapped = nullptr;
+        BOOL ok = GetQueuedCompletionStatus(port, &bytes, &key, &overlapped, static_cast<DWORD>(timerWait()));
+        DWORD error = ok ? ERROR_SUCCESS : GetLastError();
+        fireTimer();
+        if (overlapped == nullptr) {
+            if (!ok) {
+                if (error == WAIT_TIMEOUT) {
+                    continue;
+                }
+                break;
+            }
+            if (key == kWakeKey) {
+                processOutbox();
+            }
+            continue;
+        }
+        complete(*reinterpret_cast<Channel*>(key), overlapped, ok != FALSE, bytes);
+    }
+}
+
+void EventLoop::post(Outgoing outgoing) {
+    {
+        std::lock_guard<std::mutex> lock(outboxMutex);
+        outbox.push_back(std::move(outgoing));
+    }
+    PostQueuedCompletionStatus(port, 0, static_cast<ULONG_PTR>(kWakeKey), NULL);
+}
+
+void EventLoop::stop() {
+    stopped = true;
+    if (port != NULL) {
+        PostQueuedCompletionStatus(port, 0, static_cast<ULONG_PTR>(kWakeKey), NULL);
+    }
+}
+
+#else
+
+struct EventLoop::Channel {
+    uint64_t id = 0;
+    int fd = -1;
+    std::deque<std::string> outgoing;
+    size_t offset = 0;
+    bool watchingWrites = false;
+    bool closing = false;
+};
+
+EventLoop::EventLoop(const std::string& address, size_t bufferSize, Callbacks callbacks)
+    : address(address), bufferSize(bufferSize), callbacks(std::move(callbacks)) {}
+
+EventLoop::~EventLoop() {
+    for (auto& entry : channels) {
+        ::close(entry.second->fd);
+    }
+    if (listenFd >= 0) {
+        ::close(listenFd);
+        unlink(address.c_str());
+    }
+    if (wakeFd >= 0) {
+        ::close(wakeFd);
+    }
+    if (epollFd >= 0) {
+        ::close(epollFd);
+    }
+}
+
+bool EventLoop::listen() {
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (epollFd < 0 || wakeFd < 0 || listenFd < 0) {
+        return false;
+    }
+
+    sockaddr_un name = {};
+    name.sun_family = AF_UNIX;
+    if (address.size() >= sizeof(name.sun_path)) {
+        return false;
+    }
+    std::memcpy(name.sun_path, address.c_str(), address.size() + 1);
+    unlink(address.c_str());
+    if (bind(listenFd, reinterpret_cast<sockaddr*>(&name), sizeof(name)) != 0 || ::listen(listenFd, SOMAXCONN) != 0) {
+        return false;
+    }
+
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u64 = kListenKey;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event);
+    event.data.u64 = kWakeKey;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event);
+    return true;
+}
+
+void EventLoop::acceptAll() {
+    while (true) {
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        auto channel = std::make_unique<Channel>();
+        channel->id = nextId++;
+        channel->fd = fd;
+        epoll_event event = {};
+        event.events = EPOLLIN | EPOLLRDHUP;
+        event.data.u64 = channel->id;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+        uint64_t id = channel->id;
+        channels[id] = std::move(channel);
+        callbacks.onConnect(id);
+    }
+}
+
+void EventLoop::readAll(Channel& channel) {
+    std::vector<char> buffer(bufferSize);
+    while (true) {
+        ssize_t count = ::read(channel.fd, buffer.data(), buffer.size());
+        if (count > 0) {
+            callbacks.onData(channel.id, buffer.data(), static_cast<size_t>(count));
+            continue;
+        }
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        closeChannel(channel);
+        return;
+    }
+}
+
+void EventLoop::watchWrites(Channel& channel, bool enable) {
+    if (channel.watchingWrites == enable) {
+        return;
+    }
+    channel.watchingWrites = enable;
+    epoll_event event = {};
+    event.events = EPOLLIN | EPOLLRDHUP | (enable ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+    event.data.u64 = channel.id;
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, channel.fd, &event);
+}
+
+void EventLoop::startWrite(Channel& channel) {
+    while (!channel.outgoing.empty()) {
+        const std::string& front = channel.outgoing.front();
+        ssize_t count = ::send(channel.fd, front.data() + channel.offset, front.size() - channel.offset, MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            watchWrites(channel, true);
+            return;
+        }
+        if (count < 0) {
+            closeChannel(channel);
+            return;
+        }
+        channel.offset += static_cast<size_t>(count);
+        if (channel.offset == front.size()) {
+            channel.outgoing.pop_front();
+            channel.offset = 0;
+        }
+    }
+    watchWrites(channel, false);
+}
+
+// Sockets have no outstanding operations, so a channel is released as soon as
+// it is closed.
+void EventLoop::closeChannel(Channel& channel) {
+    channel.closing = true;
+    releaseIfIdle(channel);
+}
+
+void EventLoop::releaseIfIdle(Channel& channel) {
+    uint64_t id = channel.id;
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, channel.fd, nullptr);
+    ::close(channel.fd);
+    channels.erase(id);
+    callbacks.onDisconnect(id);
+}
+
+void EventLoop::run() {
+    epoll_event events[64];
+    while (!stopped) {
+        int count = epoll_wait(epollFd, events, 64, timerWait());
+        fireTimer();
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        for (int i = 0; i < count; i++) {
+            uint64_t key = events[i].data.u64;
+            if (key == kListenKey) {
+                acceptAll();
+                continue;
+            }
+            if (key == kWakeKey) {
+                uint64_t value;
+                while (::read(wakeFd, &value, sizeof(value)) > 0) {}
+                processOutbox();
+                continue;
+            }
+            auto it = channels.find(key);
+            if (it == channels.end()) {
+                continue;
+            }
+            // Read first so data sent just before a hangup is still delivered.
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                readAll(*it->second);
+                it = channels.find(key);
+                if (it == channels.end()) {
+                    continue;
+                }
+            }
+            if (events[i].events & EPOLLOUT) {
+                startWrite(*it->second);
+            }
+        }
+    }
+}
+
+void EventLoop::post(Outgoing outgoing) {
+    {
+        std::lock_guard<std::mutex> lock(outboxMutex);
+        outbox.push_back(std::move(outgoing));
+    }
+    uint64_t one = 1;
+    ssize_t written = ::write(wakeFd, &one, sizeof(one));
+    (void)written;
+}
+
+void EventLoop::stop() {
+    stopped = true;
+    if (wakeFd >= 0) {
+        uint64_t one = 1;
+        ssize_t written = ::write(wakeFd, &one, sizeof(one));
+        (void)written;
+    }
+}
+
+#endif
+
+void EventLoop::send(uint64_t connection, std::string data) {
+    post(Outgoing{ connection, std::move(data), false });
+}
+
+void EventLoop::close(uint64_t connection) {
+    post(Outgoing{ connection, std::string(), true });
+}
+
+int EventLoop::timerWait() const {
+    // Milliseconds until the timer is due, or -1 (INFINITE) without a timer.
+    if (!callbacks.onTimer || callbacks.timerInterval.count() <= 0) {
+        return -1;
+    }
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(nextTimer - std::chrono::steady_clock::now());
+    return static_cast<int>(std::clamp<long long>(wait.count(), 0, callbacks.timerInterval.count()));
+}
+
+void EventLoop::fireTimer() {
+    if (!callbacks.onTimer || callbacks.timerInterval.count() <= 0) {
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (now >= nextTimer) {
+        nextTimer = now + callbacks.timerInterval;
+        callbacks.onTimer();
+    }
+}
+
+void EventLoop::processOutbox() {
+    std::vector<Outgoing> pending;
+    {
+        std::lock_guard<std::mutex> lock(outboxMutex);
+        pending.swap(outbox);
+    }
+    for (auto& outgoing : pending) {
+        auto it = channels.find(outgoing.connection);
+        if (it == channels.end() || it->second->closing) {
+            continue;
+        }
+        Channel& channel = *it->second;
+        if (outgoing.close) {
+            closeChannel(channel);
+            continue;
+        }
+        channel.outgoing.push_back(std::move(outgoing.data));
+        startWrite(channel);
+    }
+}
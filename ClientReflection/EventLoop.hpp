@@ -0,0 +1,89 @@
+#pragma once
+#include "pch.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+
+// Multiplexes every client connection on the thread that calls run(): named
+// pipe instances on an I/O completion port on Windows, a Unix domain socket on
+// epoll elsewhere. Callbacks run on that thread and must not block; send() and
+// close() may be called from any thread.
+class EventLoop {
+public:
+    struct Callbacks {
+        std::function<void(uint64_t connection)> onConnect;
+        std::function<void(uint64_t connection, const char* data, size_t size)> onData;
+        std::function<void(uint64_t connection)> onDisconnect;
+        // Called on the loop thread about every `timerInterval`, if set.
+        std::function<void()> onTimer;
+        std::chrono::milliseconds timerInterval{ 0 };
+    };
+
+    // `address` is the pipe name on Windows and the socket path elsewhere.
+    EventLoop(const std::string& address, size_t bufferSize, Callbacks callbacks);
+    ~EventLoop();
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    bool listen();
+    void run();
+    void stop();
+
+    void send(uint64_t connection, std::string data);
+    void close(uint64_t connection);
+
+private:
+    struct Channel;
+    struct Outgoing {
+        uint64_t connection;
+        std::string data;
+        bool close;
+    };
+
+    void post(Outgoing outgoing);
+    void processOutbox();
+    void startWrite(Channel& channel);
+    void closeChannel(Channel& channel);
+    void releaseIfIdle(Channel& channel);
+    int timerWait() const;
+    void fireTimer();
+
+#ifdef _WIN32
+    bool createListener();
+    void connected(std::unique_ptr<Channel> channel);
+    void startRead(Channel& channel);
+    void complete(Channel& channel, OVERLAPPED* overlapped, bool ok, DWORD bytes);
+
+    HANDLE port = NULL;
+    std::unique_ptr<Channel> listener;
+#else
+    void acceptAll();
+    void readAll(Channel& channel);
+    void watchWrites(Channel& channel, bool enable);
+
+    int epollFd = -1;
+    int listenFd = -1;
+    int wakeFd = -1;
+#endif
+
+    std::string address;
+    size_t bufferSize;
+    Callbacks callbacks;
+    std::unordered_map<uint64_t, std::unique_ptr<Channel>> channels;
+    uint64_t nextId = 1;
+    std::atomic<bool> stopped{ false };
+    std::chrono::steady_clock::time_point nextTimer;
+
+    std::mutex outboxMutex;
+    std::vector<Outgoing> outbox;
+};
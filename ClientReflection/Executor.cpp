@@ -0,0 +1,176 @@
+#include "pch.h"
+#include "Executor.hpp"
+#include "Trace.hpp"
+#include "Log.hpp"
+#include <algorithm>
+
+static thread_local JNIEnv* workerEnv = nullptr;
+static thread_local Executor* workerOwner = nullptr;
+static thread_local size_t workerIndex = 0;
+
+Executor::Executor(size_t threads, JavaVM* jvm) : jvm(jvm) {
+    threads = std::max<size_t>(threads, 1);
+    for (size_t i = 0; i < threads; i++) {
+        queues.push_back(std::make_unique<Worker>());
+    }
+    for (size_t i = 0; i < threads; i++) {
+        workers.emplace_back(&Executor::work, this, i);
+    }
+}
+
+Executor::~Executor() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    ready.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+JNIEnv* Executor::currentEnv() {
+    return workerEnv;
+}
+
+Executor* Executor::current() {
+    return workerOwner;
+}
+
+void Executor::submit(Task task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(std::move(task));
+        pending++;
+    }
+    ready.notify_one();
+}
+
+void Executor::spawn(Task task) {
+    {
+        std::lock_guard<std::mutex> lock(queues[workerIndex]->mutex);
+        queues[workerIndex]->tasks.push_back(std::move(task));
+    }
+    {
+        // Counted under the mutex so a worker about to sleep cannot miss it.
+        std::lock_guard<std::mutex> lock(mutex);
+        pending++;
+    }
+    ready.notify_one();
+}
+
+bool Executor::findTask(size_t index, Task& task, bool shared) {
+    // Own deque first, newest task first, while it is still warm.
+    {
+        Worker& own = *queues[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            pending--;
+            return true;
+        }
+    }
+    if (shared) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!queue.empty()) {
+            task = std::move(queue.front());
+            queue.pop_front();
+            pending--;
+            return true;
+        }
+    }
+    // Steal the oldest task of another worker, which tends to be the largest
+    // remaining piece of its work.
+    for (size_t i = 1; i < queues.size(); i++) {
+        Worker& victim = *queues[(index + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            pending--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void Executor::run(Task& task) {
+    try {
+        task();
+    }
+    catch (const std::exception& e) {
+        LOG_ERROR("Exception caught in Executor.cpp: " << e.what());
+    }
+    task = nullptr;
+}
+
+void Executor::parallelFor(size_t count, size_t grain, const std::function<void(size_t begin, size_t end)>& body) {
+    grain = std::max<size_t>(grain, 1);
+    if (workerOwner != this || count <= grain) {
+        body(0, count);
+        return;
+    }
+
+    struct Join {
+        std::mutex mutex;
+        std::condition_variable done;
+        std::atomic<size_t> remaining;
+    } join;
+    join.remaining = (count + grain - 1) / grain;
+    for (size_t begin = 0; begin < count; begin += grain) {
+        size_t end = (std::min)(count, begin + grain);
+        spawn([&body, &join, begin, end] {
+            try {
+                body(begin, end);
+            }
+            catch (const std::exception& e) {
+                LOG_ERROR("Exception caught in Executor.cpp: " << e.what());
+            }
+            // Notified under the lock, so the caller cannot return and destroy
+            // join before this chunk is done with it.
+            std::lock_guard<std::mutex> lock(join.mutex);
+            if (--join.remaining == 0) {
+                join.done.notify_one();
+            }
+        });
+    }
+
+    // Blocking right away could leave every worker waiting on chunks nobody
+    // runs, so the caller first runs split work until none is left to take.
+    // Its remaining chunks are then running on other workers, and it sleeps
+    // until they finish. Queued requests are left alone; one of them could
+    // take far longer than the chunks it would delay.
+    Task task;
+    while (join.remaining > 0 && findTask(workerIndex, task, false)) {
+        run(task);
+    }
+    std::unique_lock<std::mutex> lock(join.mutex);
+    join.done.wait(lock, [&join] { return join.remaining == 0; });
+}
+
+void Executor::work(size_t index) {
+    Trace::nameThread("executor");
+    workerOwner = this;
+    workerIndex = index;
+    if (jvm != nullptr && jvm->AttachCurrentThreadAsDaemon((void**)&workerEnv, nullptr) != JNI_OK) {
+        LOG_ERROR("Failed to attach executor thread");
+        workerEnv = nullptr;
+    }
+    while (true) {
+        Task task;
+        if (findTask(index, task, true)) {
+            run(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait(lock, [this] { return stopping || pending > 0; });
+        if (stopping && pending == 0) {
+            break;
+        }
+    }
+    if (workerEnv != nullptr) {
+        jvm->DetachCurrentThread();
+        workerEnv = nullptr;
+    }
+}
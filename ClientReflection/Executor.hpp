@@ -0,0 +1,61 @@
+#pragma once
+#include "pch.h"
+#include <jni.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs decoded requests off the I/O thread on a fixed pool of workers. With a
+// JavaVM every worker is attached once, as a daemon so it never holds up VM
+// shutdown, and keeps its JNIEnv in a thread local for the tasks it runs.
+//
+// Submitted tasks go to a shared queue. Chunks split off by parallelFor go to
+// the splitting worker's own deque, which it pops from the back while
+// idle workers steal from the front, so split work spreads over every core.
+class Executor {
+public:
+    using Task = std::function<void()>;
+
+    explicit Executor(size_t threads = 1, JavaVM* jvm = nullptr);
+    ~Executor();
+    Executor(const Executor&) = delete;
+    Executor& operator=(const Executor&) = delete;
+
+    void submit(Task task);
+
+    // Runs body(begin, end) over [0, count) in chunks of `grain` on every
+    // worker and returns once all chunks are done. The calling worker executes
+    // tasks while it waits; called from outside the pool it runs in place.
+    void parallelFor(size_t count, size_t grain, const std::function<void(size_t begin, size_t end)>& body);
+
+    // The calling worker's JNIEnv, or nullptr on any other thread.
+    static JNIEnv* currentEnv();
+    // The executor the calling thread works for, or nullptr.
+    static Executor* current();
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void spawn(Task task);
+    bool findTask(size_t index, Task& task, bool shared);
+    void run(Task& task);
+    void work(size_t index);
+
+    JavaVM* jvm;
+    std::vector<std::unique_ptr<Worker>> queues;
+
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<Task> queue;
+    std::atomic<size_t> pending{ 0 };
+    bool stopping = false;
+    std::vector<std::thread> workers;
+};
@@ -0,0 +1,134 @@
+#include "pch.h"
+#include "FairScheduler.hpp"
+#include "Log.hpp"
+#include <algorithm>
+
+// Dispatches per round for the interactive, normal and bulk classes.
+static const uint32_t kWeights[] = { 8, 4, 1 };
+// Microseconds of run time a flow is granted per round.
+static const int64_t kQuantum = 2000;
+
+FairScheduler::FairScheduler(Executor& executor, size_t freeWorkers, size_t clientThreadWorkers) : executor(executor) {
+    lanes[static_cast<size_t>(Lane::Free)].limit = std::max<size_t>(freeWorkers, 1);
+    lanes[static_cast<size_t>(Lane::ClientThread)].limit = std::max<size_t>(clientThreadWorkers, 1);
+}
+
+void FairScheduler::post(uint64_t connection, Lane lane, Priority priority, Executor::Task task) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (closing.count(connection) > 0) {
+        return;
+    }
+    size_t level = std::min<size_t>(static_cast<size_t>(priority), kClasses - 1);
+    FlowKey key(connection, static_cast<uint32_t>(lane) * kClasses + static_cast<uint32_t>(level));
+    auto& flow = flows[key];
+    if (!flow) {
+        flow = std::make_unique<Flow>();
+        flow->connection = connection;
+        flow->lane = lane;
+        flow->priority = static_cast<Priority>(level);
+    }
+    flow->tasks.push_back(std::move(task));
+    if (!flow->running && flow->tasks.size() == 1) {
+        lanes[static_cast<size_t>(lane)].ready[level].push_back(flow.get());
+    }
+    pump();
+}
+
+void FairScheduler::close(uint64_t connection, Executor::Task task) {
+    std::lock_guard<std::mutex> lock(mutex);
+    closing[connection] = std::move(task);
+    closeIfIdle(connection);
+}
+
+void FairScheduler::closeIfIdle(uint64_t connection) {
+    auto it = closing.find(connection);
+    if (it == closing.end()) {
+        return;
+    }
+    auto first = flows.lower_bound(FlowKey(connection, 0));
+    auto last = flows.lower_bound(FlowKey(connection + 1, 0));
+    for (auto flow = first; flow != last; ++flow) {
+        if (flow->second->running || !flow->second->tasks.empty()) {
+            return;
+        }
+    }
+    flows.erase(first, last);
+    executor.submit(std::move(it->second));
+    closing.erase(it);
+}
+
+bool FairScheduler::pick(LaneState& lane, Flow*& flow) {
+    // Weighted round robin between classes: the highest class with credit
+    // left goes first, and credits are refilled once no waiting class has any.
+    size_t level = kClasses;
+    for (int attempt = 0; attempt < 2 && level == kClasses; attempt++) {
+        for (size_t i = 0; i < kClasses; i++) {
+            if (!lane.ready[i].empty() && lane.credit[i] > 0) {
+                level = i;
+                break;
+            }
+        }
+        if (level == kClasses) {
+            for (size_t i = 0; i < kClasses; i++) {
+                lane.credit[i] = kWeights[i];
+            }
+        }
+    }
+    if (level == kClasses) {
+        return false;
+    }
+    lane.credit[level]--;
+
+    // Deficit round robin between the flows of the class: a flow that has
+    // used up its time goes to the back with a fresh quantum.
+    auto& ready = lane.ready[level];
+    while (true) {
+        Flow* candidate = ready.front();
+        ready.pop_front();
+        if (candidate->deficit > 0) {
+            flow = candidate;
+            return true;
+        }
+        candidate->deficit += kQuantum;
+        ready.push_back(candidate);
+    }
+}
+
+void FairScheduler::pump() {
+    for (auto& lane : lanes) {
+        Flow* flow = nullptr;
+        while (lane.running < lane.limit && pick(lane, flow)) {
+            Executor::Task task = std::move(flow->tasks.front());
+            flow->tasks.pop_front();
+            flow->running = true;
+            lane.running++;
+            executor.submit([this, flow, task = std::move(task)] {
+                auto start = Clock::now();
+                try {
+                    task();
+                }
+                catch (const std::exception& e) {
+                    LOG_ERROR("Exception caught in FairScheduler.cpp: " << e.what());
+                }
+                finished(*flow, Clock::now() - start);
+            });
+        }
+    }
+}
+
+void FairScheduler::finished(Flow& flow, Clock::duration elapsed) {
+    std::lock_guard<std::mutex> lock(mutex);
+    LaneState& lane = lanes[static_cast<size_t>(flow.lane)];
+    lane.running--;
+    flow.running = false;
+    if (flow.tasks.empty()) {
+        // An idle flow keeps no credit into the next round.
+        flow.deficit = 0;
+        closeIfIdle(flow.connection);
+    }
+    else {
+        flow.deficit -= std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+        lane.ready[static_cast<size_t>(flow.priority)].push_back(&flow);
+    }
+    pump();
+}
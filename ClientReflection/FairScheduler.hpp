@@ -0,0 +1,73 @@
+#pragma once
+#include "pch.h"
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include "Executor.hpp"
+#include "Protocol.hpp"
+
+// Decides which connection's work the executor runs next, so a connection
+// streaming bulk queries cannot delay another connection's small interactive
+// ones.
+//
+// Work is queued per flow: one connection at one priority in one lane. Tasks
+// of a flow run one at a time and in order. Client thread work has its own
+// lane limited to one worker, since the client thread runs one task at a time
+// and further workers would only block waiting for it. Within a lane the
+// priority classes are served by weighted round robin, and the flows of a
+// class by deficit round robin charged with each task's measured run time.
+class FairScheduler {
+public:
+    enum class Lane : uint8_t {
+        Free = 0,
+        ClientThread = 1
+    };
+
+    FairScheduler(Executor& executor, size_t freeWorkers, size_t clientThreadWorkers = 1);
+
+    void post(uint64_t connection, Lane lane, Priority priority, Executor::Task task);
+    // Runs `task` once every task already posted for the connection is done;
+    // later posts for the connection are dropped.
+    void close(uint64_t connection, Executor::Task task);
+
+private:
+    using Clock = std::chrono::steady_clock;
+    static constexpr size_t kClasses = 3;
+
+    struct Flow {
+        uint64_t connection;
+        Lane lane;
+        Priority priority;
+        std::deque<Executor::Task> tasks;
+        // Microseconds this flow may still run in the current round.
+        int64_t deficit = 0;
+        bool running = false;
+    };
+
+    struct LaneState {
+        size_t limit;
+        size_t running = 0;
+        // Flows with queued tasks that are not running, per priority class.
+        std::array<std::deque<Flow*>, kClasses> ready;
+        std::array<uint32_t, kClasses> credit{};
+    };
+
+    using FlowKey = std::pair<uint64_t, uint32_t>;
+
+    void pump();
+    bool pick(LaneState& lane, Flow*& flow);
+    void finished(Flow& flow, Clock::duration elapsed);
+    void closeIfIdle(uint64_t connection);
+
+    Executor& executor;
+    std::mutex mutex;
+    std::array<LaneState, 2> lanes;
+    std::map<FlowKey, std::unique_ptr<Flow>> flows;
+    std::unordered_map<uint64_t, Executor::Task> closing;
+};
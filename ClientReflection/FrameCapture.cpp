@@ -0,0 +1,143 @@
+#include "pch.h"
+#include "FrameCapture.hpp"
+#include "Cache.hpp"
+#include "Log.hpp"
+#include <algorithm>
+#include <cstring>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+std::string FrameCapture::start(JNIEnv* env, Cache& cache, const std::string& query, std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Source next{ compilePlan(query + ".getWidth"), compilePlan(query + ".getHeight"), compilePlan(query + ".getPixels") };
+
+    env->PushLocalFrame(16);
+    Frame frame;
+    std::string error = read(env, cache, next, frame);
+    if (error.empty() && !mapping.isOpen()) {
+        uint64_t size = (std::max)(static_cast<uint64_t>(frame.width) * frame.height * 4, kMinimumCapacity);
+        size = (size + 63) & ~uint64_t(63);
+#ifdef _WIN32
+        std::string regionName = "Local\\JRB-" + std::to_string(GetCurrentProcessId()) + "-capture";
+#else
+        std::string regionName = "/JRB-" + std::to_string(getpid()) + "-capture";
+#endif
+        if (mapping.create(regionName, sizeof(Header) + 2 * (sizeof(Slot) + size))) {
+            capacity = size;
+            Header* header = static_cast<Header*>(mapping.data());
+            header->magic = kMagic;
+            header->version = kVersion;
+            header->capacity = capacity;
+            header->sequence.store(0, std::memory_order_relaxed);
+            sequence = 0;
+            warned = false;
+        }
+        else {
+            error = "Failed to create shared memory region";
+        }
+    }
+    if (error.empty()) {
+        source = std::move(next);
+        copy(env, frame);
+        name = mapping.getName();
+    }
+    env->PopLocalFrame(nullptr);
+    return error;
+}
+
+void FrameCapture::stop() {
+    std::lock_guard<std::mutex> lock(mutex);
+    mapping.close();
+}
+
+bool FrameCapture::isActive() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return mapping.isOpen();
+}
+
+uint64_t FrameCapture::capture(JNIEnv* env, Cache& cache) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!mapping.isOpen()) {
+        return 0;
+    }
+    env->PushLocalFrame(16);
+    Frame frame;
+    std::string error = read(env, cache, source, frame);
+    uint64_t copied = error.empty() ? copy(env, frame) : 0;
+    if (!error.empty()) {
+        LOG_DEBUG("Frame not captured: " << error);
+    }
+    env->PopLocalFrame(nullptr);
+    return copied;
+}
+
+std::string FrameCapture::read(JNIEnv* env, Cache& cache, const Source& from, Frame& frame) {
+    // The three chains share the provider's node, so it is resolved once per
+    // tick; only getPixels' array is read fresh on every frame.
+    auto evaluate = [&](const Plan& plan, char type, Cache::Evaluation& result) {
+        result = cache.evaluatePlan(env, plan);
+        if (!result.error.empty()) {
+            return result.error;
+        }
+        if (result.type.empty() || result.type[0] != type) {
+            return plan.text + " returned " + result.type;
+        }
+        return std::string();
+    };
+
+    Cache::Evaluation result;
+    std::string error = evaluate(from.width, 'I', result);
+    frame.width = result.value.i;
+    if (error.empty()) {
+        error = evaluate(from.height, 'I', result);
+        frame.height = result.value.i;
+    }
+    if (error.empty()) {
+        error = evaluate(from.pixels, '[', result);
+        frame.pixels = static_cast<jintArray>(result.value.l);
+    }
+    if (error.empty() && (result.type != "[I" || frame.pixels == nullptr)) {
+        error = from.pixels.text + " is not an int array";
+    }
+    if (error.empty() && (frame.width <= 0 || frame.height <= 0
+        || static_cast<uint64_t>(frame.width) * frame.height > static_cast<uint64_t>(env->GetArrayLength(frame.pixels)))) {
+        error = "Frame size " + std::to_string(frame.width) + "x" + std::to_string(frame.height) + " does not match its pixels";
+    }
+    return error;
+}
+
+uint64_t FrameCapture::copy(JNIEnv* env, const Frame& frame) {
+    Header* header = static_cast<Header*>(mapping.data());
+    size_t bytes = static_cast<size_t>(frame.width) * frame.height * sizeof(jint);
+    if (bytes > capacity) {
+        if (!warned) {
+            LOG_WARN("Frame of " << frame.width << "x" << frame.height << " exceeds the capture region; stop and start capture again to resize it");
+            warned = true;
+        }
+        return 0;
+    }
+
+    uint64_t next = sequence + 1;
+    char* slotStart = static_cast<char*>(mapping.data()) + sizeof(Header) + (next & 1) * (sizeof(Slot) + capacity);
+    Slot* slot = reinterpret_cast<Slot*>(slotStart);
+    slot->sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    // The array is pinned only for the copy, without allocating on the way.
+    void* pinned = env->GetPrimitiveArrayCritical(frame.pixels, nullptr);
+    if (pinned == nullptr) {
+        env->ExceptionClear();
+        return 0;
+    }
+    std::memcpy(slotStart + sizeof(Slot), pinned, bytes);
+    env->ReleasePrimitiveArrayCritical(frame.pixels, pinned, JNI_ABORT);
+
+    slot->width = static_cast<uint32_t>(frame.width);
+    slot->height = static_cast<uint32_t>(frame.height);
+    slot->sequence.store(next, std::memory_order_release);
+    header->sequence.store(next, std::memory_order_release);
+    sequence = next;
+    return next;
+}
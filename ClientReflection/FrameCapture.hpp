@@ -0,0 +1,89 @@
+#pragma once
+#include "pch.h"
+#include <jni.h>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include "Plan.hpp"
+#include "SharedMemory.hpp"
+
+class Cache;
+
+// Copies the client's rendered frames into a named shared memory region, so a
+// capture tool reads pixels without a query round trip or an image encode.
+//
+// Frames come from the buffer provider the game renders into before the frame
+// is drawn onto the canvas: an object with getWidth, getHeight and getPixels,
+// the last returning the int[] of ARGB pixels. Each frame is one memcpy out of
+// the pinned array.
+//
+//     Header | slot 0 | slot 1
+//     slot: Slot | pixels[capacity]
+//
+// Frame n is written to slot n & 1 while readers still have frame n - 1. A
+// slot's sequence is 0 while it is written and n once frame n is complete;
+// readers copy a slot and keep the copy if its sequence did not change.
+class FrameCapture {
+public:
+    static constexpr uint32_t kMagic = 0x4342524A; // "JRBC"
+    static constexpr uint32_t kVersion = 1;
+    // Slots always fit a 4K frame, so resizing the client rarely outgrows them.
+    static constexpr uint64_t kMinimumCapacity = 3840ull * 2160 * 4;
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        // Pixel bytes per slot.
+        uint64_t capacity;
+        // The latest complete frame, 0 before the first.
+        std::atomic<uint64_t> sequence;
+        char padding[40];
+    };
+
+    struct Slot {
+        std::atomic<uint64_t> sequence;
+        uint32_t width;
+        uint32_t height;
+        char padding[48];
+    };
+
+    // Starts copying the frames of the buffer provider `query` evaluates to
+    // and copies the first one. Returns an error message, or "" with the
+    // region's name in `name`.
+    std::string start(JNIEnv* env, Cache& cache, const std::string& query, std::string& name);
+    void stop();
+    bool isActive();
+
+    // Copies the current frame. Returns its sequence number, or 0 if capture is
+    // stopped or the frame could not be read.
+    uint64_t capture(JNIEnv* env, Cache& cache);
+
+private:
+    // The chains read from the buffer provider.
+    struct Source {
+        Plan width;
+        Plan height;
+        Plan pixels;
+    };
+
+    struct Frame {
+        jintArray pixels = nullptr;
+        jint width = 0;
+        jint height = 0;
+    };
+
+    std::string read(JNIEnv* env, Cache& cache, const Source& from, Frame& frame);
+    uint64_t copy(JNIEnv* env, const Frame& frame);
+
+    std::mutex mutex;
+    SharedMapping mapping;
+    Source source;
+    // Pixel bytes per slot. Kept out of the header, which readers can
+    // overwrite.
+    uint64_t capacity = 0;
+    uint64_t sequence = 0;
+    bool warned = false;
+};
+
+static_assert(sizeof(FrameCapture::Header) == 64 && sizeof(FrameCapture::Slot) == 64, "capture headers are shared with readers");
@@ -0,0 +1,127 @@
+#include "pch.h"
+#include "Histogram.hpp"
+#include <algorithm>
+
+static std::atomic<size_t> nextThread{ 0 };
+static thread_local size_t threadOrdinal = nextThread++;
+
+static int highestBit(uint64_t value) {
+    int bit = 0;
+    while (value >>= 1) {
+        bit++;
+    }
+    return bit;
+}
+
+size_t Histogram::bucketOf(uint64_t value) {
+    if (value < 32) {
+        return static_cast<size_t>(value);
+    }
+    // The top five bits select one of 16 buckets within the power of two.
+    int msb = highestBit(value);
+    int shift = msb - 4;
+    size_t bucket = 32 + static_cast<size_t>(msb - 5) * 16 + static_cast<size_t>((value >> shift) - 16);
+    return (std::min)(bucket, kBuckets - 1);
+}
+
+uint64_t Histogram::bucketLimit(size_t bucket) {
+    if (bucket < 32) {
+        return bucket;
+    }
+    size_t magnitude = (bucket - 32) / 16 + 5;
+    uint64_t top = 16 + (bucket - 32) % 16;
+    int shift = static_cast<int>(magnitude) - 4;
+    return ((top + 1) << shift) - 1;
+}
+
+Histogram::~Histogram() {
+    for (auto& slot : shards) {
+        delete slot.load();
+    }
+}
+
+Histogram::Shard& Histogram::shard() {
+    // Threads beyond kShards share shards, which stays correct since every
+    // update is atomic.
+    auto& slot = shards[threadOrdinal % kShards];
+    Shard* current = slot.load(std::memory_order_acquire);
+    if (current == nullptr) {
+        Shard* created = new Shard();
+        if (slot.compare_exchange_strong(current, created, std::memory_order_acq_rel)) {
+            current = created;
+        }
+        else {
+            delete created;
+        }
+    }
+    return *current;
+}
+
+void Histogram::record(uint64_t nanoseconds) {
+    Shard& target = shard();
+    target.buckets[bucketOf(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+    target.count.fetch_add(1, std::memory_order_relaxed);
+    target.sum.fetch_add(nanoseconds, std::memory_order_relaxed);
+    uint64_t seen = target.min.load(std::memory_order_relaxed);
+    while (nanoseconds < seen && !target.min.compare_exchange_weak(seen, nanoseconds, std::memory_order_relaxed)) {}
+    seen = target.max.load(std::memory_order_relaxed);
+    while (nanoseconds > seen && !target.max.compare_exchange_weak(seen, nanoseconds, std::memory_order_relaxed)) {}
+}
+
+Histogram::Snapshot Histogram::snapshot() const {
+    Snapshot result;
+    result.min = UINT64_MAX;
+    for (const auto& slot : shards) {
+        const Shard* current = slot.load(std::memory_order_acquire);
+        if (current == nullptr) {
+            continue;
+        }
+        for (size_t i = 0; i < kBuckets; i++) {
+            result.buckets[i] += current->buckets[i].load(std::memory_order_relaxed);
+        }
+        result.count += current->count.load(std::memory_order_relaxed);
+        result.sum += current->sum.load(std::memory_order_relaxed);
+        result.min = (std::min)(result.min, current->min.load(std::memory_order_relaxed));
+        result.max = (std::max)(result.max, current->max.load(std::memory_order_relaxed));
+    }
+    if (result.count == 0) {
+        result.min = 0;
+    }
+    return result;
+}
+
+void Histogram::reset() {
+    for (auto& slot : shards) {
+        Shard* current = slot.load(std::memory_order_acquire);
+        if (current == nullptr) {
+            continue;
+        }
+        for (auto& bucket : current->buckets) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        current->count.store(0, std::memory_order_relaxed);
+        current->sum.store(0, std::memory_order_relaxed);
+        current->min.store(UINT64_MAX, std::memory_order_relaxed);
+        current->max.store(0, std::memory_order_relaxed);
+    }
+}
+
+uint64_t Histogram::Snapshot::percentile(double fraction) const {
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(fraction * static_cast<double>(count) + 0.5);
+    rank = std::clamp<uint64_t>(rank, 1, count);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBuckets; i++) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            return std::clamp(bucketLimit(i), min, max);
+        }
+    }
+    return max;
+}
+
+double Histogram::Snapshot::mean() const {
+    return count == 0 ? 0.0 : static_cast<double>(sum) / static_cast<double>(count);
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include "pch.h"
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Latency histogram in nanoseconds with log-linear buckets in the style of
+// HdrHistogram: values below 32 get a bucket each, above that every power of
+// two is split into 16 buckets, so any recorded value is reported within
+// about 6% of its true value up to several minutes.
+//
+// Each thread records into its own shard with relaxed atomic increments, and
+// snapshot() sums the shards while writers keep going.
+class Histogram {
+public:
+    static constexpr size_t kBuckets = 32 + 43 * 16;
+
+    struct Snapshot {
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        uint64_t min = 0;
+        uint64_t max = 0;
+        std::array<uint64_t, kBuckets> buckets{};
+
+        // Smallest recorded value that `fraction` of the values do not exceed.
+        uint64_t percentile(double fraction) const;
+        double mean() const;
+    };
+
+    Histogram() = default;
+    ~Histogram();
+    Histogram(const Histogram&) = delete;
+    Histogram& operator=(const Histogram&) = delete;
+
+    void record(uint64_t nanoseconds);
+    Snapshot snapshot() const;
+    void reset();
+
+    static size_t bucketOf(uint64_t value);
+    // Largest value that falls into `bucket`.
+    static uint64_t bucketLimit(size_t bucket);
+
+private:
+    struct Shard {
+        std::array<std::atomic<uint64_t>, kBuckets> buckets{};
+        std::atomic<uint64_t> count{ 0 };
+        std::atomic<uint64_t> sum{ 0 };
+        std::atomic<uint64_t> min{ UINT64_MAX };
+        std::atomic<uint64_t> max{ 0 };
+    };
+
+    static constexpr size_t kShards = 16;
+
+    Shard& shard();
+
+    std::array<std::atomic<Shard*>, kShards> shards{};
+};
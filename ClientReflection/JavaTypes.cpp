@@ -0,0 +1,111 @@
+#include "pch.h"
+#include "JavaTypes.hpp"
+#include "Log.hpp"
+
+namespace {
+    jclass globalClass(JNIEnv* env, const char* name, bool required) {
+        jclass local = env->FindClass(name);
+        if (local == nullptr || env->ExceptionCheck()) {
+            env->ExceptionClear();
+            if (required) {
+                LOG_ERROR("Failed to find " << name);
+            }
+            return nullptr;
+        }
+        jclass global = static_cast<jclass>(env->NewGlobalRef(local));
+        env->DeleteLocalRef(local);
+        return global;
+    }
+
+    jmethodID methodId(JNIEnv* env, jclass clazz, const char* name, const char* signature) {
+        if (clazz == nullptr) {
+            return nullptr;
+        }
+        jmethodID id = env->GetMethodID(clazz, name, signature);
+        if (id == nullptr || env->ExceptionCheck()) {
+            env->ExceptionClear();
+            LOG_ERROR("Failed to find method " << name << signature);
+            return nullptr;
+        }
+        return id;
+    }
+
+    jmethodID staticMethodId(JNIEnv* env, jclass clazz, const char* name, const char* signature) {
+        if (clazz == nullptr) {
+            return nullptr;
+        }
+        jmethodID id = env->GetStaticMethodID(clazz, name, signature);
+        if (id == nullptr || env->ExceptionCheck()) {
+            env->ExceptionClear();
+            LOG_ERROR("Failed to find static method " << name << signature);
+            return nullptr;
+        }
+        return id;
+    }
+}
+
+const JavaTypes& javaTypes(JNIEnv* env) {
+    static const JavaTypes types = [env]() {
+        auto required = [env](const char* name) { return globalClass(env, name, true); };
+        auto optional = [env](const char* name) { return globalClass(env, name, false); };
+        JavaTypes t;
+        t.objectClass = required("java/lang/Object");
+        t.classClass = required("java/lang/Class");
+        t.stringClass = required("java/lang/String");
+        t.throwableClass = required("java/lang/Throwable");
+        t.methodClass = required("java/lang/reflect/Method");
+        t.fieldClass = required("java/lang/reflect/Field");
+        t.booleanClass = required("java/lang/Boolean");
+        t.characterClass = required("java/lang/Character");
+        t.numberClass = required("java/lang/Number");
+        t.floatClass = required("java/lang/Float");
+        t.doubleClass = required("java/lang/Double");
+        t.collectionClass = required("java/util/Collection");
+        t.listClass = required("java/util/List");
+        t.objectArrayClass = required("[Ljava/lang/Object;");
+        t.mapClass = required("java/util/Map");
+        t.entryClass = required("java/util/Map$Entry");
+        t.classLoaderClass = required("java/lang/ClassLoader");
+        t.systemClass = required("java/lang/System");
+        t.componentClass = optional("java/awt/Component");
+        t.containerClass = optional("java/awt/Container");
+        t.windowClass = optional("java/awt/Window");
+        t.canvasClass = optional("java/awt/Canvas");
+        t.appletClass = optional("java/applet/Applet");
+
+        t.getClass = methodId(env, t.objectClass, "getClass", "()Ljava/lang/Class;");
+        t.toString = methodId(env, t.objectClass, "toString", "()Ljava/lang/String;");
+        t.getName = methodId(env, t.classClass, "getName", "()Ljava/lang/String;");
+        t.isArray = methodId(env, t.classClass, "isArray", "()Z");
+        t.getMethods = methodId(env, t.classClass, "getMethods", "()[Ljava/lang/reflect/Method;");
+        t.getClassLoader = methodId(env, t.classClass, "getClassLoader", "()Ljava/lang/ClassLoader;");
+        t.getSuperclass = methodId(env, t.classClass, "getSuperclass", "()Ljava/lang/Class;");
+        t.getInterfaces = methodId(env, t.classClass, "getInterfaces", "()[Ljava/lang/Class;");
+        t.getDeclaredMethods = methodId(env, t.classClass, "getDeclaredMethods", "()[Ljava/lang/reflect/Method;");
+        t.getDeclaredFields = methodId(env, t.classClass, "getDeclaredFields", "()[Ljava/lang/reflect/Field;");
+        t.loadClass = methodId(env, t.classLoaderClass, "loadClass", "(Ljava/lang/String;)Ljava/lang/Class;");
+        t.identityHashCode = staticMethodId(env, t.systemClass, "identityHashCode", "(Ljava/lang/Object;)I");
+        t.methodGetName = methodId(env, t.methodClass, "getName", "()Ljava/lang/String;");
+        t.getParameterTypes = methodId(env, t.methodClass, "getParameterTypes", "()[Ljava/lang/Class;");
+        t.getReturnType = methodId(env, t.methodClass, "getReturnType", "()Ljava/lang/Class;");
+        t.fieldGetName = methodId(env, t.fieldClass, "getName", "()Ljava/lang/String;");
+        t.printStackTrace = methodId(env, t.throwableClass, "printStackTrace", "()V");
+        t.booleanValue = methodId(env, t.booleanClass, "booleanValue", "()Z");
+        t.charValue = methodId(env, t.characterClass, "charValue", "()C");
+        t.longValue = methodId(env, t.numberClass, "longValue", "()J");
+        t.floatValue = methodId(env, t.numberClass, "floatValue", "()F");
+        t.doubleValue = methodId(env, t.numberClass, "doubleValue", "()D");
+        t.toArray = methodId(env, t.collectionClass, "toArray", "()[Ljava/lang/Object;");
+        t.size = methodId(env, t.collectionClass, "size", "()I");
+        t.listGet = methodId(env, t.listClass, "get", "(I)Ljava/lang/Object;");
+        t.entrySet = methodId(env, t.mapClass, "entrySet", "()Ljava/util/Set;");
+        t.getKey = methodId(env, t.entryClass, "getKey", "()Ljava/lang/Object;");
+        t.getValue = methodId(env, t.entryClass, "getValue", "()Ljava/lang/Object;");
+        t.getComponents = methodId(env, t.containerClass, "getComponents", "()[Ljava/awt/Component;");
+        t.getParent = methodId(env, t.componentClass, "getParent", "()Ljava/awt/Container;");
+        t.isDisplayable = methodId(env, t.componentClass, "isDisplayable", "()Z");
+        t.getWindows = staticMethodId(env, t.windowClass, "getWindows", "()[Ljava/awt/Window;");
+        return t;
+    }();
+    return types;
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include "pch.h"
+#include <jni.h>
+
+// JDK classes and method IDs the bridge calls on every kind of object,
+// resolved once as global references so no query path looks them up by
+// name. ClientAPI resolves them when it attaches; later calls only read.
+//
+// The AWT entries are null when the JVM has no AWT (or no applet support);
+// callers check them before use.
+struct JavaTypes {
+    jclass objectClass;
+    jclass classClass;
+    jclass stringClass;
+    jclass throwableClass;
+    jclass methodClass;
+    jclass fieldClass;
+    jclass booleanClass;
+    jclass characterClass;
+    jclass numberClass;
+    jclass floatClass;
+    jclass doubleClass;
+    jclass collectionClass;
+    jclass listClass;
+    jclass objectArrayClass;
+    jclass mapClass;
+    jclass entryClass;
+    jclass classLoaderClass;
+    jclass systemClass;
+    jclass componentClass;
+    jclass containerClass;
+    jclass windowClass;
+    jclass canvasClass;
+    jclass appletClass;
+
+    // java.lang.Object
+    jmethodID getClass;
+    jmethodID toString;
+    // java.lang.Class
+    jmethodID getName;
+    jmethodID isArray;
+    jmethodID getMethods;
+    jmethodID getClassLoader;
+    jmethodID getSuperclass;
+    jmethodID getInterfaces;
+    jmethodID getDeclaredMethods;
+    jmethodID getDeclaredFields;
+    // java.lang.ClassLoader
+    jmethodID loadClass;
+    // java.lang.System
+    jmethodID identityHashCode;  // static
+    // java.lang.reflect.Method
+    jmethodID methodGetName;
+    jmethodID getParameterTypes;
+    jmethodID getReturnType;
+    // java.lang.reflect.Field
+    jmethodID fieldGetName;
+    // java.lang.Throwable
+    jmethodID printStackTrace;
+    // boxes
+    jmethodID booleanValue;
+    jmethodID charValue;
+    jmethodID longValue;
+    jmethodID floatValue;
+    jmethodID doubleValue;
+    // collections
+    jmethodID toArray;
+    jmethodID size;
+    jmethodID listGet;
+    jmethodID entrySet;
+    jmethodID getKey;
+    jmethodID getValue;
+    // java.awt
+    jmethodID getComponents;
+    jmethodID getParent;
+    jmethodID isDisplayable;
+    jmethodID getWindows;  // static
+};
+
+const JavaTypes& javaTypes(JNIEnv* env);
@@ -0,0 +1,335 @@
+#include "pch.h"
+#include "JniCounters.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+#include "ConcurrentMap.hpp"
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+struct JniCounters::Entry {
+    std::string text;
+    std::unique_ptr<std::atomic<uint64_t>[]> values;
+};
+
+namespace {
+    using Kind = JniCounters::Kind;
+
+    constexpr size_t kKinds = static_cast<size_t>(Kind::Count);
+    // Per entry: queries, every kind, allocations, bytes.
+    constexpr size_t kValues = kKinds + 3;
+
+    const char* const kKindNames[] = { "find_class", "member_id", "call", "field", "global_ref", "local_ref", "string", "array", "type", "exception" };
+
+    std::atomic<bool> active{ false };
+    // Constant initialized, so operator new may read it on any thread at any
+    // time, including during thread start and exit.
+    thread_local JniCounters::Tally* current = nullptr;
+
+    const JNINativeInterface_* original = nullptr;
+    JNINativeInterface_ counting;
+    std::once_flag built;
+
+    ConcurrentMap<JniCounters::Entry>& entries() {
+        static ConcurrentMap<JniCounters::Entry> map;
+        return map;
+    }
+
+    std::atomic<size_t> entryCount{ 0 };
+
+    const JniCounters::Entry& newEntry(const std::string& text) {
+        JniCounters::Entry entry{ text, std::make_unique<std::atomic<uint64_t>[]>(kValues) };
+        for (size_t i = 0; i < kValues; i++) {
+            entry.values[i] = 0;
+        }
+        return *entries().insert(text, std::move(entry));
+    }
+
+    const JniCounters::Entry& otherEntry() {
+        static const JniCounters::Entry& entry = newEntry("(other)");
+        return entry;
+    }
+
+    // The thread's env only points at the counting table inside a scope, so
+    // `current` is set whenever one of these runs on it.
+    template <Kind K, auto Slot, typename R, typename... A>
+    R JNICALL counted(JNIEnv* env, A... args) {
+        current->calls[static_cast<size_t>(K)]++;
+        return (original->*Slot)(env, args...);
+    }
+
+    template <Kind K, auto Slot, typename R, typename... A>
+    void install(R (JNICALL* JNINativeInterface_::*)(JNIEnv*, A...)) {
+        counting.*Slot = &counted<K, Slot, R, A...>;
+    }
+
+    // The variadic entries are left alone: the C++ JNIEnv wrappers forward
+    // them to the V forms, which are counted.
+#define JRB_COUNT(kind, slot) install<Kind::kind, &JNINativeInterface_::slot>(&JNINativeInterface_::slot)
+#define JRB_EACH_TYPE(X) X(Object) X(Boolean) X(Byte) X(Char) X(Short) X(Int) X(Long) X(Float) X(Double)
+#define JRB_EACH_PRIMITIVE(X) X(Boolean) X(Byte) X(Char) X(Short) X(Int) X(Long) X(Float) X(Double)
+#define JRB_COUNT_CALLS(T) \
+    JRB_COUNT(Call, Call##T##MethodV); JRB_COUNT(Call, Call##T##MethodA); \
+    JRB_COUNT(Call, CallNonvirtual##T##MethodV); JRB_COUNT(Call, CallNonvirtual##T##MethodA); \
+    JRB_COUNT(Call, CallStatic##T##MethodV); JRB_COUNT(Call, CallStatic##T##MethodA);
+#define JRB_COUNT_FIELDS(T) JRB_COUNT(Field, Get##T##Field); JRB_COUNT(Field, GetStatic##T##Field);
+#define JRB_COUNT_ARRAYS(T) \
+    JRB_COUNT(Array, New##T##Array); JRB_COUNT(Array, Get##T##ArrayElements); \
+    JRB_COUNT(Array, Release##T##ArrayElements); JRB_COUNT(Array, Get##T##ArrayRegion);
+
+    void build(const JNINativeInterface_* functions) {
+        original = functions;
+        counting = *functions;
+        JRB_COUNT(FindClass, FindClass);
+        JRB_COUNT(MemberId, GetMethodID);
+        JRB_COUNT(MemberId, GetStaticMethodID);
+        JRB_COUNT(MemberId, GetFieldID);
+        JRB_COUNT(MemberId, GetStaticFieldID);
+        JRB_EACH_TYPE(JRB_COUNT_CALLS)
+        JRB_COUNT_CALLS(Void)
+        JRB_COUNT(Call, NewObjectV);
+        JRB_COUNT(Call, NewObjectA);
+        JRB_EACH_TYPE(JRB_COUNT_FIELDS)
+        JRB_COUNT(GlobalRef, NewGlobalRef);
+        JRB_COUNT(GlobalRef, DeleteGlobalRef);
+        JRB_COUNT(GlobalRef, NewWeakGlobalRef);
+        JRB_COUNT(GlobalRef, DeleteWeakGlobalRef);
+        JRB_COUNT(LocalRef, NewLocalRef);
+        JRB_COUNT(LocalRef, DeleteLocalRef);
+        JRB_COUNT(LocalRef, PushLocalFrame);
+        JRB_COUNT(LocalRef, PopLocalFrame);
+        JRB_COUNT(LocalRef, EnsureLocalCapacity);
+        JRB_COUNT(String, NewString);
+        JRB_COUNT(String, NewStringUTF);
+        JRB_COUNT(String, GetStringLength);
+        JRB_COUNT(String, GetStringUTFLength);
+        JRB_COUNT(String, GetStringChars);
+        JRB_COUNT(String, ReleaseStringChars);
+        JRB_COUNT(String, GetStringUTFChars);
+        JRB_COUNT(String, ReleaseStringUTFChars);
+        JRB_COUNT(String, GetStringRegion);
+        JRB_COUNT(String, GetStringUTFRegion);
+        JRB_COUNT(String, GetStringCritical);
+        JRB_COUNT(String, ReleaseStringCritical);
+        JRB_COUNT(Array, GetArrayLength);
+        JRB_COUNT(Array, NewObjectArray);
+        JRB_COUNT(Array, GetObjectArrayElement);
+        JRB_COUNT(Array, GetPrimitiveArrayCritical);
+        JRB_COUNT(Array, ReleasePrimitiveArrayCritical);
+        JRB_EACH_PRIMITIVE(JRB_COUNT_ARRAYS)
+        JRB_COUNT(Type, GetObjectClass);
+        JRB_COUNT(Type, GetSuperclass);
+        JRB_COUNT(Type, IsInstanceOf);
+        JRB_COUNT(Type, IsAssignableFrom);
+        JRB_COUNT(Type, IsSameObject);
+        JRB_COUNT(Type, GetObjectRefType);
+        JRB_COUNT(Exception, ExceptionCheck);
+        JRB_COUNT(Exception, ExceptionOccurred);
+        JRB_COUNT(Exception, ExceptionClear);
+        JRB_COUNT(Exception, ExceptionDescribe);
+    }
+
+#undef JRB_COUNT_ARRAYS
+#undef JRB_COUNT_FIELDS
+#undef JRB_COUNT_CALLS
+#undef JRB_EACH_PRIMITIVE
+#undef JRB_EACH_TYPE
+#undef JRB_COUNT
+
+    void appendRow(Table& table, Encoding encoding, const JniCounters::Entry& entry) {
+        uint64_t queries = entry.values[0].load(std::memory_order_relaxed);
+        if (queries == 0) {
+            return;
+        }
+        std::vector<std::string> row;
+        if (encoding == Encoding::Binary) {
+            ValueWriter writer;
+            writer.writeString(entry.text);
+            row.push_back(writer.release());
+            writer.writeInt(static_cast<int64_t>(queries));
+            row.push_back(writer.release());
+            for (size_t i = 1; i < kValues; i++) {
+                writer.writeDouble(static_cast<double>(entry.values[i].load(std::memory_order_relaxed)) / queries);
+                row.push_back(writer.release());
+            }
+        }
+        else {
+            row.push_back(entry.text);
+            row.push_back(std::to_string(queries));
+            for (size_t i = 1; i < kValues; i++) {
+                char cell[32];
+                snprintf(cell, sizeof(cell), "%.1f", static_cast<double>(entry.values[i].load(std::memory_order_relaxed)) / queries);
+                row.push_back(cell);
+            }
+        }
+        table.rows.push_back(std::move(row));
+    }
+}
+
+void JniCounters::enable(bool on) {
+    active.store(on, std::memory_order_relaxed);
+}
+
+bool JniCounters::enabled() {
+    return active.load(std::memory_order_relaxed);
+}
+
+Table JniCounters::table(Encoding encoding) {
+    Table table;
+    table.columns = { "name", "count" };
+    for (const char* name : kKindNames) {
+        table.columns.push_back(name);
+    }
+    table.columns.push_back("allocations");
+    table.columns.push_back("alloc_bytes");
+    entries().forEach([&](const Entry& entry) {
+        appendRow(table, encoding, entry);
+    });
+    return table;
+}
+
+void JniCounters::reset() {
+    entries().forEach([](const Entry& entry) {
+        for (size_t i = 0; i < kValues; i++) {
+            entry.values[i].store(0, std::memory_order_relaxed);
+        }
+    });
+}
+
+JniCounters::Scope::Scope(JNIEnv* env, const std::string& query, bool counted) : env(env), counted(counted) {
+    if (!enabled() || env == nullptr) {
+        return;
+    }
+    std::call_once(built, build, env->functions);
+    entry = entries().find(query);
+    if (entry == nullptr) {
+        if (entryCount.load(std::memory_order_relaxed) >= kMaxQueries) {
+            entry = &otherEntry();
+        }
+        else {
+            entryCount++;
+            entry = &newEntry(query);
+        }
+    }
+    functions = env->functions;
+    env->functions = &counting;
+    previous = current;
+    current = &tally;
+}
+
+JniCounters::Scope::~Scope() {
+    if (entry == nullptr) {
+        return;
+    }
+    current = previous;
+    env->functions = functions;
+    if (counted) {
+        entry->values[0].fetch_add(1, std::memory_order_relaxed);
+    }
+    for (size_t i = 0; i < kKinds; i++) {
+        if (tally.calls[i] != 0) {
+            entry->values[1 + i].fetch_add(tally.calls[i], std::memory_order_relaxed);
+        }
+    }
+    entry->values[kKinds + 1].fetch_add(tally.allocations, std::memory_order_relaxed);
+    entry->values[kKinds + 2].fetch_add(tally.bytes, std::memory_order_relaxed);
+}
+
+// Counting allocator. Allocation and release go straight to malloc and free,
+// or their aligned forms, as the default operators do, so memory may cross
+// between this module and the runtime in either direction.
+namespace {
+    void count(size_t size) {
+        if (JniCounters::Tally* tally = current) {
+            tally->allocations++;
+            tally->bytes += size;
+        }
+    }
+
+    void* allocate(size_t size) {
+        count(size);
+        if (void* memory = std::malloc(size == 0 ? 1 : size)) {
+            return memory;
+        }
+        throw std::bad_alloc();
+    }
+
+    void* allocateAligned(size_t size, std::align_val_t alignment) {
+        count(size);
+        size_t align = static_cast<size_t>(alignment);
+#ifdef _WIN32
+        void* memory = _aligned_malloc(size == 0 ? 1 : size, align);
+#else
+        // aligned_alloc wants a nonzero multiple of the alignment.
+        size_t rounded = ((std::max)(size, align) + align - 1) / align * align;
+        void* memory = std::aligned_alloc(align, rounded);
+#endif
+        if (memory != nullptr) {
+            return memory;
+        }
+        throw std::bad_alloc();
+    }
+
+    void releaseAligned(void* memory) {
+#ifdef _WIN32
+        _aligned_free(memory);
+#else
+        std::free(memory);
+#endif
+    }
+}
+
+void* operator new(size_t size) {
+    return allocate(size);
+}
+
+void* operator new[](size_t size) {
+    return allocate(size);
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void* memory, size_t) noexcept {
+    std::free(memory);
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    return allocateAligned(size, alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+    return allocateAligned(size, alignment);
+}
+
+void operator delete(void* memory, std::align_val_t) noexcept {
+    releaseAligned(memory);
+}
+
+void operator delete[](void* memory, std::align_val_t) noexcept {
+    releaseAligned(memory);
+}
+
+void operator delete(void* memory, size_t, std::align_val_t) noexcept {
+    releaseAligned(memory);
+}
+
+void operator delete[](void* memory, size_t, std::align_val_t) noexcept {
+    releaseAligned(memory);
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include "pch.h"
+#include <jni.h>
+#include <array>
+#include <cstdint>
+#include <string>
+#include "Encoding.hpp"
+
+// JNI transitions and native allocations per compiled query. Counting is off
+// until enabled by the stats command; while off a scope costs one relaxed
+// load. While on, a scope points its thread's JNIEnv at a copy of the
+// function table whose entries count before calling the JVM's, and the
+// replaced operator new, plain and aligned, counts allocations made on that
+// thread, all attributed to the scope's query.
+//
+//  find_class   FindClass
+//  member_id    Get(Static)MethodID, Get(Static)FieldID
+//  call         Call*Method, NewObject
+//  field        Get(Static)*Field
+//  global_ref   New/Delete(Weak)GlobalRef
+//  local_ref    New/DeleteLocalRef, Push/PopLocalFrame
+//  string       Java string creation, conversion and release
+//  array        array creation, length, element and region access
+//  type         GetObjectClass, IsInstanceOf, IsSameObject and friends
+//  exception    ExceptionCheck, ExceptionOccurred, ExceptionClear
+class JniCounters {
+public:
+    enum class Kind : uint8_t {
+        FindClass,
+        MemberId,
+        Call,
+        Field,
+        GlobalRef,
+        LocalRef,
+        String,
+        Array,
+        Type,
+        Exception,
+        Count
+    };
+
+    static void enable(bool on);
+    static bool enabled();
+
+    // One row per query: name, count, then the mean per query of every kind,
+    // of allocations and of allocated bytes.
+    static Table table(Encoding encoding);
+    static void reset();
+
+    struct Tally {
+        std::array<uint64_t, static_cast<size_t>(Kind::Count)> calls{};
+        uint64_t allocations = 0;
+        uint64_t bytes = 0;
+    };
+
+    struct Entry;
+
+    // Counts the JNI calls made through `env` and the allocations made on
+    // this thread until destruction. Scopes that only add work to a query
+    // already counted elsewhere, such as projection chunks on other workers,
+    // pass counted = false.
+    class Scope {
+    public:
+        Scope(JNIEnv* env, const std::string& query, bool counted = true);
+        ~Scope();
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        JNIEnv* env;
+        const JNINativeInterface_* functions = nullptr;
+        const Entry* entry = nullptr;
+        Tally tally;
+        Tally* previous = nullptr;
+        bool counted;
+    };
+
+    // Queries beyond this many distinct texts share one row, as in Stats.
+    static constexpr size_t kMaxQueries = 512;
+};
@@ -0,0 +1,197 @@
+#include "pch.h"
+#include "Log.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <memory>
+#include <thread>
+
+namespace {
+    constexpr size_t kCapacity = 4096;
+    constexpr size_t kMessageSize = 480;
+
+    struct Record {
+        Log::Level level;
+        int line;
+        const char* file;
+        uint32_t thread;
+        std::chrono::system_clock::time_point time;
+        uint32_t length;
+        char message[kMessageSize];
+    };
+
+    // Bounded multi-producer, single-consumer ring. Each slot's sequence
+    // number says whether it is free for the producer at that position or
+    // filled for the consumer, so producers only contend on the tail index.
+    struct Ring {
+        struct Slot {
+            std::atomic<size_t> sequence;
+            Record record;
+        };
+
+        std::unique_ptr<Slot[]> slots{ new Slot[kCapacity] };
+        alignas(64) std::atomic<size_t> tail{ 0 };
+        alignas(64) size_t head = 0;
+        std::atomic<uint64_t> dropped{ 0 };
+        std::atomic<uint64_t> written{ 0 };
+        std::atomic<uint64_t> flushed{ 0 };
+
+        Ring() {
+            for (size_t i = 0; i < kCapacity; i++) {
+                slots[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        bool push(const Record& record) {
+            size_t position = tail.load(std::memory_order_relaxed);
+            while (true) {
+                Slot& slot = slots[position % kCapacity];
+                size_t sequence = slot.sequence.load(std::memory_order_acquire);
+                intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+                if (difference == 0) {
+                    if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                        slot.record = record;
+                        slot.sequence.store(position + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (difference < 0) {
+                    return false;
+                }
+                else {
+                    position = tail.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        bool pop(Record& record) {
+            Slot& slot = slots[head % kCapacity];
+            if (slot.sequence.load(std::memory_order_acquire) != head + 1) {
+                return false;
+            }
+            record = slot.record;
+            slot.sequence.store(head + kCapacity, std::memory_order_release);
+            head++;
+            return true;
+        }
+    };
+
+    std::atomic<uint32_t> nextThread{ 0 };
+    thread_local uint32_t threadOrdinal = nextThread++;
+
+    const char* levelName(Log::Level level) {
+        switch (level) {
+        case Log::Level::Trace: return "TRACE";
+        case Log::Level::Debug: return "DEBUG";
+        case Log::Level::Info: return "INFO";
+        case Log::Level::Warn: return "WARN";
+        default: return "ERROR";
+        }
+    }
+
+    const char* baseName(const char* path) {
+        const char* name = path;
+        for (const char* c = path; *c != '\0'; c++) {
+            if (*c == '/' || *c == '\\') {
+                name = c + 1;
+            }
+        }
+        return name;
+    }
+
+    void format(FILE* file, const Record& record) {
+        std::time_t seconds = std::chrono::system_clock::to_time_t(record.time);
+        auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(record.time.time_since_epoch()).count() % 1000;
+        std::tm local{};
+#ifdef _WIN32
+        localtime_s(&local, &seconds);
+#else
+        localtime_r(&seconds, &local);
+#endif
+        char stamp[32];
+        std::strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &local);
+        fprintf(file, "%s.%03d %-5s [%u] %s:%d %.*s\n", stamp, static_cast<int>(millis), levelName(record.level),
+            record.thread, baseName(record.file), record.line,
+            static_cast<int>(record.length), record.message);
+    }
+
+    // Started by the first record and never joined: the library may be
+    // unloaded from DllMain, where waiting for a thread would deadlock.
+    Ring& ring() {
+        static Ring* instance = [] {
+            Ring* created = new Ring();
+            std::thread([created] {
+                std::filesystem::path path;
+                if (const char* configured = std::getenv("JRB_LOG_FILE")) {
+                    path = configured;
+                }
+                else {
+                    std::error_code error;
+                    path = std::filesystem::temp_directory_path(error) / "jrb.log";
+                }
+                FILE* file = nullptr;
+#ifdef _WIN32
+                _wfopen_s(&file, path.wstring().c_str(), L"a");
+#else
+                file = std::fopen(path.string().c_str(), "a");
+#endif
+                Record record;
+                while (true) {
+                    uint64_t count = 0;
+                    while (created->pop(record)) {
+                        if (file != nullptr) {
+                            format(file, record);
+                        }
+                        count++;
+                    }
+                    if (count > 0) {
+                        if (file != nullptr) {
+                            std::fflush(file);
+                        }
+                        created->flushed.fetch_add(count, std::memory_order_release);
+                    }
+                    else {
+                        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                    }
+                }
+            }).detach();
+            return created;
+        }();
+        return *instance;
+    }
+}
+
+void Log::write(Level level, const char* file, int line, const std::string& message) {
+    Record record;
+    record.level = level;
+    record.line = line;
+    record.file = file;
+    record.thread = threadOrdinal;
+    record.time = std::chrono::system_clock::now();
+    record.length = static_cast<uint32_t>(message.size() < kMessageSize ? message.size() : kMessageSize);
+    std::memcpy(record.message, message.data(), record.length);
+
+    Ring& target = ring();
+    if (target.push(record)) {
+        target.written.fetch_add(1, std::memory_order_relaxed);
+    }
+    else {
+        target.dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void Log::flush() {
+    Ring& target = ring();
+    uint64_t goal = target.written.load(std::memory_order_relaxed);
+    while (target.flushed.load(std::memory_order_acquire) < goal) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+uint64_t Log::dropped() {
+    return ring().dropped.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include "pch.h"
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+// Leveled logging that compiles away. Statements below JRB_LOG_LEVEL expand
+// to nothing, arguments included, so release builds pay nothing for the
+// trace and debug statements on the request path.
+//
+// Enabled statements format their message on the calling thread and hand it
+// to a lock-free ring; a background thread writes the ring to a file
+// (JRB_LOG_FILE, or jrb.log in the temp directory). A full ring drops
+// records rather than blocking the caller.
+//
+//     LOG_DEBUG("Resolved " << key << " in " << micros << "us");
+
+#define JRB_LOG_TRACE 0
+#define JRB_LOG_DEBUG 1
+#define JRB_LOG_INFO 2
+#define JRB_LOG_WARN 3
+#define JRB_LOG_ERROR 4
+#define JRB_LOG_OFF 5
+
+#ifndef JRB_LOG_LEVEL
+#ifdef NDEBUG
+#define JRB_LOG_LEVEL JRB_LOG_INFO
+#else
+#define JRB_LOG_LEVEL JRB_LOG_TRACE
+#endif
+#endif
+
+namespace Log {
+    enum class Level : uint8_t {
+        Trace = JRB_LOG_TRACE,
+        Debug = JRB_LOG_DEBUG,
+        Info = JRB_LOG_INFO,
+        Warn = JRB_LOG_WARN,
+        Error = JRB_LOG_ERROR
+    };
+
+    void write(Level level, const char* file, int line, const std::string& message);
+    // Waits until every record written so far is in the file.
+    void flush();
+    // Records dropped because the ring was full.
+    uint64_t dropped();
+}
+
+#define JRB_LOG_AT(level, expression) \
+    do { \
+        std::ostringstream jrbLogStream; \
+        jrbLogStream << expression; \
+        ::Log::write(level, __FILE__, __LINE__, jrbLogStream.str()); \
+    } while (0)
+
+#if JRB_LOG_LEVEL <= JRB_LOG_TRACE
+#define LOG_TRACE(expression) JRB_LOG_AT(::Log::Level::Trace, expression)
+#else
+#define LOG_TRACE(expression) ((void)0)
+#endif
+
+#if JRB_LOG_LEVEL <= JRB_LOG_DEBUG
+#define LOG_DEBUG(expression) JRB_LOG_AT(::Log::Level::Debug, expression)
+#else
+#define LOG_DEBUG(expression) ((void)0)
+#endif
+
+#if JRB_LOG_LEVEL <= JRB_LOG_INFO
+#define LOG_INFO(expression) JRB_LOG_AT(::Log::Level::Info, expression)
+#else
+#define LOG_INFO(expression) ((void)0)
+#endif
+
+#if JRB_LOG_LEVEL <= JRB_LOG_WARN
+#define LOG_WARN(expression) JRB_LOG_AT(::Log::Level::Warn, expression)
+#else
+#define LOG_WARN(expression) ((void)0)
+#endif
+
+#if JRB_LOG_LEVEL <= JRB_LOG_ERROR
+#define LOG_ERROR(expression) JRB_LOG_AT(::Log::Level::Error, expression)
+#else
+#define LOG_ERROR(expression) ((void)0)
+#endif
@@ -0,0 +1,90 @@
+#include "pch.h"
+#include "Memo.hpp"
+
+bool TickMemo::isValid(const Entry& entry) const {
+    int64_t lifetime = ttl.load(std::memory_order_relaxed);
+    if (lifetime > 0) {
+        return entry.tick >= 0 && std::chrono::steady_clock::now() - entry.stored < std::chrono::milliseconds(lifetime);
+    }
+    int64_t current = tick.load(std::memory_order_acquire);
+    return current >= 0 && entry.tick == current;
+}
+
+void TickMemo::release(JNIEnv* env, Entry& entry) {
+    if ((entry.type == 'L' || entry.type == '[') && entry.value.l != nullptr) {
+        env->DeleteGlobalRef(entry.value.l);
+    }
+    entry = Entry();
+}
+
+void TickMemo::releaseAll(JNIEnv* env) {
+    for (Shard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (auto& entry : shard.entries) {
+            release(env, entry);
+        }
+    }
+}
+
+bool TickMemo::lookup(JNIEnv* env, uint32_t node, jvalue& value, std::string& nextKey) {
+    Shard& shard = shards[node % kShards];
+    size_t index = node / kShards;
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (index >= shard.entries.size() || !isValid(shard.entries[index])) {
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    const Entry& entry = shard.entries[index];
+    value = entry.value;
+    // Hand out a local reference so the entry can be released while the caller
+    // is still using the object.
+    if ((entry.type == 'L' || entry.type == '[') && entry.value.l != nullptr) {
+        value.l = env->NewLocalRef(entry.value.l);
+    }
+    nextKey = entry.nextKey;
+    hits.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void TickMemo::store(JNIEnv* env, uint32_t node, char type, jvalue value, const std::string& nextKey) {
+    bool timed = ttl.load(std::memory_order_relaxed) > 0;
+    int64_t current = tick.load(std::memory_order_acquire);
+    if (!timed && current < 0) {
+        return;
+    }
+    Shard& shard = shards[node % kShards];
+    size_t index = node / kShards;
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (index >= shard.entries.size()) {
+        shard.entries.resize(index + 1);
+    }
+    Entry& entry = shard.entries[index];
+    release(env, entry);
+    entry.tick = timed ? 0 : current;
+    entry.stored = std::chrono::steady_clock::now();
+    entry.type = type;
+    entry.value = value;
+    if ((type == 'L' || type == '[') && value.l != nullptr) {
+        entry.value.l = env->NewGlobalRef(value.l);
+    }
+    entry.nextKey = nextKey;
+}
+
+void TickMemo::advance(JNIEnv* env, int64_t newTick) {
+    // Every worker calls this once per query; only the first to see a new tick
+    // releases the old entries.
+    int64_t current = tick.load(std::memory_order_acquire);
+    if (current == newTick || !tick.compare_exchange_strong(current, newTick, std::memory_order_acq_rel)) {
+        return;
+    }
+    releaseAll(env);
+}
+
+void TickMemo::clear(JNIEnv* env) {
+    tick.store(-1, std::memory_order_release);
+    releaseAll(env);
+}
+
+void TickMemo::setTtl(std::chrono::milliseconds newTtl) {
+    ttl.store(newTtl.count(), std::memory_order_relaxed);
+}
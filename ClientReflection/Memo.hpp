@@ -0,0 +1,57 @@
+#pragma once
+#include "pch.h"
+#include <jni.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Caches hop results for the current game tick. Entries are indexed by plan
+// node; a node is a root plus a hop prefix, so it also identifies the receiver
+// the hop was invoked on. Entries are valid while the tick they were read in is
+// current or, when a TTL is set, for that long after they were read.
+//
+// One memo is shared by every worker, so a getter is invoked once per tick
+// however many workers ask for it. Nodes are spread over shards, each with its
+// own lock, so workers reading different chains do not contend.
+class TickMemo {
+public:
+    bool lookup(JNIEnv* env, uint32_t node, jvalue& value, std::string& nextKey);
+    void store(JNIEnv* env, uint32_t node, char type, jvalue value, const std::string& nextKey);
+    void advance(JNIEnv* env, int64_t tick);
+    void clear(JNIEnv* env);
+
+    void setTtl(std::chrono::milliseconds ttl);
+    std::chrono::milliseconds getTtl() const { return std::chrono::milliseconds(ttl.load(std::memory_order_relaxed)); }
+
+    std::atomic<uint64_t> hits{ 0 };
+    std::atomic<uint64_t> misses{ 0 };
+
+private:
+    static constexpr size_t kShards = 16;
+
+    struct Entry {
+        int64_t tick = -1;
+        std::chrono::steady_clock::time_point stored;
+        char type = 'V';
+        jvalue value = {};
+        std::string nextKey;
+    };
+
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        // Indexed by node / kShards.
+        std::vector<Entry> entries;
+    };
+
+    bool isValid(const Entry& entry) const;
+    void release(JNIEnv* env, Entry& entry);
+    void releaseAll(JNIEnv* env);
+
+    Shard shards[kShards];
+    std::atomic<int64_t> tick{ -1 };
+    // Milliseconds; 0 memoizes per tick.
+    std::atomic<int64_t> ttl{ 0 };
+};
@@ -1,93 +1,544 @@
 #include "pch.h"
 #include "Pipeline.hpp"
 #include "ClientAPI.hpp"
+#include "JniCounters.hpp"
+#include "Stats.hpp"
+#include "Trace.hpp"
+#include "Log.hpp"
 #include <sstream>
+#include <utility>
+#include <algorithm>
 
-Pipeline::Pipeline(const std::wstring& pipeName, size_t bufferSize)
-    : pipeName(pipeName), bufferSize(bufferSize), hPipe(INVALID_HANDLE_VALUE) {}
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+Pipeline::Pipeline(const std::string& address, size_t bufferSize)
+    : address(address), bufferSize(bufferSize) {}
+
+#ifdef _WIN32
+Pipeline::Pipeline(const std::wstring& pipeName, size_t bufferSize) : bufferSize(bufferSize) {
+    int size_needed = WideCharToMultiByte(CP_UTF8, 0, pipeName.c_str(), (int)pipeName.size(), NULL, 0, NULL, NULL);
+    address.assign(size_needed, 0);
+    WideCharToMultiByte(CP_UTF8, 0, pipeName.c_str(), (int)pipeName.size(), &address[0], size_needed, NULL, NULL);
+}
+#endif
 
 Pipeline::~Pipeline() {
-    DisconnectAndClose();
+    if (loop) {
+        loop->stop();
+    }
 }
 
 void Pipeline::StartServer() {
-    int size_needed = WideCharToMultiByte(CP_UTF8, 0, pipeName.c_str(), (int)pipeName.size(), NULL, 0, NULL, NULL);
-    std::string narrowPipeName(size_needed, 0);
-    WideCharToMultiByte(CP_UTF8, 0, pipeName.c_str(), (int)pipeName.size(), &narrowPipeName[0], size_needed, NULL, NULL);
+    // Every connection is served by this thread; queries run on the executor
+    // so a slow query never stops other clients from being read or written.
+    // Both are created here rather than in the constructor, which runs in
+    // DllMain.
+    JavaVM* jvm = nullptr;
+    jsize nVMs = 0;
+    if (JNI_GetCreatedJavaVMs(&jvm, 1, &nVMs) != JNI_OK || nVMs == 0) {
+        jvm = nullptr;
+    }
+    unsigned int workers = std::clamp(std::thread::hardware_concurrency(), 2u, 8u);
+    executor = std::make_unique<Executor>(workers, jvm);
+    scheduler = std::make_unique<FairScheduler>(*executor, workers);
+    loop = std::make_unique<EventLoop>(address, bufferSize, EventLoop::Callbacks{
+        [this](uint64_t connection) { OnConnect(connection); },
+        [this](uint64_t connection, const char* data, size_t size) { OnData(connection, data, size); },
+        [this](uint64_t connection) { OnDisconnect(connection); },
+        [this] { OnTimer(); },
+        std::chrono::milliseconds(10) });
+    if (!loop->listen()) {
 
-    hPipe = CreateNamedPipe(
-        narrowPipeName.c_str(),
-        PIPE_ACCESS_DUPLEX,
-        PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT,
-        PIPE_UNLIMITED_INSTANCES,
-        static_cast<DWORD>(bufferSize),
-        static_cast<DWORD>(bufferSize),
-        0,
-        NULL);
+        exit(1);
+    }
+    Trace::nameThread("io");
+    loop->run();
+}
 
-    if (hPipe == INVALID_HANDLE_VALUE) {
+#ifdef _WIN32
+DWORD WINAPI Pipeline::RunServer(LPVOID lpParam) {
+    Pipeline* pipeline = static_cast<Pipeline*>(lpParam);
+    pipeline->StartServer();
+    return 0;
+}
+#endif
 
-        exit(1);
+ClientAPI& Pipeline::API() {
+    std::lock_guard<std::mutex> lock(clientAPIMutex);
+    if (!clientAPI) {
+        clientAPI = std::make_unique<ClientAPI>();
     }
+    return *clientAPI;
 }
 
-bool Pipeline::ReadFromPipe(std::vector<char>& buffer, DWORD& bytesRead) {
-    buffer.resize(bufferSize - 1);
-    if (!::ReadFile(hPipe, buffer.data(), static_cast<DWORD>(buffer.size()), &bytesRead, NULL)) {
-        return false;
+void Pipeline::OnConnect(uint64_t connection) {
+    auto session = std::make_shared<Session>();
+    session->id = connection;
+    std::lock_guard<std::mutex> lock(sessionsMutex);
+    sessions[connection] = session;
+}
+
+void Pipeline::OnDisconnect(uint64_t connection) {
+    std::shared_ptr<Session> session;
+    {
+        std::lock_guard<std::mutex> lock(sessionsMutex);
+        auto it = sessions.find(connection);
+        if (it == sessions.end()) {
+            return;
+        }
+        session = std::move(it->second);
+        sessions.erase(it);
+    }
+    {
+        std::lock_guard<std::mutex> lock(session->sendMutex);
+        session->shared.close();
     }
-    return true;
+    scheduler->close(connection, [this, connection] {
+        API().DropConnection(connection);
+    });
 }
 
+void Pipeline::OnData(uint64_t connection, const char* data, size_t size) {
+    std::shared_ptr<Session> session;
+    {
+        std::lock_guard<std::mutex> lock(sessionsMutex);
+        auto it = sessions.find(connection);
+        if (it == sessions.end()) {
+            return;
+        }
+        session = it->second;
+    }
 
-bool Pipeline::WriteResponse(const std::string& response) {
-    DWORD bytesWritten;
-    if (!::WriteFile(hPipe, response.c_str(), static_cast<DWORD>(response.size()), &bytesWritten, NULL)) {
-        return false;
+    if (session->encoding == Encoding::Binary) {
+        Stats::Timer timer(Stats::Stage::Decode);
+        if (session->closeShared) {
+            std::lock_guard<std::mutex> lock(session->sendMutex);
+            session->shared.close();
+            session->closeShared = false;
+        }
+        session->frames.append(data, size);
+        std::vector<Frame> frames;
+        Frame frame;
+        while (session->frames.next(frame)) {
+            if (frame.kind == FrameKind::Cancel) {
+                Cancel(*session, frame.requestId);
+            }
+            else if (frame.kind == FrameKind::SharedMemory) {
+                OpenSharedMemory(*session, frame);
+            }
+            else if (frame.kind == FrameKind::Wakeup) {
+                // Requests written to the ring are decoded here like pipe
+                // frames; this thread is the ring's only consumer.
+                std::string record;
+                while (session->shared.isOpen() && session->shared.requests().read(record)) {
+                    FrameReader reader;
+                    reader.append(record.data(), record.size());
+                    Frame request;
+                    if (!reader.next(request)) {
+                        continue;
+                    }
+                    if (request.kind == FrameKind::Cancel) {
+                        Cancel(*session, request.requestId);
+                    }
+                    else if (request.kind != FrameKind::Wakeup && request.kind != FrameKind::SharedMemory) {
+                        frames.push_back(std::move(request));
+                    }
+                }
+                if (session->shared.isOpen() && session->shared.requests().isCorrupt()) {
+                    LOG_WARN("Connection " << connection << " corrupted its request ring; closing the shared memory region");
+                    std::lock_guard<std::mutex> lock(session->sendMutex);
+                    session->shared.close();
+                }
+            }
+            else {
+                frames.push_back(std::move(frame));
+            }
+        }
+        if (session->frames.isCorrupt()) {
+            LOG_WARN("Connection " << connection << " sent an invalid frame length; closing it");
+            loop->close(connection);
+            return;
+        }
+        if (!frames.empty()) {
+            Dispatch(session, std::move(frames));
+        }
+        return;
+    }
+
+    // Every connection starts in text mode and may negotiate binary framing
+    // with its first message.
+    std::string instruction(data, size);
+    if (std::exchange(session->firstMessage, false) && parseHello(instruction, session->encoding)) {
+        loop->send(connection, helloReply(session->encoding));
+        return;
+    }
+    // Line-oriented clients end every message with a newline, so only a
+    // message with more lines after that one is a batch.
+    if (!instruction.empty() && instruction.back() == '\n') {
+        instruction.pop_back();
+        if (!instruction.empty() && instruction.back() == '\r') {
+            instruction.pop_back();
+        }
     }
-    return true;
+    // Text replies carry no request id, so all of a text connection's
+    // messages share one flow and are answered in order.
+    auto decoded = Stats::Clock::now();
+    scheduler->post(connection, FairScheduler::Lane::Free, Priority::Normal, [this, connection, instruction, decoded] {
+        Stats::record(Stats::Stage::Queue, Stats::Clock::now() - decoded);
+        Trace::complete("queue", decoded);
+        std::string reply;
+        {
+            Stats::Timer timer(Stats::Stage::Request);
+            Trace::Span span("request", instruction);
+            reply = HandleMessage(instruction);
+        }
+        loop->send(connection, reply);
+    });
 }
 
-DWORD WINAPI Pipeline::RunServer(LPVOID lpParam) {
-    Pipeline* pipeline = static_cast<Pipeline*>(lpParam);
-    ClientAPI clientAPI;
+void Pipeline::OpenSharedMemory(Session& session, const Frame& frame) {
+    // Answered over the pipe, since the client cannot read the rings before it
+    // knows the region's name.
+    uint32_t capacity = frame.payload.size() < 4 ? 0 : getUint32(frame.payload.data());
+#ifdef _WIN32
+    std::string name = "Local\\JRB-" + std::to_string(GetCurrentProcessId()) + "-" + std::to_string(session.id);
+#else
+    std::string name = "/JRB-" + std::to_string(getpid()) + "-" + std::to_string(session.id);
+#endif
+    ValueWriter writer;
+    {
+        std::lock_guard<std::mutex> lock(session.sendMutex);
+        if (session.shared.create(name, std::max<uint32_t>(capacity, 1 << 20))) {
+            writer.writeString(session.shared.getName());
+        }
+        else {
+            writer.writeError("Failed to create shared memory region");
+        }
+    }
+    loop->send(session.id, encodeFrame(FrameKind::Result, frame.requestId, writer.release()));
+}
 
-    pipeline->StartServer();
-    std::vector<char> buffer;
-    DWORD bytesRead;
+void Pipeline::Dispatch(const std::shared_ptr<Session>& session, std::vector<Frame> frames) {
+    // Deadlines count from the moment a request is decoded, so time spent
+    // queued behind other requests is included.
+    auto now = RequestToken::Clock::now();
+    std::vector<std::shared_ptr<RequestToken>> tokens;
+    tokens.reserve(frames.size());
+    for (const auto& frame : frames) {
+        auto deadline = (RequestToken::Clock::time_point::max)();
+        if (frame.timeoutMs > 0) {
+            deadline = now + std::chrono::milliseconds(frame.timeoutMs);
+        }
+        auto token = std::make_shared<RequestToken>(deadline);
+        {
+            std::lock_guard<std::mutex> lock(session->requestsMutex);
+            session->requests[frame.requestId] = token;
+        }
+        if (token->hasDeadline()) {
+            deadlines.emplace(deadline, Expiry{ session, token, frame.requestId });
+        }
+        tokens.push_back(std::move(token));
+    }
+
+    // Frames decoded from one read are answered together, with a single
+    // Wakeup when they go through shared memory, unless they belong to
+    // different flows. Batches run on the client thread and use its lane.
+    std::map<std::pair<FairScheduler::Lane, Priority>, std::pair<std::vector<Frame>, std::vector<std::shared_ptr<RequestToken>>>> groups;
+    for (size_t i = 0; i < frames.size(); i++) {
+        auto lane = frames[i].kind == FrameKind::Batch ? FairScheduler::Lane::ClientThread : FairScheduler::Lane::Free;
+        auto& group = groups[{ lane, frames[i].priority }];
+        group.first.push_back(std::move(frames[i]));
+        group.second.push_back(std::move(tokens[i]));
+    }
+    auto decoded = Stats::Clock::now();
+    for (auto& entry : groups) {
+        scheduler->post(session->id, entry.first.first, entry.first.second,
+            [this, session, decoded, group = std::move(entry.second)] {
+                Stats::record(Stats::Stage::Queue, Stats::Clock::now() - decoded);
+                Trace::complete("queue", decoded);
+                Answer(session, group.first, group.second);
+            });
+    }
+}
 
-    while (true) {
-        BOOL connected = ConnectNamedPipe(pipeline->hPipe, NULL);
-        if (!connected) {
-            if (GetLastError() == ERROR_PIPE_CONNECTED) {
-                connected = TRUE;
+void Pipeline::Answer(const std::shared_ptr<Session>& session, const std::vector<Frame>& frames, const std::vector<std::shared_ptr<RequestToken>>& tokens) {
+    std::vector<std::string> replies;
+    replies.reserve(frames.size());
+    for (size_t i = 0; i < frames.size(); i++) {
+        const Frame& frame = frames[i];
+        RequestToken& token = *tokens[i];
+        // Requests cancelled or expired while queued are not run at all.
+        std::string stop = token.check();
+        std::string reply;
+        if (stop.empty()) {
+            RequestToken::Scope scope(&token);
+            Stats::Timer timer(Stats::Stage::Request);
+            Trace::Span span("request", frame.payload);
+            reply = HandleFrame(session, frame);
+        }
+        else {
+            reply = encodeFrame(FrameKind::Result, frame.requestId, ValueWriter::error(stop));
+        }
+        if (token.claim()) {
+            replies.push_back(std::move(reply));
+        }
+        std::lock_guard<std::mutex> lock(session->requestsMutex);
+        auto it = session->requests.find(frame.requestId);
+        if (it != session->requests.end() && it->second == tokens[i]) {
+            session->requests.erase(it);
+        }
+    }
+    Send(*session, replies);
+}
+
+void Pipeline::Cancel(Session& session, uint32_t requestId) {
+    // Answered right away; the task running the request stops at its next
+    // hop and its result is dropped.
+    std::shared_ptr<RequestToken> token;
+    {
+        std::lock_guard<std::mutex> lock(session.requestsMutex);
+        auto it = session.requests.find(requestId);
+        if (it == session.requests.end()) {
+            return;
+        }
+        token = it->second;
+    }
+    token->cancel();
+    if (token->claim()) {
+        Send(session, { encodeFrame(FrameKind::Result, requestId, ValueWriter::error("Cancelled")) });
+    }
+}
+
+void Pipeline::OnTimer() {
+    // A request stuck in a Java call cannot be interrupted, but its client
+    // gets a timeout error on time and its worker drops the late result.
+    auto now = RequestToken::Clock::now();
+    while (!deadlines.empty() && deadlines.begin()->first <= now) {
+        Expiry expiry = std::move(deadlines.begin()->second);
+        deadlines.erase(deadlines.begin());
+        auto session = expiry.session.lock();
+        auto token = expiry.token.lock();
+        if (session && token && token->claim()) {
+            Send(*session, { encodeFrame(FrameKind::Result, expiry.requestId, ValueWriter::error("Deadline exceeded")) });
+        }
+    }
+}
+
+void Pipeline::Send(Session& session, const std::vector<std::string>& frames) {
+    Trace::Span span("write");
+    std::lock_guard<std::mutex> lock(session.sendMutex);
+    bool wakeup = false;
+    for (const auto& frame : frames) {
+        // Frames that do not fit in the response ring go over the pipe;
+        // request ids keep them apart from the ones still waiting in the ring.
+        if (session.shared.isOpen() && session.shared.responses().write(frame)) {
+            wakeup = true;
+        }
+        else {
+            if (session.shared.isOpen() && session.shared.responses().isCorrupt() && !session.closeShared.exchange(true)) {
+                LOG_WARN("Connection " << session.id << " corrupted its response ring; closing the shared memory region");
             }
+            loop->send(session.id, frame);
         }
+    }
+    if (wakeup) {
+        loop->send(session.id, encodeFrame(FrameKind::Wakeup, 0, ""));
+    }
+}
 
-        if (connected) {
-            while (true) {
-                if (pipeline->ReadFromPipe(buffer, bytesRead)) {
-                    buffer[bytesRead] = '\0';
-                    std::string instruction(buffer.data());
-                    std::string response = clientAPI.ProcessInstruction(instruction);
-                    pipeline->WriteResponse(response);
-                }
-                else {
-                    break;
-                }
+std::string Pipeline::HandleMessage(const std::string& instruction) {
+    if (instruction.rfind(std::string(kHelloPrefix) + "trace", 0) == 0) {
+        std::string argument = instruction.substr(std::string(kHelloPrefix).size() + 5);
+        argument.erase(0, argument.find_first_not_of(' '));
+        return ControlTrace(argument) ? "true" : Trace::dump();
+    }
+    if (instruction.rfind(std::string(kHelloPrefix) + "stats", 0) == 0) {
+        // One row per stage and query, or per query for "stats jni".
+        std::string argument = instruction.substr(std::string(kHelloPrefix).size() + 5);
+        argument.erase(0, argument.find_first_not_of(' '));
+        bool jni = argument.rfind("jni", 0) == 0;
+        if (jni && ControlJniCounters(argument.substr(3))) {
+            return "true";
+        }
+        Table table = jni ? JniCounters::table(Encoding::Text) : Stats::table(Encoding::Text);
+        if (argument.find("reset") != std::string::npos) {
+            if (jni) {
+                JniCounters::reset();
             }
-            DisconnectNamedPipe(pipeline->hPipe);
+            else {
+                Stats::reset();
+            }
+        }
+        return TableText(std::move(table));
+    }
+    ClientAPI& api = API();
+    try {
+        if (instruction.rfind(std::string(kHelloPrefix) + "classes", 0) == 0) {
+            std::string argument = instruction.substr(std::string(kHelloPrefix).size() + 7);
+            argument.erase(0, argument.find_first_not_of(' '));
+            return TableText(api.Catalog(argument));
+        }
+        if (instruction.rfind(std::string(kHelloPrefix) + "capture", 0) == 0) {
+            std::string argument = instruction.substr(std::string(kHelloPrefix).size() + 7);
+            argument.erase(0, argument.find_first_not_of(' '));
+            return api.Capture(argument);
         }
+        if (instruction.find('\n') != std::string::npos) {
+            // One query per line, answered in the same order.
+            std::string response;
+            for (const auto& result : api.ProcessBatch(instruction)) {
+                response += result + "\n";
+            }
+            return response;
+        }
+        return api.ProcessInstruction(instruction);
     }
+    catch (const std::exception& e) {
+        LOG_ERROR(e.what());
+        return "";
+    }
+}
 
-    return 0;
+std::string Pipeline::TableText(Table table) {
+    std::string text;
+    table.rows.insert(table.rows.begin(), table.columns);
+    for (const auto& row : table.rows) {
+        for (size_t i = 0; i < row.size(); i++) {
+            text += (i > 0 ? "\t" : "") + row[i];
+        }
+        text += "\n";
+    }
+    return text;
+}
+
+bool Pipeline::ControlTrace(const std::string& argument) {
+    // "on" and "off" start and stop recording, "clear" drops what has been
+    // recorded; anything else asks for the dump.
+    if (argument == "on" || argument == "off") {
+        Trace::enable(argument == "on");
+        return true;
+    }
+    if (argument == "clear") {
+        Trace::clear();
+        return true;
+    }
+    return false;
 }
 
+bool Pipeline::ControlJniCounters(std::string argument) {
+    // "on" and "off" start and stop counting; anything else asks for the table.
+    argument.erase(0, argument.find_first_not_of(' '));
+    if (argument == "on" || argument == "off") {
+        JniCounters::enable(argument == "on");
+        return true;
+    }
+    return false;
+}
+
+std::string Pipeline::HandleFrame(const std::shared_ptr<Session>& session, const Frame& frame) {
+    ClientAPI& api = API();
+    // Pushes are sent from the client thread for as long as the connection
+    // is open.
+    std::weak_ptr<Session> weak = session;
+    auto sink = [this, weak](uint32_t id, const std::string& value) {
+        if (auto target = weak.lock()) {
+            Send(*target, { encodeFrame(FrameKind::Push, id, value) });
+        }
+    };
 
-void Pipeline::DisconnectAndClose() {
-    if (hPipe != INVALID_HANDLE_VALUE) {
-        DisconnectNamedPipe(hPipe);
-        CloseHandle(hPipe);
-        hPipe = INVALID_HANDLE_VALUE;
+    std::string payload;
+    try {
+        if (frame.kind == FrameKind::Query) {
+            payload = api.ProcessInstruction(frame.payload, Encoding::Binary);
+        }
+        else if (frame.kind == FrameKind::Subscribe) {
+            if (frame.payload.size() < 4) {
+                payload = ValueWriter::error("Malformed subscribe frame");
+            }
+            else {
+                uint32_t interval = getUint32(frame.payload.data());
+                payload = api.Subscribe(session->id, frame.requestId, frame.payload.substr(4), interval, sink);
+            }
+        }
+        else if (frame.kind == FrameKind::Watch) {
+            std::istringstream lines(frame.payload);
+            std::string query, field, signature;
+            if (!std::getline(lines, query) || !std::getline(lines, field) || !std::getline(lines, signature)) {
+                payload = ValueWriter::error("Malformed watch frame");
+            }
+            else {
+                payload = api.Watch(session->id, frame.requestId, query, field, signature, sink);
+            }
+        }
+        else if (frame.kind == FrameKind::DeltaQuery) {
+            if (frame.payload.size() < 4) {
+                payload = ValueWriter::error("Malformed delta query frame");
+            }
+            else {
+                payload = api.ProcessDelta(session->id, frame.payload.substr(4), getUint32(frame.payload.data()));
+            }
+        }
+        else if (frame.kind == FrameKind::Unsubscribe) {
+            ValueWriter writer;
+            writer.writeBool(api.Unsubscribe(session->id, frame.requestId));
+            payload = writer.release();
+        }
+        else if (frame.kind == FrameKind::Stats && frame.payload.rfind("jni", 0) == 0) {
+            ValueWriter writer;
+            if (ControlJniCounters(frame.payload.substr(3))) {
+                writer.writeBool(true);
+            }
+            else {
+                writer.writeTable(JniCounters::table(Encoding::Binary));
+                if (frame.payload == "jni reset") {
+                    JniCounters::reset();
+                }
+            }
+            payload = writer.release();
+        }
+        else if (frame.kind == FrameKind::Stats) {
+            ValueWriter writer;
+            writer.writeTable(Stats::table(Encoding::Binary));
+            payload = writer.release();
+            if (frame.payload == "reset") {
+                Stats::reset();
+            }
+        }
+        else if (frame.kind == FrameKind::Trace) {
+            ValueWriter writer;
+            if (ControlTrace(frame.payload)) {
+                writer.writeBool(true);
+            }
+            else {
+                writer.writeString(Trace::dump());
+            }
+            payload = writer.release();
+        }
+        else if (frame.kind == FrameKind::Classes) {
+            ValueWriter writer;
+            writer.writeTable(api.Catalog(frame.payload, Encoding::Binary));
+            payload = writer.release();
+        }
+        else if (frame.kind == FrameKind::Capture) {
+            payload = api.Capture(frame.payload, Encoding::Binary);
+        }
+        else if (frame.kind == FrameKind::Batch) {
+            std::vector<std::string> results = api.ProcessBatch(frame.payload, Encoding::Binary);
+            ValueWriter writer;
+            writer.beginArray(static_cast<uint32_t>(results.size()));
+            payload = writer.release();
+            for (const auto& result : results) {
+                payload += result;
+            }
+        }
+        else {
+            payload = ValueWriter::error("Unsupported frame kind");
+        }
+    }
+    catch (const std::exception& e) {
+        payload = ValueWriter::error(e.what());
     }
+    return encodeFrame(FrameKind::Result, frame.requestId, payload);
 }
@@ -1,22 +1,98 @@
 #include "pch.h"
+#include <atomic>
 #include <string>
 #include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#ifdef _WIN32
 #include <Windows.h>
+#endif
 #include "ClientAPI.hpp"
+#include "EventLoop.hpp"
+#include "Executor.hpp"
+#include "FairScheduler.hpp"
+#include "Protocol.hpp"
+#include "RequestToken.hpp"
+#include "SharedMemory.hpp"
 
 class Pipeline {
 public:
+    // `address` is the pipe name on Windows and the socket path elsewhere.
+    Pipeline(const std::string& address, size_t bufferSize);
+#ifdef _WIN32
     Pipeline(const std::wstring& pipeName, size_t bufferSize);
+#endif
     ~Pipeline();
     void StartServer();
+#ifdef _WIN32
     static DWORD WINAPI RunServer(LPVOID lpParam);
-    bool ReadFromPipe(std::vector<char>& buffer, DWORD& bytesRead);
-    bool WriteResponse(const std::string& response);
-    void DisconnectAndClose();
+#endif
 
 private:
-    HANDLE hPipe;
-    std::wstring pipeName;
+    // Protocol state of one client connection. Decoding happens on the I/O
+    // thread; replies are sent from the executor and the client thread.
+    struct Session {
+        uint64_t id;
+        Encoding encoding = Encoding::Text;
+        bool firstMessage = true;
+        FrameReader frames;
+
+        // Once a connection negotiates shared memory, frames are exchanged
+        // through its rings and the pipe only carries Wakeup frames. Guards
+        // the response ring, which has a single producer.
+        std::mutex sendMutex;
+        SharedMemoryRegion shared;
+        // Set by a sender that found the response ring corrupt. The region is
+        // unmapped by the I/O thread, which reads the request ring unlocked.
+        std::atomic<bool> closeShared{ false };
+
+        // Requests decoded but not answered yet, by request id, so a Cancel
+        // frame can reach them.
+        std::mutex requestsMutex;
+        std::unordered_map<uint32_t, std::shared_ptr<RequestToken>> requests;
+    };
+
+    // A request with a deadline, answered by the I/O thread with a timeout
+    // error if its task has not answered it by then.
+    struct Expiry {
+        std::weak_ptr<Session> session;
+        std::weak_ptr<RequestToken> token;
+        uint32_t requestId;
+    };
+
+    void OnConnect(uint64_t connection);
+    void OnData(uint64_t connection, const char* data, size_t size);
+    void OnDisconnect(uint64_t connection);
+    void OnTimer();
+    void Cancel(Session& session, uint32_t requestId);
+    void OpenSharedMemory(Session& session, const Frame& frame);
+    void Dispatch(const std::shared_ptr<Session>& session, std::vector<Frame> frames);
+    void Answer(const std::shared_ptr<Session>& session, const std::vector<Frame>& frames, const std::vector<std::shared_ptr<RequestToken>>& tokens);
+    std::string HandleFrame(const std::shared_ptr<Session>& session, const Frame& frame);
+    std::string HandleMessage(const std::string& instruction);
+    static bool ControlTrace(const std::string& argument);
+    static bool ControlJniCounters(std::string argument);
+    // Header line, then one tab separated line per row.
+    static std::string TableText(Table table);
+    void Send(Session& session, const std::vector<std::string>& frames);
+    ClientAPI& API();
+
+    std::string address;
     size_t bufferSize;
-    ClientAPI clientAPI;
+    std::unique_ptr<EventLoop> loop;
+    std::unique_ptr<Executor> executor;
+    std::unique_ptr<FairScheduler> scheduler;
+
+    // Created by the first task that needs it; shared by every worker.
+    std::mutex clientAPIMutex;
+    std::unique_ptr<ClientAPI> clientAPI;
+
+    std::mutex sessionsMutex;
+    std::unordered_map<uint64_t, std::shared_ptr<Session>> sessions;
+
+    // Only used on the I/O thread.
+    std::multimap<RequestToken::Clock::time_point, Expiry> deadlines;
 };
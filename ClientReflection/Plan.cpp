@@ -0,0 +1,112 @@
+#include "pch.h"
+#include "Plan.hpp"
+#include "Stats.hpp"
+#include "Trace.hpp"
+#include <mutex>
+#include <unordered_map>
+
+// Returns false once kMaxNodes prefixes are interned, so queries that embed
+// handles or indices cannot grow the table, or the memo indexed by it, without
+// bound.
+static bool internNode(const std::string& path, uint32_t& id) {
+    static std::mutex mutex;
+    static std::unordered_map<std::string, uint32_t> nodes;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = nodes.find(path);
+    if (it != nodes.end()) {
+        id = it->second;
+        return true;
+    }
+    if (nodes.size() >= kMaxNodes) {
+        return false;
+    }
+    id = static_cast<uint32_t>(nodes.size());
+    nodes.emplace(path, id);
+    return true;
+}
+
+static std::vector<std::string> splitChain(const std::string& chain) {
+    // Split the method chain based on '.' to get individual method calls
+    std::vector<std::string> methods;
+    size_t pos = 0, found;
+    while ((found = chain.find('.', pos)) != std::string::npos) {
+        methods.push_back(chain.substr(pos, found - pos));
+        pos = found + 1;
+    }
+    methods.push_back(chain.substr(pos));  // Push the last method
+    return methods;
+}
+
+static Plan compileColumn(const std::string& column) {
+    Plan plan;
+    plan.text = column;
+    for (const auto& method : splitChain(column)) {
+        plan.hops.push_back(method.substr(0, method.find('(')));
+    }
+    return plan;
+}
+
+Plan compilePlan(const std::string& query) {
+    Stats::Timer timer(Stats::Stage::Parse);
+    Trace::Span span("compile", query);
+    Plan plan;
+    plan.text = query;
+
+    std::string chain = query;
+    size_t brace = query.find('{');
+    if (brace != std::string::npos && query.back() == '}') {
+        chain = query.substr(0, brace);
+        std::string columns = query.substr(brace + 1, query.size() - brace - 2);
+        size_t pos = 0;
+        while (pos <= columns.size()) {
+            size_t comma = columns.find(',', pos);
+            if (comma == std::string::npos) {
+                comma = columns.size();
+            }
+            std::string column = columns.substr(pos, comma - pos);
+            column.erase(0, column.find_first_not_of(' '));
+            column.erase(column.find_last_not_of(' ') + 1);
+            if (!column.empty()) {
+                plan.columns.push_back(compileColumn(column));
+            }
+            pos = comma + 1;
+        }
+    }
+
+    std::vector<std::string> methods = splitChain(chain);
+
+    plan.root = methods[0];
+    std::string path = plan.root;
+    // Hops past the last node are evaluated without the memo.
+    bool interned = true;
+    for (size_t i = 1; i < methods.size(); i++) {
+        plan.hops.push_back(methods[i].substr(0, methods[i].find('(')));
+        path += "." + plan.hops.back();
+        uint32_t node;
+        interned = interned && internNode(path, node);
+        if (interned) {
+            plan.nodes.push_back(node);
+        }
+    }
+    return plan;
+}
+
+std::vector<Plan> compileBatch(const std::string& queries) {
+    std::vector<Plan> plans;
+    size_t pos = 0;
+    while (pos <= queries.size()) {
+        size_t end = queries.find('\n', pos);
+        if (end == std::string::npos) {
+            end = queries.size();
+        }
+        std::string line = queries.substr(pos, end - pos);
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (!line.empty()) {
+            plans.push_back(compilePlan(line));
+        }
+        pos = end + 1;
+    }
+    return plans;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include "pch.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A query parsed once into its root and the method name of every hop, so it
+// can be executed repeatedly (or later, on another thread) without re-parsing.
+struct Plan {
+    std::string text;
+    std::string root;
+    std::vector<std::string> hops;
+    // nodes[i] identifies the chain up to and including hops[i]. Plans that
+    // share a prefix share its nodes, which is what TickMemo is keyed by. It
+    // may be shorter than hops once kMaxNodes prefixes exist.
+    std::vector<uint32_t> nodes;
+    // Projection columns, e.g. Client.getNpcs{getIndex,getName}. Each column is
+    // a chain without a root that is evaluated on every element of the result.
+    std::vector<Plan> columns;
+};
+
+// Distinct chain prefixes that get a node. Later prefixes compile without
+// one and are never memoized.
+constexpr uint32_t kMaxNodes = 4096;
+
+Plan compilePlan(const std::string& query);
+
+// Batches are sent as one query per line.
+std::vector<Plan> compileBatch(const std::string& queries);
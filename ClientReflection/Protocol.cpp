@@ -0,0 +1,107 @@
+#include "pch.h"
+#include "Protocol.hpp"
+#include <algorithm>
+
+void putUint32(std::string& out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out.push_back(static_cast<char>((value >> (i * 8)) & 0xFF));
+    }
+}
+
+uint32_t getUint32(const char* data) {
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+    return static_cast<uint32_t>(bytes[0]) | (static_cast<uint32_t>(bytes[1]) << 8) |
+        (static_cast<uint32_t>(bytes[2]) << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+}
+
+bool parseHello(const std::string& message, Encoding& encoding) {
+    if (message.rfind(kHelloPrefix, 0) != 0) {
+        return false;
+    }
+    std::string mode = message.substr(std::string(kHelloPrefix).size());
+    while (!mode.empty() && (mode.back() == '\n' || mode.back() == '\r' || mode.back() == ' ')) {
+        mode.pop_back();
+    }
+    if (mode == "binary") {
+        encoding = Encoding::Binary;
+        return true;
+    }
+    if (mode == "text") {
+        encoding = Encoding::Text;
+        return true;
+    }
+    return false;
+}
+
+std::string helloReply(Encoding encoding) {
+    return std::string(kHelloPrefix) + (encoding == Encoding::Binary ? "binary" : "text");
+}
+
+std::string encodeFrame(FrameKind kind, uint32_t requestId, std::string_view payload) {
+    std::string frame;
+    frame.reserve(4 + kFrameHeaderSize + payload.size());
+    putUint32(frame, static_cast<uint32_t>(kFrameHeaderSize - 4 + payload.size()));
+    frame.push_back(static_cast<char>(kind));
+    putUint32(frame, requestId);
+    frame.append(payload.data(), payload.size());
+    return frame;
+}
+
+void FrameReader::append(const char* data, size_t size) {
+    if (corrupt) {
+        return;
+    }
+    // Under pipelining reads usually end mid-frame, so the consumed prefix is
+    // dropped once it is half the buffer rather than only when it is all of it.
+    // Each byte is moved at most once on average.
+    if (offset > 0 && offset >= pending.size() / 2) {
+        pending.erase(0, offset);
+        offset = 0;
+    }
+    pending.append(data, size);
+}
+
+bool FrameReader::next(Frame& frame) {
+    if (pending.size() - offset < kFrameHeaderSize) {
+        return false;
+    }
+    const char* header = pending.data() + offset;
+    uint32_t length = getUint32(header);
+    // A length too short for the kind and request id would never be consumed.
+    if (length < kFrameHeaderSize - 4 || length > kMaxFrameLength) {
+        corrupt = true;
+        pending.clear();
+        offset = 0;
+        return false;
+    }
+    if (pending.size() - offset - 4 < length) {
+        return false;
+    }
+    frame.kind = static_cast<FrameKind>(header[4]);
+    frame.requestId = getUint32(header + 5);
+    frame.payload.assign(header + kFrameHeaderSize, length - (kFrameHeaderSize - 4));
+    frame.timeoutMs = 0;
+    frame.priority = Priority::Normal;
+    // Deadline and Priority frames wrap a request and may wrap each other.
+    while (true) {
+        if (frame.kind == FrameKind::Deadline && frame.payload.size() >= 5) {
+            frame.timeoutMs = getUint32(frame.payload.data());
+            frame.kind = static_cast<FrameKind>(frame.payload[4]);
+            frame.payload.erase(0, 5);
+        }
+        else if (frame.kind == FrameKind::Priority && frame.payload.size() >= 2) {
+            frame.priority = static_cast<Priority>(std::min<uint8_t>(static_cast<uint8_t>(frame.payload[0]), static_cast<uint8_t>(Priority::Bulk)));
+            frame.kind = static_cast<FrameKind>(frame.payload[1]);
+            frame.payload.erase(0, 2);
+        }
+        else {
+            break;
+        }
+    }
+    offset += 4 + length;
+    if (offset == pending.size()) {
+        pending.clear();
+        offset = 0;
+    }
+    return true;
+}
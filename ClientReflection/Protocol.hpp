@@ -0,0 +1,84 @@
+#pragma once
+#include "pch.h"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "Encoding.hpp"
+
+// A connection starts in the legacy text mode, where every pipe message is a
+// query and every reply is a string. Sending "JRB/1 binary" as the first
+// message switches the connection to framed binary mode, in which both
+// directions exchange frames of
+//
+//     u32 length | u8 kind | u32 request id | payload
+//
+// (little endian, length counts the kind, id and payload bytes).
+
+enum class FrameKind : uint8_t {
+    Query = 0x01,   // payload: query text
+    Result = 0x02,  // payload: one tagged value
+    Batch = 0x03,       // payload: queries, one per line; answered by an array result
+    Subscribe = 0x04,   // payload: u32 interval in ticks + query; answered by the current value
+    Unsubscribe = 0x05, // request id of the Subscribe or Watch frame; answered by true or false
+    Push = 0x06,        // server to client, request id of the Subscribe or Watch frame, payload: new value
+    DeltaQuery = 0x07,  // payload: u32 key column + projection query; answered by a table or a delta
+    Watch = 0x08,       // payload: object query, field name and JNI signature, one per line; answered by the current value
+    SharedMemory = 0x09,// payload: u32 ring capacity; answered over the pipe by the shared memory region name
+    Wakeup = 0x0A,      // no payload; the sender has written records to its shared memory ring
+    Deadline = 0x0B,    // payload: u32 timeout in ms + u8 kind + payload of the request it wraps
+    Cancel = 0x0C,      // request id of a pending request, no payload; that request is answered by a "Cancelled" error
+    Priority = 0x0D,    // payload: u8 priority + u8 kind + payload of the request it wraps
+    Stats = 0x0E,       // payload: empty, or "reset" to clear after reading; answered by a table of latencies
+    Trace = 0x0F,       // payload: "on", "off" or empty to dump; answered by true or by Chrome trace JSON
+    Classes = 0x10,     // payload: class name prefix, "member " + member name prefix or "of " + class name; answered by a table
+    Capture = 0x11      // payload: "on" with an optional source query, "off", or empty to copy one frame; answered by the region name, true or the frame's sequence number
+};
+
+// Scheduling class of a request; requests without a Priority frame are Normal.
+enum class Priority : uint8_t {
+    Interactive = 0,
+    Normal = 1,
+    Bulk = 2
+};
+
+struct Frame {
+    FrameKind kind;
+    uint32_t requestId;
+    std::string payload;
+    // Milliseconds the request may take from its arrival, 0 for no limit.
+    // Set by FrameReader when it unwraps a Deadline frame.
+    uint32_t timeoutMs = 0;
+    // Set by FrameReader when it unwraps a Priority frame.
+    Priority priority = Priority::Normal;
+};
+
+constexpr size_t kFrameHeaderSize = 9;
+// Longer frames are a protocol error, so a bad length cannot make the reader
+// buffer without bound.
+constexpr uint32_t kMaxFrameLength = 64u << 20;
+constexpr const char* kHelloPrefix = "JRB/1 ";
+
+void putUint32(std::string& out, uint32_t value);
+uint32_t getUint32(const char* data);
+
+bool parseHello(const std::string& message, Encoding& encoding);
+std::string helloReply(Encoding encoding);
+std::string encodeFrame(FrameKind kind, uint32_t requestId, std::string_view payload);
+
+// Reassembles frames from a byte stream that may split or merge them.
+class FrameReader {
+public:
+    void append(const char* data, size_t size);
+    bool next(Frame& frame);
+    // Set once a frame's length is shorter than its header or exceeds
+    // kMaxFrameLength; the stream cannot be resynced, so the connection should
+    // be closed.
+    bool isCorrupt() const { return corrupt; }
+    // Bytes held, including the prefix of frames already returned.
+    size_t buffered() const { return pending.size(); }
+
+private:
+    std::string pending;
+    size_t offset = 0;
+    bool corrupt = false;
+};
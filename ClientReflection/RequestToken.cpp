@@ -0,0 +1,51 @@
+#include "pch.h"
+#include "RequestToken.hpp"
+
+static thread_local const RequestToken* currentToken = nullptr;
+
+RequestToken::RequestToken(Clock::time_point deadline) : deadline(deadline) {}
+
+void RequestToken::cancel() {
+    cancelled = true;
+}
+
+bool RequestToken::hasDeadline() const {
+    return deadline != (Clock::time_point::max)();
+}
+
+RequestToken::Clock::duration RequestToken::remaining() const {
+    if (!hasDeadline()) {
+        return (Clock::duration::max)();
+    }
+    return deadline - Clock::now();
+}
+
+std::string RequestToken::check() const {
+    if (cancelled) {
+        return "Cancelled";
+    }
+    if (hasDeadline() && Clock::now() >= deadline) {
+        return "Deadline exceeded";
+    }
+    return "";
+}
+
+bool RequestToken::claim() {
+    return !claimed.exchange(true);
+}
+
+RequestToken::Scope::Scope(const RequestToken* token) : previous(currentToken) {
+    currentToken = token;
+}
+
+RequestToken::Scope::~Scope() {
+    currentToken = previous;
+}
+
+const RequestToken* RequestToken::current() {
+    return currentToken;
+}
+
+std::string RequestToken::checkCurrent() {
+    return currentToken != nullptr ? currentToken->check() : "";
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include "pch.h"
+#include <atomic>
+#include <chrono>
+#include <string>
+
+// Deadline and cancellation state of one framed request. The thread executing
+// the request installs its token with a Scope; the plan executor checks it
+// between hops, so a request that ran out of time stops at the next hop
+// instead of walking the rest of its chain.
+class RequestToken {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit RequestToken(Clock::time_point deadline = (Clock::time_point::max)());
+
+    void cancel();
+    bool hasDeadline() const;
+    Clock::duration remaining() const;
+    // Empty while the request may go on, otherwise why it has to stop.
+    std::string check() const;
+    // Only the first caller may answer the request: the executing task, the
+    // deadline sweep or a Cancel frame.
+    bool claim();
+
+    class Scope {
+    public:
+        explicit Scope(const RequestToken* token);
+        ~Scope();
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        const RequestToken* previous;
+    };
+
+    static const RequestToken* current();
+    static std::string checkCurrent();
+
+private:
+    Clock::time_point deadline;
+    std::atomic<bool> cancelled{ false };
+    std::atomic<bool> claimed{ false };
+};
@@ -0,0 +1,177 @@
+#include "pch.h"
+#include "SharedMemory.hpp"
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+SpscRing::SpscRing(void* memory, uint64_t capacity, bool initialize)
+    : header(static_cast<RingHeader*>(memory)), data(static_cast<char*>(memory) + sizeof(RingHeader)), capacity(capacity) {
+    if (initialize) {
+        header->head.store(0, std::memory_order_relaxed);
+        header->tail.store(0, std::memory_order_relaxed);
+        header->capacity = capacity;
+    }
+}
+
+void SpscRing::copyIn(uint64_t position, const char* source, size_t size) {
+    size_t offset = static_cast<size_t>(position & (capacity - 1));
+    size_t first = std::min<size_t>(size, capacity - offset);
+    std::memcpy(data + offset, source, first);
+    std::memcpy(data, source + first, size - first);
+}
+
+void SpscRing::copyOut(uint64_t position, char* destination, size_t size) const {
+    size_t offset = static_cast<size_t>(position & (capacity - 1));
+    size_t first = std::min<size_t>(size, capacity - offset);
+    std::memcpy(destination, data + offset, first);
+    std::memcpy(destination + first, data, size - first);
+}
+
+bool SpscRing::write(std::string_view record) {
+    if (corrupt) {
+        return false;
+    }
+    uint64_t head = header->head.load(std::memory_order_relaxed);
+    uint64_t tail = header->tail.load(std::memory_order_acquire);
+    if (head - tail > capacity) {
+        corrupt = true;
+        return false;
+    }
+    uint64_t needed = sizeof(uint32_t) + record.size();
+    if (needed > capacity - (head - tail)) {
+        return false;
+    }
+    uint32_t length = static_cast<uint32_t>(record.size());
+    copyIn(head, reinterpret_cast<const char*>(&length), sizeof(length));
+    copyIn(head + sizeof(length), record.data(), record.size());
+    // Publishes the record to the consumer.
+    header->head.store(head + needed, std::memory_order_release);
+    return true;
+}
+
+bool SpscRing::read(std::string& record) {
+    if (corrupt) {
+        return false;
+    }
+    uint64_t tail = header->tail.load(std::memory_order_relaxed);
+    uint64_t head = header->head.load(std::memory_order_acquire);
+    uint64_t used = head - tail;
+    if (used > capacity) {
+        corrupt = true;
+        return false;
+    }
+    if (used < sizeof(uint32_t)) {
+        return false;
+    }
+    uint32_t length;
+    copyOut(tail, reinterpret_cast<char*>(&length), sizeof(length));
+    // The producer publishes whole records, so a length past `head` can only
+    // be garbage.
+    if (length > used - sizeof(length)) {
+        corrupt = true;
+        return false;
+    }
+    record.resize(length);
+    copyOut(tail + sizeof(length), record.data(), length);
+    // Hands the space back to the producer.
+    header->tail.store(tail + sizeof(length) + length, std::memory_order_release);
+    return true;
+}
+
+bool SpscRing::empty() const {
+    return header->head.load(std::memory_order_acquire) == header->tail.load(std::memory_order_relaxed);
+}
+
+SharedMapping::~SharedMapping() {
+    close();
+}
+
+bool SharedMapping::create(const std::string& regionName, size_t regionSize) {
+    close();
+#ifdef _WIN32
+    mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+        static_cast<DWORD>(static_cast<uint64_t>(regionSize) >> 32), static_cast<DWORD>(regionSize & 0xFFFFFFFF), regionName.c_str());
+    if (mapping == NULL) {
+        return false;
+    }
+    view = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, regionSize);
+    if (view == nullptr) {
+        CloseHandle(std::exchange(mapping, (HANDLE)NULL));
+        return false;
+    }
+#else
+    descriptor = shm_open(regionName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (descriptor < 0) {
+        return false;
+    }
+    void* mapped = MAP_FAILED;
+    if (ftruncate(descriptor, static_cast<off_t>(regionSize)) == 0) {
+        mapped = mmap(nullptr, regionSize, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+    }
+    if (mapped == MAP_FAILED) {
+        ::close(descriptor);
+        shm_unlink(regionName.c_str());
+        descriptor = -1;
+        return false;
+    }
+    view = mapped;
+#endif
+    name = regionName;
+    size = regionSize;
+    return true;
+}
+
+void SharedMapping::close() {
+#ifdef _WIN32
+    if (view != nullptr) {
+        UnmapViewOfFile(view);
+    }
+    if (mapping != NULL) {
+        CloseHandle(std::exchange(mapping, (HANDLE)NULL));
+    }
+#else
+    if (view != nullptr) {
+        munmap(view, size);
+    }
+    if (descriptor >= 0) {
+        ::close(descriptor);
+        shm_unlink(name.c_str());
+        descriptor = -1;
+    }
+#endif
+    view = nullptr;
+    size = 0;
+    name.clear();
+}
+
+bool SharedMemoryRegion::create(const std::string& regionName, uint64_t capacity) {
+    close();
+    uint64_t rounded = 4096;
+    while (rounded < (std::min)(capacity, kMaxCapacity)) {
+        rounded <<= 1;
+    }
+    if (!mapping.create(regionName, sizeof(Header) + 2 * SpscRing::footprint(rounded))) {
+        return false;
+    }
+
+    Header* header = static_cast<Header*>(mapping.data());
+    header->magic = kMagic;
+    header->version = kVersion;
+    header->capacity = rounded;
+    char* rings = static_cast<char*>(mapping.data()) + sizeof(Header);
+    requestRing = SpscRing(rings, rounded, true);
+    responseRing = SpscRing(rings + SpscRing::footprint(rounded), rounded, true);
+    return true;
+}
+
+void SharedMemoryRegion::close() {
+    requestRing = SpscRing();
+    responseRing = SpscRing();
+    mapping.close();
+}
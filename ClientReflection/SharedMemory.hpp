@@ -0,0 +1,113 @@
+#pragma once
+#include "pch.h"
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+
+// Lock-free single-producer/single-consumer byte ring living in shared memory.
+// Records are a u32 length followed by the record bytes and may wrap around the
+// end of the buffer. The producer only moves `head` and the consumer only moves
+// `tail`, so neither side ever blocks the other.
+struct RingHeader {
+    std::atomic<uint64_t> head;
+    char headPadding[56];
+    std::atomic<uint64_t> tail;
+    char tailPadding[56];
+    uint64_t capacity;
+    char capacityPadding[56];
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "ring indices must be lock free to be shared between processes");
+
+class SpscRing {
+public:
+    SpscRing() = default;
+    SpscRing(void* memory, uint64_t capacity, bool initialize);
+
+    // Bytes used by a ring with a data area of `capacity` bytes.
+    static size_t footprint(uint64_t capacity) { return sizeof(RingHeader) + capacity; }
+
+    bool write(std::string_view record);
+    bool read(std::string& record);
+    bool empty() const;
+    bool isValid() const { return header != nullptr; }
+    // The other process left indices no ring can have; nothing more is read
+    // or written.
+    bool isCorrupt() const { return corrupt; }
+
+private:
+    void copyIn(uint64_t position, const char* source, size_t size);
+    void copyOut(uint64_t position, char* destination, size_t size) const;
+
+    RingHeader* header = nullptr;
+    char* data = nullptr;
+    // Kept out of the shared header, which the other process can overwrite.
+    uint64_t capacity = 0;
+    bool corrupt = false;
+};
+
+// A named region of shared memory, created by the server and opened by
+// clients by name. The name is removed again when the region is closed.
+class SharedMapping {
+public:
+    SharedMapping() = default;
+    ~SharedMapping();
+    SharedMapping(const SharedMapping&) = delete;
+    SharedMapping& operator=(const SharedMapping&) = delete;
+
+    bool create(const std::string& name, size_t size);
+    void close();
+
+    bool isOpen() const { return view != nullptr; }
+    void* data() const { return view; }
+    const std::string& getName() const { return name; }
+
+private:
+    std::string name;
+    void* view = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE mapping = NULL;
+#else
+    int descriptor = -1;
+#endif
+};
+
+// A named shared memory region holding a request ring (client to server) and a
+// response ring (server to client), created by the server and opened by the
+// client by name:
+//
+//     u32 magic | u32 version | u64 ring capacity | request ring | response ring
+class SharedMemoryRegion {
+public:
+    static constexpr uint32_t kMagic = 0x3142524A; // "JRB1"
+    static constexpr uint32_t kVersion = 1;
+    // Bounds what a client can make the game process map.
+    static constexpr uint64_t kMaxCapacity = 64ull << 20;
+
+    // `capacity` is rounded up to a power of two, at most kMaxCapacity.
+    bool create(const std::string& name, uint64_t capacity);
+    void close();
+
+    bool isOpen() const { return mapping.isOpen(); }
+    const std::string& getName() const { return mapping.getName(); }
+    SpscRing& requests() { return requestRing; }
+    SpscRing& responses() { return responseRing; }
+
+private:
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t capacity;
+        char padding[48];
+    };
+
+    SharedMapping mapping;
+    SpscRing requestRing;
+    SpscRing responseRing;
+};
@@ -0,0 +1,127 @@
+#include "pch.h"
+#include "Stats.hpp"
+#include <array>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "ConcurrentMap.hpp"
+
+namespace {
+    struct QueryStats {
+        std::string text;
+        std::unique_ptr<Histogram> histogram;
+    };
+
+    const char* const kStageNames[] = { "decode", "queue", "parse", "resolve", "invoke", "encode", "request" };
+
+    std::array<Histogram, static_cast<size_t>(Stats::Stage::Count)>& stages() {
+        static std::array<Histogram, static_cast<size_t>(Stats::Stage::Count)> histograms;
+        return histograms;
+    }
+
+    ConcurrentMap<QueryStats>& queries() {
+        static ConcurrentMap<QueryStats> map;
+        return map;
+    }
+
+    std::atomic<size_t> queryCount{ 0 };
+
+    Histogram& otherQueries() {
+        static Histogram histogram;
+        return histogram;
+    }
+
+    uint64_t nanoseconds(Stats::Clock::duration elapsed) {
+        auto count = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+        return count < 0 ? 0 : static_cast<uint64_t>(count);
+    }
+
+    void appendRow(Table& table, Encoding encoding, const std::string& name, const Histogram& histogram) {
+        Histogram::Snapshot snapshot = histogram.snapshot();
+        if (snapshot.count == 0) {
+            return;
+        }
+        const double values[] = {
+            snapshot.mean(),
+            static_cast<double>(snapshot.percentile(0.5)),
+            static_cast<double>(snapshot.percentile(0.9)),
+            static_cast<double>(snapshot.percentile(0.99)),
+            static_cast<double>(snapshot.percentile(0.999)),
+            static_cast<double>(snapshot.max)
+        };
+        std::vector<std::string> row;
+        if (encoding == Encoding::Binary) {
+            ValueWriter writer;
+            writer.writeString(name);
+            row.push_back(writer.release());
+            writer.writeInt(static_cast<int64_t>(snapshot.count));
+            row.push_back(writer.release());
+            for (double value : values) {
+                writer.writeDouble(value / 1000.0);
+                row.push_back(writer.release());
+            }
+        }
+        else {
+            row.push_back(name);
+            row.push_back(std::to_string(snapshot.count));
+            for (double value : values) {
+                char cell[32];
+                snprintf(cell, sizeof(cell), "%.1f", value / 1000.0);
+                row.push_back(cell);
+            }
+        }
+        table.rows.push_back(std::move(row));
+    }
+}
+
+void Stats::record(Stage stage, Clock::duration elapsed) {
+    stages()[static_cast<size_t>(stage)].record(nanoseconds(elapsed));
+}
+
+void Stats::recordQuery(const std::string& query, Clock::duration elapsed) {
+    const QueryStats* found = queries().find(query);
+    if (found == nullptr) {
+        if (queryCount.load(std::memory_order_relaxed) >= kMaxQueries) {
+            otherQueries().record(nanoseconds(elapsed));
+            return;
+        }
+        queryCount++;
+        found = queries().insert(query, QueryStats{ query, std::make_unique<Histogram>() });
+    }
+    found->histogram->record(nanoseconds(elapsed));
+}
+
+Table Stats::table(Encoding encoding) {
+    Table table;
+    table.columns = { "name", "count", "mean_us", "p50_us", "p90_us", "p99_us", "p999_us", "max_us" };
+    for (size_t i = 0; i < static_cast<size_t>(Stage::Count); i++) {
+        appendRow(table, encoding, kStageNames[i], stages()[i]);
+    }
+    queries().forEach([&](const QueryStats& query) {
+        appendRow(table, encoding, "query:" + query.text, *query.histogram);
+    });
+    appendRow(table, encoding, "query:(other)", otherQueries());
+    return table;
+}
+
+void Stats::reset() {
+    for (auto& histogram : stages()) {
+        histogram.reset();
+    }
+    queries().forEach([](const QueryStats& query) {
+        query.histogram->reset();
+    });
+    otherQueries().reset();
+}
+
+Stats::Timer::Timer(Stage stage) : stage(stage), start(Clock::now()) {}
+
+Stats::Timer::~Timer() {
+    record(stage, Clock::now() - start);
+}
+
+Stats::QueryTimer::QueryTimer(const std::string& query) : query(query), start(Clock::now()) {}
+
+Stats::QueryTimer::~QueryTimer() {
+    recordQuery(query, Clock::now() - start);
+}
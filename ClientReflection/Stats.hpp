@@ -0,0 +1,72 @@
+#pragma once
+#include "pch.h"
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include "Encoding.hpp"
+#include "Histogram.hpp"
+
+// Latency of every pipeline stage and of every compiled query, kept in
+// histograms and reported by the stats command.
+//
+//  Decode   splitting pipe or ring bytes into frames (I/O thread)
+//  Queue    from decoding a request until a worker starts it
+//  Parse    compiling query text into a plan
+//  Resolve  method lookup and reflection over new classes, per chain
+//  Invoke   JNI calls, per chain
+//  Encode   turning results into tagged values or text
+//  Request  whole request on its worker, queueing excluded
+class Stats {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    enum class Stage : uint8_t {
+        Decode,
+        Queue,
+        Parse,
+        Resolve,
+        Invoke,
+        Encode,
+        Request,
+        Count
+    };
+
+    static void record(Stage stage, Clock::duration elapsed);
+    static void recordQuery(const std::string& query, Clock::duration elapsed);
+
+    // One row per stage, then one per query: name, count, and mean, p50,
+    // p90, p99, p99.9 and max in microseconds. Cells are tagged values in
+    // binary mode and plain strings in text mode.
+    static Table table(Encoding encoding);
+    static void reset();
+
+    // Records the time from construction to destruction under `stage`.
+    class Timer {
+    public:
+        explicit Timer(Stage stage);
+        ~Timer();
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+
+    private:
+        Stage stage;
+        Clock::time_point start;
+    };
+
+    // Records the time from construction to destruction under `query`.
+    class QueryTimer {
+    public:
+        explicit QueryTimer(const std::string& query);
+        ~QueryTimer();
+        QueryTimer(const QueryTimer&) = delete;
+        QueryTimer& operator=(const QueryTimer&) = delete;
+
+    private:
+        const std::string& query;
+        Clock::time_point start;
+    };
+
+    // Queries beyond this many distinct texts share one histogram, so clients
+    // that embed handles or coordinates in queries cannot grow it unbounded.
+    static constexpr size_t kMaxQueries = 512;
+};
@@ -0,0 +1,80 @@
+#include "pch.h"
+#include "Subscriptions.hpp"
+#include "Cache.hpp"
+#include <algorithm>
+
+void SubscriptionManager::removeIf(const std::function<bool(const Subscription&)>& predicate) {
+    subscriptions.erase(std::remove_if(subscriptions.begin(), subscriptions.end(), [&](const std::shared_ptr<Subscription>& s) {
+        if (!predicate(*s)) {
+            return false;
+        }
+        s->active.store(false, std::memory_order_relaxed);
+        return true;
+    }), subscriptions.end());
+}
+
+void SubscriptionManager::subscribe(uint64_t connection, uint32_t id, const Plan& plan, uint32_t interval, const std::string& initial, Sink sink) {
+    auto subscription = std::make_shared<Subscription>();
+    subscription->connection = connection;
+    subscription->id = id;
+    subscription->plan = plan;
+    subscription->interval = std::max<uint32_t>(interval, 1);
+    subscription->lastTick = -1;
+    subscription->lastValue = initial;
+    subscription->sink = std::move(sink);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    removeIf([&](const Subscription& s) {
+        return s.connection == connection && s.id == id;
+    });
+    subscriptions.push_back(std::move(subscription));
+}
+
+bool SubscriptionManager::unsubscribe(uint64_t connection, uint32_t id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t before = subscriptions.size();
+    removeIf([&](const Subscription& s) {
+        return s.connection == connection && s.id == id;
+    });
+    return subscriptions.size() != before;
+}
+
+void SubscriptionManager::drop(uint64_t connection) {
+    std::lock_guard<std::mutex> lock(mutex);
+    removeIf([&](const Subscription& s) {
+        return s.connection == connection;
+    });
+}
+
+bool SubscriptionManager::evaluate(JNIEnv* env, Cache& cache, int64_t tick) {
+    // The due subscriptions are taken under the lock and evaluated without it.
+    std::vector<std::shared_ptr<Subscription>> due;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& subscription : subscriptions) {
+            // Without a tick counter every subscription is evaluated on every call.
+            if (tick >= 0 && subscription->lastTick >= 0 && tick >= subscription->lastTick && tick - subscription->lastTick < subscription->interval) {
+                continue;
+            }
+            subscription->lastTick = tick;
+            due.push_back(subscription);
+        }
+    }
+
+    for (auto& subscription : due) {
+        std::string value;
+        try {
+            value = cache.executePlan(env, subscription->plan, Encoding::Binary);
+        }
+        catch (const std::exception& e) {
+            value = ValueWriter::error(e.what());
+        }
+        if (value != subscription->lastValue && subscription->active.load(std::memory_order_relaxed)) {
+            subscription->lastValue = value;
+            subscription->sink(subscription->id, value);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    return !subscriptions.empty();
+}
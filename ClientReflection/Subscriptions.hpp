@@ -0,0 +1,49 @@
+#pragma once
+#include "pch.h"
+#include <jni.h>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Plan.hpp"
+
+class Cache;
+
+// Plans registered by a connection and re-evaluated on the client thread every
+// `interval` ticks. Only values whose encoding differs from the last one sent
+// are pushed to the connection's sink. Plans run and sinks are called without
+// the lock, so subscribing never waits for a tick's Java calls.
+class SubscriptionManager {
+public:
+    using Sink = std::function<void(uint32_t id, const std::string& value)>;
+
+    void subscribe(uint64_t connection, uint32_t id, const Plan& plan, uint32_t interval, const std::string& initial, Sink sink);
+    bool unsubscribe(uint64_t connection, uint32_t id);
+    void drop(uint64_t connection);
+
+    // Returns false once there is nothing left to evaluate.
+    bool evaluate(JNIEnv* env, Cache& cache, int64_t tick);
+
+private:
+    struct Subscription {
+        uint64_t connection;
+        uint32_t id;
+        Plan plan;
+        uint32_t interval;
+        int64_t lastTick;
+        // Only touched by the evaluating thread once published.
+        std::string lastValue;
+        Sink sink;
+        // Cleared on removal, so a subscription being evaluated as it is
+        // removed pushes nothing more.
+        std::atomic<bool> active{ true };
+    };
+
+    void removeIf(const std::function<bool(const Subscription&)>& predicate);
+
+    std::mutex mutex;
+    std::vector<std::shared_ptr<Subscription>> subscriptions;
+};
@@ -0,0 +1,211 @@
+#include "pch.h"
+#include "Trace.hpp"
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+    struct Event {
+        const char* name;
+        char phase;
+        uint8_t length;
+        char detail[Trace::kDetailSize];
+        int64_t start;
+        int64_t duration;
+    };
+
+    // Written only by its thread; the mutex is contended only while dumping.
+    struct Buffer {
+        std::mutex mutex;
+        std::vector<Event> events;
+        uint64_t written = 0;
+        uint32_t thread = 0;
+        std::string name;
+    };
+
+    std::atomic<bool> active{ false };
+    std::atomic<uint32_t> nextThread{ 0 };
+    std::mutex registryMutex;
+    std::vector<std::shared_ptr<Buffer>> registry;
+    thread_local std::shared_ptr<Buffer> local;
+    thread_local const char* localName = nullptr;
+
+    Trace::Clock::time_point origin() {
+        static const Trace::Clock::time_point start = Trace::Clock::now();
+        return start;
+    }
+
+    int64_t sinceOrigin(Trace::Clock::time_point time) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(time - origin()).count();
+    }
+
+    Buffer& buffer() {
+        if (!local) {
+            local = std::make_shared<Buffer>();
+            local->events.resize(Trace::kEventsPerThread);
+            local->thread = nextThread++;
+            if (localName != nullptr) {
+                local->name = localName;
+            }
+            std::lock_guard<std::mutex> lock(registryMutex);
+            registry.push_back(local);
+        }
+        return *local;
+    }
+
+    void append(const char* name, char phase, int64_t start, int64_t duration, std::string_view detail) {
+        Buffer& target = buffer();
+        std::lock_guard<std::mutex> lock(target.mutex);
+        Event& event = target.events[target.written % target.events.size()];
+        event.name = name;
+        event.phase = phase;
+        event.start = start;
+        event.duration = duration;
+        size_t length = detail.size();
+        if (length > Trace::kDetailSize) {
+            // Cut at a character boundary so the dump stays valid UTF-8.
+            length = Trace::kDetailSize;
+            while (length > 0 && (static_cast<unsigned char>(detail[length]) & 0xC0) == 0x80) {
+                length--;
+            }
+        }
+        event.length = static_cast<uint8_t>(length);
+        std::memcpy(event.detail, detail.data(), length);
+        target.written++;
+    }
+
+    void appendEscaped(std::string& out, std::string_view text) {
+        for (char c : text) {
+            switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char escaped[8];
+                    snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    out += escaped;
+                }
+                else {
+                    out += c;
+                }
+            }
+        }
+    }
+
+    void appendMicros(std::string& out, int64_t nanoseconds) {
+        char text[32];
+        snprintf(text, sizeof(text), "%lld.%03lld", static_cast<long long>(nanoseconds / 1000),
+            static_cast<long long>(nanoseconds % 1000));
+        out += text;
+    }
+}
+
+void Trace::enable(bool on) {
+    origin();
+    active.store(on, std::memory_order_relaxed);
+}
+
+bool Trace::enabled() {
+    return active.load(std::memory_order_relaxed);
+}
+
+void Trace::clear() {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (const auto& entry : registry) {
+        std::lock_guard<std::mutex> bufferLock(entry->mutex);
+        entry->written = 0;
+    }
+}
+
+std::string Trace::dump() {
+    std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    auto separate = [&] {
+        if (!first) {
+            out += ",";
+        }
+        first = false;
+    };
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (const auto& entry : registry) {
+        std::lock_guard<std::mutex> bufferLock(entry->mutex);
+        std::string tid = std::to_string(entry->thread);
+        if (!entry->name.empty()) {
+            separate();
+            out += "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" + tid + ",\"args\":{\"name\":\"";
+            appendEscaped(out, entry->name);
+            out += "\"}}";
+        }
+        size_t capacity = entry->events.size();
+        uint64_t begin = entry->written > capacity ? entry->written - capacity : 0;
+        for (uint64_t i = begin; i < entry->written; i++) {
+            const Event& event = entry->events[i % capacity];
+            separate();
+            out += "{\"ph\":\"";
+            out += event.phase;
+            out += "\",\"cat\":\"jrb\",\"name\":\"";
+            out += event.name;
+            out += "\",\"pid\":1,\"tid\":" + tid + ",\"ts\":";
+            appendMicros(out, event.start);
+            if (event.phase == 'X') {
+                out += ",\"dur\":";
+                appendMicros(out, event.duration);
+            }
+            else {
+                out += ",\"s\":\"g\"";
+            }
+            if (event.length > 0) {
+                out += ",\"args\":{\"detail\":\"";
+                appendEscaped(out, std::string_view(event.detail, event.length));
+                out += "\"}";
+            }
+            out += "}";
+        }
+    }
+    out += "]}";
+    return out;
+}
+
+void Trace::nameThread(const char* name) {
+    if (localName == name) {
+        return;
+    }
+    localName = name;
+    if (local) {
+        std::lock_guard<std::mutex> lock(local->mutex);
+        local->name = name;
+    }
+}
+
+void Trace::complete(const char* name, Clock::time_point start, std::string_view detail) {
+    if (!enabled()) {
+        return;
+    }
+    append(name, 'X', sinceOrigin(start), sinceOrigin(Clock::now()) - sinceOrigin(start), detail);
+}
+
+void Trace::instant(const char* name, std::string_view detail) {
+    if (!enabled()) {
+        return;
+    }
+    append(name, 'i', sinceOrigin(Clock::now()), 0, detail);
+}
+
+Trace::Span::Span(const char* name, std::string_view detail) : name(name), detail(detail), active(enabled()) {
+    if (active) {
+        start = Clock::now();
+    }
+}
+
+Trace::Span::~Span() {
+    if (active) {
+        complete(name, start, detail);
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include "pch.h"
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Span tracing for finding where a slow request spends its time. Tracing is
+// off until enabled by the trace command; while off a span costs one relaxed
+// load. While on, every finished span is appended to its thread's ring
+// (oldest spans are overwritten), and dump() renders all rings as Chrome
+// trace JSON for Perfetto or chrome://tracing.
+//
+//  request  one frame or text message on its worker
+//  queue    from decoding a request until a worker starts it
+//  compile  compiling query text into a plan
+//  query    one query of a request or batch
+//  hop      one method of a chain, lookup and call
+//  chunk    one range of a parallel projection
+//  encode   turning results into tagged values or text
+//  write    handing replies to the pipe or shared memory
+//  tick     game tick observed (instant)
+class Trace {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static void enable(bool on);
+    static bool enabled();
+    static void clear();
+    static std::string dump();
+
+    // Labels the calling thread in dumps.
+    static void nameThread(const char* name);
+
+    // Records a span that has already finished.
+    static void complete(const char* name, Clock::time_point start, std::string_view detail = {});
+    static void instant(const char* name, std::string_view detail = {});
+
+    // Records the time from construction to destruction. `name` must be a
+    // literal and `detail` must outlive the span.
+    class Span {
+    public:
+        explicit Span(const char* name, std::string_view detail = {});
+        ~Span();
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+
+    private:
+        const char* name;
+        std::string_view detail;
+        Clock::time_point start;
+        bool active;
+    };
+
+    static constexpr size_t kEventsPerThread = 16384;
+    static constexpr size_t kDetailSize = 96;
+};
@@ -0,0 +1,293 @@
+#include "pch.h"
+#include "Watches.hpp"
+#include "Cache.hpp"
+#include "Epoch.hpp"
+#include <utility>
+
+FieldWatches* FieldWatches::instance = nullptr;
+
+FieldWatches::~FieldWatches() {
+    if (instance == this) {
+        instance = nullptr;
+    }
+    delete index.load();
+}
+
+bool FieldWatches::initialize(JavaVM* jvm, std::string& error) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (jvmti != nullptr) {
+        return true;
+    }
+
+    jvmtiEnv* env = nullptr;
+    if (jvm->GetEnv((void**)&env, JVMTI_VERSION_1_2) != JNI_OK || env == nullptr) {
+        error = "JVMTI is not available";
+        return false;
+    }
+    jvmtiCapabilities capabilities = {};
+    capabilities.can_generate_field_modification_events = 1;
+    if (env->AddCapabilities(&capabilities) != JVMTI_ERROR_NONE) {
+        env->DisposeEnvironment();
+        error = "Field modification events are not available in this VM";
+        return false;
+    }
+
+    instance = this;
+    jvmtiEventCallbacks callbacks = {};
+    callbacks.FieldModification = &FieldWatches::onFieldModification;
+    if (env->SetEventCallbacks(&callbacks, sizeof(callbacks)) != JVMTI_ERROR_NONE ||
+        env->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_FIELD_MODIFICATION, nullptr) != JVMTI_ERROR_NONE) {
+        env->DisposeEnvironment();
+        instance = nullptr;
+        error = "Failed to enable field modification events";
+        return false;
+    }
+    jvmti = env;
+    vm = jvm;
+    return true;
+}
+
+template<typename T>
+static T readField(JNIEnv* env, jclass clazz, jobject object, jfieldID field, T (JNIEnv::*getStatic)(jclass, jfieldID), T (JNIEnv::*get)(jobject, jfieldID)) {
+    return object == nullptr ? (env->*getStatic)(clazz, field) : (env->*get)(object, field);
+}
+
+std::string FieldWatches::read(JNIEnv* env, Cache& cache, const Watch& watch) {
+    ValueWriter writer;
+    jobject object = nullptr;
+    if (!watch.isStatic) {
+        object = env->NewLocalRef(watch.object);
+        if (object == nullptr) {
+            writer.writeNull();
+            return writer.release();
+        }
+    }
+
+    jvalue value = {};
+    switch (watch.signature[0]) {
+    case 'Z': value.z = readField(env, watch.clazz, object, watch.field, &JNIEnv::GetStaticBooleanField, &JNIEnv::GetBooleanField); break;
+    case 'B': value.b = readField(env, watch.clazz, object, watch.field, &JNIEnv::GetStaticByteField, &JNIEnv::GetByteField); break;
+    case 'C': value.c = readField(env, watch.clazz, object, watch.field, &JNIEnv::GetStaticCharField, &JNIEnv::GetCharField); break;
+    case 'S': value.s = readField(env, watch.clazz, object, watch.field, &JNIEnv::GetStaticShortField, &JNIEnv::GetShortField); break;
+    case 'I': value.i = readField(env, watch.clazz, object, watch.field, &JNIEnv::GetStaticIntField, &JNIEnv::GetIntField); break;
+    case 'J': value.j = readField(env, watch.clazz, object, watch.field, &JNIEnv::GetStaticLongField, &JNIEnv::GetLongField); break;
+    case 'F': value.f = readField(env, watch.clazz, object, watch.field, &JNIEnv::GetStaticFloatField, &JNIEnv::GetFloatField); break;
+    case 'D': value.d = readField(env, watch.clazz, object, watch.field, &JNIEnv::GetStaticDoubleField, &JNIEnv::GetDoubleField); break;
+    default: value.l = readField(env, watch.clazz, object, watch.field, &JNIEnv::GetStaticObjectField, &JNIEnv::GetObjectField); break;
+    }
+    cache.encodeValue(env, writer, watch.signature, value);
+
+    if (watch.signature[0] == 'L' || watch.signature[0] == '[') {
+        env->DeleteLocalRef(value.l);
+    }
+    env->DeleteLocalRef(object);
+    return writer.release();
+}
+
+void FieldWatches::release(JNIEnv* env, const Watch& watch) {
+    env->DeleteGlobalRef(watch.clazz);
+    if (watch.object != nullptr) {
+        env->DeleteWeakGlobalRef(watch.object);
+    }
+}
+
+std::string FieldWatches::watch(JNIEnv* env, Cache& cache, uint64_t connection, uint32_t id, jobject target,
+    const std::string& field, const std::string& signature, Sink sink, std::string& initial) {
+    if (jvmti == nullptr) {
+        return "Field watches are not initialized";
+    }
+    if (signature.empty()) {
+        return "Missing field signature";
+    }
+    std::string className = cache.getClassName(env, target);
+    if (className.empty()) {
+        return "Failed to get the class of the watch target";
+    }
+
+    // Instance fields are looked up first; a static field of the target's
+    // class is watched regardless of which instance writes it.
+    std::string key = className + "." + field;
+    jclass clazz = env->GetObjectClass(target);
+    bool isStatic = false;
+    jfieldID fieldID = cache.getFieldID(env, key, clazz, field.c_str(), signature.c_str());
+    if (fieldID == nullptr) {
+        fieldID = cache.getStaticFieldID(env, key, clazz, field.c_str(), signature.c_str());
+        isStatic = true;
+    }
+    if (fieldID == nullptr) {
+        env->DeleteLocalRef(clazz);
+        return "Field " + key + " " + signature + " not found";
+    }
+
+    auto entry = std::make_shared<Watch>();
+    entry->connection = connection;
+    entry->id = id;
+    entry->clazz = static_cast<jclass>(env->NewGlobalRef(clazz));
+    entry->object = isStatic ? nullptr : env->NewWeakGlobalRef(target);
+    entry->field = fieldID;
+    entry->signature = signature;
+    entry->isStatic = isStatic;
+    entry->sink = std::move(sink);
+    env->DeleteLocalRef(clazz);
+
+    // The JVMTI watch is per field, shared by every watch of that field, and
+    // set outside the lock.
+    bool first;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        first = watchedFields[fieldID]++ == 0;
+    }
+    if (first) {
+        jvmtiError result = jvmti->SetFieldModificationWatch(entry->clazz, fieldID);
+        if (result != JVMTI_ERROR_NONE && result != JVMTI_ERROR_DUPLICATE) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--watchedFields[fieldID] == 0) {
+                    watchedFields.erase(fieldID);
+                }
+            }
+            release(env, *entry);
+            return "Failed to watch " + key + " (JVMTI error " + std::to_string(result) + ")";
+        }
+    }
+
+    // Read before publishing; the first flush reads again, so a write that
+    // lands in between is still pushed.
+    entry->lastValue = read(env, cache, *entry);
+    entry->dirty.store(true, std::memory_order_relaxed);
+    initial = entry->lastValue;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<std::shared_ptr<Watch>> replaced = remove([&](const Watch& watch) {
+            return watch.connection == connection && watch.id == id;
+        });
+        watches.push_back(entry);
+        publish(std::move(replaced));
+    }
+    anyDirty.store(true, std::memory_order_release);
+    return "";
+}
+
+std::vector<std::shared_ptr<FieldWatches::Watch>> FieldWatches::remove(const std::function<bool(const Watch&)>& predicate) {
+    std::vector<std::shared_ptr<Watch>> removed;
+    for (auto it = watches.begin(); it != watches.end();) {
+        if (!predicate(**it)) {
+            ++it;
+            continue;
+        }
+        if (--watchedFields[(*it)->field] == 0) {
+            watchedFields.erase((*it)->field);
+            jvmti->ClearFieldModificationWatch((*it)->clazz, (*it)->field);
+        }
+        removed.push_back(std::move(*it));
+        it = watches.erase(it);
+    }
+    return removed;
+}
+
+void FieldWatches::publish(std::vector<std::shared_ptr<Watch>> removed) {
+    Index* next = new Index();
+    for (const auto& watch : watches) {
+        next->emplace(watch->field, watch);
+    }
+    const Index* previous = index.exchange(next);
+    // Callbacks that loaded the previous index may still compare against the
+    // removed watches' references, so they are released with it.
+    JavaVM* jvm = vm;
+    Epoch::retire([previous, removed = std::move(removed), jvm] {
+        delete previous;
+        JNIEnv* env = nullptr;
+        if (jvm != nullptr && jvm->GetEnv(reinterpret_cast<void**>(&env), JNI_VERSION_1_6) == JNI_OK) {
+            for (const auto& watch : removed) {
+                release(env, *watch);
+            }
+        }
+    });
+}
+
+bool FieldWatches::unwatch(uint64_t connection, uint32_t id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::shared_ptr<Watch>> removed = remove([&](const Watch& watch) {
+        return watch.connection == connection && watch.id == id;
+    });
+    bool found = !removed.empty();
+    if (found) {
+        publish(std::move(removed));
+    }
+    return found;
+}
+
+void FieldWatches::drop(uint64_t connection) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::shared_ptr<Watch>> removed = remove([&](const Watch& watch) {
+        return watch.connection == connection;
+    });
+    if (!removed.empty()) {
+        publish(std::move(removed));
+    }
+}
+
+bool FieldWatches::flush(JNIEnv* env, Cache& cache) {
+    // Fields are read and sinks called without the lock, so workers adding or
+    // removing watches never wait for Java. The guard keeps the references of
+    // a watch removed meanwhile alive until the read is done.
+    Epoch::Guard guard;
+    std::vector<std::shared_ptr<Watch>> current;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        current = watches;
+    }
+    if (anyDirty.exchange(false, std::memory_order_acq_rel)) {
+        for (auto& watch : current) {
+            if (!watch->dirty.exchange(false, std::memory_order_acq_rel)) {
+                continue;
+            }
+            std::string value = read(env, cache, *watch);
+            if (value != watch->lastValue) {
+                watch->lastValue = value;
+                watch->sink(watch->id, value);
+            }
+        }
+    }
+
+    // A watched instance that was garbage collected ends its watch with a
+    // final null.
+    std::vector<std::shared_ptr<Watch>> collected;
+    bool remaining;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        collected = remove([&](const Watch& watch) {
+            return !watch.isStatic && env->IsSameObject(watch.object, nullptr);
+        });
+        if (!collected.empty()) {
+            publish(collected);
+        }
+        remaining = !watches.empty();
+    }
+    for (const auto& watch : collected) {
+        ValueWriter writer;
+        writer.writeNull();
+        watch->sink(watch->id, writer.release());
+    }
+    return remaining;
+}
+
+void JNICALL FieldWatches::onFieldModification(jvmtiEnv*, JNIEnv* env, jthread, jmethodID,
+    jlocation, jclass, jobject object, jfieldID field, char, jvalue) {
+    FieldWatches* self = instance;
+    if (self == nullptr) {
+        return;
+    }
+    // Runs on whichever thread wrote the field, so it only marks the watch;
+    // the value is read by the next flush.
+    Epoch::Guard guard;
+    const Index* current = self->index.load(std::memory_order_acquire);
+    auto range = current->equal_range(field);
+    for (auto it = range.first; it != range.second; ++it) {
+        Watch& watch = *it->second;
+        if (watch.isStatic || env->IsSameObject(watch.object, object)) {
+            watch.dirty.store(true, std::memory_order_relaxed);
+            self->anyDirty.store(true, std::memory_order_release);
+        }
+    }
+}
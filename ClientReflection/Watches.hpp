@@ -0,0 +1,84 @@
+#pragma once
+#include "pch.h"
+#include <jni.h>
+#include <jvmti.h>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Subscriptions.hpp"
+
+class Cache;
+
+// Field watches backed by JVMTI FieldModification events. The event callback
+// only marks the matching watches dirty; the client thread reads every dirty
+// field once per tick and pushes it when its encoding changed, so a burst of
+// writes within one tick produces at most one notification.
+//
+// The callback runs on whichever game thread wrote the field, so it takes no
+// lock: it looks the field up in an immutable index that writers replace and
+// retire through Epoch. Java is never called while the lock is held.
+class FieldWatches {
+public:
+    using Sink = SubscriptionManager::Sink;
+
+    ~FieldWatches();
+
+    // Acquires a JVMTI environment with field modification events. Fails on
+    // VMs that only grant the capability to agents loaded at startup.
+    bool initialize(JavaVM* jvm, std::string& error);
+
+    // Watches `field` (JNI signature `signature`) of `target`, or of its class
+    // when the field is static. Returns an error message, or "" with the
+    // current encoded value in `initial`.
+    std::string watch(JNIEnv* env, Cache& cache, uint64_t connection, uint32_t id, jobject target,
+        const std::string& field, const std::string& signature, Sink sink, std::string& initial);
+    bool unwatch(uint64_t connection, uint32_t id);
+    void drop(uint64_t connection);
+
+    // Pushes the watches that were written since the last flush. Returns false
+    // once there is nothing left to watch.
+    bool flush(JNIEnv* env, Cache& cache);
+
+private:
+    struct Watch {
+        uint64_t connection;
+        uint32_t id;
+        jclass clazz;
+        jweak object;
+        jfieldID field;
+        std::string signature;
+        bool isStatic;
+        std::atomic<bool> dirty{ false };
+        // Only touched by the client thread once the watch is published.
+        std::string lastValue;
+        Sink sink;
+    };
+    using Index = std::unordered_multimap<jfieldID, std::shared_ptr<Watch>>;
+
+    std::string read(JNIEnv* env, Cache& cache, const Watch& watch);
+    static void release(JNIEnv* env, const Watch& watch);
+    // Takes the watches matching `predicate` out of `watches` and the index.
+    std::vector<std::shared_ptr<Watch>> remove(const std::function<bool(const Watch&)>& predicate);
+    // Publishes an index of `watches`, releasing `removed` once no callback can
+    // still see them.
+    void publish(std::vector<std::shared_ptr<Watch>> removed);
+    static void JNICALL onFieldModification(jvmtiEnv* jvmti, JNIEnv* env, jthread thread, jmethodID method,
+        jlocation location, jclass fieldClass, jobject object, jfieldID field, char type, jvalue value);
+
+    jvmtiEnv* jvmti = nullptr;
+    JavaVM* vm = nullptr;
+
+    // Guards `watches` and `watchedFields`; never held across Java calls.
+    std::mutex mutex;
+    std::vector<std::shared_ptr<Watch>> watches;
+    std::unordered_map<jfieldID, int> watchedFields;
+    std::atomic<const Index*> index{ new Index() };
+    std::atomic<bool> anyDirty{ false };
+
+    static FieldWatches* instance;
+};
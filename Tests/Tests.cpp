@@ -0,0 +1,483 @@
+#include "pch.h"
+#include <jni.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ClassResolver.hpp"
+#include "ConcurrentMap.hpp"
+#include "Delta.hpp"
+#include "Encoding.hpp"
+#include "Epoch.hpp"
+#include "JniCounters.hpp"
+#include "MockJni.hpp"
+#include "Protocol.hpp"
+#include "SharedMemory.hpp"
+
+// Unit tests of the modules that parse or store data a client controls, run
+// against MockJvm where a JNIEnv is needed. `jrb_tests <filter>` runs the
+// cases whose name contains the filter; CTest runs one suite per module.
+
+namespace {
+    struct Case {
+        const char* name = nullptr;
+        std::function<void()> run;
+    };
+
+    int failures = 0;
+
+    void expect(bool condition, const char* text, const char* file, int line) {
+        if (!condition) {
+            printf("  %s:%d: expected %s\n", file, line, text);
+            failures++;
+        }
+    }
+
+#define EXPECT(condition) expect((condition), #condition, __FILE__, __LINE__)
+
+    std::string bytes(std::initializer_list<int> values) {
+        std::string result;
+        for (int value : values) {
+            result.push_back(static_cast<char>(value));
+        }
+        return result;
+    }
+
+    std::string encodeInt(int64_t value) {
+        ValueWriter writer;
+        writer.writeInt(value);
+        return writer.release();
+    }
+
+    std::string encodeString(const std::string& value) {
+        ValueWriter writer;
+        writer.writeString(value);
+        return writer.release();
+    }
+
+    Table table(const std::vector<std::vector<int>>& rows) {
+        Table result;
+        result.columns = { "id", "value" };
+        for (const auto& row : rows) {
+            result.rows.push_back({ encodeInt(row[0]), encodeInt(row[1]) });
+        }
+        return result;
+    }
+
+    // A ring over plain memory, with the header placed the way a mapping
+    // would place it.
+    struct LocalRing {
+        explicit LocalRing(uint64_t capacity) : memory(SpscRing::footprint(capacity) / sizeof(uint64_t) + 1), ring(memory.data(), capacity, true) {}
+
+        RingHeader& header() { return *reinterpret_cast<RingHeader*>(memory.data()); }
+
+        std::vector<uint64_t> memory;
+        SpscRing ring;
+    };
+
+    void frameRoundTrip() {
+        FrameReader reader;
+        std::string wire = encodeFrame(FrameKind::Query, 7, "Client.getWorld");
+        reader.append(wire.data(), wire.size());
+        Frame frame;
+        EXPECT(reader.next(frame));
+        EXPECT(frame.kind == FrameKind::Query);
+        EXPECT(frame.requestId == 7);
+        EXPECT(frame.payload == "Client.getWorld");
+        EXPECT(!reader.next(frame));
+        EXPECT(!reader.isCorrupt());
+    }
+
+    void frameSplitAndMerged() {
+        FrameReader reader;
+        std::string wire = encodeFrame(FrameKind::Query, 1, "a") + encodeFrame(FrameKind::Batch, 2, "b\nc");
+        Frame frame;
+        std::vector<uint32_t> ids;
+        for (char c : wire) {
+            reader.append(&c, 1);
+            while (reader.next(frame)) {
+                ids.push_back(frame.requestId);
+            }
+        }
+        EXPECT((ids == std::vector<uint32_t>{ 1, 2 }));
+        EXPECT(frame.kind == FrameKind::Batch && frame.payload == "b\nc");
+
+        reader.append(wire.data(), wire.size());
+        EXPECT(reader.next(frame) && frame.requestId == 1);
+        EXPECT(reader.next(frame) && frame.requestId == 2);
+        EXPECT(!reader.next(frame));
+    }
+
+    void frameWrappers() {
+        std::string query = encodeFrame(FrameKind::Query, 3, "Client.getWorld");
+        std::string inner;
+        putUint32(inner, 250);
+        inner.append(query, 4, 1);
+        inner.append(query, kFrameHeaderSize, std::string::npos);
+        std::string priority = bytes({ static_cast<int>(Priority::Bulk), static_cast<int>(FrameKind::Deadline) }) + inner;
+        std::string wire = encodeFrame(FrameKind::Priority, 3, priority);
+
+        FrameReader reader;
+        reader.append(wire.data(), wire.size());
+        Frame frame;
+        EXPECT(reader.next(frame));
+        EXPECT(frame.kind == FrameKind::Query);
+        EXPECT(frame.priority == Priority::Bulk);
+        EXPECT(frame.timeoutMs == 250);
+        EXPECT(frame.payload == "Client.getWorld");
+    }
+
+    void frameOversized() {
+        FrameReader reader;
+        std::string wire;
+        putUint32(wire, kMaxFrameLength + 1);
+        wire += bytes({ 1, 0, 0, 0, 0 });
+        reader.append(wire.data(), wire.size());
+        Frame frame;
+        EXPECT(!reader.next(frame));
+        EXPECT(reader.isCorrupt());
+        std::string valid = encodeFrame(FrameKind::Query, 1, "a");
+        reader.append(valid.data(), valid.size());
+        EXPECT(!reader.next(frame));
+    }
+
+    void frameShortLength() {
+        for (uint32_t length = 0; length < kFrameHeaderSize - 4; length++) {
+            FrameReader reader;
+            std::string wire;
+            putUint32(wire, length);
+            wire += bytes({ 1, 0, 0, 0, 0 });
+            reader.append(wire.data(), wire.size());
+            Frame frame;
+            EXPECT(!reader.next(frame));
+            EXPECT(reader.isCorrupt());
+        }
+    }
+
+    void framePipelined() {
+        // Every read ends a few bytes into the next frame, so the buffer is
+        // never consumed completely.
+        FrameReader reader;
+        std::string wire = encodeFrame(FrameKind::Query, 1, "Client.getLocalPlayer.getName");
+        std::string stream;
+        for (int i = 0; i < 10000; i++) {
+            stream += wire;
+        }
+        Frame frame;
+        int received = 0;
+        size_t largest = 0;
+        for (size_t pos = 0; pos < stream.size(); pos += wire.size()) {
+            size_t end = (std::min)(stream.size(), pos + wire.size() + 3);
+            size_t start = pos == 0 ? 0 : pos + 3;
+            reader.append(stream.data() + start, end - start);
+            while (reader.next(frame)) {
+                received++;
+            }
+            largest = (std::max)(largest, reader.buffered());
+        }
+        EXPECT(received == 10000);
+        EXPECT(largest <= 4 * wire.size());
+    }
+
+    void valueScalars() {
+        EXPECT(encodeInt(0) == bytes({ 0x03, 0x00 }));
+        EXPECT(encodeInt(-1) == bytes({ 0x03, 0x01 }));
+        EXPECT(encodeInt(1) == bytes({ 0x03, 0x02 }));
+        EXPECT(encodeInt(300) == bytes({ 0x03, 0xD8, 0x04 }));
+        EXPECT(encodeInt(INT64_MIN) == bytes({ 0x03, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x01 }));
+        EXPECT(encodeString("ab") == bytes({ 0x06, 0x02, 'a', 'b' }));
+
+        ValueWriter writer;
+        writer.writeNull();
+        writer.writeBool(true);
+        writer.writeBool(false);
+        writer.writeDouble(1.0);
+        EXPECT(writer.release() == bytes({ 0x00, 0x02, 0x01, 0x05, 0, 0, 0, 0, 0, 0, 0xF0, 0x3F }));
+        EXPECT(writer.data().empty());
+        EXPECT(ValueWriter::error("no") == bytes({ 0x0A, 0x02, 'n', 'o' }));
+    }
+
+    void valueTable() {
+        ValueWriter writer;
+        writer.writeTable(table({ { 1, 2 } }));
+        EXPECT(writer.release() == bytes({ 0x09, 0x02, 0x06, 0x02, 'i', 'd', 0x06, 0x05, 'v', 'a', 'l', 'u', 'e', 0x01, 0x03, 0x02, 0x03, 0x04 }));
+    }
+
+    void handleTable(MockJvm& mock) {
+        JNIEnv* env = mock.env();
+        jclass system = env->FindClass("java/lang/System");
+        jmethodID identityHashCode = env->GetStaticMethodID(system, "identityHashCode", "(Ljava/lang/Object;)I");
+        auto put = [&](HandleTable& handles, jobject object) {
+            return handles.put(env, object, env->CallStaticIntMethod(system, identityHashCode, object));
+        };
+        std::vector<jobject> objects;
+        for (int i = 0; i < 6; i++) {
+            objects.push_back(mock.newString("object" + std::to_string(i)));
+        }
+
+        HandleTable handles(4);
+        uint64_t first = put(handles, objects[0]);
+        EXPECT(env->IsSameObject(handles.get(env, first), objects[0]));
+        EXPECT(handles.get(env, first + 1) == nullptr);
+        // The same object keeps its handle, however often it is returned.
+        for (int i = 0; i < 10; i++) {
+            EXPECT(put(handles, objects[0]) == first);
+        }
+        // Objects whose identity hashes collide are still told apart.
+        EXPECT(handles.put(env, objects[1], 7) != handles.put(env, objects[2], 7));
+        EXPECT(handles.put(env, objects[2], 7) == first + 2);
+
+        // Newer objects evict the oldest handle.
+        for (int i = 3; i < 6; i++) {
+            put(handles, objects[i]);
+        }
+        EXPECT(handles.get(env, first) == nullptr);
+        EXPECT(env->IsSameObject(handles.get(env, first + 5), objects[5]));
+        EXPECT(put(handles, objects[0]) == first + 6);
+        handles.clear(env);
+        EXPECT(handles.get(env, first + 6) == nullptr);
+    }
+
+    void classResolver(MockJvm& mock) {
+        JNIEnv* env = mock.env();
+        jclass defined = mock.defineClass("jrb/tests/Resolved");
+        jclass classClass = env->FindClass("java/lang/Class");
+        jobject loader = env->CallObjectMethod(defined, env->GetMethodID(classClass, "getClassLoader", "()Ljava/lang/ClassLoader;"));
+        ClassResolver resolver;
+        resolver.setLoader(env, loader);
+
+        jclass found = resolver.resolve(env, "jrb/tests/Resolved");
+        EXPECT(found != nullptr && env->IsSameObject(found, defined));
+        EXPECT(resolver.resolve(env, "jrb.tests.Resolved") == found);
+        // Misses beyond the cap are forgotten, and a name missed earlier
+        // resolves once the class exists.
+        for (size_t i = 0; i < 3 * ClassResolver::kMaxMisses; i++) {
+            EXPECT(resolver.resolve(env, "jrb/tests/Missing" + std::to_string(i)) == nullptr);
+        }
+        EXPECT(resolver.resolve(env, "jrb/tests/Late") == nullptr);
+        mock.defineClass("jrb/tests/Late");
+        EXPECT(resolver.resolve(env, "jrb/tests/Late") == nullptr);
+        for (size_t i = 0; i < ClassResolver::kMaxMisses; i++) {
+            resolver.resolve(env, "jrb/tests/Other" + std::to_string(i));
+        }
+        EXPECT(resolver.resolve(env, "jrb/tests/Late") != nullptr);
+        EXPECT(resolver.resolve(env, "jrb/tests/Resolved") == found);
+    }
+
+    // The mean allocations and allocated bytes of a counted query.
+    std::pair<double, double> allocationsOf(const std::string& query) {
+        Table table = JniCounters::table(Encoding::Text);
+        for (const auto& row : table.rows) {
+            if (row[0] == query) {
+                return { std::stod(row[row.size() - 2]), std::stod(row[row.size() - 1]) };
+            }
+        }
+        return { -1, -1 };
+    }
+
+    void countedAllocations(MockJvm& mock) {
+        struct alignas(64) Aligned {
+            char bytes[64];
+        };
+        JNIEnv* env = mock.env();
+        JniCounters::enable(true);
+        {
+            JniCounters::Scope scope(env, "tests.empty");
+        }
+        {
+            JniCounters::Scope scope(env, "tests.plain");
+            delete new char[100];
+        }
+        {
+            JniCounters::Scope scope(env, "tests.aligned");
+            Aligned* aligned = new Aligned[2];
+            EXPECT(reinterpret_cast<uintptr_t>(aligned) % alignof(Aligned) == 0);
+            delete[] aligned;
+            delete new Aligned;
+        }
+        JniCounters::enable(false);
+        auto empty = allocationsOf("tests.empty");
+        auto plain = allocationsOf("tests.plain");
+        auto aligned = allocationsOf("tests.aligned");
+        EXPECT(plain.first - empty.first == 1 && plain.second - empty.second == 100);
+        EXPECT(aligned.first - empty.first == 2 && aligned.second - empty.second >= 3 * sizeof(Aligned));
+        JniCounters::reset();
+    }
+
+    void ringRoundTrip() {
+        LocalRing local(64);
+        std::string record;
+        EXPECT(!local.ring.read(record));
+        EXPECT(local.ring.write("hello"));
+        EXPECT(local.ring.write(""));
+        EXPECT(local.ring.read(record) && record == "hello");
+        EXPECT(local.ring.read(record) && record.empty());
+        EXPECT(local.ring.empty());
+
+        // Records of 4 + 21 bytes start at every offset mod 64 in turn, so
+        // lengths and bodies wrap around the end of the data area.
+        for (int i = 0; i < 64; i++) {
+            std::string sent(21, static_cast<char>('a' + i % 26));
+            EXPECT(local.ring.write(sent));
+            EXPECT(local.ring.read(record) && record == sent);
+        }
+        EXPECT(!local.ring.isCorrupt());
+    }
+
+    void ringFull() {
+        LocalRing local(64);
+        EXPECT(local.ring.write(std::string(60, 'x')));
+        EXPECT(!local.ring.write(""));
+        std::string record;
+        EXPECT(local.ring.read(record) && record.size() == 60);
+        EXPECT(!local.ring.write(std::string(61, 'x')));
+        EXPECT(!local.ring.isCorrupt());
+    }
+
+    void ringCorrupt() {
+        LocalRing indices(64);
+        indices.header().head.store(65);
+        std::string record;
+        EXPECT(!indices.ring.read(record));
+        EXPECT(indices.ring.isCorrupt());
+        EXPECT(!indices.ring.write("a"));
+
+        LocalRing length(64);
+        EXPECT(length.ring.write("abc"));
+        uint32_t bogus = 1000;
+        std::memcpy(reinterpret_cast<char*>(length.memory.data()) + sizeof(RingHeader), &bogus, sizeof(bogus));
+        EXPECT(!length.ring.read(record));
+        EXPECT(length.ring.isCorrupt());
+
+        // The shared copy of the capacity is not trusted.
+        LocalRing capacity(64);
+        capacity.header().capacity = 1ull << 40;
+        capacity.header().head.store(128);
+        EXPECT(!capacity.ring.read(record));
+        EXPECT(capacity.ring.isCorrupt());
+    }
+
+    void deltaChanges() {
+        DeltaTracker tracker;
+        ValueWriter writer;
+        writer.writeTable(table({ { 1, 10 }, { 2, 20 }, { 3, 30 } }));
+        EXPECT(tracker.encode(1, "q", 0, table({ { 1, 10 }, { 2, 20 }, { 3, 30 } })) == writer.release());
+
+        // 1 removed, 2 changed, 3 unchanged, 4 inserted.
+        std::string delta = tracker.encode(1, "q", 0, table({ { 2, 21 }, { 3, 30 }, { 4, 40 } }));
+        std::string expected = bytes({ 0x0B, 0x00, 0x01 }) + encodeInt(1)
+            + bytes({ 0x01 }) + encodeInt(4) + encodeInt(40)
+            + bytes({ 0x01 }) + encodeInt(2) + encodeInt(21);
+        EXPECT(delta == expected);
+
+        std::string empty = tracker.encode(1, "q", 0, table({ { 2, 21 }, { 3, 30 }, { 4, 40 } }));
+        EXPECT(empty == bytes({ 0x0B, 0x00, 0x00, 0x00, 0x00 }));
+    }
+
+    void deltaFallback() {
+        DeltaTracker tracker;
+        tracker.encode(1, "q", 0, table({ { 1, 10 } }));
+        // Another connection or query has its own previous result.
+        EXPECT(tracker.encode(2, "q", 0, table({ { 1, 10 } }))[0] == static_cast<char>(ValueTag::Table));
+        EXPECT(tracker.encode(1, "r", 0, table({ { 1, 10 } }))[0] == static_cast<char>(ValueTag::Table));
+        // Keys that are not unique, and a key column out of range.
+        EXPECT(tracker.encode(1, "q", 0, table({ { 1, 10 }, { 1, 11 } }))[0] == static_cast<char>(ValueTag::Table));
+        EXPECT(tracker.encode(1, "q", 5, table({ { 1, 10 } }))[0] == static_cast<char>(ValueTag::Table));
+        EXPECT(tracker.encode(1, "q", 0, table({ { 1, 10 } }))[0] == static_cast<char>(ValueTag::Delta));
+        tracker.drop(1);
+        EXPECT(tracker.encode(1, "q", 0, table({ { 1, 10 } }))[0] == static_cast<char>(ValueTag::Table));
+    }
+
+    void concurrentMap() {
+        ConcurrentMap<int> map;
+        EXPECT(map.find("a") == nullptr);
+        const int* first = map.insert("a", 1);
+        EXPECT(first != nullptr && *first == 1);
+        EXPECT(*map.insert("a", 2) == 1);
+        EXPECT(map.find("a") == first);
+        EXPECT(map.size() == 1);
+
+        // Readers keep finding every published key while a writer adds more.
+        std::atomic<bool> done{ false };
+        std::atomic<int> missing{ 0 };
+        std::vector<std::thread> readers;
+        for (int r = 0; r < 4; r++) {
+            readers.emplace_back([&] {
+                while (!done) {
+                    const int* value = map.find("a");
+                    if (value == nullptr || *value != 1) {
+                        missing++;
+                    }
+                }
+            });
+        }
+        for (int i = 0; i < 2000; i++) {
+            map.insert("k" + std::to_string(i), i);
+        }
+        done = true;
+        for (auto& reader : readers) {
+            reader.join();
+        }
+        EXPECT(missing == 0);
+        EXPECT(map.size() == 2001);
+        EXPECT(*map.find("k1999") == 1999);
+    }
+
+    void epochRetire() {
+        bool reclaimed = false;
+        {
+            Epoch::Guard guard;
+            Epoch::retire([&] { reclaimed = true; });
+            EXPECT(!reclaimed);
+        }
+        // Reclamation happens on a later retire once the guard has exited.
+        Epoch::retire([] {});
+        EXPECT(reclaimed);
+    }
+}
+
+int main(int argc, char** argv) {
+    std::string filter = argc > 1 ? argv[1] : "";
+    MockJvm mock;
+
+    const std::vector<Case> all = {
+        { "protocol/frame-round-trip", frameRoundTrip },
+        { "protocol/frame-split-and-merged", frameSplitAndMerged },
+        { "protocol/frame-wrappers", frameWrappers },
+        { "protocol/frame-oversized", frameOversized },
+        { "protocol/frame-short-length", frameShortLength },
+        { "protocol/frame-pipelined", framePipelined },
+        { "encoding/value-scalars", valueScalars },
+        { "encoding/value-table", valueTable },
+        { "encoding/handle-table", [&] { handleTable(mock); } },
+        { "classes/resolver", [&] { classResolver(mock); } },
+        { "counters/allocations", [&] { countedAllocations(mock); } },
+        { "ring/round-trip", ringRoundTrip },
+        { "ring/full", ringFull },
+        { "ring/corrupt", ringCorrupt },
+        { "delta/changes", deltaChanges },
+        { "delta/fallback", deltaFallback },
+        { "concurrent/map", concurrentMap },
+        { "concurrent/epoch-retire", epochRetire },
+    };
+
+    int run = 0;
+    for (const auto& test : all) {
+        if (std::string(test.name).find(filter) == std::string::npos) {
+            continue;
+        }
+        int before = failures;
+        test.run();
+        printf("%s %s\n", failures == before ? "PASS" : "FAIL", test.name);
+        run++;
+    }
+    if (run == 0) {
+        fprintf(stderr, "no test matches %s\n", filter.c_str());
+        return 2;
+    }
+    return failures == 0 ? 0 : 1;
+}